@@ -0,0 +1,131 @@
+#include "commandLineOptions.hpp"
+#include "ensemble.hpp"
+#include "execution.hpp"
+#include "manyBodySystem.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+/* Expected call of the program:
+
+"./build/ensembleSimulator <dt> steps <numberOfSteps> <numberOfMembers>" if you
+want to evolve <numberOfMembers> independent solar systems for <numberOfSteps>
+steps
+
+or
+
+"./build/ensembleSimulator <dt> time <totalTime> <numberOfMembers>" if you want
+to evolve them until the <totalTime> is reached
+
+The members only differ in the initial angles of the planets. The optional
+argument "--seed=<seed>" changes the seed used to draw them (default 1).
+
+"--execution=<openmp|pool>" integrates the blocks of members on OpenMP (the
+default of the build) or as tasks on a work-stealing pool of
+"--pool-threads=<n>" threads (default NBODY_THREADS, or one per hardware
+thread)
+
+If -h or --help is displayed at the end of the string, an help message should be
+printed */
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/* Function to time the execution of the program */
+
+double tSeconds(std::chrono::time_point<Clock> t1,
+    std::chrono::time_point<Clock> t2)
+{
+    return (t2 - t1).count() / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        CommandLineOptions options = extractOptions(argc, argv);
+        std::string helpString = argv[argc - 1];
+        if (helpString == "-h" || helpString == "--help" || argc == 1) {
+            /* Prints help message */
+
+            throw std::invalid_argument(
+                "\nTo call the program you can:\n\nRun ./build/ensembleSimulator "
+                "<dt> steps <number_of_steps> <number_of_members> to evolve "
+                "<number_of_members> independent solar systems for a certain "
+                "number of steps\n\nRun ./build/ensembleSimulator <dt> time "
+                "<total_time> <number_of_members> to evolve them until a certain "
+                "time t has been reached\n\nAdd --seed=<seed> to change the seed of "
+                "the initial angles of the planets.\n\nAdd --execution=<openmp|pool> "
+                "to run the members on OpenMP or on a work-stealing pool of "
+                "--pool-threads=<n> threads.\n\nBy placing '-h' or "
+                "\"--help\" at the end of the command line this message will appear "
+                "again.\n");
+        }
+        if (argc != 5) {
+            /* Wrong number of arguments passed by command line */
+
+            throw std::invalid_argument(
+                "\nError in calling the program: run '-h' or \"--help\" at the end "
+                "of the command line to see how the program should be launched.\n");
+        }
+        double dt = std::stod(argv[1]);
+        if (dt <= 0) {
+            throw std::logic_error("\nThe increment dt must be a positive value.\n");
+        }
+        std::string methodRun = argv[2];
+        int steps = 0;
+        if (methodRun == "steps") {
+            steps = std::stoi(argv[3]);
+        } else if (methodRun == "time") {
+            /* Counting the steps with stepsToReach, as evolutionOfSystem does */
+
+            steps = stepsToReach(std::stod(argv[3]), dt);
+        } else {
+            throw std::invalid_argument(
+                "\nError in selecting the method for running the simulations. Run "
+                "'-h' or \"--help\" at the end of the command line to see how the "
+                "program should be launched.\n");
+        }
+        if (steps <= 0) {
+            throw std::logic_error(
+                "\nThe number of steps should be a positive number\n");
+        }
+        int numberOfMembers = std::stoi(argv[4]);
+        if (numberOfMembers <= 0) {
+            throw std::logic_error(
+                "\nThe number of members should be higher than 0\n");
+        }
+        if (hasOption(options, "execution")) {
+            setExecutionBackend(executionBackendFromName(getOption(options, "execution", "openmp")),
+                std::stoi(getOption(options, "pool-threads", "0")));
+        }
+        unsigned int seed = std::stoul(getOption(options, "seed", "1"));
+        SystemEnsemble ensemble(9);
+        ensemble.generateSolarSystemEnsemble(numberOfMembers, seed);
+        std::cout << "\n-> Running " << numberOfMembers
+                  << " solar systems with dt = " << dt << " s over " << steps
+                  << " steps\n"
+                  << std::endl;
+        auto t1 = Clock::now();
+        ensemble.evolve(steps, dt, 0.0);
+        auto t2 = Clock::now();
+        std::vector<double> drift = ensemble.getRelativeEnergyDrift();
+        double maximumDrift = 0.;
+        double averageDrift = 0.;
+        for (double memberDrift : drift) {
+            maximumDrift = std::max(maximumDrift, std::abs(memberDrift));
+            averageDrift = averageDrift + std::abs(memberDrift) / numberOfMembers;
+        }
+        std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
+                  << " s\n\n\n-> Average timestep per member: "
+                  << tSeconds(t1, t2) / ((double)steps * numberOfMembers)
+                  << " s/step\n\n\n-> Integrations per hour at this length: "
+                  << numberOfMembers * 3600. / tSeconds(t1, t2) << "\n"
+                  << std::endl;
+        std::cout << "\n-> Average energy drift: " << averageDrift * 100
+                  << " %\n\n\n-> Maximum energy drift: " << maximumDrift * 100
+                  << " %\n"
+                  << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "commandLineOptions.hpp"
+#include "trajectoryAnalysis.hpp"
+#include <iomanip>
+#include <iostream>
+
+/* Expected call of the program:
+
+"./build/nBodyAnalyze <checkpoint files>" maps the checkpoints of a run (for
+instance those written with "--checkpoint-dir") into memory, analyses them in
+parallel and prints for each the energy, the angular momentum and the number of
+bodies bound to the central body with their mean eccentricity and semi-major
+axis. The frames are taken in the order of their steps.
+
+Optional arguments:
+
+"--output=<analysis>" is the prefix of the time series (<prefix>_series.csv)
+and of the histograms of distance and speed from the central body
+(<prefix>_histograms.csv); "--bins=<64>", "--radius-max=<40>" and
+"--speed-max=<2>" set the histograms; "--elements=<file.bin>" writes the
+Keplerian elements of every body of every frame to a binary file;
+"--pairwise-energy-limit=<20000>" is the largest frame whose potential energy
+is summed over all the pairs
+
+If -h or --help is displayed at the end of the string, an help message should be
+printed */
+
+int main(int argc, char** argv)
+{
+    try {
+        CommandLineOptions options = extractOptions(argc, argv);
+        std::string helpString = argv[argc - 1];
+        if (helpString == "-h" || helpString == "--help" || argc == 1) {
+            /* Prints help message */
+
+            throw std::invalid_argument(
+                "\nRun ./build/nBodyAnalyze <checkpoint files> to compute the "
+                "conserved quantities, the Keplerian elements around the central "
+                "body and the histograms of distance and speed of every "
+                "checkpoint.\n\nOptional arguments: --output=<analysis> (prefix "
+                "of the CSV files), --bins=<64>, --radius-max=<40>, "
+                "--speed-max=<2>, --elements=<file.bin> (binary file of the "
+                "elements of every body), --pairwise-energy-limit=<20000>.\n\nBy "
+                "placing '-h' or \"--help\" at the end of the command line this "
+                "message will appear again.\n");
+        }
+        std::vector<std::string> files(argv + 1, argv + argc);
+        AnalysisSettings settings;
+        settings.bins = std::stoi(getOption(options, "bins", "64"));
+        settings.maximumRadius = std::stod(getOption(options, "radius-max", "40"));
+        settings.maximumSpeed = std::stod(getOption(options, "speed-max", "2"));
+        settings.pairwiseEnergyLimit = std::stoll(getOption(options, "pairwise-energy-limit", "20000"));
+        settings.elementsFile = getOption(options, "elements", "");
+        std::string prefix = getOption(options, "output", "analysis");
+
+        std::vector<FrameSummary> frames = analyzeTrajectory(files, settings);
+        std::cout << "\n"
+                  << std::left << std::setw(10) << "step" << std::setw(14) << "time"
+                  << std::setw(16) << "energy" << std::setw(16) << "|L|"
+                  << std::setw(8) << "bound" << std::setw(14) << "mean e"
+                  << "mean a\n";
+        for (const FrameSummary& frame : frames) {
+            std::cout << std::setw(10) << frame.step << std::setw(14) << frame.time
+                      << std::setw(16) << frame.kineticEnergy + frame.potentialEnergy
+                      << std::setw(16) << frame.angularMomentum.norm() << std::setw(8)
+                      << frame.boundBodies << std::setw(14) << frame.meanEccentricity
+                      << frame.meanSemiMajorAxis << "\n";
+        }
+        writeSeriesCsv(prefix + "_series.csv", frames);
+        writeHistogramsCsv(prefix + "_histograms.csv", frames, settings);
+        std::cout << "\n-> Series written to " << prefix << "_series.csv and "
+                  << prefix << "_histograms.csv\n";
+        if (!settings.elementsFile.empty()) {
+            std::cout << "-> Elements written to " << settings.elementsFile << "\n";
+        }
+        std::cout << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+    }
+    return 0;
+}
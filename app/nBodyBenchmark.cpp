@@ -0,0 +1,121 @@
+#include "benchmark.hpp"
+#include "commandLineOptions.hpp"
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+/* Expected call of the program:
+
+"./build/nBodyBenchmark" runs every force backend and integrator on the
+standard initial conditions (a Plummer sphere and the disc of
+nBodySystemGenerator) for a sweep of sizes, and prints for each configuration
+the time per step, the RMS and maximum relative force error against the direct
+summation, the relative drift of the energy and of the angular momentum, and
+whether it is on the Pareto front of time, force error and energy drift.
+
+Optional arguments (lists are separated by commas):
+
+"--initial-conditions=<plummer,disc>", "--sizes=<256,1024>",
+"--backends=<direct,tiled,cells,verlet,ewald,split>", "--integrators=<euler>",
+"--cutoffs=<0.5,2>" (the cutoffs of "cells" and "verlet"), "--steps=<10>",
+"--dt=<0.001>" and "--epsilon=<0.01>" change the grid; "--csv=<file.csv>" and
+"--json=<file.json>" write the table
+
+If -h or --help is displayed at the end of the string, an help message should be
+printed */
+
+static std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        CommandLineOptions options = extractOptions(argc, argv);
+        std::string helpString = argv[argc - 1];
+        if (helpString == "-h" || helpString == "--help" || argc != 1) {
+            /* Prints help message */
+
+            throw std::invalid_argument(
+                "\nRun ./build/nBodyBenchmark to measure the time per step, the "
+                "force error against the direct summation and the energy and "
+                "angular momentum drift of every force backend and integrator on "
+                "the standard initial conditions.\n\nOptional arguments (lists "
+                "separated by commas): --initial-conditions=<plummer,disc>, "
+                "--sizes=<256,1024>, --backends=<direct,tiled,cells,verlet,ewald,split>, "
+                "--integrators=<euler>, --cutoffs=<0.5,2>, --steps=<10>, "
+                "--dt=<0.001>, --epsilon=<0.01>; --csv=<file.csv> and "
+                "--json=<file.json> write the table.\n\nBy placing '-h' or "
+                "\"--help\" at the end of the command line this message will appear "
+                "again.\n");
+        }
+        BenchmarkSettings settings;
+        if (hasOption(options, "initial-conditions")) {
+            settings.initialConditions = splitList(getOption(options, "initial-conditions", ""));
+        }
+        if (hasOption(options, "sizes")) {
+            settings.sizes.clear();
+            for (const std::string& size : splitList(getOption(options, "sizes", ""))) {
+                settings.sizes.push_back(std::stoi(size));
+            }
+        }
+        if (hasOption(options, "backends")) {
+            settings.backends = splitList(getOption(options, "backends", ""));
+        }
+        if (hasOption(options, "integrators")) {
+            settings.integrators = splitList(getOption(options, "integrators", ""));
+        }
+        if (hasOption(options, "cutoffs")) {
+            settings.cutoffs.clear();
+            for (const std::string& cutoff : splitList(getOption(options, "cutoffs", ""))) {
+                settings.cutoffs.push_back(std::stod(cutoff));
+            }
+        }
+        settings.steps = std::stoi(getOption(options, "steps", "10"));
+        settings.dt = std::stod(getOption(options, "dt", "0.001"));
+        settings.epsilon = std::stod(getOption(options, "epsilon", "0.01"));
+        std::vector<BenchmarkResult> results = runBenchmark(settings);
+        std::cout << "\n"
+                  << std::left << std::setw(10) << "initial" << std::setw(8) << "N"
+                  << std::setw(9) << "backend" << std::setw(8) << "cutoff"
+                  << std::setw(8) << "integr." << std::setw(14) << "s/step"
+                  << std::setw(14) << "rms error" << std::setw(14) << "max error"
+                  << std::setw(14) << "energy drift" << std::setw(14) << "L drift"
+                  << "pareto\n";
+        for (const BenchmarkResult& result : results) {
+            std::cout << std::setw(10) << result.initialConditions << std::setw(8)
+                      << result.numberOfParticles << std::setw(9) << result.backend
+                      << std::setw(8) << result.cutoff << std::setw(8)
+                      << result.integrator << std::setw(14) << result.secondsPerStep
+                      << std::setw(14) << result.rmsForceError << std::setw(14)
+                      << result.maximumForceError << std::setw(14) << result.energyDrift
+                      << std::setw(14) << result.angularMomentumDrift
+                      << (result.paretoOptimal ? "*" : "") << "\n";
+        }
+        std::cout << std::endl;
+        if (hasOption(options, "csv")) {
+            std::string csvFile = getOption(options, "csv", "benchmark.csv");
+            writeBenchmarkCsv(csvFile, results);
+            std::cout << "\n-> Table written to " << csvFile << "\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "json")) {
+            std::string jsonFile = getOption(options, "json", "benchmark.json");
+            writeBenchmarkJson(jsonFile, results);
+            std::cout << "\n-> Table written to " << jsonFile << "\n"
+                      << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+    }
+    return 0;
+}
@@ -1,6 +1,18 @@
+#include "autotuner.hpp"
+#include "cellList.hpp"
+#include "commandLineOptions.hpp"
+#include "execution.hpp"
 #include "manyBodySystem.hpp"
+#include "outOfCore.hpp"
 #include "particle.hpp"
+#include "periodicEwald.hpp"
+#include "simulationServer.hpp"
+#include "testParticles.hpp"
+#include "threadPlacement.hpp"
+#include <algorithm>
 #include <chrono>
+#include <iomanip>
+#include <sstream>
 
 /* Suggested call of the program:
 
@@ -30,6 +42,95 @@ or
 <epsilon> weak" if you want to iterate until the number of steps done in the
 evolution is <numberOfSteps>
 
+Optional arguments can be appended to any of the calls above:
+
+"--counters=<file.json>" writes the per-phase timers and counters of the run to
+<file.json>
+
+"--backend=<name>" selects how the accelerations are computed: "direct" (all
+the pairs, the default), "cells" (cell list, only pairs closer than the cutoff)
+or "verlet" (cell list with Verlet lists). "cells" and "verlet" need
+"--cutoff=<radius>", "verlet" also takes "--skin=<radius>" (default 0.1 times the
+cutoff). "ewald" makes the system periodic in a cube of side "--box=<side>",
+with Ewald summation; "--ewald-split=<alpha>" sets the split between the real
+and Fourier space sums and "--ewald-waves=<n>" the largest wave number.
+"split" treats the particles lighter than "--test-particle-mass=<mass>"
+(default 0.01) as test particles, which feel the massive bodies but not each
+other
+
+"--hardware-counters" reads the CPU performance counters (Linux only) around the
+force and update phases and prints the instructions per cycle, the cache misses
+per interaction and the FLOP rate
+
+"--trace=<file.json>" records the begin and the duration of every timed phase
+of every thread and writes them at the end of the run as a Chrome trace, which
+chrome://tracing or Perfetto display; "--trace-events=<n>" is the number of
+events kept per thread (default 65536, the latest ones)
+
+"--encounter-radius=<radius>" looks for the pairs of particles closer than
+<radius> every "--encounter-interval=<steps>" steps (default every step);
+"--merge" also merges them into one body with their total mass and momentum
+
+"--diagnostics=<steps>" samples the energy, the linear and angular momentum, the
+centre of mass and the virial ratio every <steps> steps in a helper thread, and
+prints the maximum energy drift; "--diagnostics-file=<file.csv>" also writes the
+samples to <file.csv>
+
+"--checkpoint-interval=<steps>" writes a checkpoint every <steps> steps to
+"--checkpoint-dir=<directory>" (default the current one). Each checkpoint is
+written by a forked child while the run goes on, with at most
+"--checkpoint-writers=<n>" children at a time (default 2). "--restart=<file>"
+starts from a checkpoint instead of the generated particles
+
+"--output-interval=<time>" writes the state of the system every <time> of
+simulated time, whatever dt is, to "--output-dir=<directory>" (default the
+current one) as snapshot_<index>.bin, in the format of the checkpoints with the
+index of the output in place of the step. The states are interpolated inside
+the steps with a cubic Hermite polynomial
+
+Planar systems (every z position and velocity zero, as the generated ones) are
+integrated with two dimensional kernels unless "--no-planar" is given
+
+"--execution=<openmp|pool>" runs every parallel loop of the library on OpenMP
+(the default of the build) or as tasks on a work-stealing pool of
+"--pool-threads=<n>" threads (default NBODY_THREADS, or one per hardware
+thread). The environment variable NBODY_EXECUTION selects it too
+
+"--huge-pages=<none|transparent|hugetlb>" backs the particles with huge pages,
+"--pin-threads" pins the OpenMP threads to CPUs (unless OMP_PROC_BIND or
+OMP_PLACES already bind them) and "--report-binding" prints the binding of the
+threads and where the memory of the particles came from
+
+"--reorder=<morton|hilbert>" stores the particles in the order of a space
+filling curve through their positions, recomputed every
+"--reorder-interval=<steps>" steps (default 10), and prints the time the
+reorderings took
+
+"--escape-radius=<radius>" removes, every "--escape-interval=<steps>" steps
+(default 10), the particles farther than <radius> from the centre of mass that
+move away from it and are no longer bound, so that they stop costing force
+evaluations; "--escapers-file=<file.csv>" writes their state at the removal
+
+"--autotune" times a few steps for a grid of loop schedules, chunk sizes,
+tile sizes of the direct summation and thread counts, and runs with the
+fastest; the choice is cached in "--tuning-cache=<file>" (default
+nbody_tuning.cache) for the same CPU, backend and size within a factor of two,
+and later runs reuse it. "--tuning-steps=<n>" sets the steps timed per
+configuration (default 3). It tunes the OpenMP loops, so like "--pin-threads"
+it is refused with "--execution=pool"
+
+"--out-of-core=<file>" keeps the particles in <file>, mapped into memory,
+instead of in memory, for systems larger than the memory of the node: the
+direct summation streams blocks of "--out-of-core-block=<n>" particles
+(default 65536) from the file, and the time spent reading, computing and
+waiting for the reads is printed. An existing <file> with the same number of
+particles is continued instead of being generated again
+
+"./build/nBodySystemSimulator --serve=<socket>" starts a service on the Unix
+domain socket <socket> instead of running one simulation: it keeps named
+simulations in memory and generates, loads, advances, samples and sends them
+back on binary requests (see simulationServer.hpp), until a shutdown request
+
 If -h or --help is displayed at the end of the string, an help message should be
 printed */
 
@@ -47,7 +148,22 @@ int main(int argc, char** argv)
 {
     try {
         int count = 0;
+        CommandLineOptions options = extractOptions(argc, argv);
         std::string helpString = argv[argc - 1];
+        if (hasOption(options, "serve") && argc == 1) {
+            /* Long-running service: the process and its OpenMP team are
+             * created once for all the requests */
+
+            std::string socketPath = getOption(options, "serve", "nbody.sock");
+            SimulationServer server(socketPath);
+            std::cout << "\n-> Serving simulations on " << socketPath << "\n"
+                      << std::endl;
+            server.run();
+            std::cout << "\n-> Requests served: " << server.getNumberOfRequests()
+                      << "\n"
+                      << std::endl;
+            return 0;
+        }
         if (helpString == "-h" || helpString == "--help" || argc == 1) {
             /* Prints help message */
 
@@ -67,7 +183,45 @@ int main(int argc, char** argv)
                 "OMP_SCHEDULE=<scheduleType> ./build/nBodySystemSimulator <dt> steps "
                 "<numberOfSteps> <numberOfParticles> <epsilon> weak\" if you want to "
                 "iterate until the number of steps done in the evolution is "
-                "<numberOfSteps>\n\n\nIf -h or --help is displayed at the end of the "
+                "<numberOfSteps>\n\nOptional arguments:\n\n--counters=<file.json> "
+                "writes the per-phase timers and counters of the run to "
+                "<file.json>\n\n--backend=<direct|cells|verlet|ewald|split> selects the force "
+                "backend, with --cutoff=<radius> and --skin=<radius> for the cell "
+                "list backends and --box=<side>, --ewald-split=<alpha> and "
+                "--ewald-waves=<n> for the periodic one and --test-particle-mass=<mass> "
+                "for the split between massive bodies and test particles\n\n--hardware-counters reads the CPU performance "
+                "counters around the force and update phases\n\n--trace=<file.json> "
+                "writes a Chrome trace of the phases of every thread, keeping the "
+                "last --trace-events=<n> events per thread\n\n"
+                "--encounter-radius=<radius> looks for close encounters every "
+                "--encounter-interval=<steps> steps, --merge merges the bodies "
+                "involved\n\n--diagnostics=<steps> samples energy, momenta, "
+                "centre of mass and virial ratio every <steps> steps in a helper "
+                "thread, --diagnostics-file=<file.csv> writes the samples\n\n"
+                "--checkpoint-interval=<steps> writes checkpoints from forked "
+                "children, with --checkpoint-dir=<directory> and "
+                "--checkpoint-writers=<n>; --restart=<file> starts from a "
+                "checkpoint\n\n--output-interval=<time> writes snapshots interpolated "
+                "every <time> of simulated time to --output-dir=<directory>\n\n"
+                "--no-planar keeps the three dimensional kernels for planar "
+                "systems\n\n--execution=<openmp|pool> runs the loops on OpenMP or on a "
+                "work-stealing pool of --pool-threads=<n> threads\n\n"
+                "--huge-pages=<none|transparent|hugetlb> backs the "
+                "particles with huge pages, --pin-threads pins the threads and "
+                "--report-binding prints the binding achieved\n\n"
+                "--reorder=<morton|hilbert> reorders the particles along a space "
+                "filling curve every --reorder-interval=<steps> steps\n\n"
+                "--escape-radius=<radius> removes the unbound particles beyond "
+                "<radius> every --escape-interval=<steps> steps, "
+                "--escapers-file=<file.csv> writes them\n\n"
+                "--autotune picks the fastest schedule, chunk, tile size and "
+                "thread count, cached in --tuning-cache=<file>, timing "
+                "--tuning-steps=<n> steps per configuration\n\n"
+                "--out-of-core=<file> keeps the particles in a memory-mapped "
+                "file, streamed in blocks of --out-of-core-block=<n> "
+                "particles\n\n"
+                "--serve=<socket> (alone) serves simulations on a Unix domain "
+                "socket until a shutdown request\n\n\nIf -h or --help is displayed at the end of the "
                 "string, this message will be printed\n");
         }
         if (argc != 7) {
@@ -109,12 +263,218 @@ int main(int argc, char** argv)
             throw std::logic_error(
                 "\nThe softening factor epsilon must be a positive value.\n");
         }
+        if (hasOption(options, "out-of-core")) {
+            /* The particles stay in a file and only blocks of them are
+             * resident, so the number of particles may exceed an int */
+
+            long long particlesOnFile = std::stoll(numberOfParticlesString) * numberThreads;
+            std::string fileName = getOption(options, "out-of-core", "nbody.ooc");
+            bool continuing = OutOfCoreSystem::numberOfParticlesInFile(fileName) == particlesOnFile;
+            if (!continuing) {
+                OutOfCoreSystem::create(fileName, particlesOnFile);
+            }
+            OutOfCoreSystem outOfCoreSystem(fileName,
+                std::stoll(getOption(options, "out-of-core-block", "65536")));
+            if (!continuing) {
+                outOfCoreSystem.fillWithNBodySystem();
+            }
+            int steps = 0;
+            if (methodRun == "time") {
+                steps = stepsToReach(std::stod(timeString), dt);
+            } else {
+                steps = std::stoi(stepsString);
+            }
+            std::cout << "\n-> " << (continuing ? "Continuing" : "Beginning")
+                      << " the out-of-core simulation of " << particlesOnFile
+                      << " particles in " << fileName << " for " << steps
+                      << " steps\n"
+                      << std::endl;
+            auto t1 = Clock::now();
+            outOfCoreSystem.advance(steps, dt, epsilon);
+            outOfCoreSystem.flush();
+            auto t2 = Clock::now();
+            const OutOfCoreStatistics& statistics = outOfCoreSystem.getStatistics();
+            std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
+                      << " s\n\n\n-> Average timestep: " << tSeconds(t1, t2) / steps
+                      << " s/step\n\n\n-> Reading: " << statistics.ioSeconds << " s for "
+                      << statistics.bytesRead / 1e9 << " GB in " << statistics.blocksRead
+                      << " blocks, waited for " << statistics.waitSeconds << " s ("
+                      << statistics.overlapFraction * 100 << " % hidden behind the "
+                      << statistics.computeSeconds << " s of force computation)\n\n\n"
+                      << "-> Update and write-back: " << statistics.updateSeconds << " s\n"
+                      << std::endl;
+            return 0;
+        }
         int numberOfParticles = std::stoi(numberOfParticlesString) * numberThreads;
         if (numberOfParticles <= 0) {
             throw std::logic_error(
                 "\nThe number of particles should be higher than 0\n");
         }
+        if (hasOption(options, "execution")) {
+            /* Selected before the particles are allocated, as their pages are
+             * first touched by the loops of the chosen runtime */
+
+            setExecutionBackend(executionBackendFromName(getOption(options, "execution", "openmp")),
+                std::stoi(getOption(options, "pool-threads", "0")));
+        }
+        if (usingWorkStealingPool()) {
+            std::cout << "\n-> Loops run on a work-stealing pool of "
+                      << threadPool().getNumberOfThreads() << " threads\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "huge-pages")) {
+            setHugePageMode(hugePageModeFromName(getOption(options, "huge-pages", "none")));
+        }
+        if (hasOption(options, "pin-threads")) {
+            /* Pinning before the particles are allocated, so that the threads
+             * that first touch the pages are the ones that use them */
+
+            if (!pinThreads()) {
+                std::cout << "\n-> Some threads could not be pinned\n"
+                          << std::endl;
+            }
+        }
+        if (hasOption(options, "pin-threads") || hasOption(options, "report-binding")) {
+            std::cout << "\n-> Thread binding: " << describeThreadBinding() << "\n"
+                      << std::endl;
+        }
         nBodySystem.generateInitialConditions(numberOfParticles);
+        std::string backendName = getOption(options, "backend", "direct");
+        if (backendName == "cells" || backendName == "verlet") {
+            /* Short-range interactions through the cell list backend */
+
+            double cutoff = std::stod(getOption(options, "cutoff", "0"));
+            if (cutoff <= 0) {
+                throw std::logic_error(
+                    "\nThe cell list backends need a positive --cutoff=<radius>.\n");
+            }
+            double skin = std::stod(getOption(options, "skin", std::to_string(0.1 * cutoff)));
+            nBodySystem.setForceBackend(std::make_shared<CellListBackend>(cutoff,
+                skin, backendName == "verlet"));
+        } else if (backendName == "ewald") {
+            /* Periodic box with the Ewald sums */
+
+            double box = std::stod(getOption(options, "box", "0"));
+            if (box <= 0) {
+                throw std::logic_error(
+                    "\nThe periodic backend needs a positive --box=<side>.\n");
+            }
+            nBodySystem.setForceBackend(std::make_shared<PeriodicEwaldBackend>(box,
+                std::stod(getOption(options, "ewald-split", "0")),
+                std::stoi(getOption(options, "ewald-waves", "8"))));
+        } else if (backendName == "split") {
+            /* Massive bodies and test particles */
+
+            nBodySystem.setForceBackend(std::make_shared<MassiveTestParticleBackend>(
+                std::stod(getOption(options, "test-particle-mass", "0.01"))));
+        } else if (backendName != "direct") {
+            throw std::invalid_argument("\nUnknown force backend " + backendName
+                + ". Run '-h' or \"--help\" to see the available ones.\n");
+        }
+        if (hasOption(options, "no-planar")) {
+            nBodySystem.enablePlanarKernels(false);
+        }
+        if (hasOption(options, "encounter-radius")) {
+            /* Detection (and merging) of the close encounters */
+
+            nBodySystem.enableCloseEncounters(
+                std::stod(getOption(options, "encounter-radius", "0")),
+                std::stoi(getOption(options, "encounter-interval", "1")),
+                hasOption(options, "merge"));
+        }
+        if (hasOption(options, "escape-radius")) {
+            /* Unbound particles far from the system are removed */
+
+            nBodySystem.enableEscaperPruning(
+                std::stod(getOption(options, "escape-radius", "0")),
+                std::stoi(getOption(options, "escape-interval", "10")));
+        }
+        if (hasOption(options, "reorder")) {
+            /* Particles kept in the order of a space filling curve */
+
+            nBodySystem.enableReordering(
+                spaceFillingCurveFromName(getOption(options, "reorder", "hilbert")),
+                std::stoi(getOption(options, "reorder-interval", "10")));
+        }
+        if (hasOption(options, "diagnostics")) {
+            /* Observers sampled in a helper thread during the evolution */
+
+            nBodySystem.setDiagnostics(makeStandardDiagnostics(
+                std::stoi(getOption(options, "diagnostics", "100")), epsilon));
+        }
+        if (hasOption(options, "restart")) {
+            /* Continuing a previous run from one of its checkpoints */
+
+            nBodySystem.restoreCheckpoint(getOption(options, "restart", ""));
+        }
+        if (hasOption(options, "checkpoint-interval")) {
+            /* Checkpoints written by forked children during the evolution */
+
+            nBodySystem.setCheckpointer(std::make_shared<ForkCheckpointer>(
+                getOption(options, "checkpoint-dir", "."),
+                std::stoi(getOption(options, "checkpoint-interval", "1000")),
+                std::stoi(getOption(options, "checkpoint-writers", "2"))));
+        }
+        if (hasOption(options, "output-interval")) {
+            /* Snapshots every interval of time, interpolated inside the steps
+             * and written as checkpoints numbered by output */
+
+            double interval = std::stod(getOption(options, "output-interval", "0"));
+            if (interval <= 0) {
+                throw std::logic_error("\nThe output interval must be a positive value.\n");
+            }
+            long long steps = methodRun == "time" ? stepsToReach(std::stod(timeString), dt) : std::stoll(stepsString);
+            double startTime = nBodySystem.getElapsedTime();
+            double endTime = startTime + steps * dt;
+            std::vector<double> outputTimes;
+            for (long long k = 0; startTime + k * interval <= endTime * (1 + 1e-12); k++) {
+                outputTimes.push_back(std::min(startTime + k * interval, endTime));
+            }
+            std::string outputDirectory = getOption(options, "output-dir", ".");
+            int outputIndex = 0;
+            nBodySystem.setDenseOutput(std::make_shared<DenseOutput>(outputTimes,
+                [&nBodySystem, outputDirectory, outputIndex](double time, ConstParticleSpan particles) mutable {
+                    std::ostringstream fileName;
+                    fileName << outputDirectory << "/snapshot_" << std::setw(6)
+                             << std::setfill('0') << outputIndex << ".bin";
+                    writeCheckpoint(fileName.str(), outputIndex, time, particles,
+                        nBodySystem.getParticleIdentifiers());
+                    outputIndex++;
+                }));
+        }
+        if (hasOption(options, "hardware-counters")) {
+            /* If the kernel does not allow the counters the run goes on
+             * without them */
+
+            if (!enableHardwareCounters()) {
+                std::cout << "\n-> Hardware counters unavailable: "
+                          << hardwareCountersStatus() << "\n"
+                          << std::endl;
+            }
+        }
+        if (hasOption(options, "autotune")) {
+            /* Trial steps on copies of the system, unless the cache already
+             * has a configuration for it; the counters of the trials are
+             * thrown away */
+
+            Autotuner autotuner(getOption(options, "tuning-cache", "nbody_tuning.cache"),
+                std::stoi(getOption(options, "tuning-steps", "3")));
+            TuningConfiguration configuration = autotuner.tune(nBodySystem, dt, epsilon);
+            autotuner.apply(configuration, nBodySystem);
+            nBodySystem.resetProcessPerformanceCounters();
+            std::cout << "\n-> Tuned configuration ("
+                      << (autotuner.lastWasCached() ? "from the cache" : std::to_string(autotuner.getNumberOfTrials()) + " trials")
+                      << "): schedule " << scheduleKindName(configuration.scheduleKind)
+                      << ", chunk " << configuration.chunkSize << ", tile "
+                      << configuration.tileSize << ", " << configuration.threads
+                      << " threads, " << configuration.secondsPerStep << " s/step\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "trace")) {
+            /* Timeline of the phases, started after the tuning trials */
+
+            phaseTracer().enable(std::stoll(getOption(options, "trace-events", "65536")));
+        }
         double energyBeforeUpdate = 0.;
         double energyAfterUpdate = 0.;
 
@@ -136,14 +496,18 @@ int main(int argc, char** argv)
             std::cout << "\n-> Running the simulation with dt = " << dt
                       << " s with an integration time of " << t << " s\n"
                       << std::endl;
+            /* After a restart the iterations include the steps of the
+             * checkpoint, so only the steps of this run are counted */
+
+            int iterationsBefore = nBodySystem.getIterations();
             auto t1 = Clock::now();
-            energyBeforeUpdate = calculateTotalEnergy(nBodySystem.getSystemInformations());
+            energyBeforeUpdate = calculateTotalEnergy(nBodySystem.getSystemView());
             nBodySystem.evolutionOfSystem(methodRun, t, dt, epsilon);
-            energyAfterUpdate = calculateTotalEnergy(nBodySystem.getSystemInformations());
+            energyAfterUpdate = calculateTotalEnergy(nBodySystem.getSystemView());
             auto t2 = Clock::now();
             std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
                       << " s\n\n\n-> Average timestep: "
-                      << tSeconds(t1, t2) / nBodySystem.getIterations() << " s/step\n"
+                      << tSeconds(t1, t2) / (nBodySystem.getIterations() - iterationsBefore) << " s/step\n"
                       << std::endl;
             std::cout << "\n-> Total energy of the system before the update: "
                       << energyBeforeUpdate << " J\n"
@@ -173,14 +537,18 @@ int main(int argc, char** argv)
             std::cout << "\n-> Running the simulation with dt = " << dt << " s over "
                       << steps << " steps\n"
                       << std::endl;
+            /* After a restart the iterations include the steps of the
+             * checkpoint, so only the steps of this run are counted */
+
+            int iterationsBefore = nBodySystem.getIterations();
             auto t1 = Clock::now();
-            energyBeforeUpdate = calculateTotalEnergy(nBodySystem.getSystemInformations());
+            energyBeforeUpdate = calculateTotalEnergy(nBodySystem.getSystemView());
             nBodySystem.evolutionOfSystem(methodRun, steps, dt, epsilon);
-            energyAfterUpdate = calculateTotalEnergy(nBodySystem.getSystemInformations());
+            energyAfterUpdate = calculateTotalEnergy(nBodySystem.getSystemView());
             auto t2 = Clock::now();
             std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
                       << " s\n\n\n-> Average timestep: "
-                      << tSeconds(t1, t2) / nBodySystem.getIterations() << " s/step\n"
+                      << tSeconds(t1, t2) / (nBodySystem.getIterations() - iterationsBefore) << " s/step\n"
                       << std::endl;
             std::cout << "\n-> Total energy of the system before the update: "
                       << energyBeforeUpdate << " J\n"
@@ -199,6 +567,121 @@ int main(int argc, char** argv)
                 "'-h' or \"--help\" at the end of the command line to see how the "
                 "program should be launched.\n");
         }
+        if (nBodySystem.usesPlanarKernels()) {
+            std::cout << "\n-> The system is planar: the direct summation and the "
+                         "update ran in two dimensions\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "encounter-radius")) {
+            std::cout << "\n-> Close encounters found: "
+                      << nBodySystem.getNumberOfEncounters()
+                      << "\n\n\n-> Bodies removed by mergers: "
+                      << nBodySystem.getNumberOfMergers() << "\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "escape-radius")) {
+            std::cout << "\n-> Escapers removed: " << nBodySystem.getNumberOfEscapers()
+                      << "\n\n\n-> Particles left: " << nBodySystem.getNumberOfParticles()
+                      << "\n"
+                      << std::endl;
+            if (hasOption(options, "escapers-file")) {
+                std::string escapersFile = getOption(options, "escapers-file", "escapers.csv");
+                writeEscapersCsv(escapersFile, nBodySystem.getEscapers());
+                std::cout << "\n-> Escapers written to " << escapersFile << "\n"
+                          << std::endl;
+            }
+        }
+        if (hasOption(options, "reorder") && nBodySystem.getNumberOfReorderings() > 0) {
+            /* The cost of the reorderings, to be set against the time they
+             * save in the steps */
+
+            std::cout << "\n-> Reorderings along the "
+                      << getOption(options, "reorder", "hilbert") << " curve: "
+                      << nBodySystem.getNumberOfReorderings()
+                      << "\n\n\n-> Time spent reordering: "
+                      << nBodySystem.getReorderingSeconds() << " s ("
+                      << nBodySystem.getReorderingSeconds() / nBodySystem.getNumberOfReorderings()
+                      << " s per reordering)\n"
+                      << std::endl;
+        }
+        if (hardwareCountersEnabled()) {
+            /* Printing the figures derived from the hardware counters */
+
+            HardwareCounterSummary hardware = nBodySystem.getProcessPerformanceCounters().getHardwareSummary();
+            std::cout << "\n-> Instructions per cycle: " << hardware.instructionsPerCycle
+                      << "\n\n\n-> L1 data misses per interaction: "
+                      << hardware.l1DataMissesPerInteraction
+                      << "\n\n\n-> Last level cache misses per interaction: "
+                      << hardware.lastLevelCacheMissesPerInteraction
+                      << "\n\n\n-> FLOP rate: " << hardware.gigaFlopsPerSecond
+                      << (hardware.flopsMeasured ? " GFLOP/s\n" : " GFLOP/s (estimated)\n")
+                      << std::endl;
+        }
+        if (hasOption(options, "huge-pages") || hasOption(options, "report-binding")) {
+            /* Where the memory of the particles came from */
+
+            MemoryPlacementReport memory = getMemoryPlacementReport();
+            std::cout << "\n-> Memory: " << memory.numaNodes << " NUMA node(s), "
+                      << memory.firstTouchedBytes << " bytes first touched in parallel, "
+                      << memory.plainBytes << " bytes from operator new\n\n\n-> Huge pages ("
+                      << hugePageModeName(memory.hugePageMode) << "): "
+                      << memory.explicitHugePageBytes << " bytes from hugetlbfs, "
+                      << memory.transparentHugePageBytes << " bytes advised as transparent, "
+                      << memory.hugePageFallbacks << " fallback(s) to normal pages\n"
+                      << std::endl;
+        }
+        if (nBodySystem.getCheckpointer()) {
+            /* Waiting for the last checkpoints before reporting them */
+
+            std::shared_ptr<ForkCheckpointer> checkpointer = nBodySystem.getCheckpointer();
+            checkpointer->waitForAll();
+            std::cout << "\n-> Checkpoints written: "
+                      << checkpointer->getNumberOfCheckpoints() - checkpointer->getNumberOfFailures()
+                      << " (" << checkpointer->getNumberOfFailures()
+                      << " failed)\n\n\n-> Time spent forking: "
+                      << checkpointer->getForkSeconds() << " s\n"
+                      << std::endl;
+        }
+        if (nBodySystem.getDiagnostics()) {
+            /* Summary of the samples taken by the observers */
+
+            std::cout << "\n-> Samples taken by the observers: "
+                      << nBodySystem.getDiagnostics()->getBuffer().getNumberOfPushed()
+                      << "\n\n\n-> Maximum energy drift: "
+                      << nBodySystem.getDiagnostics()->getMaximumRelativeEnergyDrift() * 100
+                      << " %\n"
+                      << std::endl;
+            if (hasOption(options, "diagnostics-file")) {
+                std::string diagnosticsFile = getOption(options, "diagnostics-file", "diagnostics.csv");
+                nBodySystem.getDiagnostics()->writeCsv(diagnosticsFile);
+                std::cout << "\n-> Samples written to " << diagnosticsFile << "\n"
+                          << std::endl;
+            }
+        }
+        if (hasOption(options, "trace")) {
+            /* Exporting the timeline of the phases */
+
+            phaseTracer().disable();
+            std::string traceFile = getOption(options, "trace", "trace.json");
+            phaseTracer().writeChromeTrace(traceFile);
+            std::cout << "\n-> Trace of " << phaseTracer().getNumberOfEvents()
+                      << " phases written to " << traceFile;
+            if (phaseTracer().getNumberOfDroppedEvents() > 0) {
+                std::cout << " (" << phaseTracer().getNumberOfDroppedEvents()
+                          << " older ones overwritten)";
+            }
+            std::cout << "\n"
+                      << std::endl;
+        }
+        if (hasOption(options, "counters")) {
+            /* Dumping the timers and counters collected during the run */
+
+            std::string countersFile = getOption(options, "counters", "counters.json");
+            nBodySystem.getProcessPerformanceCounters().writeJson(countersFile);
+            std::cout << "\n-> Performance counters written to " << countersFile
+                      << "\n"
+                      << std::endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << '\n';
     }
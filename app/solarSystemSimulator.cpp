@@ -1,3 +1,5 @@
+#include "commandLineOptions.hpp"
+#include "execution.hpp"
 #include "manyBodySystem.hpp"
 #include "particle.hpp"
 #include <chrono>
@@ -12,6 +14,26 @@ or
 "./build/solarSystemSimulator <dt> steps <numberOfSteps>" if you want to iterate
 until the number of steps done in the evolution is <numberOfSteps>
 
+The optional argument "--counters=<file.json>" writes the per-phase timers and
+counters of the run to <file.json>
+
+"--diagnostics=<steps>" samples the energy, the linear and angular momentum, the
+centre of mass and the virial ratio every <steps> steps in a helper thread, and
+prints the maximum energy drift; "--diagnostics-file=<file.csv>" also writes the
+samples to <file.csv>
+
+"--parareal" integrates in parallel in time instead: the interval is split into
+"--parareal-slices=<n>" slices (default one per thread), propagated at the same
+time with dt and corrected with steps "--parareal-coarse=<factor>" times longer
+(default 50), until the residual is below "--parareal-tolerance=<tol>" (default
+1e-10) or after "--parareal-iterations=<n>" iterations (default the number of
+slices, which gives the serial result)
+
+"--execution=<openmp|pool>" runs the loops on OpenMP (the default of the build)
+or as tasks on a work-stealing pool of "--pool-threads=<n>" threads (default
+NBODY_THREADS, or one per hardware thread). With the pool the Parareal slices
+and the loops inside them share the same threads
+
 If -h or --help is displayed at the end of the string, an help message should be
 printed */
 
@@ -28,6 +50,7 @@ double tSeconds(std::chrono::time_point<Clock> t1,
 int main(int argc, char** argv)
 {
     int count = 0;
+    CommandLineOptions options = extractOptions(argc, argv);
 
     /* Printing format for vectors from Eigen Library */
 
@@ -43,8 +66,18 @@ int main(int argc, char** argv)
                 "<dt> time <total_time> if you want to run it until a certain time t "
                 "has been reached\n\nRun ./build/solarSystemSimulator <dt> steps "
                 "<number_of_steps> if you want to simulate a certain number of "
-                "steps.\n\nBy placing '-h' or \"--help\" at the end of the command "
-                "line this message will appear again.\n");
+                "steps.\n\nAdd --counters=<file.json> to write the per-phase timers "
+                "and counters of the run to <file.json>.\n\nAdd --diagnostics=<steps> "
+                "to sample energy, momenta, centre of mass and virial ratio every "
+                "<steps> steps, and --diagnostics-file=<file.csv> to write the "
+                "samples.\n\nAdd --parareal to integrate in parallel in time, with "
+                "--parareal-slices=<n>, --parareal-coarse=<factor>, "
+                "--parareal-tolerance=<tol> and --parareal-iterations=<n>.\n\nAdd "
+                "--execution=<openmp|pool> to run the loops on OpenMP or on a "
+                "work-stealing pool of --pool-threads=<n> threads.\n\nBy "
+                "placing '-h' or "
+                "\"--help\" at the end of the command line this message will appear "
+                "again.\n");
         }
         if (argc != 4) {
             /* Wrong number of arguments passed by command line */
@@ -53,8 +86,18 @@ int main(int argc, char** argv)
                 "\nError in calling the program: run '-h' or \"--help\" at the end "
                 "of the command line to see how the program should be launched.\n");
         }
+        if (hasOption(options, "execution")) {
+            setExecutionBackend(executionBackendFromName(getOption(options, "execution", "openmp")),
+                std::stoi(getOption(options, "pool-threads", "0")));
+        }
         solarSystemGenerator solarSystem;
         solarSystem.generateInitialConditions(9);
+        if (hasOption(options, "diagnostics")) {
+            /* Observers sampled in a helper thread during the evolution */
+
+            solarSystem.setDiagnostics(makeStandardDiagnostics(
+                std::stoi(getOption(options, "diagnostics", "100"))));
+        }
         std::string dtString = argv[1];
         std::string methodRun = argv[2];
         std::string timeString = argv[3];
@@ -66,6 +109,32 @@ int main(int argc, char** argv)
         double energyBeforeUpdate = 0.;
         double energyAfterUpdate = 0.;
 
+        /* Evolution over the steps or the time given, in parallel in time with
+         * Parareal if it was asked for */
+
+        auto evolve = [&](double upperLimit) {
+            if (!hasOption(options, "parareal")) {
+                solarSystem.evolutionOfSystem(methodRun, upperLimit, dt, 0.0);
+                return;
+            }
+            PararealSettings settings;
+            settings.slices = std::stoi(getOption(options, "parareal-slices", "0"));
+            settings.coarseFactor = std::stoi(getOption(options, "parareal-coarse", "50"));
+            settings.tolerance = std::stod(getOption(options, "parareal-tolerance", "1e-10"));
+            settings.maximumIterations = std::stoi(getOption(options, "parareal-iterations", "0"));
+            long long steps = methodRun == "time" ? stepsToReach(upperLimit, dt) : (long long)upperLimit;
+            PararealResult result = solarSystem.evolutionInParallelInTime(steps, dt, 0.0, settings);
+            std::cout << "\n-> Parareal over " << result.slices << " slices: "
+                      << result.iterations << " iterations, "
+                      << (result.converged ? "converged" : "not converged")
+                      << "\n\n-> Residual per iteration:";
+            for (double residual : result.residuals) {
+                std::cout << " " << residual;
+            }
+            std::cout << "\n"
+                      << std::endl;
+        };
+
         /* If we choose to use the time of integration to compute the evolution of
          * the system */
 
@@ -87,10 +156,10 @@ int main(int argc, char** argv)
                 std::cout
                     << "Planet " << solarSystem.getIdentifierParticles().at(i)
                     << ":\nPosition: ("
-                    << solarSystem.getSystemInformations().at(i).getPosition().format(
+                    << solarSystem.getSystemView().at(i).getPosition().format(
                            CommaInitFmt)
                     << ")\nVelocity: ("
-                    << solarSystem.getSystemInformations().at(i).getVelocity().format(
+                    << solarSystem.getSystemView().at(i).getVelocity().format(
                            CommaInitFmt)
                     << ")\n"
                     << std::endl;
@@ -99,9 +168,9 @@ int main(int argc, char** argv)
                       << " s with an integration time of " << t << " s\n"
                       << std::endl;
             auto t1 = Clock::now();
-            energyBeforeUpdate = calculateTotalEnergy(solarSystem.getSystemInformations());
-            solarSystem.evolutionOfSystem(methodRun, t, dt, 0.0);
-            energyAfterUpdate = calculateTotalEnergy(solarSystem.getSystemInformations());
+            energyBeforeUpdate = calculateTotalEnergy(solarSystem.getSystemView());
+            evolve(t);
+            energyAfterUpdate = calculateTotalEnergy(solarSystem.getSystemView());
             auto t2 = Clock::now();
             std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
                       << " s\n\n\n-> Average timestep: "
@@ -127,10 +196,10 @@ int main(int argc, char** argv)
                 std::cout
                     << "Planet " << solarSystem.getIdentifierParticles().at(i)
                     << ":\nPosition: ("
-                    << solarSystem.getSystemInformations().at(i).getPosition().format(
+                    << solarSystem.getSystemView().at(i).getPosition().format(
                            CommaInitFmt)
                     << ")\nVelocity: ("
-                    << solarSystem.getSystemInformations().at(i).getVelocity().format(
+                    << solarSystem.getSystemView().at(i).getVelocity().format(
                            CommaInitFmt)
                     << ")\n"
                     << std::endl;
@@ -154,10 +223,10 @@ int main(int argc, char** argv)
                 std::cout
                     << "Planet " << solarSystem.getIdentifierParticles().at(i)
                     << ":\nPosition: ("
-                    << solarSystem.getSystemInformations().at(i).getPosition().format(
+                    << solarSystem.getSystemView().at(i).getPosition().format(
                            CommaInitFmt)
                     << ")\nVelocity: ("
-                    << solarSystem.getSystemInformations().at(i).getVelocity().format(
+                    << solarSystem.getSystemView().at(i).getVelocity().format(
                            CommaInitFmt)
                     << ")\n"
                     << std::endl;
@@ -166,9 +235,9 @@ int main(int argc, char** argv)
                       << steps << " steps\n"
                       << std::endl;
             auto t1 = Clock::now();
-            energyBeforeUpdate = calculateTotalEnergy(solarSystem.getSystemInformations());
-            solarSystem.evolutionOfSystem(methodRun, steps, dt, 0.0);
-            energyAfterUpdate = calculateTotalEnergy(solarSystem.getSystemInformations());
+            energyBeforeUpdate = calculateTotalEnergy(solarSystem.getSystemView());
+            evolve(steps);
+            energyAfterUpdate = calculateTotalEnergy(solarSystem.getSystemView());
             auto t2 = Clock::now();
             std::cout << "\n-> Elapsed time: " << tSeconds(t1, t2)
                       << " s\n\n\n-> Average timestep: "
@@ -194,10 +263,10 @@ int main(int argc, char** argv)
                 std::cout
                     << "Planet " << solarSystem.getIdentifierParticles().at(i)
                     << ":\nPosition: ("
-                    << solarSystem.getSystemInformations().at(i).getPosition().format(
+                    << solarSystem.getSystemView().at(i).getPosition().format(
                            CommaInitFmt)
                     << ")\nVelocity: ("
-                    << solarSystem.getSystemInformations().at(i).getVelocity().format(
+                    << solarSystem.getSystemView().at(i).getVelocity().format(
                            CommaInitFmt)
                     << ")\n"
                     << std::endl;
@@ -208,6 +277,31 @@ int main(int argc, char** argv)
                 "'-h' or \"--help\" at the end of the command line to see how the "
                 "program should be launched.\n");
         }
+        if (solarSystem.getDiagnostics()) {
+            /* Summary of the samples taken by the observers */
+
+            std::cout << "\n-> Samples taken by the observers: "
+                      << solarSystem.getDiagnostics()->getBuffer().getNumberOfPushed()
+                      << "\n\n\n-> Maximum energy drift: "
+                      << solarSystem.getDiagnostics()->getMaximumRelativeEnergyDrift() * 100
+                      << " %\n"
+                      << std::endl;
+            if (hasOption(options, "diagnostics-file")) {
+                std::string diagnosticsFile = getOption(options, "diagnostics-file", "diagnostics.csv");
+                solarSystem.getDiagnostics()->writeCsv(diagnosticsFile);
+                std::cout << "\n-> Samples written to " << diagnosticsFile << "\n"
+                          << std::endl;
+            }
+        }
+        if (hasOption(options, "counters")) {
+            /* Dumping the timers and counters collected during the run */
+
+            std::string countersFile = getOption(options, "counters", "counters.json");
+            solarSystem.getProcessPerformanceCounters().writeJson(countersFile);
+            std::cout << "\n-> Performance counters written to " << countersFile
+                      << "\n"
+                      << std::endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << '\n';
     }
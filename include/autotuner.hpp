@@ -0,0 +1,57 @@
+#pragma once
+#include "manyBodySystem.hpp"
+#include "omp.h"
+#include <string>
+
+/* See .cpp file for explanation and comments */
+
+/* One point of the space searched by the Autotuner: the schedule of the loops
+over the particles, the tile size of the direct summation (0 for no tiling)
+and the number of threads, with the time per step measured for it */
+
+struct TuningConfiguration {
+    omp_sched_t scheduleKind = omp_sched_static;
+    int chunkSize = 0;
+    int tileSize = 0;
+    int threads = 1;
+    double secondsPerStep = 0.;
+};
+
+std::string scheduleKindName(omp_sched_t kind);
+omp_sched_t scheduleKindFromName(const std::string& name);
+
+/* Chooses the fastest TuningConfiguration for a system by timing a few steps
+of a copy of it for every configuration of a small grid, and remembers the
+choice in cacheFile under the CPU model, the power of two below the number of
+particles and the force backend, so that later runs on the same machine and
+of a similar size reuse it without timing anything */
+
+class Autotuner {
+public:
+    Autotuner(std::string cacheFileArgument = "nbody_tuning.cache",
+        int trialStepsArgument = 3);
+
+    TuningConfiguration tune(InitialConditionGenerator& system, double dt,
+        double epsilon);
+    void apply(const TuningConfiguration& configuration,
+        InitialConditionGenerator& system) const;
+    std::string cacheKey(InitialConditionGenerator& system) const;
+    bool lastWasCached() const;
+    int getNumberOfTrials() const;
+
+    static std::string cpuModel();
+    static int sizeBucket(int numberOfParticles);
+
+private:
+    double timeConfiguration(InitialConditionGenerator& system,
+        const TuningConfiguration& configuration, double dt, double epsilon);
+    bool readCache(const std::string& key,
+        TuningConfiguration& configuration) const;
+    void writeCache(const std::string& key,
+        const TuningConfiguration& configuration) const;
+
+    std::string cacheFile;
+    int trialSteps;
+    bool cached = false;
+    int trials = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include "forceBackend.hpp"
+#include "particle.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+std::vector<Particle> makeStandardInitialConditions(const std::string& name,
+    int numberOfParticles, unsigned int seed = 1);
+
+/* Grid of a benchmark: every initial condition is run at every size with
+every force backend and integrator. The names of the backends are those of
+makeBenchmarkBackend, "cells" and "verlet" being run once per cutoff. */
+
+struct BenchmarkSettings {
+    std::vector<std::string> initialConditions { "plummer", "disc" };
+    std::vector<int> sizes { 256, 1024 };
+    std::vector<std::string> backends { "direct", "tiled", "cells", "verlet", "ewald", "split" };
+    std::vector<std::string> integrators { "euler" };
+    std::vector<double> cutoffs { 0.5, 2. };
+    int steps = 10;
+    double dt = 0.001;
+    double epsilon = 0.01;
+};
+
+/* Cost and accuracy of one configuration. The force errors are relative to
+the direct summation on the initial conditions; the drifts are relative
+changes of the total energy and of the angular momentum over the run. A result
+is on the Pareto front if no other result with the same initial conditions and
+size is at least as good in time, RMS force error and energy drift, and better
+in one of them. */
+
+struct BenchmarkResult {
+    std::string initialConditions;
+    int numberOfParticles = 0;
+    std::string backend;
+    double cutoff = 0.;
+    std::string integrator;
+    int steps = 0;
+    double secondsPerStep = 0.;
+    double timeToSolution = 0.;
+    double rmsForceError = 0.;
+    double maximumForceError = 0.;
+    double energyDrift = 0.;
+    double angularMomentumDrift = 0.;
+    bool paretoOptimal = false;
+};
+
+std::shared_ptr<ForceBackend> makeBenchmarkBackend(const std::string& name,
+    double cutoff, ConstParticleSpan particles);
+std::vector<BenchmarkResult> runBenchmark(const BenchmarkSettings& settings);
+void markParetoFront(std::vector<BenchmarkResult>& results);
+void writeBenchmarkCsv(const std::string& fileName,
+    const std::vector<BenchmarkResult>& results);
+void writeBenchmarkJson(const std::string& fileName,
+    const std::vector<BenchmarkResult>& results);
@@ -0,0 +1,63 @@
+#pragma once
+#include "forceBackend.hpp"
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Force backend for short-range interactions. Only the pairs closer than
+cutoffRadius interact, with the softened force of calcAcceleration. The
+particles are binned into cells at least as large as the interaction range, so
+each particle only looks at the 27 cells around its own one.
+
+With useVerletLists, every particle also keeps the list of the neighbours
+closer than cutoffRadius + skinRadius. The lists are reused until one particle
+has moved by more than half the skin since they were built. */
+
+class CellListBackend : public ForceBackend {
+public:
+    CellListBackend(double cutoffRadiusArgument, double skinRadiusArgument = 0.,
+        bool useVerletListsArgument = false);
+
+    std::string getName() const override;
+    void computeAccelerations(ParticleSpan particles,
+        double epsilon) override;
+    void particlesRearranged() override;
+    FieldValues evaluateField(ConstParticleSpan sources,
+        const std::vector<Eigen::Vector3d>& probes, double epsilon) override;
+
+    double getCutoffRadius() const;
+    double getSkinRadius() const;
+    int getNumberOfRebuilds() const;
+    int getNumberOfCells() const;
+
+private:
+    void buildCells(ConstParticleSpan particles);
+    void buildVerletLists(ConstParticleSpan particles);
+    bool verletListsAreValid(ConstParticleSpan particles) const;
+    template <typename PairFunction>
+    void forEachCandidate(int particle, PairFunction pairFunction) const;
+
+    double cutoffRadius;
+    double skinRadius;
+    bool useVerletLists;
+    int rebuilds = 0;
+
+    /* Grid of cells: cellStart[c] to cellStart[c + 1] is the range of
+    cellParticles that holds the particles in cell c */
+
+    Eigen::Vector3d gridOrigin = Eigen::Vector3d(0., 0., 0.);
+    double cellSize = 0.;
+    int cellsPerDimension[3] = { 0, 0, 0 };
+    std::vector<int> particleCell {};
+    std::vector<int> cellStart {};
+    std::vector<int> cellParticles {};
+
+    /* Verlet lists: neighbourStart[i] to neighbourStart[i + 1] is the range of
+    neighbours that belong to particle i */
+
+    std::vector<int> neighbourStart {};
+    std::vector<int> neighbours {};
+    std::vector<Eigen::Vector3d> positionsAtBuild {};
+};
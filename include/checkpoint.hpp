@@ -0,0 +1,84 @@
+#pragma once
+#include "particle.hpp"
+#include <deque>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* State of a system read back from a checkpoint file */
+
+struct Checkpoint {
+    int step = 0;
+    double time = 0.;
+    std::vector<Particle> particles {};
+    std::vector<int> identifiers {};
+};
+
+void writeCheckpoint(const std::string& fileName, int step, double time,
+    ConstParticleSpan particles, const std::vector<int>& identifiers);
+
+Checkpoint loadCheckpoint(const std::string& fileName);
+
+/* Read-only view of a checkpoint file mapped into memory: the particles are
+used where they are in the file, without being read or copied, so that tools
+that go through many large checkpoints only touch the pages they need */
+
+class MappedCheckpoint {
+public:
+    MappedCheckpoint(const std::string& fileName);
+    ~MappedCheckpoint();
+    MappedCheckpoint(const MappedCheckpoint&) = delete;
+    MappedCheckpoint& operator=(const MappedCheckpoint&) = delete;
+
+    long long getStep() const;
+    double getTime() const;
+    long long getNumberOfParticles() const;
+    ConstParticleSpan getParticles() const;
+    const int* getIdentifiers() const;
+
+private:
+    const char* mapping = nullptr;
+    std::size_t mappingBytes = 0;
+    long long step = 0;
+    double time = 0.;
+    long long numberOfParticles = 0;
+};
+
+/* Writes checkpoints every "interval" steps without stopping the integration:
+at a step boundary the process forks, the child writes its copy-on-write image
+of the particles and exits, and the parent goes on at once. At most
+maximumWritersArgument children run at the same time. */
+
+class ForkCheckpointer {
+public:
+    ForkCheckpointer(std::string directoryArgument, int intervalArgument,
+        int maximumWritersArgument = 2);
+    ~ForkCheckpointer();
+    ForkCheckpointer(const ForkCheckpointer&) = delete;
+    ForkCheckpointer& operator=(const ForkCheckpointer&) = delete;
+
+    int getInterval() const;
+    std::string getFileName(int step) const;
+    std::string checkpoint(int step, double time, ConstParticleSpan particles,
+        const std::vector<int>& identifiers);
+    void waitForAll();
+
+    int getNumberOfOutstanding();
+    int getNumberOfCheckpoints() const;
+    int getNumberOfFailures();
+    double getForkSeconds() const;
+
+private:
+    void reapChildren(bool block);
+    void reapOne(pid_t child, int status);
+
+    std::string directory;
+    int interval;
+    int maximumWriters;
+    std::deque<pid_t> writers {};
+    int checkpoints = 0;
+    int failures = 0;
+    double forkSeconds = 0.;
+};
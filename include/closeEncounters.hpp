@@ -0,0 +1,20 @@
+#pragma once
+#include "particle.hpp"
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Pair of particles (indices in the vector of particles, first < second)
+closer than the encounter radius */
+
+struct EncounterPair {
+    int first;
+    int second;
+    double distance;
+};
+
+std::vector<EncounterPair> findCloseEncounters(
+    ConstParticleSpan particles, double encounterRadius);
+
+std::vector<char> mergeCloseEncounters(ParticleSpan particles,
+    const std::vector<EncounterPair>& encounters);
@@ -0,0 +1,14 @@
+#pragma once
+#include <map>
+#include <string>
+
+/* See .cpp file for explanation and comments */
+
+typedef std::map<std::string, std::string> CommandLineOptions;
+
+CommandLineOptions extractOptions(int& argc, char** argv);
+
+bool hasOption(const CommandLineOptions& options, const std::string& name);
+
+std::string getOption(const CommandLineOptions& options,
+    const std::string& name, const std::string& defaultValue);
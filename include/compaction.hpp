@@ -0,0 +1,116 @@
+#pragma once
+#include "execution.hpp"
+#include "omp.h"
+#include <stdexcept>
+#include <vector>
+
+/* Removes from "values" the elements whose flag in "keep" is zero, keeping the
+order of the others. Every thread counts the elements it keeps in its static
+share of the vector, the counts give the position where each thread starts
+writing, and the threads copy their elements into a new, contiguous vector at
+the same time (on the pool every share is a task). The result is the same as a
+serial stable compaction. This is a template, so it is defined in the header. */
+
+template <typename T, typename Allocator>
+void compactInParallel(std::vector<T, Allocator>& values,
+    const std::vector<char>& keep)
+{
+    if (keep.size() != values.size()) {
+        throw std::invalid_argument(
+            "\nThe flags of the compaction must have the size of the values.\n");
+    }
+    const int n = values.size();
+    const bool pool = usingWorkStealingPool();
+    const int threads = pool ? threadPool().getNumberOfThreads() : omp_get_max_threads();
+    std::vector<int> firstSlot(threads + 1, 0);
+    std::vector<T, Allocator> compacted;
+    auto countShare = [&](int share, int shares) {
+        int begin = (long long)n * share / shares;
+        int end = (long long)n * (share + 1) / shares;
+        int keptInShare = 0;
+        for (int i = begin; i < end; i++) {
+            keptInShare = keptInShare + (keep[i] != 0);
+        }
+        firstSlot[share + 1] = keptInShare;
+    };
+    auto allocate = [&](int shares) {
+        for (int t = 0; t < shares; t++) {
+            firstSlot[t + 1] = firstSlot[t + 1] + firstSlot[t];
+        }
+        if (firstSlot[shares] > 0) {
+            compacted.assign(firstSlot[shares], values.front());
+        }
+    };
+    auto copyShare = [&](int share, int shares) {
+        int begin = (long long)n * share / shares;
+        int end = (long long)n * (share + 1) / shares;
+        int slot = firstSlot[share];
+        for (int i = begin; i < end; i++) {
+            if (keep[i] != 0) {
+                compacted[slot] = values[i];
+                slot++;
+            }
+        }
+    };
+    if (pool) {
+        WorkStealingPool& workers = threadPool();
+        workers.parallelFor(0, threads, 1, [&](long long first, long long last) {
+            for (int share = first; share < last; share++) {
+                countShare(share, threads);
+            }
+        });
+        allocate(threads);
+        workers.parallelFor(0, threads, 1, [&](long long first, long long last) {
+            for (int share = first; share < last; share++) {
+                copyShare(share, threads);
+            }
+        });
+    } else {
+#pragma omp parallel num_threads(threads)
+        {
+            int activeThreads = omp_get_num_threads();
+            int thread = omp_get_thread_num();
+            countShare(thread, activeThreads);
+#pragma omp barrier
+#pragma omp single
+            allocate(activeThreads);
+            copyShare(thread, activeThreads);
+        }
+    }
+    values.swap(compacted);
+}
+
+/* Rearranges "values" so that the element at position k is the one that was at
+position order[k]. The threads gather the elements into a new vector, each one
+filling its static share of the result. The new storage comes from the
+allocator of the vector, so with FirstTouchAllocator on OpenMP its pages are
+spread over the NUMA nodes like the loops that will read it. */
+
+template <typename T, typename Allocator>
+void permuteInParallel(std::vector<T, Allocator>& values,
+    const std::vector<int>& order)
+{
+    if (order.size() != values.size()) {
+        throw std::invalid_argument(
+            "\nThe permutation must have the size of the values.\n");
+    }
+    if (values.empty()) {
+        return;
+    }
+    const int n = values.size();
+    std::vector<T, Allocator> permuted;
+    permuted.assign(n, values.front());
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int k = first; k < last; k++) {
+                permuted[k] = values[order[k]];
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int k = 0; k < n; k++) {
+            permuted[k] = values[order[k]];
+        }
+    }
+    values.swap(permuted);
+}
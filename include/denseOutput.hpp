@@ -0,0 +1,45 @@
+#pragma once
+#include "particle.hpp"
+#include <functional>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* State of the particles at "theta" (0 at "start", 1 at "end") of a step of
+length dt, from the cubic Hermite interpolant of the positions and velocities at
+the two ends. The particles of "output" take the masses of "end". */
+
+void interpolateStep(ConstParticleSpan start, ConstParticleSpan end, double dt,
+    double theta, ParticleSpan output);
+
+/* Output of the state of the system at requested times, decoupled from the time
+step: the steps that contain an output time keep a copy of the state at their
+beginning, and the state at the output time is interpolated inside the step
+and passed to the callback with the time. Output times that fall on the
+beginning of the evolution get the state as it is. */
+
+typedef std::function<void(double time, ConstParticleSpan particles)>
+    DenseOutputCallback;
+
+class DenseOutput {
+public:
+    DenseOutput(std::vector<double> outputTimesArgument,
+        DenseOutputCallback callbackArgument);
+
+    bool isDue(double time) const;
+    void emitCurrent(double time, ConstParticleSpan particles);
+    void beginStep(ConstParticleSpan particles);
+    void endStep(double startTime, double endTime, double dt,
+        ConstParticleSpan particles);
+
+    int getNumberOfOutputs() const;
+    int getNumberOfPendingOutputs() const;
+    double getNextOutputTime() const;
+
+private:
+    std::vector<double> outputTimes;
+    DenseOutputCallback callback;
+    std::size_t nextOutput = 0;
+    ParticleVector stepStart {};
+    ParticleVector interpolated {};
+};
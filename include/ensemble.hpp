@@ -0,0 +1,56 @@
+#pragma once
+#include "particle.hpp"
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Ensemble of many independent systems with the same number of bodies. The
+members are stored in blocks of membersPerBlock systems: inside a block, the
+value of a quantity for a given body is contiguous over the members, so the
+pairwise kernel is vectorised across systems instead of within one. The blocks
+are distributed over the threads and each block is integrated from the first to
+the last step without any synchronisation. The energies use the potential
+softened by the epsilon of the evolution, which is fixed by the first call of
+evolve. */
+
+class SystemEnsemble {
+public:
+    static constexpr int membersPerBlock = 32;
+
+    explicit SystemEnsemble(int bodiesPerSystemArgument);
+
+    void addMember(const std::vector<Particle>& system);
+    void generateSolarSystemEnsemble(int membersToGenerate, unsigned int seed);
+
+    int getNumberOfMembers() const;
+    int getBodiesPerSystem() const;
+    std::vector<Particle> getMember(int member) const;
+
+    void evolve(int steps, double dt, double epsilon);
+    int getIterations() const;
+
+    std::vector<double> calculateEnergies() const;
+    std::vector<double> getInitialEnergies() const;
+    std::vector<double> getRelativeEnergyDrift() const;
+
+private:
+    int index(int member, int body) const;
+    void evolveBlock(int block, int steps, double dt, double epsilon);
+    double calculateEnergy(int member) const;
+
+    /* Columns of the batched layout. The value for body b of member m is at
+    index(m, b). The last block is padded with massless members. */
+
+    int bodiesPerSystem;
+    int numberOfMembers = 0;
+    int iterations = 0;
+    double epsilon = 0.;
+    std::vector<double> mass {};
+    std::vector<double> positionX {};
+    std::vector<double> positionY {};
+    std::vector<double> positionZ {};
+    std::vector<double> velocityX {};
+    std::vector<double> velocityY {};
+    std::vector<double> velocityZ {};
+    std::vector<double> initialEnergies {};
+};
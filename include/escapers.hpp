@@ -0,0 +1,28 @@
+#pragma once
+#include "particle.hpp"
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Particle removed from the system because it escaped: its state when it was
+removed, with its specific energy and distance from the centre of mass at that
+moment. index is its position in the vector of particles when it was found;
+the system replaces it with the identifier of the particle, and fills in the
+step and time of the removal. */
+
+struct EscapedParticle {
+    int index = 0;
+    int identifier = 0;
+    int step = 0;
+    double time = 0.;
+    double specificEnergy = 0.;
+    double distance = 0.;
+    Particle particle { 0. };
+};
+
+std::vector<char> findEscapers(ConstParticleSpan particles,
+    double escapeRadius, std::vector<EscapedParticle>& escapers);
+
+void writeEscapersCsv(const std::string& fileName,
+    const std::vector<EscapedParticle>& escapers);
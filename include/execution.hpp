@@ -0,0 +1,177 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Runtimes the parallel loops of the library can run on. "openmp" is the
+default of the build; "workStealing" runs them as tasks on the pool below. */
+
+enum class ExecutionBackend {
+    openmp,
+    workStealing
+};
+
+std::string executionBackendName(ExecutionBackend backend);
+ExecutionBackend executionBackendFromName(const std::string& name);
+
+class WorkStealingPool;
+
+/* Set of tasks that can be waited for together. The thread that waits runs
+tasks of the pool meanwhile, so a task can open a group of its own and wait
+for it without blocking a worker. The first exception thrown by a task is
+rethrown by wait. */
+
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& poolArgument);
+    ~TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    WorkStealingPool& pool;
+    std::atomic<long long> pendingTasks { 0 };
+    std::mutex exceptionMutex;
+    std::exception_ptr firstException {};
+};
+
+/* Pool with a fixed number of threads, so the CPU it uses is known up front.
+Every worker owns a deque: it pushes and pops its own tasks at the back, and
+when it runs out it steals the oldest task at the front of another deque, which
+with ranges split in halves is the biggest piece of work left. Threads that are
+not workers submit to a deque shared between them and help while they wait. */
+
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int getNumberOfThreads() const;
+    long long getNumberOfTasks() const;
+    long long getNumberOfSteals() const;
+
+    void submit(std::function<void()> task);
+    bool runPendingTask();
+
+    template <typename Function>
+    void parallelFor(long long begin, long long end, long long grain,
+        const Function& function);
+
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce(long long begin, long long end, long long grain,
+        T identity, const Map& map, const Combine& combine);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks {};
+    };
+
+    template <typename Function>
+    void splitRange(TaskGroup& group, long long begin, long long end,
+        long long grain, const Function& function);
+    long long defaultGrain(long long iterations) const;
+    bool popTask(int queue, bool fromBack, std::function<void()>& task);
+    void workerLoop(int index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues {};
+    std::vector<std::thread> workers {};
+    std::atomic<bool> stopping { false };
+    std::atomic<long long> queuedTasks { 0 };
+    std::atomic<long long> submittedTasks { 0 };
+    std::atomic<long long> stolenTasks { 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+};
+
+/* Backend used by the loops of the library. The default is chosen when the
+library is configured (NBODY_EXECUTION) and can be overridden by the
+environment variable NBODY_EXECUTION or at run time; threads = 0 takes
+NBODY_THREADS, or else one per hardware thread. */
+
+void setExecutionBackend(ExecutionBackend backend, int threads = 0);
+ExecutionBackend executionBackend();
+bool usingWorkStealingPool();
+WorkStealingPool& threadPool();
+
+/* Runs function(first, last) over pieces of [begin, end) of at most grain
+iterations (grain <= 0 picks a few pieces per thread). The range is halved
+recursively, one half pushed as a task and the other kept, so idle workers
+steal big pieces first and no work is assigned before it is needed. */
+
+template <typename Function>
+void WorkStealingPool::parallelFor(long long begin, long long end,
+    long long grain, const Function& function)
+{
+    if (end <= begin) {
+        return;
+    }
+    if (grain <= 0) {
+        grain = defaultGrain(end - begin);
+    }
+    if (end - begin <= grain) {
+        function(begin, end);
+        return;
+    }
+    TaskGroup group(*this);
+    splitRange(group, begin, end, grain, function);
+    group.wait();
+}
+
+template <typename Function>
+void WorkStealingPool::splitRange(TaskGroup& group, long long begin,
+    long long end, long long grain, const Function& function)
+{
+    while (end - begin > grain) {
+        long long middle = begin + (end - begin) / 2;
+        group.run([this, &group, middle, end, grain, &function]() {
+            splitRange(group, middle, end, grain, function);
+        });
+        end = middle;
+    }
+    function(begin, end);
+}
+
+/* Reduction over the pieces of the range: map(first, last) gives the value of
+a piece, and the values are combined in the order of the pieces, so for a
+given grain the result does not depend on the number of threads */
+
+template <typename T, typename Map, typename Combine>
+T WorkStealingPool::parallelReduce(long long begin, long long end,
+    long long grain, T identity, const Map& map, const Combine& combine)
+{
+    if (end <= begin) {
+        return identity;
+    }
+    if (grain <= 0) {
+        grain = defaultGrain(end - begin);
+    }
+    long long pieces = (end - begin + grain - 1) / grain;
+    std::vector<T> partialValues(pieces, identity);
+    parallelFor(0, pieces, 1, [&](long long firstPiece, long long lastPiece) {
+        for (long long piece = firstPiece; piece < lastPiece; piece++) {
+            long long first = begin + piece * grain;
+            partialValues[piece] = map(first, std::min(end, first + grain));
+        }
+    });
+    T result = identity;
+    for (const T& value : partialValues) {
+        result = combine(result, value);
+    }
+    return result;
+}
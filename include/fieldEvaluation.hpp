@@ -0,0 +1,18 @@
+#pragma once
+#include "particle.hpp"
+#include <Eigen/Core>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Gravitational potential and acceleration at a set of probe points, in the
+order of the probes */
+
+struct FieldValues {
+    std::vector<double> potential {};
+    std::vector<Eigen::Vector3d> acceleration {};
+};
+
+FieldValues evaluateFieldDirect(ConstParticleSpan sources,
+    const std::vector<Eigen::Vector3d>& probes, double epsilon,
+    double cutoffRadius = 0.);
@@ -0,0 +1,57 @@
+#pragma once
+#include "fieldEvaluation.hpp"
+#include "particle.hpp"
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Interface of the methods that compute the accelerations of all the particles
+of a system. InitialConditionGenerator::evolutionOfSystem calls the backend
+once per step, outside any parallel region, so a backend is free to organise
+its own parallel loops. startEvolution is called once at the start of every
+run, with whether the system may use the planar kernels (it is planar and
+they are enabled), so that a backend decides what holds for the whole run once
+instead of at every step. particlesRearranged is called when particles have
+been reordered or removed, so that a backend which keeps data indexed by
+particle (e.g. neighbour lists) throws it away. evaluateField gives the potential and
+acceleration of the particles at points that are not particles; by default it
+is the direct summation of evaluateFieldDirect, and a backend whose
+interaction is not the plain Newtonian one overrides it to match. */
+
+class ForceBackend {
+public:
+    virtual ~ForceBackend() = default;
+    virtual std::string getName() const = 0;
+    virtual void computeAccelerations(ParticleSpan particles,
+        double epsilon)
+        = 0;
+    virtual void startEvolution(bool /* planar */) { }
+    virtual void particlesRearranged() { }
+    virtual FieldValues evaluateField(ConstParticleSpan sources,
+        const std::vector<Eigen::Vector3d>& probes, double epsilon);
+};
+
+/* Direct summation over all the pairs, the same computation as the one built
+into evolutionOfSystem. With a positive tileSize the particles are taken in
+tiles of tileSize: the accelerations of a tile are summed over one tile of
+sources at a time, so the sources stay in cache while they are used by every
+particle of the tile. The planar kernels are used once startEvolution has
+allowed them, so the choice belongs to the system the backend is attached to;
+before any run computeAccelerations uses the three dimensional ones. */
+
+class DirectSummationBackend : public ForceBackend {
+public:
+    DirectSummationBackend(int tileSizeArgument = 0);
+
+    std::string getName() const override;
+    void startEvolution(bool planar) override;
+    void computeAccelerations(ParticleSpan particles,
+        double epsilon) override;
+    int getTileSize() const;
+
+private:
+    int tileSize;
+    bool planarSystem = false;
+    void computeTiledAccelerations(ParticleSpan particles, double epsilon);
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+
+/* See .cpp file for explanation and comments */
+
+/* Hardware events read around the force and update phases. fpOperations is
+only counted if a raw event for the CPU in use is given through the environment
+variable NBODY_PERF_FP_EVENT, because Linux has no generic floating point event.
+*/
+
+enum class HardwareEvent {
+    cycles,
+    instructions,
+    l1DataMisses,
+    lastLevelCacheMisses,
+    fpOperations,
+    numberOfEvents
+};
+
+constexpr int numberOfHardwareEvents = static_cast<int>(HardwareEvent::numberOfEvents);
+
+std::string hardwareEventName(HardwareEvent event);
+
+/* Set of perf_event_open counters measuring the thread that opened them. Each
+thread that takes part in a measured phase owns one of these groups. */
+
+class HardwareCounterGroup {
+public:
+    HardwareCounterGroup();
+    ~HardwareCounterGroup();
+    HardwareCounterGroup(const HardwareCounterGroup&) = delete;
+    HardwareCounterGroup& operator=(const HardwareCounterGroup&) = delete;
+
+    bool isAvailable() const;
+    bool isEventAvailable(HardwareEvent event) const;
+    std::string getStatus() const;
+    void read(long long values[numberOfHardwareEvents]) const;
+
+private:
+    /* fileDescriptors[e] is -1 for the events that could not be opened. The
+    first event that opens is the group leader. */
+
+    int fileDescriptors[numberOfHardwareEvents];
+    int leaderDescriptor = -1;
+    int openedEvents = 0;
+    std::string status = "";
+};
+
+bool enableHardwareCounters();
+void disableHardwareCounters();
+bool hardwareCountersEnabled();
+bool hardwareEventAvailable(HardwareEvent event);
+std::string hardwareCountersStatus();
+
+/* Counter group of the calling thread, opened the first time it is needed */
+
+HardwareCounterGroup& threadHardwareCounters();
@@ -0,0 +1,201 @@
+#pragma once
+#include "hardwareCounters.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Phases of a step that are timed separately. "io" is the work done between
+steps for the observers and the checkpoints. "synchronisation" collects the
+time threads spend waiting at the barriers that close each parallel loop. */
+
+enum class Phase {
+    force,
+    update,
+    energy,
+    reordering,
+    io,
+    synchronisation,
+    numberOfPhases
+};
+
+constexpr int numberOfPhases = static_cast<int>(Phase::numberOfPhases);
+
+std::string phaseName(Phase phase);
+
+/* Counters owned by a single thread. They are aligned to a cache line so that
+two threads never write to the same line while updating their own counters. */
+
+struct alignas(64) ThreadCounters {
+    double phaseSeconds[numberOfPhases] = {};
+    long long phaseCalls[numberOfPhases] = {};
+    long long pairInteractions = 0;
+    long long phasePairInteractions[numberOfPhases] = {};
+    long long bytesAllocated = 0;
+    long long hardwareEvents[numberOfPhases][numberOfHardwareEvents] = {};
+};
+
+/* Figures derived from the hardware counters of the force and update phases.
+If the CPU gives no floating point event the FLOP rate is estimated from the
+number of pair interactions, and flopsMeasured is false. */
+
+struct HardwareCounterSummary {
+    bool available = false;
+    std::string status = "";
+    double instructionsPerCycle = 0.;
+    double l1DataMissesPerInteraction = 0.;
+    double lastLevelCacheMissesPerInteraction = 0.;
+    double gigaFlopsPerSecond = 0.;
+    bool flopsMeasured = false;
+};
+
+class PerformanceCounters {
+public:
+    PerformanceCounters();
+    ThreadCounters& getThreadCounters();
+    void reset();
+
+    int getNumberOfThreads() const;
+    std::vector<ThreadCounters> getCountersPerThread() const;
+    ThreadCounters getTotals() const;
+    double getPhaseSeconds(Phase phase) const;
+    double getLoadImbalance(Phase phase) const;
+    long long getPairInteractions() const;
+    long long getPairInteractions(Phase phase) const;
+    double getBarrierWaitSeconds() const;
+    long long getBytesAllocated() const;
+    HardwareCounterSummary getHardwareSummary() const;
+
+    void writeJson(std::ostream& output) const;
+    void writeJson(const std::string& fileName) const;
+
+private:
+    /* Every thread that reports something gets its own slot the first time it
+    does so. The mutex only protects the registration and the lookup of the
+    slots; instanceId tells the slots of different instances apart in the cache
+    that each thread keeps of its last slot. */
+
+    mutable std::mutex slotsMutex;
+    std::vector<std::unique_ptr<ThreadCounters>> slots {};
+    std::unordered_map<std::thread::id, ThreadCounters*> slotOfThread {};
+    const std::uint64_t instanceId;
+};
+
+/* Process-wide counters filled by the instrumented kernels */
+
+PerformanceCounters& performanceCounters();
+
+/* Timeline of the phases of every thread, for the diagnosis of stragglers and
+barrier stalls that the totals average out. While it is enabled, every timed
+phase also leaves an event (phase, start and duration) in a ring buffer owned
+by the calling thread, so recording takes no lock and no allocation; when a
+buffer is full the oldest events are overwritten. writeChromeTrace exports the
+events as Chrome Trace Event JSON, which chrome://tracing and Perfetto load. */
+
+struct TraceEvent {
+    std::int64_t startNanoseconds;
+    std::int64_t durationNanoseconds;
+    Phase phase;
+};
+
+class PhaseTracer {
+public:
+    void enable(std::size_t eventsPerThread = 1 << 16);
+    void disable();
+    bool isEnabled() const;
+    void record(Phase phase, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end);
+
+    long long getNumberOfEvents() const;
+    long long getNumberOfDroppedEvents() const;
+    void writeChromeTrace(std::ostream& output) const;
+    void writeChromeTrace(const std::string& fileName) const;
+
+private:
+    /* Ring buffer of one thread: only that thread writes it, and
+    writtenEvents is only read once the threads are done */
+
+    struct ThreadTrace {
+        std::vector<TraceEvent> events {};
+        std::atomic<std::uint64_t> writtenEvents { 0 };
+    };
+
+    ThreadTrace& getThreadTrace();
+
+    std::atomic<bool> enabled { false };
+    std::size_t capacity = 0;
+    std::chrono::steady_clock::time_point origin {};
+    mutable std::mutex tracesMutex;
+    std::vector<std::unique_ptr<ThreadTrace>> traces {};
+};
+
+/* Process-wide tracer fed by the phase timers */
+
+PhaseTracer& phaseTracer();
+
+/* Scoped timer that adds the time spent in its scope to the given phase of the
+calling thread, and records it in the timeline if the tracer is enabled. While
+it is alive its phase is the current phase of the thread, which the pair
+interactions counted meanwhile are attributed to. */
+
+class ScopedPhaseTimer {
+public:
+    explicit ScopedPhaseTimer(Phase phaseArgument);
+    ~ScopedPhaseTimer();
+
+private:
+    ThreadCounters* counters;
+    Phase phase;
+    int previousPhase;
+    std::chrono::steady_clock::time_point start;
+};
+
+/* Adds pair interactions to the calling thread, in total and in its current
+ * phase if it is inside one */
+
+void countPairInteractions(long long count);
+
+/* Reads the hardware counters of the calling thread at the beginning and at the
+end of its scope and adds the difference to the given phase. It does nothing
+unless enableHardwareCounters() succeeded. */
+
+class ScopedHardwareCounters {
+public:
+    explicit ScopedHardwareCounters(Phase phaseArgument);
+    ~ScopedHardwareCounters();
+
+private:
+    bool active;
+    Phase phase;
+    long long startValues[numberOfHardwareEvents];
+};
+
+/* The macros below are the only way the kernels touch the counters. If the
+library is configured with NBODY_INSTRUMENTATION=OFF they expand to nothing and
+the instrumentation has no cost at all. */
+
+#define NBODY_CONCATENATE_IMPLEMENTATION(a, b) a##b
+#define NBODY_CONCATENATE(a, b) NBODY_CONCATENATE_IMPLEMENTATION(a, b)
+
+#ifdef NBODY_INSTRUMENTATION
+#define INSTRUMENT_PHASE(phase) \
+    ScopedPhaseTimer NBODY_CONCATENATE(scopedPhaseTimer, __LINE__)(phase)
+#define INSTRUMENT_HARDWARE(phase) \
+    ScopedHardwareCounters NBODY_CONCATENATE(scopedHardwareCounters, __LINE__)(phase)
+#define INSTRUMENT_PAIRS(count) countPairInteractions(count)
+#define INSTRUMENT_BYTES(count) \
+    (performanceCounters().getThreadCounters().bytesAllocated += (count))
+#else
+#define INSTRUMENT_PHASE(phase) ((void)0)
+#define INSTRUMENT_HARDWARE(phase) ((void)0)
+#define INSTRUMENT_PAIRS(count) ((void)(count))
+#define INSTRUMENT_BYTES(count) ((void)(count))
+#endif
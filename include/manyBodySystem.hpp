@@ -1,20 +1,34 @@
 #pragma once
+#include "checkpoint.hpp"
+#include "closeEncounters.hpp"
+#include "denseOutput.hpp"
+#include "escapers.hpp"
+#include "forceBackend.hpp"
+#include "instrumentation.hpp"
+#include "observers.hpp"
 #include "omp.h"
+#include "parareal.hpp"
 #include "particle.hpp"
+#include "spaceFillingCurve.hpp"
 #include <Eigen/Core>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 /* See .cpp file for explanation and comments */
 
-double getDistance(Particle* p1, Particle* p2);
+double getDistance(const Particle* p1, const Particle* p2);
 
-Eigen::Vector3d calcAcceleration(Particle* p1, Particle* p2,
+Eigen::Vector3d calcAcceleration(const Particle* p1, const Particle* p2,
     double epsilon = 0.);
 
-double calculateTotalEnergy(std::vector<Particle> particlesInTheSystem);
+double calculateTotalEnergy(ConstParticleSpan particlesInTheSystem,
+    double epsilon = 0.);
+
+long long stepsToReach(double time, double dt);
 
 /* Virtual class InitialConditionGenerator with the virtual function
 generateInitialConditions. The other functions are inherited from the
@@ -24,11 +38,45 @@ class InitialConditionGenerator {
 public:
     virtual void generateInitialConditions(int particlesInTheSystem) = 0;
     std::vector<Particle> getSystemInformations();
+    ConstParticleSpan getSystemView() const;
     void evolutionOfSystem(std::string method, double upperLimit, double dt,
         double epsilon);
     int getIterations();
+    double getElapsedTime();
     int getNumberOfParticles();
     void copySystem(std::vector<Particle>* toCopy);
+    void setForceBackend(std::shared_ptr<ForceBackend> backend);
+    std::shared_ptr<ForceBackend> getForceBackend();
+    void setLoopSchedule(omp_sched_t kind, int chunk);
+    void enablePlanarKernels(bool enabled);
+    bool usesPlanarKernels();
+    FieldValues evaluateField(const std::vector<Eigen::Vector3d>& probes,
+        double epsilon = 0.);
+    static const PerformanceCounters& getProcessPerformanceCounters();
+    static void resetProcessPerformanceCounters();
+    std::vector<int> getParticleIdentifiers();
+    void enableCloseEncounters(double encounterRadiusArgument,
+        int checkIntervalArgument = 1, bool mergeBodiesArgument = false);
+    int getNumberOfEncounters();
+    int getNumberOfMergers();
+    std::vector<EncounterPair> getLastEncounters();
+    void setDiagnostics(std::shared_ptr<DiagnosticsMonitor> monitor);
+    std::shared_ptr<DiagnosticsMonitor> getDiagnostics();
+    void setCheckpointer(std::shared_ptr<ForkCheckpointer> checkpointerArgument);
+    std::shared_ptr<ForkCheckpointer> getCheckpointer();
+    void restoreCheckpoint(const std::string& fileName);
+    void enableReordering(SpaceFillingCurve curve, int intervalArgument);
+    void reorderParticles(SpaceFillingCurve curve);
+    int getNumberOfReorderings();
+    double getReorderingSeconds();
+    void enableEscaperPruning(double escapeRadiusArgument,
+        int checkIntervalArgument = 10);
+    int getNumberOfEscapers();
+    std::vector<EscapedParticle> getEscapers();
+    void setDenseOutput(std::shared_ptr<DenseOutput> output);
+    std::shared_ptr<DenseOutput> getDenseOutput();
+    PararealResult evolutionInParallelInTime(long long steps, double dt,
+        double epsilon, const PararealSettings& settings);
 
 protected:
     /* The protected variables here stored are systemOfParticles (a vector that
@@ -38,10 +86,110 @@ protected:
     particle of the system), iterations (it counts the number of iterations made
     during the evolution of the system) and numberOfParticles. */
 
-    std::vector<Particle> systemOfParticles {};
+    ParticleVector systemOfParticles {};
     std::vector<double> distanceFromCentralStar {};
     int iterations = 0;
     int numberOfParticles = 0;
+
+    /* Backend used to compute the accelerations, the built-in direct summation
+    if it is null */
+
+    std::shared_ptr<ForceBackend> forceBackend = nullptr;
+
+    /* particleIdentifiers stores, for each particle, its index in the system
+    as it was generated, so that the particles can still be recognised after
+    merged bodies have been removed */
+
+    std::vector<int> particleIdentifiers {};
+    void compactParticles(const std::vector<char>& keep);
+
+    /* Close encounters: pairs closer than encounterRadius (0 disables the
+    search) are looked for every encounterCheckInterval steps, and merged if
+    mergeBodies is true */
+
+    double encounterRadius = 0.;
+    int encounterCheckInterval = 1;
+    bool mergeBodies = false;
+    int numberOfEncounters = 0;
+    int numberOfMergers = 0;
+    std::vector<EncounterPair> lastEncounters {};
+
+    /* Observers sampled after the steps (none if null) and time evolved so
+    far, summed over all the calls of evolutionOfSystem */
+
+    std::shared_ptr<DiagnosticsMonitor> diagnostics = nullptr;
+    double elapsedTime = 0.;
+
+    /* Clock of the steps: elapsedTime is clockOriginTime plus the steps done
+    since iteration clockOriginIteration times dt, so that it does not drift
+    with the sum of the time steps. The origin is moved at every call of
+    evolutionOfSystem, whose dt can change. */
+
+    double clockOriginTime = 0.;
+    int clockOriginIteration = 0;
+
+    /* States interpolated at requested times (none if null) */
+
+    std::shared_ptr<DenseOutput> denseOutput = nullptr;
+
+    /* Writer of the periodic checkpoints (none if null) */
+
+    std::shared_ptr<ForkCheckpointer> checkpointer = nullptr;
+
+    /* Reordering of the particles along a space filling curve every
+    reorderingInterval steps (0 switches it off), with the number of
+    reorderings done and the time they took */
+
+    SpaceFillingCurve reorderingCurve = SpaceFillingCurve::hilbert;
+    int reorderingInterval = 0;
+    int numberOfReorderings = 0;
+    double reorderingSeconds = 0.;
+
+    /* Removal of the escapers: particles farther than escapeRadius from the
+    centre of mass and no longer bound are looked for every
+    escapeCheckInterval steps (never if escapeRadius is 0) and moved to
+    escapedParticles */
+
+    double escapeRadius = 0.;
+    int escapeCheckInterval = 10;
+    std::vector<EscapedParticle> escapedParticles {};
+
+    /* Planar kernels: if planarKernelsEnabled, evolutionOfSystem looks at
+    whether the system lies in the plane z = 0 (planar) and then runs the
+    direct summation and the update in two dimensions */
+
+    bool planarKernelsEnabled = true;
+    bool planar = false;
+
+    /* Schedule of the parallel loops chosen with setLoopSchedule, if any */
+
+    bool loopScheduleIsSet = false;
+    omp_sched_t loopScheduleKind = omp_sched_static;
+    int loopScheduleChunk = 0;
+
+private:
+    /* Direct summation kernel and update of the current run, chosen by
+    evolutionOfSystem for its softening factor and for planar systems */
+
+    AccelerationKernel accelerationKernel = nullptr;
+    UpdateFunction updateFunction = &Particle::update;
+
+    /* Planar runs sum the forces over columns of the x and y positions and
+    of the masses, gathered from the particles at every step. The particles
+    stay the state of the system, so nothing else sees the columns. */
+
+    PlanarColumnKernel planarColumnKernel = nullptr;
+    std::vector<double> planarX {};
+    std::vector<double> planarY {};
+    std::vector<double> planarMass {};
+
+    void gatherPlanarColumns();
+    void advanceOneStep(double dt, double epsilon);
+    void integrateOneStep(double dt, double epsilon);
+    void finishStep(double dt);
+    void checkCloseEncounters();
+    void pruneEscapers();
+    void fillParticleIdentifiers();
 };
 
 class solarSystemGenerator : public InitialConditionGenerator {
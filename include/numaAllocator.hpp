@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <string>
+
+/* See .cpp file for explanation and comments */
+
+/* Pages used for the large allocations of FirstTouchAllocator: "none" for
+normal pages, "transparent" asks the kernel to back the memory with
+transparent huge pages (madvise), "hugetlb" maps pages from the hugetlbfs
+pool (MAP_HUGETLB) and falls back to normal pages if the pool is empty */
+
+enum class HugePageMode {
+    none,
+    transparent,
+    hugetlb
+};
+
+void setHugePageMode(HugePageMode mode);
+HugePageMode getHugePageMode();
+HugePageMode hugePageModeFromName(const std::string& name);
+std::string hugePageModeName(HugePageMode mode);
+
+int getNumberOfNumaNodes();
+
+/* What the allocations made so far have obtained */
+
+struct MemoryPlacementReport {
+    int numaNodes = 1;
+    HugePageMode hugePageMode = HugePageMode::none;
+    long long mappedBytes = 0;
+    long long firstTouchedBytes = 0;
+    long long explicitHugePageBytes = 0;
+    long long transparentHugePageBytes = 0;
+    long long hugePageFallbacks = 0;
+    long long plainBytes = 0;
+};
+
+MemoryPlacementReport getMemoryPlacementReport();
+
+void* allocateFirstTouch(std::size_t bytes);
+void deallocateFirstTouch(void* memory, std::size_t bytes);
+
+/* Allocator whose large blocks are mapped directly and first touched in
+parallel with a static partition, so that each page lands on the NUMA node of
+the thread that works on it in the OpenMP loops using schedule(static) (the
+work-stealing pool only shares the page faults among its threads). Small blocks,
+and every block on machines with a single NUMA node and no huge pages
+requested, come from the normal operator new. */
+
+template <typename T>
+class FirstTouchAllocator {
+public:
+    typedef T value_type;
+
+    FirstTouchAllocator() noexcept = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(allocateFirstTouch(n * sizeof(T)));
+    }
+
+    void deallocate(T* memory, std::size_t n) noexcept
+    {
+        deallocateFirstTouch(memory, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&)
+{
+    return false;
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include "particle.hpp"
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Diagnostic computed on the state of the system every "interval" steps. The
+values of a sample depend on the observer (e.g. the three components of the
+total momentum). observe is called from the helper thread of a
+DiagnosticsMonitor, on a copy of the particles, so it must not touch the
+system being evolved. */
+
+class Observer {
+public:
+    explicit Observer(int intervalArgument);
+    virtual ~Observer() = default;
+    virtual std::string getName() const = 0;
+    virtual std::vector<std::string> getValueNames() const = 0;
+    virtual std::vector<double> observe(ConstParticleSpan particles) const = 0;
+    int getInterval() const;
+
+private:
+    int interval;
+};
+
+/* Kinetic, potential and total energy, with the potential of the force
+softened by epsilon, which is the energy the evolution with that epsilon
+conserves */
+
+class EnergyObserver : public Observer {
+public:
+    explicit EnergyObserver(int intervalArgument, double epsilonArgument = 0.);
+    std::string getName() const override;
+    std::vector<std::string> getValueNames() const override;
+    std::vector<double> observe(ConstParticleSpan particles) const override;
+
+private:
+    double epsilon;
+};
+
+/* Components of the total linear momentum */
+
+class MomentumObserver : public Observer {
+public:
+    explicit MomentumObserver(int intervalArgument);
+    std::string getName() const override;
+    std::vector<std::string> getValueNames() const override;
+    std::vector<double> observe(ConstParticleSpan particles) const override;
+};
+
+/* Components of the total angular momentum about the origin */
+
+class AngularMomentumObserver : public Observer {
+public:
+    explicit AngularMomentumObserver(int intervalArgument);
+    std::string getName() const override;
+    std::vector<std::string> getValueNames() const override;
+    std::vector<double> observe(ConstParticleSpan particles) const override;
+};
+
+/* Position of the centre of mass */
+
+class CentreOfMassObserver : public Observer {
+public:
+    explicit CentreOfMassObserver(int intervalArgument);
+    std::string getName() const override;
+    std::vector<std::string> getValueNames() const override;
+    std::vector<double> observe(ConstParticleSpan particles) const override;
+};
+
+/* Virial ratio 2K/|U| (1 for a system in virial equilibrium), with the
+softened potential as in EnergyObserver */
+
+class VirialRatioObserver : public Observer {
+public:
+    explicit VirialRatioObserver(int intervalArgument, double epsilonArgument = 0.);
+    std::string getName() const override;
+    std::vector<std::string> getValueNames() const override;
+    std::vector<double> observe(ConstParticleSpan particles) const override;
+
+private:
+    double epsilon;
+};
+
+/* One value set produced by an observer */
+
+struct DiagnosticSample {
+    std::string observer;
+    int step;
+    double time;
+    std::vector<double> values;
+};
+
+/* Fixed-capacity buffer of the latest samples: when it is full the oldest
+sample is overwritten. It can be read while the helper thread writes to it. */
+
+class SampleRingBuffer {
+public:
+    explicit SampleRingBuffer(int capacityArgument);
+
+    void push(DiagnosticSample sample);
+    std::vector<DiagnosticSample> getSamples() const;
+    std::vector<DiagnosticSample> getSamples(const std::string& observer) const;
+    int getCapacity() const;
+    long long getNumberOfPushed() const;
+    void clear();
+
+private:
+    mutable std::mutex bufferMutex;
+    std::vector<DiagnosticSample> samples {};
+    int capacity;
+    int next = 0;
+    long long pushed = 0;
+};
+
+/* Runs a set of observers on snapshots of the system in a helper thread, so
+that the threads integrating the system only pay for copying the particles
+when a sample is due. */
+
+class DiagnosticsMonitor {
+public:
+    explicit DiagnosticsMonitor(int bufferCapacity = 4096,
+        int maximumPendingSnapshotsArgument = 4);
+    ~DiagnosticsMonitor();
+    DiagnosticsMonitor(const DiagnosticsMonitor&) = delete;
+    DiagnosticsMonitor& operator=(const DiagnosticsMonitor&) = delete;
+
+    void addObserver(std::shared_ptr<Observer> observer);
+    void observe(int step, double time, ConstParticleSpan particles);
+    void flush();
+
+    const SampleRingBuffer& getBuffer() const;
+    double getMaximumRelativeEnergyDrift() const;
+    void writeCsv(std::ostream& output) const;
+    void writeCsv(const std::string& fileName) const;
+
+private:
+    struct Snapshot {
+        int step;
+        double time;
+        std::vector<Particle> particles;
+    };
+
+    void helperLoop();
+
+    std::vector<std::shared_ptr<Observer>> observers {};
+    SampleRingBuffer buffer;
+    int maximumPendingSnapshots;
+
+    /* Snapshots waiting for the helper thread, and copies already processed
+    that are reused to avoid allocating at every sample */
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<Snapshot> pendingSnapshots {};
+    std::vector<std::vector<Particle>> freeSnapshots {};
+    bool helperBusy = false;
+    bool stopping = false;
+    std::thread helper;
+};
+
+std::shared_ptr<DiagnosticsMonitor> makeStandardDiagnostics(int interval,
+    double epsilon = 0.);
@@ -0,0 +1,82 @@
+#pragma once
+#include "particle.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Time spent by an OutOfCoreSystem, summed over its steps. ioSeconds is the
+time the reading thread spent reading source blocks, waitSeconds the part of it
+the force computation had to wait for, so 1 - waitSeconds / ioSeconds is the
+fraction of the reading hidden behind the computation (overlapFraction). */
+
+struct OutOfCoreStatistics {
+    double ioSeconds = 0.;
+    double computeSeconds = 0.;
+    double waitSeconds = 0.;
+    double updateSeconds = 0.;
+    long long bytesRead = 0;
+    long long blocksRead = 0;
+    double overlapFraction = 0.;
+};
+
+/* System of particles kept in a file instead of memory. The file holds the ten
+columns of the particles (mass, position, velocity and acceleration, one
+component per column) and is mapped into memory, so the system can be much
+larger than the memory of the node: only the blocks being used need to be
+resident. advance makes the same steps as evolutionOfSystem with the direct
+summation, one block of blockSize particles at a time. */
+
+class OutOfCoreSystem {
+public:
+    OutOfCoreSystem(const std::string& fileNameArgument,
+        long long blockSizeArgument = 65536);
+    ~OutOfCoreSystem();
+    OutOfCoreSystem(const OutOfCoreSystem&) = delete;
+    OutOfCoreSystem& operator=(const OutOfCoreSystem&) = delete;
+
+    static void create(const std::string& fileName,
+        long long numberOfParticles);
+    static long long numberOfParticlesInFile(const std::string& fileName);
+
+    long long getNumberOfParticles() const;
+    long long getBlockSize() const;
+    std::vector<Particle> readParticles(long long first, long long count) const;
+    void writeParticles(long long first, ConstParticleSpan particles);
+    void fillWithNBodySystem(unsigned int seed = 1);
+    void advance(int steps, double dt, double epsilon);
+    void flush();
+    int getIterations() const;
+    const OutOfCoreStatistics& getStatistics() const;
+
+private:
+    /* One block of sources (masses and positions) read from the file, two of
+    which are filled alternately by the reading thread */
+
+    struct SourceBlock {
+        std::vector<double> columns[4];
+        long long first = 0;
+        long long count = 0;
+        bool ready = false;
+    };
+
+    double* column(int index) const;
+    void readSourceBlock(SourceBlock& block, long long first, long long count);
+    void computeAccelerations(double epsilon);
+    void updateParticles(double dt);
+
+    std::string fileName;
+    int file = -1;
+    char* mapping = nullptr;
+    std::size_t mappingBytes = 0;
+    long long numberOfParticles = 0;
+    long long blockSize;
+    int iterations = 0;
+    OutOfCoreStatistics statistics {};
+
+    SourceBlock sourceBlocks[2] {};
+    std::mutex sourceMutex;
+    std::condition_variable sourceReady;
+};
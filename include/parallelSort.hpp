@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+void parallelRadixSort(std::vector<std::uint64_t>& keys,
+    std::vector<int>& values);
@@ -0,0 +1,35 @@
+#pragma once
+#include "particle.hpp"
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Settings of the Parareal integration: the interval is split into "slices"
+slices (0 for one per OpenMP thread); the coarse propagator takes steps
+coarseFactor times longer than the fine ones; the iterations stop when the
+residual is below "tolerance" or after maximumIterations iterations (0 for the
+number of slices, after which the solution is the fine one exactly); the
+planar kernels are used for planar systems only if planarKernels is set */
+
+struct PararealSettings {
+    int slices = 0;
+    int coarseFactor = 50;
+    int maximumIterations = 0;
+    double tolerance = 1e-10;
+    bool planarKernels = true;
+};
+
+/* Outcome of the integration: the final state, the number of slices and of
+iterations done, and the residual of every iteration (the largest change of a
+position or velocity at the slice boundaries, relative to the largest one) */
+
+struct PararealResult {
+    std::vector<Particle> finalState {};
+    int slices = 0;
+    int iterations = 0;
+    std::vector<double> residuals {};
+    bool converged = false;
+};
+
+PararealResult integrateParareal(ConstParticleSpan initial, long long steps,
+    double dt, double epsilon, const PararealSettings& settings);
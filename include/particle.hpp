@@ -1,19 +1,24 @@
 #pragma once
+#include "numaAllocator.hpp"
 #include "omp.h"
 #include <Eigen/Core>
+#include <cstddef>
 #include <random>
 #include <stdexcept>
+#include <vector>
 
 /* See .cpp file for explanation and comments */
 
+class ConstParticleSpan;
+
 class Particle {
 public:
     Particle(double massArgument);
 
     double getMass() const;
-    Eigen::Vector3d getPosition();
-    Eigen::Vector3d getVelocity();
-    Eigen::Vector3d getAcceleration();
+    const Eigen::Vector3d& getPosition() const;
+    const Eigen::Vector3d& getVelocity() const;
+    const Eigen::Vector3d& getAcceleration() const;
 
     void setRandomPosition(double minRandomValue, double maxRandomValue);
     void setRandomVelocity(double minRandomValue, double maxRandomValue);
@@ -24,11 +29,13 @@ public:
     void setAcceleration(Eigen::Vector3d acceleration);
 
     void update(double dt);
+    template <int Dimensions>
+    void updateComponents(double dt);
 
-    void calcTotalAcceleration(std::vector<Particle> particlesInTheSystem,
+    void calcTotalAcceleration(ConstParticleSpan particlesInTheSystem,
         double epsilon);
-    double calculateKineticEnergy();
-    double calculatePotentialEnergy(std::vector<Particle> particlesInTheSystem);
+    double calculateKineticEnergy() const;
+    double calculatePotentialEnergy(ConstParticleSpan particlesInTheSystem) const;
 
 private:
     /* Stored private informations for the Particle class are the mass, position,
@@ -38,8 +45,126 @@ private:
     Eigen::Vector3d positionParticle = Eigen::Vector3d(0, 0, 0);
     Eigen::Vector3d velocityParticle = Eigen::Vector3d(0, 0, 0);
     Eigen::Vector3d accelerationParticle = Eigen::Vector3d(0, 0, 0);
+
+    friend class ConstParticleSpan;
+};
+
+/* Read-only view of contiguous particles (e.g. a std::vector<Particle>). It
+does not own nor copy them, so it is cheap to pass by value, and it is valid as
+long as the viewed vector is not resized. The positions, velocities and
+accelerations of all the viewed particles can also be read as the columns of a
+3xN matrix mapped in place on the particles. */
+
+typedef Eigen::Map<const Eigen::Matrix3Xd, 0, Eigen::OuterStride<>>
+    ConstParticleColumns;
+
+class ConstParticleSpan {
+public:
+    ConstParticleSpan(const Particle* dataArgument, std::size_t sizeArgument);
+    template <typename Allocator>
+    ConstParticleSpan(const std::vector<Particle, Allocator>& particles)
+        : ConstParticleSpan(particles.data(), particles.size())
+    {
+    }
+
+    std::size_t size() const;
+    bool empty() const;
+    const Particle* data() const;
+    const Particle* begin() const;
+    const Particle* end() const;
+    const Particle& operator[](std::size_t i) const;
+    const Particle& at(std::size_t i) const;
+
+    ConstParticleColumns positions() const;
+    ConstParticleColumns velocities() const;
+    ConstParticleColumns accelerations() const;
+
+private:
+    ConstParticleColumns columns(std::size_t offset) const;
+
+    const Particle* particlesData;
+    std::size_t particlesSize;
+};
+
+/* View of contiguous particles that can be modified, used by the kernels that
+write the accelerations. It converts to a ConstParticleSpan. */
+
+class ParticleSpan {
+public:
+    ParticleSpan(Particle* dataArgument, std::size_t sizeArgument);
+    template <typename Allocator>
+    ParticleSpan(std::vector<Particle, Allocator>& particles)
+        : ParticleSpan(particles.data(), particles.size())
+    {
+    }
+    operator ConstParticleSpan() const;
+
+    std::size_t size() const;
+    bool empty() const;
+    Particle* data() const;
+    Particle* begin() const;
+    Particle* end() const;
+    Particle& operator[](std::size_t i) const;
+    Particle& at(std::size_t i) const;
+
+private:
+    Particle* particlesData;
+    std::size_t particlesSize;
 };
 
+/* Storage of the particles of a system, allocated and first touched in
+parallel (see numaAllocator.hpp) */
+
+typedef std::vector<Particle, FirstTouchAllocator<Particle>> ParticleVector;
+
+/* A system whose positions and velocities all have a z component of exactly
+zero stays in the plane z = 0, as the forces between its particles have no z
+component either. Its kernels only need the x and y components. */
+
+bool isPlanar(ConstParticleSpan particles);
+
+/* Kernels of the direct summation for the particle at index "self" of a
+view, which is excluded by index. The acceleration kernel has a variant for
+epsilon == 0 and one for epsilon > 0, and a planar variant of each that leaves
+the z component at zero, chosen once by selectAccelerationKernel before the
+loop over the particles. */
+
+typedef Eigen::Vector3d (*AccelerationKernel)(ConstParticleSpan particles,
+    std::size_t self, double epsilon);
+
+AccelerationKernel selectAccelerationKernel(double epsilon, bool planar = false);
+
+/* The same kernel restricted to the particles from index "first" to "last"
+ * (excluded), for the loops that go through the particles in tiles */
+
+typedef Eigen::Vector3d (*PartialAccelerationKernel)(
+    ConstParticleSpan particles, std::size_t self, std::size_t first,
+    std::size_t last, double epsilon);
+
+PartialAccelerationKernel selectPartialAccelerationKernel(double epsilon,
+    bool planar = false);
+
+/* Planar kernel over columns of x, y and mass of n particles instead of over
+ * the particles themselves, so the inner loop reads 24 bytes per source */
+
+typedef Eigen::Vector3d (*PlanarColumnKernel)(const double* x, const double* y,
+    const double* mass, std::size_t n, std::size_t self, double epsilon);
+
+PlanarColumnKernel selectPlanarColumnKernel(double epsilon);
+
+/* Update of the position and velocity of a particle, in three dimensions or
+ * only in the plane */
+
+typedef void (Particle::*UpdateFunction)(double dt);
+
+UpdateFunction selectUpdateFunction(bool planar);
+
+/* Potential energy of the particle at index "self", with the softened
+ * potential of the force for epsilon > 0 */
+
+double calculatePotentialEnergyOfParticle(ConstParticleSpan particles,
+    std::size_t self, double epsilon = 0.);
+
 /* Random generator used for initialisation purposes. If one wants to use a
 manual seed, seedIsRandom must be set to "false". If it is set to "true" the
 seed will be random. This function is stored here because Particle items call
@@ -0,0 +1,74 @@
+#pragma once
+#include "forceBackend.hpp"
+#include <Eigen/Core>
+#include <complex>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Force backend for a cubic box of side boxSize repeated periodically in the
+three directions. The interaction is split by Ewald's method: the short-range
+part, erfc(splitParameter r) / r, is summed directly over the nearest image of
+every other particle closer than realSpaceCutoff, and the long-range part is
+summed in Fourier space over the wave vectors 2 pi n / boxSize with
+|n| <= maximumWaveNumber. A larger splitParameter moves work from the real
+space to the Fourier space sum. */
+
+class PeriodicEwaldBackend : public ForceBackend {
+public:
+    PeriodicEwaldBackend(double boxSizeArgument,
+        double splitParameterArgument = 0., int maximumWaveNumberArgument = 8,
+        double realSpaceCutoffArgument = 0.);
+
+    std::string getName() const override;
+    void computeAccelerations(ParticleSpan particles,
+        double epsilon) override;
+    FieldValues evaluateField(ConstParticleSpan sources,
+        const std::vector<Eigen::Vector3d>& probes, double epsilon) override;
+
+    double getBoxSize() const;
+    double getSplitParameter() const;
+    int getMaximumWaveNumber() const;
+    double getRealSpaceCutoff() const;
+    int getNumberOfWaveVectors() const;
+
+private:
+    double boxSize;
+    double splitParameter;
+    int maximumWaveNumber;
+    double realSpaceCutoff;
+
+    /* Table of the wave vectors of one half of Fourier space (the other half
+    gives the same contribution) with their integer components and the
+    coefficient of the Fourier space sum, computed once in the constructor */
+
+    struct WaveVector {
+        int n[3];
+        Eigen::Vector3d k;
+        double coefficient;
+    };
+    std::vector<WaveVector> waveVectors {};
+
+    /* Share of the force left to the real space sum,
+    erfc(alpha r) + 2 alpha r / sqrt(pi) exp(-alpha^2 r^2), tabulated at equally
+    spaced distances from 0 to realSpaceCutoff and interpolated linearly */
+
+    std::vector<double> shortRangeTable {};
+    double tableSpacing = 0.;
+
+    /* Share of the potential left to the real space sum, erfc(alpha r), at the
+    same distances */
+
+    std::vector<double> shortRangePotentialTable {};
+
+    /* Positions brought back into the box, exp(i 2 pi m x / boxSize) for
+    m = 0 ... maximumWaveNumber along each axis of each particle, the structure
+    factor of each wave vector and the
+    share of it summed by each thread, reused from step to step */
+
+    std::vector<Eigen::Vector3d> wrappedPositions {};
+    std::vector<std::complex<double>> phaseTable {};
+    std::vector<std::complex<double>> structureFactors {};
+    std::vector<std::complex<double>> partialStructureFactors {};
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "manyBodySystem.hpp"
+#include "particle.hpp"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Commands of the binary protocol spoken on the socket. Every request is a
+ServerRequestHeader followed by nameBytes bytes of the name of the simulation
+and payloadBytes bytes of payload; every response is a ServerResponseHeader
+followed by payloadBytes bytes of payload. Particles travel as 10 doubles each
+(mass, position, velocity, acceleration), the layout of the checkpoints. Only
+a load has a payload, of exactly "count" particles; the server closes the
+connection of a request whose header asks for anything else. The peers are on
+the same machine, so the fields are in its byte order. */
+
+enum class ServerCommand : std::uint32_t {
+    generateNBody = 1,
+    generateSolarSystem = 2,
+    load = 3,
+    advance = 4,
+    energy = 5,
+    snapshot = 6,
+    remove = 7,
+    shutdown = 8
+};
+
+struct ServerRequestHeader {
+    std::uint32_t command = 0;
+    std::uint32_t nameBytes = 0;
+    std::int64_t count = 0;
+    double dt = 0.;
+    double epsilon = 0.;
+    std::uint64_t payloadBytes = 0;
+};
+
+/* status is 0 on success; otherwise the payload is the error message */
+
+struct ServerResponseHeader {
+    std::int32_t status = 0;
+    std::uint32_t reserved = 0;
+    std::int64_t iterations = 0;
+    std::int64_t numberOfParticles = 0;
+    double time = 0.;
+    double energy = 0.;
+    std::uint64_t payloadBytes = 0;
+};
+
+/* Long-running service that keeps named simulations in memory and advances
+them on request, so that many short requests share one process and one OpenMP
+team */
+
+class SimulationServer {
+public:
+    SimulationServer(std::string socketPathArgument);
+    ~SimulationServer();
+
+    void run();
+    int getNumberOfSimulations() const;
+    long long getNumberOfRequests() const;
+
+private:
+    /* Request being received from one client. The client is read without
+    blocking whenever poll says it has bytes, so a client that stops in the
+    middle of a request keeps only its own request waiting. */
+
+    struct ClientConnection {
+        ServerRequestHeader request {};
+        std::size_t headerBytesReceived = 0;
+        std::string name {};
+        std::size_t nameBytesReceived = 0;
+        std::vector<double> payload {};
+        std::size_t payloadBytesReceived = 0;
+    };
+
+    bool receiveFromClient(int client, ClientConnection& connection);
+    bool checkRequestHeader(const ServerRequestHeader& request) const;
+    bool serveRequest(int client, ClientConnection& connection);
+    ServerResponseHeader execute(const ServerRequestHeader& request,
+        const std::string& name, const std::vector<double>& payload);
+    InitialConditionGenerator& findSimulation(const std::string& name);
+
+    std::string socketPath;
+    int listeningSocket = -1;
+    bool stopping = false;
+    long long requests = 0;
+    std::map<std::string, std::unique_ptr<InitialConditionGenerator>> simulations {};
+    std::map<int, ClientConnection> connections {};
+};
+
+/* Client of a SimulationServer. A response with an error status is thrown as a
+ * std::runtime_error carrying the message of the server. */
+
+class SimulationClient {
+public:
+    SimulationClient(const std::string& socketPath);
+    ~SimulationClient();
+
+    ServerResponseHeader generateNBody(const std::string& name,
+        int numberOfParticles);
+    ServerResponseHeader generateSolarSystem(const std::string& name);
+    ServerResponseHeader load(const std::string& name,
+        ConstParticleSpan particles);
+    ServerResponseHeader advance(const std::string& name, int steps, double dt,
+        double epsilon);
+    ServerResponseHeader energy(const std::string& name);
+    std::vector<Particle> snapshot(const std::string& name);
+    ServerResponseHeader remove(const std::string& name);
+    void shutdown();
+
+private:
+    ServerResponseHeader call(ServerCommand command, const std::string& name,
+        std::int64_t count, double dt, double epsilon, const void* payload,
+        std::size_t payloadBytes, std::vector<double>* responsePayload);
+
+    int connection = -1;
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include "particle.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Curves used to order the particles in memory: both visit the cells of a
+regular grid so that nearby cells tend to be close along the curve. The
+Hilbert curve never jumps between cells that are not adjacent, the Morton
+(Z-order) curve is cheaper to compute. */
+
+enum class SpaceFillingCurve {
+    morton,
+    hilbert
+};
+
+SpaceFillingCurve spaceFillingCurveFromName(const std::string& name);
+std::string spaceFillingCurveName(SpaceFillingCurve curve);
+
+/* Number of bits of each grid coordinate: the three coordinates fill 63 bits
+ * of the key */
+
+constexpr int curveBitsPerDimension = 21;
+
+std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+std::uint64_t hilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+std::vector<int> spaceFillingCurveOrder(ConstParticleSpan particles,
+    SpaceFillingCurve curve);
@@ -0,0 +1,46 @@
+#pragma once
+#include "forceBackend.hpp"
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Force backend for systems of a few massive bodies among many light ones
+(e.g. a star and planets in a debris disc). The particles lighter than
+massThreshold are test particles: they feel the massive bodies but not each
+other, while the massive bodies feel every particle. A step costs about twice
+N times the number of massive bodies M instead of N^2. The pairs left out are
+the test-test ones, on both sides, so the total momentum is still conserved. */
+
+class MassiveTestParticleBackend : public ForceBackend {
+public:
+    MassiveTestParticleBackend(double massThresholdArgument);
+
+    std::string getName() const override;
+    void computeAccelerations(ParticleSpan particles,
+        double epsilon) override;
+    FieldValues evaluateField(ConstParticleSpan sources,
+        const std::vector<Eigen::Vector3d>& probes, double epsilon) override;
+
+    double getMassThreshold() const;
+    int getNumberOfMassiveParticles() const;
+
+private:
+    void gatherColumns(ConstParticleSpan particles);
+
+    double massThreshold;
+
+    /* Columns of the positions of all the particles, with the mass of the test
+    particles (zero for the massive ones), and of the positions and masses of
+    the massive bodies, whose indices are in massiveParticles */
+
+    std::vector<double> positionX {};
+    std::vector<double> positionY {};
+    std::vector<double> positionZ {};
+    std::vector<double> testMass {};
+    std::vector<int> massiveParticles {};
+    std::vector<double> massiveX {};
+    std::vector<double> massiveY {};
+    std::vector<double> massiveZ {};
+    std::vector<double> massiveMass {};
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Where an OpenMP thread was running when the placement was sampled */
+
+struct ThreadPlacement {
+    int thread;
+    int cpu;
+    int numaNode;
+    bool pinned;
+};
+
+bool pinThreads();
+std::vector<ThreadPlacement> getThreadPlacement();
+std::string describeThreadBinding();
@@ -0,0 +1,66 @@
+#pragma once
+#include "particle.hpp"
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+/* See .cpp file for explanation and comments */
+
+/* Keplerian elements of an orbit around the central body, angles in radians.
+For an unbound orbit the semi-major axis is negative. */
+
+struct OrbitalElements {
+    double semiMajorAxis = 0.;
+    double eccentricity = 0.;
+    double inclination = 0.;
+    double longitudeOfAscendingNode = 0.;
+    double argumentOfPericentre = 0.;
+    double trueAnomaly = 0.;
+};
+
+OrbitalElements keplerianElements(const Eigen::Vector3d& position,
+    const Eigen::Vector3d& velocity, double gravitationalParameter);
+
+/* Settings of analyzeTrajectory: the histograms of the distance and speed
+relative to the central body have "bins" bins up to maximumRadius and
+maximumSpeed (larger values go to the last bin); the pairwise potential energy
+is only summed for frames of at most pairwiseEnergyLimit particles; the
+elements of every body of every frame are written to elementsFile if it is not
+empty */
+
+struct AnalysisSettings {
+    int bins = 64;
+    double maximumRadius = 40.;
+    double maximumSpeed = 2.;
+    long long pairwiseEnergyLimit = 20000;
+    std::string elementsFile = "";
+};
+
+/* Summary of one frame: the conserved quantities (the potential energy is NaN
+if the frame was too large for the pairwise sum; centralPotentialEnergy is the
+part due to the central body alone), the number of bodies bound to the central
+body with their mean eccentricity and semi-major axis, and the histograms */
+
+struct FrameSummary {
+    long long step = 0;
+    double time = 0.;
+    long long numberOfParticles = 0;
+    double kineticEnergy = 0.;
+    double potentialEnergy = 0.;
+    double centralPotentialEnergy = 0.;
+    Eigen::Vector3d momentum = Eigen::Vector3d(0., 0., 0.);
+    Eigen::Vector3d angularMomentum = Eigen::Vector3d(0., 0., 0.);
+    Eigen::Vector3d centreOfMass = Eigen::Vector3d(0., 0., 0.);
+    long long boundBodies = 0;
+    double meanEccentricity = 0.;
+    double meanSemiMajorAxis = 0.;
+    std::vector<long long> radialHistogram {};
+    std::vector<long long> speedHistogram {};
+};
+
+std::vector<FrameSummary> analyzeTrajectory(
+    const std::vector<std::string>& files, const AnalysisSettings& settings);
+void writeSeriesCsv(const std::string& fileName,
+    const std::vector<FrameSummary>& frames);
+void writeHistogramsCsv(const std::string& fileName,
+    const std::vector<FrameSummary>& frames, const AnalysisSettings& settings);
@@ -0,0 +1,252 @@
+#include "autotuner.hpp"
+
+#include "execution.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+
+/* Grid searched by the autotuner. The chunk size 0 is the default chunk of
+ * the kind. The tile sizes only apply to the direct summation, and the thread
+ * counts are the largest team and its halves down to one thread. */
+
+static const std::pair<omp_sched_t, int> scheduleCandidates[] = {
+    { omp_sched_static, 0 },
+    { omp_sched_static, 16 },
+    { omp_sched_dynamic, 1 },
+    { omp_sched_dynamic, 16 },
+    { omp_sched_dynamic, 64 },
+    { omp_sched_guided, 0 },
+    { omp_sched_guided, 16 }
+};
+
+static const int tileCandidates[] = { 0, 64, 256 };
+
+std::string scheduleKindName(omp_sched_t kind)
+{
+    switch (kind) {
+    case omp_sched_static:
+        return "static";
+    case omp_sched_dynamic:
+        return "dynamic";
+    case omp_sched_guided:
+        return "guided";
+    default:
+        return "auto";
+    }
+}
+
+omp_sched_t scheduleKindFromName(const std::string& name)
+{
+    if (name == "static") {
+        return omp_sched_static;
+    }
+    if (name == "dynamic") {
+        return omp_sched_dynamic;
+    }
+    if (name == "guided") {
+        return omp_sched_guided;
+    }
+    if (name == "auto") {
+        return omp_sched_auto;
+    }
+    throw std::invalid_argument("\nUnknown schedule kind " + name
+        + ": use static, dynamic, guided or auto.\n");
+}
+
+Autotuner::Autotuner(std::string cacheFileArgument, int trialStepsArgument)
+{
+    if (trialStepsArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe autotuner needs a positive number of trial steps.\n");
+    }
+    cacheFile = cacheFileArgument;
+    trialSteps = trialStepsArgument;
+}
+
+/* Model of the CPU as reported by /proc/cpuinfo, "unknown" where there is no
+ * such file */
+
+std::string Autotuner::cpuModel()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            std::size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::size_t first = line.find_first_not_of(" \t", colon + 1);
+                if (first != std::string::npos) {
+                    return line.substr(first);
+                }
+            }
+        }
+    }
+    return "unknown";
+}
+
+/* Largest power of two not above the number of particles: the best
+ * configuration changes slowly with N, so one entry serves a whole octave */
+
+int Autotuner::sizeBucket(int numberOfParticles)
+{
+    int bucket = 1;
+    while (bucket <= numberOfParticles / 2) {
+        bucket = bucket * 2;
+    }
+    return bucket;
+}
+
+/* Key of the cache: CPU model, size bucket and force backend ("direct" for the
+ * built-in summation), separated by '|' */
+
+std::string Autotuner::cacheKey(InitialConditionGenerator& system) const
+{
+    std::shared_ptr<ForceBackend> backend = system.getForceBackend();
+    std::string backendName = backend ? backend->getName() : "direct";
+    return cpuModel() + "|" + std::to_string(sizeBucket(system.getNumberOfParticles()))
+        + "|" + backendName;
+}
+
+bool Autotuner::lastWasCached() const
+{
+    return cached;
+}
+
+int Autotuner::getNumberOfTrials() const
+{
+    return trials;
+}
+
+/* Returns the configuration stored in the cache for the system, if there is
+one with no more threads than are available now; otherwise times every
+configuration of the grid, stores the fastest in the cache and returns it.
+The system itself is not advanced: the trials run on copies of it. The grid is
+made of OpenMP schedules and team sizes, so it means nothing on the pool. */
+
+TuningConfiguration Autotuner::tune(InitialConditionGenerator& system,
+    double dt, double epsilon)
+{
+    if (usingWorkStealingPool()) {
+        throw std::logic_error("\nThe autotuner chooses OpenMP schedules and teams: "
+                               "it cannot be used with the work-stealing pool.\n");
+    }
+    std::string key = cacheKey(system);
+    int maximumThreads = omp_get_max_threads();
+    TuningConfiguration best;
+    trials = 0;
+    cached = readCache(key, best) && best.threads <= maximumThreads;
+    if (cached) {
+        return best;
+    }
+    std::shared_ptr<ForceBackend> backend = system.getForceBackend();
+    bool tiled = !backend || std::dynamic_pointer_cast<DirectSummationBackend>(backend);
+    std::vector<int> threadCandidates;
+    for (int threads = maximumThreads; threads >= 1; threads = threads / 2) {
+        threadCandidates.push_back(threads);
+    }
+    best.secondsPerStep = -1.;
+    for (int threads : threadCandidates) {
+        for (const auto& schedule : scheduleCandidates) {
+            for (int tile : tileCandidates) {
+                if (tile > 0 && (!tiled || tile >= system.getNumberOfParticles())) {
+                    continue;
+                }
+                TuningConfiguration candidate;
+                candidate.scheduleKind = schedule.first;
+                candidate.chunkSize = schedule.second;
+                candidate.tileSize = tile;
+                candidate.threads = threads;
+                candidate.secondsPerStep = timeConfiguration(system, candidate, dt,
+                    epsilon);
+                trials++;
+                if (best.secondsPerStep < 0 || candidate.secondsPerStep < best.secondsPerStep) {
+                    best = candidate;
+                }
+            }
+        }
+    }
+    omp_set_num_threads(maximumThreads);
+    if (backend) {
+        backend->particlesRearranged();
+    }
+    writeCache(key, best);
+    return best;
+}
+
+/* Seconds per step of a copy of the system with the configuration, after one
+ * step of warm-up. A tiled configuration runs on a DirectSummationBackend of
+ * its own; the others share the backend of the system. */
+
+double Autotuner::timeConfiguration(InitialConditionGenerator& system,
+    const TuningConfiguration& configuration, double dt, double epsilon)
+{
+    nBodySystemGenerator trial;
+    std::vector<Particle> particles = system.getSystemInformations();
+    trial.copySystem(&particles);
+    if (configuration.tileSize > 0) {
+        trial.setForceBackend(std::make_shared<DirectSummationBackend>(configuration.tileSize));
+    } else {
+        trial.setForceBackend(system.getForceBackend());
+    }
+    trial.setLoopSchedule(configuration.scheduleKind, configuration.chunkSize);
+    omp_set_num_threads(configuration.threads);
+    trial.evolutionOfSystem("steps", 1, dt, epsilon);
+    double start = omp_get_wtime();
+    trial.evolutionOfSystem("steps", trialSteps, dt, epsilon);
+    return (omp_get_wtime() - start) / trialSteps;
+}
+
+/* Makes the system run with the configuration: the schedule of its loops, the
+ * size of the OpenMP team for the following parallel regions and, for a tiled
+ * configuration, a tiled DirectSummationBackend */
+
+void Autotuner::apply(const TuningConfiguration& configuration,
+    InitialConditionGenerator& system) const
+{
+    system.setLoopSchedule(configuration.scheduleKind, configuration.chunkSize);
+    omp_set_num_threads(configuration.threads);
+    if (configuration.tileSize > 0) {
+        system.setForceBackend(std::make_shared<DirectSummationBackend>(configuration.tileSize));
+    }
+}
+
+/* The cache is a text file with one configuration per line:
+key<TAB>schedule<TAB>chunk<TAB>tile<TAB>threads<TAB>seconds per step
+New entries are appended, and the last line of a key is the one that counts,
+so tuning again on the same key replaces the previous choice */
+
+bool Autotuner::readCache(const std::string& key,
+    TuningConfiguration& configuration) const
+{
+    std::ifstream file(cacheFile);
+    std::string line;
+    bool found = false;
+    while (std::getline(file, line)) {
+        std::size_t tab = line.find('\t');
+        if (tab == std::string::npos || line.substr(0, tab) != key) {
+            continue;
+        }
+        std::istringstream fields(line.substr(tab + 1));
+        std::string schedule;
+        TuningConfiguration entry;
+        if (fields >> schedule >> entry.chunkSize >> entry.tileSize >> entry.threads >> entry.secondsPerStep) {
+            entry.scheduleKind = scheduleKindFromName(schedule);
+            configuration = entry;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void Autotuner::writeCache(const std::string& key,
+    const TuningConfiguration& configuration) const
+{
+    std::ofstream file(cacheFile, std::ios::app);
+    if (!file) {
+        throw std::runtime_error("\nCannot write the tuning cache " + cacheFile + ".\n");
+    }
+    file << key << "\t" << scheduleKindName(configuration.scheduleKind) << "\t"
+         << configuration.chunkSize << "\t" << configuration.tileSize << "\t"
+         << configuration.threads << "\t" << configuration.secondsPerStep << "\n";
+}
@@ -0,0 +1,286 @@
+#include "benchmark.hpp"
+
+#include "cellList.hpp"
+#include "manyBodySystem.hpp"
+#include "periodicEwald.hpp"
+#include "testParticles.hpp"
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+/* Standard initial conditions of the benchmarks, with G = 1:
+
+"plummer": Plummer sphere of total mass 1 and scale radius 1 in equilibrium,
+drawn with the method of Aarseth, Henon and Wielen (1974); the radii are
+limited to 10 scale radii.
+
+"disc": the system of nBodySystemGenerator, a central star of mass 1 with
+bodies on circular orbits of radius between 0.4 and 30, but with the values of
+the bodies drawn from one generator so that they are all different.
+
+Both are moved to the frame of their centre of mass. */
+
+std::vector<Particle> makeStandardInitialConditions(const std::string& name,
+    int numberOfParticles, unsigned int seed)
+{
+    if (numberOfParticles <= 0) {
+        throw std::invalid_argument("\nThe number of particles should be higher than 0\n");
+    }
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::vector<Particle> particles;
+    if (name == "plummer") {
+        for (int i = 0; i < numberOfParticles; i++) {
+            double r = 0.;
+            do {
+                r = 1. / std::sqrt(std::pow(uniform(generator), -2. / 3.) - 1.);
+            } while (r > 10.);
+            auto isotropic = [&](double length) {
+                double z = 2. * uniform(generator) - 1.;
+                double phi = 2. * M_PI * uniform(generator);
+                double s = std::sqrt(1. - z * z);
+                return Eigen::Vector3d(length * s * std::cos(phi), length * s * std::sin(phi), length * z);
+            };
+            double q = 0.;
+            double g = 0.;
+            do {
+                q = uniform(generator);
+                g = 0.1 * uniform(generator);
+            } while (g > q * q * std::pow(1. - q * q, 3.5));
+            Particle particle(1. / numberOfParticles);
+            particle.setPosition(isotropic(r));
+            particle.setVelocity(isotropic(q * std::sqrt(2.) * std::pow(1. + r * r, -0.25)));
+            particles.push_back(particle);
+        }
+    } else if (name == "disc") {
+        particles.push_back(Particle(1.));
+        particles.back().setPosition(Eigen::Vector3d(0., 0., 0.));
+        particles.back().setVelocity(Eigen::Vector3d(0., 0., 0.));
+        for (int i = 1; i < numberOfParticles; i++) {
+            double mass = 1. / 6000000 + uniform(generator) * (1. / 1000 - 1. / 6000000);
+            double r = 0.4 + uniform(generator) * (30. - 0.4);
+            double theta = 2. * M_PI * uniform(generator);
+            Particle particle(mass);
+            particle.setPosition(Eigen::Vector3d(r * std::sin(theta), r * std::cos(theta), 0.));
+            particle.setVelocity(Eigen::Vector3d(-std::cos(theta) / std::sqrt(r), std::sin(theta) / std::sqrt(r), 0.));
+            particles.push_back(particle);
+        }
+    } else {
+        throw std::invalid_argument("\nUnknown initial conditions " + name + ": use plummer or disc.\n");
+    }
+    double totalMass = 0.;
+    Eigen::Vector3d position(0., 0., 0.), velocity(0., 0., 0.);
+    for (const Particle& particle : particles) {
+        totalMass = totalMass + particle.getMass();
+        position = position + particle.getMass() * particle.getPosition();
+        velocity = velocity + particle.getMass() * particle.getVelocity();
+    }
+    for (Particle& particle : particles) {
+        particle.setPosition(particle.getPosition() - position / totalMass);
+        particle.setVelocity(particle.getVelocity() - velocity / totalMass);
+    }
+    return particles;
+}
+
+/* Backend of a benchmark configuration: "direct" is the built-in summation
+ * (a null pointer), "tiled" the DirectSummationBackend with tiles of 64
+ * particles, "cells" and "verlet" the CellListBackend with the given cutoff,
+ * "ewald" the PeriodicEwaldBackend in a box four times as large as the
+ * system, which approximates the isolated system with its periodic images, and
+ * "split" the MassiveTestParticleBackend with the particles lighter than a
+ * hundredth of the heaviest one as test particles */
+
+std::shared_ptr<ForceBackend> makeBenchmarkBackend(const std::string& name,
+    double cutoff, ConstParticleSpan particles)
+{
+    if (name == "direct") {
+        return nullptr;
+    }
+    if (name == "tiled") {
+        return std::make_shared<DirectSummationBackend>(64);
+    }
+    if (name == "cells" || name == "verlet") {
+        return std::make_shared<CellListBackend>(cutoff, 0.1 * cutoff, name == "verlet");
+    }
+    if (name == "ewald") {
+        double extent = 0.;
+        for (const Particle& particle : particles) {
+            extent = std::max(extent, particle.getPosition().cwiseAbs().maxCoeff());
+        }
+        return std::make_shared<PeriodicEwaldBackend>(8. * std::max(extent, 1.));
+    }
+    if (name == "split") {
+        double heaviest = 0.;
+        for (const Particle& particle : particles) {
+            heaviest = std::max(heaviest, particle.getMass());
+        }
+        return std::make_shared<MassiveTestParticleBackend>(0.01 * heaviest);
+    }
+    throw std::invalid_argument("\nUnknown force backend " + name
+        + ": use direct, tiled, cells, verlet, ewald or split.\n");
+}
+
+static Eigen::Vector3d totalAngularMomentum(ConstParticleSpan particles)
+{
+    Eigen::Vector3d angularMomentum(0., 0., 0.);
+    for (const Particle& particle : particles) {
+        angularMomentum = angularMomentum + particle.getMass() * particle.getPosition().cross(particle.getVelocity());
+    }
+    return angularMomentum;
+}
+
+/* Runs one configuration: the force error from one evaluation on the initial
+ * conditions, then the cost and the drifts of "steps" steps */
+
+static BenchmarkResult runConfiguration(const std::vector<Particle>& initial,
+    const std::vector<Particle>& reference, const std::string& backendName,
+    double cutoff, const std::string& integrator,
+    const BenchmarkSettings& settings)
+{
+    if (integrator != "euler") {
+        throw std::invalid_argument("\nUnknown integrator " + integrator
+            + ": the only one available is euler.\n");
+    }
+    BenchmarkResult result;
+    result.numberOfParticles = initial.size();
+    result.backend = backendName;
+    result.cutoff = cutoff;
+    result.integrator = integrator;
+    result.steps = settings.steps;
+    std::shared_ptr<ForceBackend> backend = makeBenchmarkBackend(backendName, cutoff, initial);
+    std::vector<Particle> evaluated = initial;
+    if (backend) {
+        backend->computeAccelerations(evaluated, settings.epsilon);
+    } else {
+        DirectSummationBackend().computeAccelerations(evaluated, settings.epsilon);
+    }
+    double sumOfSquares = 0.;
+    for (int i = 0; i < evaluated.size(); i++) {
+        double norm = reference.at(i).getAcceleration().norm();
+        double error = (evaluated.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm() / (norm > 0 ? norm : 1.);
+        sumOfSquares = sumOfSquares + error * error;
+        result.maximumForceError = std::max(result.maximumForceError, error);
+    }
+    result.rmsForceError = std::sqrt(sumOfSquares / evaluated.size());
+
+    nBodySystemGenerator system;
+    std::vector<Particle> particles = initial;
+    system.copySystem(&particles);
+    if (backend) {
+        backend->particlesRearranged();
+        system.setForceBackend(backend);
+    }
+    double energyBefore = calculateTotalEnergy(system.getSystemView(), settings.epsilon);
+    Eigen::Vector3d angularMomentumBefore = totalAngularMomentum(system.getSystemView());
+    double start = omp_get_wtime();
+    system.evolutionOfSystem("steps", settings.steps, settings.dt, settings.epsilon);
+    result.timeToSolution = omp_get_wtime() - start;
+    result.secondsPerStep = result.timeToSolution / settings.steps;
+    double energyAfter = calculateTotalEnergy(system.getSystemView(), settings.epsilon);
+    Eigen::Vector3d angularMomentumAfter = totalAngularMomentum(system.getSystemView());
+    result.energyDrift = std::abs((energyAfter - energyBefore) / energyBefore);
+    double angularMomentumNorm = angularMomentumBefore.norm();
+    result.angularMomentumDrift = (angularMomentumAfter - angularMomentumBefore).norm() / (angularMomentumNorm > 0 ? angularMomentumNorm : 1.);
+    return result;
+}
+
+/* Runs every configuration of the grid and marks the Pareto front. The
+ * reference accelerations are computed once per initial condition and size. */
+
+std::vector<BenchmarkResult> runBenchmark(const BenchmarkSettings& settings)
+{
+    if (settings.steps <= 0 || settings.dt <= 0) {
+        throw std::invalid_argument("\nThe benchmark needs a positive number of steps and a positive dt.\n");
+    }
+    std::vector<BenchmarkResult> results;
+    for (const std::string& initialConditions : settings.initialConditions) {
+        for (int size : settings.sizes) {
+            std::vector<Particle> initial = makeStandardInitialConditions(initialConditions, size);
+            std::vector<Particle> reference = initial;
+            DirectSummationBackend().computeAccelerations(reference, settings.epsilon);
+            for (const std::string& backend : settings.backends) {
+                bool usesCutoff = backend == "cells" || backend == "verlet";
+                std::vector<double> cutoffs = usesCutoff ? settings.cutoffs : std::vector<double> { 0. };
+                for (double cutoff : cutoffs) {
+                    for (const std::string& integrator : settings.integrators) {
+                        results.push_back(runConfiguration(initial, reference, backend, cutoff,
+                            integrator, settings));
+                        results.back().initialConditions = initialConditions;
+                    }
+                }
+            }
+        }
+    }
+    markParetoFront(results);
+    return results;
+}
+
+void markParetoFront(std::vector<BenchmarkResult>& results)
+{
+    for (BenchmarkResult& candidate : results) {
+        candidate.paretoOptimal = true;
+        for (const BenchmarkResult& other : results) {
+            if (other.initialConditions != candidate.initialConditions || other.numberOfParticles != candidate.numberOfParticles) {
+                continue;
+            }
+            bool asGood = other.secondsPerStep <= candidate.secondsPerStep && other.rmsForceError <= candidate.rmsForceError && other.energyDrift <= candidate.energyDrift;
+            bool better = other.secondsPerStep < candidate.secondsPerStep || other.rmsForceError < candidate.rmsForceError || other.energyDrift < candidate.energyDrift;
+            if (asGood && better) {
+                candidate.paretoOptimal = false;
+                break;
+            }
+        }
+    }
+}
+
+void writeBenchmarkCsv(const std::string& fileName,
+    const std::vector<BenchmarkResult>& results)
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    output.precision(17);
+    output << "initial_conditions,particles,backend,cutoff,integrator,steps,"
+              "seconds_per_step,time_to_solution,rms_force_error,max_force_error,"
+              "energy_drift,angular_momentum_drift,pareto\n";
+    for (const BenchmarkResult& result : results) {
+        output << result.initialConditions << "," << result.numberOfParticles << ","
+               << result.backend << "," << result.cutoff << "," << result.integrator
+               << "," << result.steps << "," << result.secondsPerStep << ","
+               << result.timeToSolution << "," << result.rmsForceError << ","
+               << result.maximumForceError << "," << result.energyDrift << ","
+               << result.angularMomentumDrift << "," << (result.paretoOptimal ? 1 : 0)
+               << "\n";
+    }
+}
+
+void writeBenchmarkJson(const std::string& fileName,
+    const std::vector<BenchmarkResult>& results)
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    output.precision(17);
+    output << "[";
+    for (int r = 0; r < results.size(); r++) {
+        const BenchmarkResult& result = results.at(r);
+        output << (r == 0 ? "\n" : ",\n") << "  { \"initialConditions\": \""
+               << result.initialConditions << "\", \"particles\": "
+               << result.numberOfParticles << ", \"backend\": \"" << result.backend
+               << "\", \"cutoff\": " << result.cutoff << ", \"integrator\": \""
+               << result.integrator << "\", \"steps\": " << result.steps
+               << ", \"secondsPerStep\": " << result.secondsPerStep
+               << ", \"timeToSolution\": " << result.timeToSolution
+               << ", \"rmsForceError\": " << result.rmsForceError
+               << ", \"maximumForceError\": " << result.maximumForceError
+               << ", \"energyDrift\": " << result.energyDrift
+               << ", \"angularMomentumDrift\": " << result.angularMomentumDrift
+               << ", \"pareto\": " << (result.paretoOptimal ? "true" : "false") << " }";
+    }
+    output << "\n]\n";
+}
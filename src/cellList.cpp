@@ -0,0 +1,418 @@
+#include "cellList.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+CellListBackend::CellListBackend(double cutoffRadiusArgument,
+    double skinRadiusArgument, bool useVerletListsArgument)
+{
+    if (cutoffRadiusArgument <= 0) {
+        throw std::invalid_argument("\nThe cutoff radius must be a positive value.\n");
+    }
+    if (skinRadiusArgument < 0) {
+        throw std::invalid_argument("\nThe skin radius cannot be negative.\n");
+    }
+    cutoffRadius = cutoffRadiusArgument;
+    skinRadius = skinRadiusArgument;
+    useVerletLists = useVerletListsArgument;
+}
+
+std::string CellListBackend::getName() const
+{
+    return useVerletLists ? "verletList" : "cellList";
+}
+
+double CellListBackend::getCutoffRadius() const
+{
+    return cutoffRadius;
+}
+
+double CellListBackend::getSkinRadius() const
+{
+    return skinRadius;
+}
+
+/* Number of times the cells (and the Verlet lists, if used) have been built */
+
+int CellListBackend::getNumberOfRebuilds() const
+{
+    return rebuilds;
+}
+
+int CellListBackend::getNumberOfCells() const
+{
+    return cellStart.empty() ? 0 : cellStart.size() - 1;
+}
+
+/* Bins the particles into cells of side at least equal to the interaction
+range. The grid covers the bounding box of the particles; if that would need
+more than about two cells per particle (very sparse systems) the cells are made
+larger, which keeps the memory linear in N and the result unchanged.
+
+The particles are binned in parallel: the cell of each particle is computed,
+the cells are counted with atomic increments, and the particles are scattered
+to their cell. The order inside each cell is then sorted, so that the sums are
+always done in the same order whatever the number of threads. */
+
+void CellListBackend::buildCells(ConstParticleSpan particles)
+{
+    int n = particles.size();
+    double minimumX = std::numeric_limits<double>::max();
+    double minimumY = std::numeric_limits<double>::max();
+    double minimumZ = std::numeric_limits<double>::max();
+    double maximumX = std::numeric_limits<double>::lowest();
+    double maximumY = std::numeric_limits<double>::lowest();
+    double maximumZ = std::numeric_limits<double>::lowest();
+    if (usingWorkStealingPool()) {
+        typedef std::pair<Eigen::Vector3d, Eigen::Vector3d> Box;
+        Box box = threadPool().parallelReduce(
+            0, n, 0, Box(Eigen::Vector3d::Constant(minimumX), Eigen::Vector3d::Constant(maximumX)),
+            [&](long long first, long long last) {
+                Box pieceBox(Eigen::Vector3d::Constant(minimumX), Eigen::Vector3d::Constant(maximumX));
+                for (int i = first; i < last; i++) {
+                    pieceBox.first = pieceBox.first.cwiseMin(particles.at(i).getPosition());
+                    pieceBox.second = pieceBox.second.cwiseMax(particles.at(i).getPosition());
+                }
+                return pieceBox;
+            },
+            [](const Box& a, const Box& b) {
+                return Box(a.first.cwiseMin(b.first), a.second.cwiseMax(b.second));
+            });
+        minimumX = box.first(0);
+        minimumY = box.first(1);
+        minimumZ = box.first(2);
+        maximumX = box.second(0);
+        maximumY = box.second(1);
+        maximumZ = box.second(2);
+    } else {
+#pragma omp parallel for reduction(min                           \
+                                   : minimumX, minimumY, minimumZ) \
+    reduction(max                                                 \
+              : maximumX, maximumY, maximumZ)
+        for (int i = 0; i < n; i++) {
+            Eigen::Vector3d position = particles.at(i).getPosition();
+            minimumX = std::min(minimumX, position(0));
+            minimumY = std::min(minimumY, position(1));
+            minimumZ = std::min(minimumZ, position(2));
+            maximumX = std::max(maximumX, position(0));
+            maximumY = std::max(maximumY, position(1));
+            maximumZ = std::max(maximumZ, position(2));
+        }
+    }
+    gridOrigin = Eigen::Vector3d(minimumX, minimumY, minimumZ);
+    Eigen::Vector3d extent(maximumX - minimumX, maximumY - minimumY,
+        maximumZ - minimumZ);
+
+    /* Choosing the size of the cells. The counts are computed in double and
+     * clamped to maximumCells before they are cast, as a cutoff much smaller
+     * than the extent would give more cells than an int holds. */
+
+    cellSize = cutoffRadius + (useVerletLists ? skinRadius : 0.);
+    long long maximumCells = std::max(27LL, 2LL * n);
+    long long numberOfCells = 0;
+    while (true) {
+        double cells = 1.;
+        for (int d = 0; d < 3; d++) {
+            double perDimension = std::floor(extent(d) / cellSize) + 1.;
+            perDimension = std::min(std::max(perDimension, 1.), (double)maximumCells);
+            cellsPerDimension[d] = (int)perDimension;
+            cells = cells * perDimension;
+        }
+        if (cells <= maximumCells) {
+            numberOfCells = (long long)cells;
+            break;
+        }
+        cellSize = cellSize * 1.5;
+    }
+
+    /* Computing the cell of each particle and counting the particles per cell.
+     * The atomic directives are plain atomic instructions, so the bodies of the
+     * loops are the same on both execution backends. */
+
+    particleCell.resize(n);
+    cellStart.assign(numberOfCells + 1, 0);
+    auto binParticle = [&](int i) {
+        Eigen::Vector3d cellCoordinates = (particles.at(i).getPosition() - gridOrigin) / cellSize;
+        int cx = std::min((int)cellCoordinates(0), cellsPerDimension[0] - 1);
+        int cy = std::min((int)cellCoordinates(1), cellsPerDimension[1] - 1);
+        int cz = std::min((int)cellCoordinates(2), cellsPerDimension[2] - 1);
+        int cell = (cz * cellsPerDimension[1] + cy) * cellsPerDimension[0] + cx;
+        particleCell.at(i) = cell;
+#pragma omp atomic
+        cellStart.at(cell + 1)++;
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                binParticle(i);
+            }
+        });
+    } else {
+#pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+            binParticle(i);
+        }
+    }
+    for (int cell = 0; cell < numberOfCells; cell++) {
+        cellStart.at(cell + 1) = cellStart.at(cell + 1) + cellStart.at(cell);
+    }
+
+    /* Scattering the particles to their cells */
+
+    std::vector<int> nextSlot(cellStart.begin(), cellStart.end() - 1);
+    cellParticles.resize(n);
+    auto scatterParticle = [&](int i) {
+        int slot;
+#pragma omp atomic capture
+        slot = nextSlot.at(particleCell.at(i))++;
+        cellParticles.at(slot) = i;
+    };
+    auto sortCell = [&](long long cell) {
+        std::sort(cellParticles.begin() + cellStart.at(cell),
+            cellParticles.begin() + cellStart.at(cell + 1));
+    };
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                scatterParticle(i);
+            }
+        });
+        pool.parallelFor(0, numberOfCells, 64, [&](long long first, long long last) {
+            for (long long cell = first; cell < last; cell++) {
+                sortCell(cell);
+            }
+        });
+        return;
+    }
+#pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+        scatterParticle(i);
+    }
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int cell = 0; cell < numberOfCells; cell++) {
+        sortCell(cell);
+    }
+}
+
+/* Calls pairFunction(j) for every particle j in the 27 cells around the cell
+of "particle" (including "particle" itself) */
+
+template <typename PairFunction>
+void CellListBackend::forEachCandidate(int particle,
+    PairFunction pairFunction) const
+{
+    int cell = particleCell.at(particle);
+    int cx = cell % cellsPerDimension[0];
+    int cy = (cell / cellsPerDimension[0]) % cellsPerDimension[1];
+    int cz = cell / (cellsPerDimension[0] * cellsPerDimension[1]);
+    for (int z = std::max(cz - 1, 0); z <= std::min(cz + 1, cellsPerDimension[2] - 1); z++) {
+        for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, cellsPerDimension[1] - 1); y++) {
+            for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, cellsPerDimension[0] - 1); x++) {
+                int neighbourCell = (z * cellsPerDimension[1] + y) * cellsPerDimension[0] + x;
+                for (int k = cellStart.at(neighbourCell); k < cellStart.at(neighbourCell + 1); k++) {
+                    pairFunction(cellParticles.at(k));
+                }
+            }
+        }
+    }
+}
+
+/* Builds the Verlet list of every particle from the cells, in two parallel
+passes: the first counts the neighbours of each particle, the second writes
+them at the offsets given by the running sum of the counts */
+
+void CellListBackend::buildVerletLists(ConstParticleSpan particles)
+{
+    int n = particles.size();
+    double listRadiusSquared = (cutoffRadius + skinRadius) * (cutoffRadius + skinRadius);
+    neighbourStart.assign(n + 1, 0);
+    positionsAtBuild.resize(n);
+    auto countNeighbours = [&](int i) {
+        Eigen::Vector3d position = particles.at(i).getPosition();
+        positionsAtBuild.at(i) = position;
+        int count = 0;
+        forEachCandidate(i, [&](int j) {
+            if (j != i && (particles.at(j).getPosition() - position).squaredNorm() < listRadiusSquared) {
+                count++;
+            }
+        });
+        neighbourStart.at(i + 1) = count;
+    };
+    auto writeNeighbours = [&](int i) {
+        Eigen::Vector3d position = particles.at(i).getPosition();
+        int slot = neighbourStart.at(i);
+        forEachCandidate(i, [&](int j) {
+            if (j != i && (particles.at(j).getPosition() - position).squaredNorm() < listRadiusSquared) {
+                neighbours.at(slot) = j;
+                slot++;
+            }
+        });
+    };
+    auto runningSum = [&]() {
+        for (int i = 0; i < n; i++) {
+            neighbourStart.at(i + 1) = neighbourStart.at(i + 1) + neighbourStart.at(i);
+        }
+        neighbours.resize(neighbourStart.at(n));
+    };
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                countNeighbours(i);
+            }
+        });
+        runningSum();
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                writeNeighbours(i);
+            }
+        });
+        return;
+    }
+#pragma omp parallel for schedule(runtime)
+    for (int i = 0; i < n; i++) {
+        countNeighbours(i);
+    }
+    runningSum();
+#pragma omp parallel for schedule(runtime)
+    for (int i = 0; i < n; i++) {
+        writeNeighbours(i);
+    }
+}
+
+/* The lists are still valid if no particle has moved by more than half of the
+skin since they were built: no pair outside the lists can have come closer
+than the cutoff */
+
+bool CellListBackend::verletListsAreValid(
+    ConstParticleSpan particles) const
+{
+    if (positionsAtBuild.size() != particles.size()) {
+        return false;
+    }
+    double maximumDisplacementSquared = 0.;
+    if (usingWorkStealingPool()) {
+        maximumDisplacementSquared = threadPool().parallelReduce(
+            0, particles.size(), 0, 0., [&](long long first, long long last) {
+                double pieceMaximum = 0.;
+                for (int i = first; i < last; i++) {
+                    pieceMaximum = std::max(pieceMaximum, (particles.at(i).getPosition() - positionsAtBuild.at(i)).squaredNorm());
+                }
+                return pieceMaximum;
+            },
+            [](double a, double b) { return std::max(a, b); });
+    } else {
+#pragma omp parallel for reduction(max \
+                                   : maximumDisplacementSquared)
+        for (int i = 0; i < particles.size(); i++) {
+            double displacementSquared = (particles.at(i).getPosition() - positionsAtBuild.at(i)).squaredNorm();
+            maximumDisplacementSquared = std::max(maximumDisplacementSquared, displacementSquared);
+        }
+    }
+    return 4. * maximumDisplacementSquared < skinRadius * skinRadius;
+}
+
+/* The Verlet lists refer to the particles by index, so they are rebuilt at the
+ * next step after the particles have been reordered or removed */
+
+void CellListBackend::particlesRearranged()
+{
+    positionsAtBuild.clear();
+}
+
+/* Field at the probes with the same truncated interaction as the particles
+ * feel: only the sources closer than the cutoff contribute. The grid is not
+ * used, since the probes are not in it. */
+
+FieldValues CellListBackend::evaluateField(ConstParticleSpan sources,
+    const std::vector<Eigen::Vector3d>& probes, double epsilon)
+{
+    return evaluateFieldDirect(sources, probes, epsilon, cutoffRadius);
+}
+
+/* Computes the accelerations of all the particles. Each particle sums the
+softened force of the particles closer than the cutoff, found either in the
+neighbouring cells or in its Verlet list. The particles are visited in cell
+order, so that neighbours in space are also close in time. */
+
+void CellListBackend::computeAccelerations(ParticleSpan particles,
+    double epsilon)
+{
+    int n = particles.size();
+    if (!useVerletLists) {
+        buildCells(particles);
+        rebuilds++;
+    } else if (!verletListsAreValid(particles)) {
+        buildCells(particles);
+        buildVerletLists(particles);
+        rebuilds++;
+    }
+    double cutoffSquared = cutoffRadius * cutoffRadius;
+    double epsilonSquared = epsilon * epsilon;
+
+    /* Sums the force on the k-th particle of the visiting order and returns the
+     * number of pairs that interacted */
+
+    auto accelerateParticle = [&](int k) {
+        int i = useVerletLists ? k : cellParticles.at(k);
+        Eigen::Vector3d position = particles.at(i).getPosition();
+        Eigen::Vector3d acceleration(0., 0., 0.);
+        long long pairsEvaluated = 0;
+        auto interact = [&](int j) {
+            if (j == i) {
+                return;
+            }
+            Eigen::Vector3d difference = particles.at(j).getPosition() - position;
+            double distanceSquared = difference.squaredNorm();
+            if (distanceSquared < cutoffSquared) {
+                double softened = distanceSquared + epsilonSquared;
+                acceleration = acceleration + particles.at(j).getMass() * difference / std::sqrt(softened * softened * softened);
+                pairsEvaluated++;
+            }
+        };
+        if (useVerletLists) {
+            for (int slot = neighbourStart.at(i); slot < neighbourStart.at(i + 1); slot++) {
+                interact(neighbours.at(slot));
+            }
+        } else {
+            forEachCandidate(i, interact);
+        }
+        particles.at(i).setAcceleration(acceleration);
+        return pairsEvaluated;
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            long long pairsEvaluated = 0;
+            for (int k = first; k < last; k++) {
+                pairsEvaluated = pairsEvaluated + accelerateParticle(k);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        });
+        return;
+    }
+#pragma omp parallel
+    {
+        {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            long long pairsEvaluated = 0;
+#pragma omp for schedule(runtime) nowait
+            for (int k = 0; k < n; k++) {
+                pairsEvaluated = pairsEvaluated + accelerateParticle(k);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+        }
+    }
+}
@@ -0,0 +1,334 @@
+#include "checkpoint.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Layout of a checkpoint file: the header below, then 10 doubles per particle
+(mass, position, velocity and acceleration, i.e. the Particle objects as they
+are in memory) and one 32-bit identifier per particle */
+
+static const char checkpointMagic[8] = { 'N', 'B', 'O', 'D', 'Y', 'C', 'K', '1' };
+
+struct CheckpointHeader {
+    char magic[8];
+    std::int64_t step;
+    double time;
+    std::int64_t numberOfParticles;
+};
+
+static_assert(sizeof(Particle) == 10 * sizeof(double),
+    "Checkpoints store the particles as 10 contiguous doubles");
+
+/* Writes the whole buffer, going on after partial writes. Only system calls are
+used, so it can be called in the child of a multithreaded process. */
+
+static bool writeAll(int file, const void* data, std::size_t bytes)
+{
+    const char* next = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t written = write(file, next, bytes);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        next = next + written;
+        bytes = bytes - written;
+    }
+    return true;
+}
+
+/* Writes the checkpoint to temporaryName and renames it to fileName, so that a
+file with the final name is always complete. The names are built by the
+caller: between fork and exit the child must not allocate memory. */
+
+static bool writeCheckpointFile(const char* fileName, const char* temporaryName,
+    int step, double time, ConstParticleSpan particles,
+    const std::vector<int>& identifiers)
+{
+    int file = open(temporaryName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        return false;
+    }
+    CheckpointHeader header;
+    std::memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.step = step;
+    header.time = time;
+    header.numberOfParticles = particles.size();
+    bool written = writeAll(file, &header, sizeof(header))
+        && writeAll(file, particles.data(), particles.size() * sizeof(Particle))
+        && writeAll(file, identifiers.data(), identifiers.size() * sizeof(int));
+    written = (close(file) == 0) && written;
+    return written && std::rename(temporaryName, fileName) == 0;
+}
+
+/* Writes a checkpoint synchronously */
+
+void writeCheckpoint(const std::string& fileName, int step, double time,
+    ConstParticleSpan particles, const std::vector<int>& identifiers)
+{
+    if (identifiers.size() != particles.size()) {
+        throw std::invalid_argument(
+            "\nA checkpoint needs one identifier per particle.\n");
+    }
+    std::string temporaryName = fileName + ".tmp";
+    if (!writeCheckpointFile(fileName.c_str(), temporaryName.c_str(), step, time,
+            particles, identifiers)) {
+        throw std::runtime_error("\nCannot write the checkpoint " + fileName + ".\n");
+    }
+}
+
+/* Reads a checkpoint written by writeCheckpoint or by ForkCheckpointer */
+
+Checkpoint loadCheckpoint(const std::string& fileName)
+{
+    std::ifstream input(fileName, std::ios::binary);
+    if (!input) {
+        throw std::invalid_argument("\nCannot open the checkpoint " + fileName + ".\n");
+    }
+    CheckpointHeader header;
+    input.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!input || std::memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0 || header.numberOfParticles < 0) {
+        throw std::invalid_argument("\n" + fileName + " is not a checkpoint file.\n");
+    }
+    Checkpoint checkpoint;
+    checkpoint.step = header.step;
+    checkpoint.time = header.time;
+    std::vector<double> values(10 * header.numberOfParticles);
+    checkpoint.identifiers.resize(header.numberOfParticles);
+    input.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(double));
+    input.read(reinterpret_cast<char*>(checkpoint.identifiers.data()),
+        checkpoint.identifiers.size() * sizeof(int));
+    if (!input) {
+        throw std::invalid_argument("\nThe checkpoint " + fileName + " is truncated.\n");
+    }
+    for (int i = 0; i < header.numberOfParticles; i++) {
+        const double* value = &values.at(10 * i);
+        Particle particle(value[0]);
+        particle.setPosition(Eigen::Vector3d(value[1], value[2], value[3]));
+        particle.setVelocity(Eigen::Vector3d(value[4], value[5], value[6]));
+        particle.setAcceleration(Eigen::Vector3d(value[7], value[8], value[9]));
+        checkpoint.particles.push_back(particle);
+    }
+    return checkpoint;
+}
+
+/* Maps a checkpoint written by writeCheckpoint or by ForkCheckpointer. The
+ * header is checked, and the file must be long enough for its particles and
+ * identifiers. */
+
+MappedCheckpoint::MappedCheckpoint(const std::string& fileName)
+{
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::invalid_argument("\nCannot open the checkpoint " + fileName + ".\n");
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || (std::size_t)status.st_size < sizeof(CheckpointHeader)) {
+        close(file);
+        throw std::invalid_argument("\n" + fileName + " is not a checkpoint file.\n");
+    }
+    mappingBytes = status.st_size;
+    void* address = mmap(nullptr, mappingBytes, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("\nCannot map the checkpoint " + fileName + ".\n");
+    }
+    mapping = static_cast<const char*>(address);
+    CheckpointHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    std::size_t expectedBytes = sizeof(header) + header.numberOfParticles * (sizeof(Particle) + sizeof(int));
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0 || header.numberOfParticles < 0 || mappingBytes < expectedBytes) {
+        munmap(const_cast<char*>(mapping), mappingBytes);
+        throw std::invalid_argument("\n" + fileName + " is not a complete checkpoint file.\n");
+    }
+    step = header.step;
+    time = header.time;
+    numberOfParticles = header.numberOfParticles;
+    madvise(const_cast<char*>(mapping), mappingBytes, MADV_SEQUENTIAL);
+}
+
+MappedCheckpoint::~MappedCheckpoint()
+{
+    munmap(const_cast<char*>(mapping), mappingBytes);
+}
+
+long long MappedCheckpoint::getStep() const
+{
+    return step;
+}
+
+double MappedCheckpoint::getTime() const
+{
+    return time;
+}
+
+long long MappedCheckpoint::getNumberOfParticles() const
+{
+    return numberOfParticles;
+}
+
+/* The particles are stored as the 10 doubles of Particle objects, right after
+ * the header, whose size keeps them aligned */
+
+ConstParticleSpan MappedCheckpoint::getParticles() const
+{
+    const Particle* first = reinterpret_cast<const Particle*>(mapping + sizeof(CheckpointHeader));
+    return ConstParticleSpan(first, numberOfParticles);
+}
+
+const int* MappedCheckpoint::getIdentifiers() const
+{
+    return reinterpret_cast<const int*>(mapping + sizeof(CheckpointHeader) + numberOfParticles * sizeof(Particle));
+}
+
+ForkCheckpointer::ForkCheckpointer(std::string directoryArgument,
+    int intervalArgument, int maximumWritersArgument)
+{
+    if (intervalArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe checkpoint interval must be a positive number of steps.\n");
+    }
+    if (maximumWritersArgument <= 0) {
+        throw std::invalid_argument(
+            "\nAt least one checkpoint writer must be allowed.\n");
+    }
+    directory = directoryArgument.empty() ? "." : directoryArgument;
+    interval = intervalArgument;
+    maximumWriters = maximumWritersArgument;
+}
+
+/* The checkpoints already started are completed before the object goes away */
+
+ForkCheckpointer::~ForkCheckpointer()
+{
+    waitForAll();
+}
+
+int ForkCheckpointer::getInterval() const
+{
+    return interval;
+}
+
+std::string ForkCheckpointer::getFileName(int step) const
+{
+    return directory + "/checkpoint_" + std::to_string(step) + ".bin";
+}
+
+/* Starts writing a checkpoint of the particles and returns the name of the
+ * file. If maximumWriters children are still writing, the oldest one is waited
+ * for first. If fork fails the checkpoint is written by the calling process. */
+
+std::string ForkCheckpointer::checkpoint(int step, double time,
+    ConstParticleSpan particles, const std::vector<int>& identifiers)
+{
+    if (identifiers.size() != particles.size()) {
+        throw std::invalid_argument(
+            "\nA checkpoint needs one identifier per particle.\n");
+    }
+    reapChildren(false);
+    while (writers.size() >= maximumWriters) {
+        int status = 0;
+        pid_t child = writers.front();
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+        }
+        reapOne(child, status);
+    }
+    std::string fileName = getFileName(step);
+    std::string temporaryName = fileName + ".tmp";
+    auto start = std::chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child == 0) {
+        bool written = writeCheckpointFile(fileName.c_str(), temporaryName.c_str(),
+            step, time, particles, identifiers);
+        _exit(written ? 0 : 1);
+    }
+    forkSeconds = forkSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    checkpoints++;
+    if (child < 0) {
+        writeCheckpoint(fileName, step, time, particles, identifiers);
+    } else {
+        writers.push_back(child);
+    }
+    return fileName;
+}
+
+/* Waits until every child has finished writing */
+
+void ForkCheckpointer::waitForAll()
+{
+    reapChildren(true);
+}
+
+int ForkCheckpointer::getNumberOfOutstanding()
+{
+    reapChildren(false);
+    return writers.size();
+}
+
+/* Number of checkpoints started so far */
+
+int ForkCheckpointer::getNumberOfCheckpoints() const
+{
+    return checkpoints;
+}
+
+/* Number of children that could not write their checkpoint, among the ones
+ * that have finished */
+
+int ForkCheckpointer::getNumberOfFailures()
+{
+    reapChildren(false);
+    return failures;
+}
+
+/* Time the parent spent in fork, i.e. the cost of the checkpoints for the
+ * integration */
+
+double ForkCheckpointer::getForkSeconds() const
+{
+    return forkSeconds;
+}
+
+void ForkCheckpointer::reapChildren(bool block)
+{
+    for (auto child = writers.begin(); child != writers.end();) {
+        int status = 0;
+        pid_t finished = waitpid(*child, &status, block ? 0 : WNOHANG);
+        if (finished < 0 && errno == EINTR) {
+            continue;
+        }
+        if (finished == 0) {
+            child++;
+            continue;
+        }
+        if (finished < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failures++;
+        }
+        child = writers.erase(child);
+    }
+}
+
+void ForkCheckpointer::reapOne(pid_t child, int status)
+{
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failures++;
+    }
+    for (auto writer = writers.begin(); writer != writers.end(); writer++) {
+        if (*writer == child) {
+            writers.erase(writer);
+            return;
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#include "closeEncounters.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include "parallelSort.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+
+/* Integer coordinates of the cell (of side equal to the encounter radius)
+containing a position */
+
+static void cellOfPosition(const Eigen::Vector3d& position, double cellSize,
+    long long cell[3])
+{
+    for (int d = 0; d < 3; d++) {
+        cell[d] = (long long)std::floor(position(d) / cellSize);
+    }
+}
+
+/* Spatial hash of a cell. Different cells can share the same key, so the real
+cell coordinates are always checked after a lookup. */
+
+static std::uint64_t hashOfCell(long long x, long long y, long long z)
+{
+    return ((std::uint64_t)x * 73856093ULL) ^ ((std::uint64_t)y * 19349663ULL) ^ ((std::uint64_t)z * 83492791ULL);
+}
+
+/* Finds all the pairs of particles closer than encounterRadius. Space is cut
+into cells of side encounterRadius and every particle gets the hash of its
+cell; the (hash, index) pairs are sorted in parallel, so the particles of a
+cell are contiguous and can be found with a binary search. No grid is stored,
+so the memory is linear in N however sparse the system is. Each particle then
+looks, in parallel, at the 27 cells around its own one and keeps the closer
+particles with a larger index. The pairs are returned sorted by (first,
+second), whatever the number of threads. */
+
+std::vector<EncounterPair> findCloseEncounters(
+    ConstParticleSpan particles, double encounterRadius)
+{
+    if (encounterRadius <= 0) {
+        throw std::invalid_argument("\nThe encounter radius must be a positive value.\n");
+    }
+    int n = particles.size();
+    std::vector<long long> cells(3 * n);
+    std::vector<std::uint64_t> keys(n);
+    std::vector<int> sortedParticles(n);
+    auto hashParticle = [&](int i) {
+        cellOfPosition(particles.at(i).getPosition(), encounterRadius, &cells.at(3 * i));
+        keys.at(i) = hashOfCell(cells.at(3 * i), cells.at(3 * i + 1), cells.at(3 * i + 2));
+        sortedParticles.at(i) = i;
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                hashParticle(i);
+            }
+        });
+    } else {
+#pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+            hashParticle(i);
+        }
+    }
+    parallelRadixSort(keys, sortedParticles);
+
+    /* Appends the pairs of particle i with the particles of larger index */
+
+    double radiusSquared = encounterRadius * encounterRadius;
+    auto findPairs = [&](int i, std::vector<EncounterPair>& pairs) {
+        const long long* cell = &cells.at(3 * i);
+        const Eigen::Vector3d position = particles.at(i).getPosition();
+        for (long long z = cell[2] - 1; z <= cell[2] + 1; z++) {
+            for (long long y = cell[1] - 1; y <= cell[1] + 1; y++) {
+                for (long long x = cell[0] - 1; x <= cell[0] + 1; x++) {
+                    auto range = std::equal_range(keys.begin(), keys.end(), hashOfCell(x, y, z));
+                    for (auto k = range.first; k != range.second; k++) {
+                        int j = sortedParticles.at(k - keys.begin());
+                        if (j <= i || cells.at(3 * j) != x || cells.at(3 * j + 1) != y || cells.at(3 * j + 2) != z) {
+                            continue;
+                        }
+                        double distanceSquared = (particles.at(j).getPosition() - position).squaredNorm();
+                        if (distanceSquared < radiusSquared) {
+                            pairs.push_back({ i, j, std::sqrt(distanceSquared) });
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    /* The pairs are gathered per thread, or per piece of the reduction on the
+     * pool, and sorted at the end */
+
+    std::vector<EncounterPair> encounters;
+    if (usingWorkStealingPool()) {
+        encounters = threadPool().parallelReduce(
+            0, n, 64, std::vector<EncounterPair>(), [&](long long first, long long last) {
+                std::vector<EncounterPair> pairs;
+                for (int i = first; i < last; i++) {
+                    findPairs(i, pairs);
+                }
+                return pairs;
+            },
+            [](std::vector<EncounterPair> sum, const std::vector<EncounterPair>& pairs) {
+                sum.insert(sum.end(), pairs.begin(), pairs.end());
+                return sum;
+            });
+    } else {
+        std::vector<std::vector<EncounterPair>> pairsPerThread(omp_get_max_threads());
+#pragma omp parallel
+        {
+            std::vector<EncounterPair>& threadPairs = pairsPerThread.at(omp_get_thread_num());
+#pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < n; i++) {
+                findPairs(i, threadPairs);
+            }
+        }
+        for (const std::vector<EncounterPair>& threadPairs : pairsPerThread) {
+            encounters.insert(encounters.end(), threadPairs.begin(), threadPairs.end());
+        }
+    }
+    std::sort(encounters.begin(), encounters.end(),
+        [](const EncounterPair& a, const EncounterPair& b) {
+            return a.first < b.first || (a.first == b.first && a.second < b.second);
+        });
+    return encounters;
+}
+
+/* Root of the group of a particle, halving the path on the way */
+
+static int findGroup(std::vector<int>& parent, int i)
+{
+    while (parent.at(i) != i) {
+        parent.at(i) = parent.at(parent.at(i));
+        i = parent.at(i);
+    }
+    return i;
+}
+
+/* Merges every group of particles connected by the encounters into one body.
+The survivor of a group is its most massive member (the first one if more
+have the same mass): it gets the total mass, the centre of mass position and
+the velocity that conserves the total momentum. The returned flags are 0 for
+the particles absorbed by another one and 1 for the others, and can be passed
+to compactInParallel to remove them from every vector indexed like the
+particles. */
+
+std::vector<char> mergeCloseEncounters(ParticleSpan particles,
+    const std::vector<EncounterPair>& encounters)
+{
+    int n = particles.size();
+    std::vector<int> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    for (const EncounterPair& encounter : encounters) {
+        int first = findGroup(parent, encounter.first);
+        int second = findGroup(parent, encounter.second);
+        if (first == second) {
+            continue;
+        }
+        /* The root of a group is always its survivor */
+
+        double firstMass = particles.at(first).getMass();
+        double secondMass = particles.at(second).getMass();
+        if (secondMass > firstMass || (secondMass == firstMass && second < first)) {
+            std::swap(first, second);
+        }
+        parent.at(second) = first;
+    }
+
+    /* Mass-weighted sums of each group, accumulated on its survivor */
+
+    std::vector<double> groupMass(n, 0.);
+    std::vector<Eigen::Vector3d> groupPosition(n, Eigen::Vector3d(0., 0., 0.));
+    std::vector<Eigen::Vector3d> groupMomentum(n, Eigen::Vector3d(0., 0., 0.));
+    std::vector<Eigen::Vector3d> groupAcceleration(n, Eigen::Vector3d(0., 0., 0.));
+    std::vector<Eigen::Vector3d> groupVelocity(n, Eigen::Vector3d(0., 0., 0.));
+    std::vector<int> groupSize(n, 0);
+    std::vector<char> keep(n, 1);
+    for (int i = 0; i < n; i++) {
+        int root = findGroup(parent, i);
+        double mass = particles.at(i).getMass();
+        groupMass.at(root) = groupMass.at(root) + mass;
+        groupPosition.at(root) = groupPosition.at(root) + mass * particles.at(i).getPosition();
+        groupMomentum.at(root) = groupMomentum.at(root) + mass * particles.at(i).getVelocity();
+        groupAcceleration.at(root) = groupAcceleration.at(root) + mass * particles.at(i).getAcceleration();
+        groupVelocity.at(root) = groupVelocity.at(root) + particles.at(i).getVelocity();
+        groupSize.at(root)++;
+        keep.at(i) = (root == i);
+    }
+    auto mergeGroup = [&](int i) {
+        if (groupSize.at(i) < 2) {
+            return;
+        }
+        double mass = groupMass.at(i);
+        Particle merged(mass);
+        if (mass > 0) {
+            merged.setPosition(groupPosition.at(i) / mass);
+            merged.setVelocity(groupMomentum.at(i) / mass);
+            merged.setAcceleration(groupAcceleration.at(i) / mass);
+        } else {
+            merged.setPosition(particles.at(i).getPosition());
+            merged.setVelocity(groupVelocity.at(i) / groupSize.at(i));
+            merged.setAcceleration(particles.at(i).getAcceleration());
+        }
+        particles.at(i) = merged;
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                mergeGroup(i);
+            }
+        });
+    } else {
+#pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+            mergeGroup(i);
+        }
+    }
+    return keep;
+}
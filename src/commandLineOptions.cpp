@@ -0,0 +1,50 @@
+#include "commandLineOptions.hpp"
+
+#include <stdexcept>
+
+/* Removes the optional arguments written as "--name=value" (or just "--name")
+from the command line and returns them in a map. argc and argv are compacted so
+that the programs can keep checking their positional arguments as before. The
+help flags "-h" and "--help" are left where they are. */
+
+CommandLineOptions
+extractOptions(int& argc, char** argv)
+{
+    CommandLineOptions options;
+    int positionalArguments = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.rfind("--", 0) != 0 || argument == "--help") {
+            argv[positionalArguments] = argv[i];
+            positionalArguments++;
+            continue;
+        }
+        std::string::size_type equalSign = argument.find('=');
+        if (equalSign == std::string::npos) {
+            options[argument.substr(2)] = "";
+        } else {
+            options[argument.substr(2, equalSign - 2)] = argument.substr(equalSign + 1);
+        }
+    }
+    argc = positionalArguments;
+    return options;
+}
+
+bool hasOption(const CommandLineOptions& options, const std::string& name)
+{
+    return options.find(name) != options.end();
+}
+
+/* Returns the value of an option, or defaultValue if it was not given or was
+given without a value */
+
+std::string
+getOption(const CommandLineOptions& options, const std::string& name,
+    const std::string& defaultValue)
+{
+    CommandLineOptions::const_iterator option = options.find(name);
+    if (option == options.end() || option->second.empty()) {
+        return defaultValue;
+    }
+    return option->second;
+}
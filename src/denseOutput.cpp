@@ -0,0 +1,141 @@
+#include "denseOutput.hpp"
+
+#include "execution.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+/* Cubic Hermite interpolation over a step of length h = dt with
+theta = (t - t0) / h:
+
+x(theta) = h00 x0 + h h10 v0 + h01 x1 + h h11 v1
+
+with h00 = 2 theta^3 - 3 theta^2 + 1, h10 = theta^3 - 2 theta^2 + theta,
+h01 = -2 theta^3 + 3 theta^2 and h11 = theta^3 - theta^2. The velocity and the
+acceleration are its first and second derivatives in time, so the three are
+consistent with each other, and at theta = 0 and 1 the positions and
+velocities are exactly those of the ends of the step. The error in the
+positions is of order dt^4 inside a step, well below that of the integrator. */
+
+void interpolateStep(ConstParticleSpan start, ConstParticleSpan end, double dt,
+    double theta, ParticleSpan output)
+{
+    if (start.size() != end.size() || output.size() != end.size()) {
+        throw std::invalid_argument("\nThe two ends of the step and the output must have the same particles\n");
+    }
+    if (dt <= 0) {
+        throw std::invalid_argument("\nThe step to interpolate must be longer than 0\n");
+    }
+    const double theta2 = theta * theta;
+    const double theta3 = theta2 * theta;
+    const double h00 = 2 * theta3 - 3 * theta2 + 1, h10 = theta3 - 2 * theta2 + theta;
+    const double h01 = -2 * theta3 + 3 * theta2, h11 = theta3 - theta2;
+    const double d00 = (6 * theta2 - 6 * theta) / dt, d10 = 3 * theta2 - 4 * theta + 1;
+    const double d01 = -d00, d11 = 3 * theta2 - 2 * theta;
+    const double s00 = (12 * theta - 6) / (dt * dt), s10 = (6 * theta - 4) / dt;
+    const double s01 = -s00, s11 = (6 * theta - 2) / dt;
+    const int n = end.size();
+    auto interpolateParticle = [&](int i) {
+        const Eigen::Vector3d& x0 = start[i].getPosition();
+        const Eigen::Vector3d& v0 = start[i].getVelocity();
+        const Eigen::Vector3d& x1 = end[i].getPosition();
+        const Eigen::Vector3d& v1 = end[i].getVelocity();
+        Particle& particle = output[i];
+        particle.setMass(end[i].getMass());
+        particle.setPosition(h00 * x0 + dt * h10 * v0 + h01 * x1 + dt * h11 * v1);
+        particle.setVelocity(d00 * x0 + d10 * v0 + d01 * x1 + d11 * v1);
+        particle.setAcceleration(s00 * x0 + s10 * v0 + s01 * x1 + s11 * v1);
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                interpolateParticle(i);
+            }
+        });
+        return;
+    }
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        interpolateParticle(i);
+    }
+}
+
+/* The output times are sorted; they are all still to come */
+
+DenseOutput::DenseOutput(std::vector<double> outputTimesArgument,
+    DenseOutputCallback callbackArgument)
+{
+    if (!callbackArgument) {
+        throw std::invalid_argument("\nThe dense output needs a callback\n");
+    }
+    outputTimes = std::move(outputTimesArgument);
+    std::sort(outputTimes.begin(), outputTimes.end());
+    callback = std::move(callbackArgument);
+}
+
+/* True if the next output time is not later than "time", i.e. if a step that
+ * ends at "time" has to be interpolated */
+
+bool DenseOutput::isDue(double time) const
+{
+    return nextOutput < outputTimes.size() && outputTimes[nextOutput] <= time;
+}
+
+/* Gives the current state to the output times up to "time" (the time of the
+ * state), e.g. those at the beginning of the evolution */
+
+void DenseOutput::emitCurrent(double time, ConstParticleSpan particles)
+{
+    while (isDue(time)) {
+        callback(outputTimes[nextOutput], particles);
+        nextOutput++;
+    }
+}
+
+/* Keeps the state at the beginning of a step that contains output times */
+
+void DenseOutput::beginStep(ConstParticleSpan particles)
+{
+    stepStart.assign(particles.begin(), particles.end());
+}
+
+/* Interpolates the state at every output time of the step from startTime to
+ * endTime, for which beginStep was called. endTime is the end of the step on
+ * the clock of the evolution, which startTime + dt can miss by a rounding, and
+ * an output time equal to it must not be left for a step that never comes. */
+
+void DenseOutput::endStep(double startTime, double endTime, double dt,
+    ConstParticleSpan particles)
+{
+    if (stepStart.size() != particles.size()) {
+        throw std::logic_error("\nThe dense output step was not begun on the same particles\n");
+    }
+    interpolated.assign(particles.begin(), particles.end());
+    while (isDue(endTime)) {
+        double theta = std::clamp((outputTimes[nextOutput] - startTime) / dt, 0., 1.);
+        interpolateStep(stepStart, particles, dt, theta, interpolated);
+        callback(outputTimes[nextOutput], interpolated);
+        nextOutput++;
+    }
+}
+
+int DenseOutput::getNumberOfOutputs() const
+{
+    return nextOutput;
+}
+
+int DenseOutput::getNumberOfPendingOutputs() const
+{
+    return outputTimes.size() - nextOutput;
+}
+
+/* Next output time, or infinity if there is none left */
+
+double DenseOutput::getNextOutputTime() const
+{
+    if (nextOutput == outputTimes.size()) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return outputTimes[nextOutput];
+}
@@ -0,0 +1,291 @@
+#include "ensemble.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include "manyBodySystem.hpp"
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+SystemEnsemble::SystemEnsemble(int bodiesPerSystemArgument)
+{
+    if (bodiesPerSystemArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe systems of an ensemble need at least one body.\n");
+    }
+    bodiesPerSystem = bodiesPerSystemArgument;
+}
+
+/* Position of body "body" of member "member" in the columns. Blocks of
+membersPerBlock members are stored one after the other; inside a block the
+bodies are the outer index and the members the inner one. */
+
+int SystemEnsemble::index(int member, int body) const
+{
+    int block = member / membersPerBlock;
+    int lane = member % membersPerBlock;
+    return (block * bodiesPerSystem + body) * membersPerBlock + lane;
+}
+
+/* Adds a system to the ensemble. When a new block is opened, its unused lanes
+are filled with massless bodies placed at different positions, so that the
+kernel never divides by zero on them. */
+
+void SystemEnsemble::addMember(const std::vector<Particle>& system)
+{
+    if (system.size() != bodiesPerSystem) {
+        throw std::invalid_argument(
+            "\nAll the members of an ensemble must have the same number of bodies.\n");
+    }
+    if (numberOfMembers % membersPerBlock == 0) {
+        int newSize = mass.size() + bodiesPerSystem * membersPerBlock;
+        mass.resize(newSize, 0.);
+        positionX.resize(newSize, 0.);
+        positionY.resize(newSize, 0.);
+        positionZ.resize(newSize, 0.);
+        velocityX.resize(newSize, 0.);
+        velocityY.resize(newSize, 0.);
+        velocityZ.resize(newSize, 0.);
+        for (int lane = 0; lane < membersPerBlock; lane++) {
+            for (int body = 0; body < bodiesPerSystem; body++) {
+                positionX.at(index(numberOfMembers + lane, body)) = body + 1.;
+            }
+        }
+    }
+    int member = numberOfMembers;
+    numberOfMembers++;
+    for (int body = 0; body < bodiesPerSystem; body++) {
+        const Particle& particle = system.at(body);
+        int i = index(member, body);
+        mass.at(i) = particle.getMass();
+        positionX.at(i) = particle.getPosition()(0);
+        positionY.at(i) = particle.getPosition()(1);
+        positionZ.at(i) = particle.getPosition()(2);
+        velocityX.at(i) = particle.getVelocity()(0);
+        velocityY.at(i) = particle.getVelocity()(1);
+        velocityZ.at(i) = particle.getVelocity()(2);
+    }
+    initialEnergies.push_back(calculateEnergy(member));
+}
+
+/* Fills the ensemble with solar systems that only differ in the initial angle
+of each planet. The masses and the distances from the Sun are taken from
+solarSystemGenerator, the angles are drawn from a generator seeded with
+seed + member so that every member can be reproduced on its own. */
+
+void SystemEnsemble::generateSolarSystemEnsemble(int membersToGenerate,
+    unsigned int seed)
+{
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(bodiesPerSystem);
+    std::vector<Particle> system = solarSystem.getSystemInformations();
+    std::uniform_real_distribution<> angle(0., 2 * M_PI);
+    for (int member = 0; member < membersToGenerate; member++) {
+        std::mt19937 rng(seed + member);
+        for (int body = 1; body < bodiesPerSystem; body++) {
+            double distance = system.at(body).getPosition().norm();
+            double theta = angle(rng);
+            system.at(body).setPosition(Eigen::Vector3d(distance * std::sin(theta),
+                distance * std::cos(theta), 0.0));
+            system.at(body).setVelocity(Eigen::Vector3d(
+                ((-1) * (std::cos(theta))) / std::sqrt(distance),
+                (std::sin(theta)) / std::sqrt(distance), 0.0));
+        }
+        addMember(system);
+    }
+}
+
+int SystemEnsemble::getNumberOfMembers() const
+{
+    return numberOfMembers;
+}
+
+int SystemEnsemble::getBodiesPerSystem() const
+{
+    return bodiesPerSystem;
+}
+
+/* Copies a member back into a vector of particles */
+
+std::vector<Particle> SystemEnsemble::getMember(int member) const
+{
+    if (member < 0 || member >= numberOfMembers) {
+        throw std::out_of_range("\nThe ensemble has no member with this index.\n");
+    }
+    std::vector<Particle> system;
+    for (int body = 0; body < bodiesPerSystem; body++) {
+        int i = index(member, body);
+        Particle particle(mass.at(i));
+        particle.setPosition(Eigen::Vector3d(positionX.at(i), positionY.at(i),
+            positionZ.at(i)));
+        particle.setVelocity(Eigen::Vector3d(velocityX.at(i), velocityY.at(i),
+            velocityZ.at(i)));
+        system.push_back(particle);
+    }
+    return system;
+}
+
+/* Evolves every member by the given number of steps, with the same scheme as
+InitialConditionGenerator::evolutionOfSystem (accelerations from the current
+positions, then position updated with the old velocity and velocity with the
+new acceleration). The threads share the blocks and integrate them from start
+to end, so there is a single parallel region for the whole run (on the pool,
+every block is a task). The first call fixes the softening factor of the
+energies, and the initial energies are taken again with it; the drift is only
+meaningful for one epsilon, so a later call with another one is refused. */
+
+void SystemEnsemble::evolve(int steps, double dt, double epsilonArgument)
+{
+    if (iterations == 0) {
+        epsilon = epsilonArgument;
+        initialEnergies = calculateEnergies();
+    } else if (epsilonArgument != epsilon) {
+        throw std::invalid_argument("\nThe ensemble was evolved with epsilon = "
+            + std::to_string(epsilon) + ": its energy drift is measured with that softening factor.\n");
+    }
+    int numberOfBlocks = mass.size() / (bodiesPerSystem * membersPerBlock);
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, numberOfBlocks, 1, [&](long long first, long long last) {
+            for (int block = first; block < last; block++) {
+                evolveBlock(block, steps, dt, epsilon);
+            }
+        });
+        iterations = iterations + steps;
+        return;
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (int block = 0; block < numberOfBlocks; block++) {
+        evolveBlock(block, steps, dt, epsilon);
+    }
+    iterations = iterations + steps;
+}
+
+void SystemEnsemble::evolveBlock(int block, int steps, double dt,
+    double epsilon)
+{
+    INSTRUMENT_PHASE(Phase::force);
+    const int lanes = membersPerBlock;
+    const int offset = block * bodiesPerSystem * lanes;
+    const double epsilonSquared = epsilon * epsilon;
+    double* m = mass.data() + offset;
+    double* x = positionX.data() + offset;
+    double* y = positionY.data() + offset;
+    double* z = positionZ.data() + offset;
+    double* vx = velocityX.data() + offset;
+    double* vy = velocityY.data() + offset;
+    double* vz = velocityZ.data() + offset;
+    std::vector<double> ax(bodiesPerSystem * lanes);
+    std::vector<double> ay(bodiesPerSystem * lanes);
+    std::vector<double> az(bodiesPerSystem * lanes);
+    for (int step = 0; step < steps; step++) {
+        for (int i = 0; i < bodiesPerSystem; i++) {
+            double* axi = ax.data() + i * lanes;
+            double* ayi = ay.data() + i * lanes;
+            double* azi = az.data() + i * lanes;
+            const double* xi = x + i * lanes;
+            const double* yi = y + i * lanes;
+            const double* zi = z + i * lanes;
+#pragma omp simd
+            for (int lane = 0; lane < lanes; lane++) {
+                axi[lane] = 0.;
+                ayi[lane] = 0.;
+                azi[lane] = 0.;
+            }
+            for (int j = 0; j < bodiesPerSystem; j++) {
+                if (j == i) {
+                    continue;
+                }
+                const double* mj = m + j * lanes;
+                const double* xj = x + j * lanes;
+                const double* yj = y + j * lanes;
+                const double* zj = z + j * lanes;
+#pragma omp simd
+                for (int lane = 0; lane < lanes; lane++) {
+                    double dx = xj[lane] - xi[lane];
+                    double dy = yj[lane] - yi[lane];
+                    double dz = zj[lane] - zi[lane];
+                    double d2 = dx * dx + dy * dy + dz * dz + epsilonSquared;
+                    double factor = mj[lane] / (d2 * std::sqrt(d2));
+                    axi[lane] += factor * dx;
+                    ayi[lane] += factor * dy;
+                    azi[lane] += factor * dz;
+                }
+            }
+        }
+#pragma omp simd
+        for (int i = 0; i < bodiesPerSystem * lanes; i++) {
+            x[i] = x[i] + dt * vx[i];
+            y[i] = y[i] + dt * vy[i];
+            z[i] = z[i] + dt * vz[i];
+            vx[i] = vx[i] + dt * ax[i];
+            vy[i] = vy[i] + dt * ay[i];
+            vz[i] = vz[i] + dt * az[i];
+        }
+    }
+    INSTRUMENT_PAIRS((long long)steps * lanes * bodiesPerSystem * (bodiesPerSystem - 1));
+}
+
+int SystemEnsemble::getIterations() const
+{
+    return iterations;
+}
+
+/* Total energy of one member, with the same definitions as
+calculateTotalEnergy and the softening factor of the evolution */
+
+double SystemEnsemble::calculateEnergy(int member) const
+{
+    double kineticEnergy = 0.;
+    double potentialEnergy = 0.;
+    for (int body = 0; body < bodiesPerSystem; body++) {
+        int i = index(member, body);
+        kineticEnergy = kineticEnergy
+            + 0.5 * mass.at(i) * (velocityX.at(i) * velocityX.at(i) + velocityY.at(i) * velocityY.at(i) + velocityZ.at(i) * velocityZ.at(i));
+        for (int other = body + 1; other < bodiesPerSystem; other++) {
+            int j = index(member, other);
+            double dx = positionX.at(j) - positionX.at(i);
+            double dy = positionY.at(j) - positionY.at(i);
+            double dz = positionZ.at(j) - positionZ.at(i);
+            potentialEnergy = potentialEnergy
+                - mass.at(i) * mass.at(j) / std::sqrt(dx * dx + dy * dy + dz * dz + epsilon * epsilon);
+        }
+    }
+    return kineticEnergy + potentialEnergy;
+}
+
+std::vector<double> SystemEnsemble::calculateEnergies() const
+{
+    std::vector<double> energies(numberOfMembers);
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, numberOfMembers, 0, [&](long long first, long long last) {
+            for (int member = first; member < last; member++) {
+                energies.at(member) = calculateEnergy(member);
+            }
+        });
+        return energies;
+    }
+#pragma omp parallel for
+    for (int member = 0; member < numberOfMembers; member++) {
+        energies.at(member) = calculateEnergy(member);
+    }
+    return energies;
+}
+
+std::vector<double> SystemEnsemble::getInitialEnergies() const
+{
+    return initialEnergies;
+}
+
+/* Relative change of the total energy of each member since it was added to
+the ensemble */
+
+std::vector<double> SystemEnsemble::getRelativeEnergyDrift() const
+{
+    std::vector<double> drift = calculateEnergies();
+    for (int member = 0; member < numberOfMembers; member++) {
+        drift.at(member) = (drift.at(member) - initialEnergies.at(member))
+            / std::abs(initialEnergies.at(member));
+    }
+    return drift;
+}
@@ -0,0 +1,130 @@
+#include "escapers.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+/* Flags the particles that have escaped from the system: farther than
+escapeRadius from the centre of mass, moving away from it and with a positive
+specific energy, 1/2 v^2 - (M - m) / r, where v and r are relative to the
+centre of mass and M is the total mass. Beyond a large radius the rest of the
+system pulls almost like a point mass at its centre of mass, so this test costs
+O(N) instead of the O(N^2) of the true potential. The result has a 0 for every
+escaper and a 1 for the others, as compactInParallel expects, and the state of
+the escapers is appended to "escapers" in the order of their indices. */
+
+std::vector<char> findEscapers(ConstParticleSpan particles,
+    double escapeRadius, std::vector<EscapedParticle>& escapers)
+{
+    if (escapeRadius <= 0) {
+        throw std::invalid_argument("\nThe escape radius must be a positive value.\n");
+    }
+    const int n = particles.size();
+    std::vector<char> keep(n, 1);
+    std::vector<double> specificEnergies(n, 0.);
+    double totalMass = 0.;
+    double px = 0., py = 0., pz = 0., vx = 0., vy = 0., vz = 0.;
+    if (usingWorkStealingPool()) {
+        typedef Eigen::Matrix<double, 7, 1> Moments;
+        Moments moments = threadPool().parallelReduce(
+            0, n, 0, Moments(Moments::Zero()), [&](long long first, long long last) {
+                Moments pieceMoments = Moments::Zero();
+                for (int i = first; i < last; i++) {
+                    double mass = particles[i].getMass();
+                    pieceMoments(0) += mass;
+                    pieceMoments.segment<3>(1) += mass * particles[i].getPosition();
+                    pieceMoments.segment<3>(4) += mass * particles[i].getVelocity();
+                }
+                return pieceMoments;
+            },
+            [](const Moments& a, const Moments& b) { return Moments(a + b); });
+        totalMass = moments(0);
+        px = moments(1);
+        py = moments(2);
+        pz = moments(3);
+        vx = moments(4);
+        vy = moments(5);
+        vz = moments(6);
+    } else {
+#pragma omp parallel for schedule(static) reduction(+ : totalMass, px, py, pz, vx, vy, vz)
+        for (int i = 0; i < n; i++) {
+            double mass = particles[i].getMass();
+            const Eigen::Vector3d& position = particles[i].getPosition();
+            const Eigen::Vector3d& velocity = particles[i].getVelocity();
+            totalMass = totalMass + mass;
+            px = px + mass * position(0);
+            py = py + mass * position(1);
+            pz = pz + mass * position(2);
+            vx = vx + mass * velocity(0);
+            vy = vy + mass * velocity(1);
+            vz = vz + mass * velocity(2);
+        }
+    }
+    if (totalMass <= 0) {
+        return keep;
+    }
+    const Eigen::Vector3d centreOfMass = Eigen::Vector3d(px, py, pz) / totalMass;
+    const Eigen::Vector3d centreOfMassVelocity = Eigen::Vector3d(vx, vy, vz) / totalMass;
+    auto flagEscaper = [&](int i) {
+        Eigen::Vector3d position = particles[i].getPosition() - centreOfMass;
+        double distance = position.norm();
+        if (distance <= escapeRadius) {
+            return;
+        }
+        Eigen::Vector3d velocity = particles[i].getVelocity() - centreOfMassVelocity;
+        double energy = 0.5 * velocity.squaredNorm() - (totalMass - particles[i].getMass()) / distance;
+        if (energy > 0 && position.dot(velocity) > 0) {
+            keep[i] = 0;
+            specificEnergies[i] = energy;
+        }
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                flagEscaper(i);
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            flagEscaper(i);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (keep[i] == 0) {
+            EscapedParticle escaper;
+            escaper.index = i;
+            escaper.identifier = i;
+            escaper.specificEnergy = specificEnergies[i];
+            escaper.distance = (particles[i].getPosition() - centreOfMass).norm();
+            escaper.particle = particles[i];
+            escapers.push_back(escaper);
+        }
+    }
+    return keep;
+}
+
+/* Writes the archive of the escapers, one line per particle with its state at
+ * the removal */
+
+void writeEscapersCsv(const std::string& fileName,
+    const std::vector<EscapedParticle>& escapers)
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    output.precision(17);
+    output << "identifier,step,time,mass,x,y,z,vx,vy,vz,specific_energy,distance\n";
+    for (const EscapedParticle& escaper : escapers) {
+        const Eigen::Vector3d& position = escaper.particle.getPosition();
+        const Eigen::Vector3d& velocity = escaper.particle.getVelocity();
+        output << escaper.identifier << "," << escaper.step << "," << escaper.time
+               << "," << escaper.particle.getMass() << "," << position(0) << ","
+               << position(1) << "," << position(2) << "," << velocity(0) << ","
+               << velocity(1) << "," << velocity(2) << "," << escaper.specificEnergy
+               << "," << escaper.distance << "\n";
+    }
+}
@@ -0,0 +1,283 @@
+#include "execution.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+
+/* The loops of the library run on OpenMP unless the work-stealing pool is
+selected. The pool is meant for the cases where the OpenMP runtime is a poor
+fit: a program embedding the library that must know how many threads it uses,
+or work that opens parallel loops inside parallel tasks, which the pool runs
+as more tasks on the same threads instead of nesting teams of threads. */
+
+std::string executionBackendName(ExecutionBackend backend)
+{
+    switch (backend) {
+    case ExecutionBackend::openmp:
+        return "openmp";
+    case ExecutionBackend::workStealing:
+        return "pool";
+    }
+    return "unknown";
+}
+
+ExecutionBackend executionBackendFromName(const std::string& name)
+{
+    if (name == "openmp") {
+        return ExecutionBackend::openmp;
+    }
+    if (name == "pool" || name == "workstealing") {
+        return ExecutionBackend::workStealing;
+    }
+    throw std::invalid_argument("\nUnknown execution backend \"" + name
+        + "\": it should be \"openmp\" or \"pool\".\n");
+}
+
+/* The pool and the index of its deque that the calling thread owns, if it is
+one of its workers */
+
+static thread_local const WorkStealingPool* currentPool = nullptr;
+static thread_local int currentQueue = -1;
+
+TaskGroup::TaskGroup(WorkStealingPool& poolArgument)
+    : pool(poolArgument)
+{
+}
+
+/* The tasks refer to the group, so it can not go away before they are done,
+even when wait was skipped because of an exception */
+
+TaskGroup::~TaskGroup()
+{
+    while (pendingTasks.load(std::memory_order_acquire) > 0) {
+        if (!pool.runPendingTask()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    pendingTasks.fetch_add(1, std::memory_order_relaxed);
+    pool.submit([this, task = std::move(task)]() {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(exceptionMutex);
+            if (!firstException) {
+                firstException = std::current_exception();
+            }
+        }
+        /* Last access to the group: it may be destroyed right after */
+
+        pendingTasks.fetch_sub(1, std::memory_order_release);
+    });
+}
+
+void TaskGroup::wait()
+{
+    while (pendingTasks.load(std::memory_order_acquire) > 0) {
+        if (!pool.runPendingTask()) {
+            std::this_thread::yield();
+        }
+    }
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(exceptionMutex);
+        std::swap(exception, firstException);
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+/* The thread that waits for a group works too, so a pool of n threads starts
+n - 1 workers. The last deque is shared by the threads that are not workers. */
+
+WorkStealingPool::WorkStealingPool(int threads)
+{
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 0; i < threads - 1; i++) {
+        workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int WorkStealingPool::getNumberOfThreads() const
+{
+    return queues.size();
+}
+
+long long WorkStealingPool::getNumberOfTasks() const
+{
+    return submittedTasks.load();
+}
+
+long long WorkStealingPool::getNumberOfSteals() const
+{
+    return stolenTasks.load();
+}
+
+void WorkStealingPool::submit(std::function<void()> task)
+{
+    int queue = currentPool == this ? currentQueue : queues.size() - 1;
+    {
+        std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+        queues[queue]->tasks.push_back(std::move(task));
+    }
+    queuedTasks.fetch_add(1);
+    submittedTasks.fetch_add(1, std::memory_order_relaxed);
+
+    /* Taking the lock orders the notification after the check of a worker
+    that is about to sleep, so the wake up can not be lost */
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+}
+
+bool WorkStealingPool::popTask(int queue, bool fromBack,
+    std::function<void()>& task)
+{
+    std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+    std::deque<std::function<void()>>& tasks = queues[queue]->tasks;
+    if (tasks.empty()) {
+        return false;
+    }
+    if (fromBack) {
+        task = std::move(tasks.back());
+        tasks.pop_back();
+    } else {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+    queuedTasks.fetch_sub(1);
+    return true;
+}
+
+/* Runs one task, the newest of the deque of the calling thread or else the
+oldest of another deque. Returns false if every deque was empty. */
+
+bool WorkStealingPool::runPendingTask()
+{
+    const int numberOfQueues = queues.size();
+    const int own = currentPool == this ? currentQueue : numberOfQueues - 1;
+    std::function<void()> task;
+    bool found = popTask(own, true, task);
+    for (int offset = 1; !found && offset < numberOfQueues; offset++) {
+        found = popTask((own + offset) % numberOfQueues, false, task);
+        if (found) {
+            stolenTasks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void WorkStealingPool::workerLoop(int index)
+{
+    currentPool = this;
+    currentQueue = index;
+    while (true) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || queuedTasks.load() > 0; });
+        if (stopping && queuedTasks.load() == 0) {
+            return;
+        }
+    }
+}
+
+long long WorkStealingPool::defaultGrain(long long iterations) const
+{
+    return std::max(1LL, iterations / (8LL * getNumberOfThreads()));
+}
+
+/* Process-wide selection. The pool is created on first use and replaced only by
+setExecutionBackend, which must not be called while loops are running. */
+
+static std::mutex executionMutex;
+static std::unique_ptr<WorkStealingPool> globalPool;
+static std::atomic<int> selectedBackend { -1 };
+
+static int threadsFromEnvironment()
+{
+    const char* threads = std::getenv("NBODY_THREADS");
+    return threads == nullptr ? 0 : std::atoi(threads);
+}
+
+static ExecutionBackend defaultExecutionBackend()
+{
+    const char* name = std::getenv("NBODY_EXECUTION");
+    if (name != nullptr && *name != '\0') {
+        return executionBackendFromName(name);
+    }
+#ifdef NBODY_EXECUTION_WORK_STEALING
+    return ExecutionBackend::workStealing;
+#else
+    return ExecutionBackend::openmp;
+#endif
+}
+
+void setExecutionBackend(ExecutionBackend backend, int threads)
+{
+    std::lock_guard<std::mutex> lock(executionMutex);
+    if (backend == ExecutionBackend::workStealing) {
+        if (threads <= 0) {
+            threads = threadsFromEnvironment();
+        }
+        if (!globalPool || (threads > 0 && globalPool->getNumberOfThreads() != threads)) {
+            globalPool.reset();
+            globalPool = std::make_unique<WorkStealingPool>(threads);
+        }
+    }
+    selectedBackend = static_cast<int>(backend);
+}
+
+ExecutionBackend executionBackend()
+{
+    int backend = selectedBackend.load();
+    if (backend < 0) {
+        std::lock_guard<std::mutex> lock(executionMutex);
+        if (selectedBackend.load() < 0) {
+            selectedBackend = static_cast<int>(defaultExecutionBackend());
+        }
+        backend = selectedBackend.load();
+    }
+    return static_cast<ExecutionBackend>(backend);
+}
+
+bool usingWorkStealingPool()
+{
+    return executionBackend() == ExecutionBackend::workStealing;
+}
+
+WorkStealingPool& threadPool()
+{
+    std::lock_guard<std::mutex> lock(executionMutex);
+    if (!globalPool) {
+        globalPool = std::make_unique<WorkStealingPool>(threadsFromEnvironment());
+    }
+    return *globalPool;
+}
@@ -0,0 +1,104 @@
+#include "fieldEvaluation.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/* Probes handled by one iteration of the parallel loop, and sources summed
+ * for all of them before moving to the next ones, so that the tile of sources
+ * stays in cache while the probes of the block use it */
+
+static const int probeBlockSize = 64;
+static const int sourceTileSize = 2048;
+
+/* Field of the sources at the probes by direct summation: the potential
+-sum_j m_j / sqrt(r^2 + epsilon^2) and the softened acceleration of
+calcAcceleration. The probes are targets only: they have no mass and do not
+act on the sources or on each other, so the cost is O(probes * sources)
+instead of the O((probes + sources)^2) of adding them to the system.
+
+The sources are first copied into one array per component, so that the
+inner loop over them reads contiguous doubles and is vectorised; a source
+at the position of a probe (without softening) or beyond cutoffRadius (if it
+is positive) is masked out with a select instead of a branch. The blocks of
+probes are shared among the threads. */
+
+FieldValues evaluateFieldDirect(ConstParticleSpan sources,
+    const std::vector<Eigen::Vector3d>& probes, double epsilon,
+    double cutoffRadius)
+{
+    const int n = sources.size();
+    const int numberOfProbes = probes.size();
+    const double epsilonSquared = epsilon * epsilon;
+    const double cutoffSquared = cutoffRadius > 0 ? cutoffRadius * cutoffRadius : std::numeric_limits<double>::infinity();
+    std::vector<double> mass(n), x(n), y(n), z(n);
+    auto gatherSource = [&](int j) {
+        mass[j] = sources[j].getMass();
+        x[j] = sources[j].getPosition()(0);
+        y[j] = sources[j].getPosition()(1);
+        z[j] = sources[j].getPosition()(2);
+    };
+    FieldValues field;
+    field.potential.assign(numberOfProbes, 0.);
+    field.acceleration.assign(numberOfProbes, Eigen::Vector3d(0., 0., 0.));
+    const int blocks = (numberOfProbes + probeBlockSize - 1) / probeBlockSize;
+    const double* sourceMass = mass.data();
+    const double* sourceX = x.data();
+    const double* sourceY = y.data();
+    const double* sourceZ = z.data();
+    auto evaluateBlock = [&](int block) {
+        int first = block * probeBlockSize;
+        int last = std::min(numberOfProbes, first + probeBlockSize);
+        for (int tile = 0; tile < n; tile = tile + sourceTileSize) {
+            int tileEnd = std::min(n, tile + sourceTileSize);
+            for (int probe = first; probe < last; probe++) {
+                const double px = probes[probe](0);
+                const double py = probes[probe](1);
+                const double pz = probes[probe](2);
+                double potential = 0., ax = 0., ay = 0., az = 0.;
+#pragma omp simd reduction(+ : potential, ax, ay, az)
+                for (int j = tile; j < tileEnd; j++) {
+                    double dx = sourceX[j] - px;
+                    double dy = sourceY[j] - py;
+                    double dz = sourceZ[j] - pz;
+                    double distanceSquared = dx * dx + dy * dy + dz * dz;
+                    double softened = distanceSquared + epsilonSquared;
+                    double inverse = (softened > 0 && distanceSquared < cutoffSquared) ? 1. / std::sqrt(softened) : 0.;
+                    double weighted = sourceMass[j] * inverse;
+                    double factor = weighted * inverse * inverse;
+                    potential = potential - weighted;
+                    ax = ax + factor * dx;
+                    ay = ay + factor * dy;
+                    az = az + factor * dz;
+                }
+                field.potential[probe] = field.potential[probe] + potential;
+                field.acceleration[probe] = field.acceleration[probe] + Eigen::Vector3d(ax, ay, az);
+            }
+        }
+    };
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int j = first; j < last; j++) {
+                gatherSource(j);
+            }
+        });
+        pool.parallelFor(0, blocks, 1, [&](long long first, long long last) {
+            for (int block = first; block < last; block++) {
+                evaluateBlock(block);
+            }
+        });
+        return field;
+    }
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < n; j++) {
+        gatherSource(j);
+    }
+#pragma omp parallel for schedule(static)
+    for (int block = 0; block < blocks; block++) {
+        evaluateBlock(block);
+    }
+    return field;
+}
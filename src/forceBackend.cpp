@@ -0,0 +1,142 @@
+#include "forceBackend.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+FieldValues ForceBackend::evaluateField(ConstParticleSpan sources,
+    const std::vector<Eigen::Vector3d>& probes, double epsilon)
+{
+    return evaluateFieldDirect(sources, probes, epsilon);
+}
+
+DirectSummationBackend::DirectSummationBackend(int tileSizeArgument)
+{
+    if (tileSizeArgument < 0) {
+        throw std::invalid_argument("\nThe tile size of the direct summation cannot be negative.\n");
+    }
+    tileSize = tileSizeArgument;
+}
+
+std::string DirectSummationBackend::getName() const
+{
+    return "direct";
+}
+
+int DirectSummationBackend::getTileSize() const
+{
+    return tileSize;
+}
+
+/* A planar system stays planar for the whole run, and mergers of planar
+ * bodies are planar too, so the O(N) scan is not repeated at every step */
+
+void DirectSummationBackend::startEvolution(bool planar)
+{
+    planarSystem = planar;
+}
+
+/* Computes the acceleration of every particle due to all the others, with the
+ * kernel variant for the softening factor, and for planar systems, chosen once
+ * before the loop */
+
+void DirectSummationBackend::computeAccelerations(
+    ParticleSpan particles, double epsilon)
+{
+    if (tileSize > 0) {
+        computeTiledAccelerations(particles, epsilon);
+        return;
+    }
+    AccelerationKernel kernel = selectAccelerationKernel(epsilon, planarSystem);
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, particles.size(), 0, [&](long long first, long long last) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            for (int i = first; i < last; i++) {
+                particles.at(i).setAcceleration(kernel(particles, i, epsilon));
+            }
+            INSTRUMENT_PAIRS((last - first) * (particles.size() - 1));
+        });
+        return;
+    }
+#pragma omp parallel
+    {
+        {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            long long pairsEvaluated = 0;
+#pragma omp for schedule(runtime) nowait
+            for (int i = 0; i < particles.size(); i++) {
+                particles.at(i).setAcceleration(kernel(particles, i, epsilon));
+                pairsEvaluated = pairsEvaluated + particles.size() - 1;
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+        }
+    }
+}
+
+/* Tiled version: the loop is over the tiles of tileSize particles, and every
+ * thread sums the accelerations of its tile in a buffer of its own, one tile of
+ * sources after the other. The sums are the same as in the untiled loop up to
+ * the order of the additions. */
+
+void DirectSummationBackend::computeTiledAccelerations(ParticleSpan particles,
+    double epsilon)
+{
+    PartialAccelerationKernel kernel = selectPartialAccelerationKernel(epsilon, planarSystem);
+    const int n = particles.size();
+    const int tiles = (n + tileSize - 1) / tileSize;
+    auto computeTile = [&](int tile, std::vector<Eigen::Vector3d>& tileAccelerations) {
+        int first = tile * tileSize;
+        int last = std::min(n, first + tileSize);
+        for (int i = first; i < last; i++) {
+            tileAccelerations[i - first] = Eigen::Vector3d(0., 0., 0.);
+        }
+        for (int sources = 0; sources < n; sources = sources + tileSize) {
+            int lastSource = std::min(n, sources + tileSize);
+            for (int i = first; i < last; i++) {
+                tileAccelerations[i - first] = tileAccelerations[i - first] + kernel(particles, i, sources, lastSource, epsilon);
+            }
+        }
+        for (int i = first; i < last; i++) {
+            particles.at(i).setAcceleration(tileAccelerations[i - first]);
+        }
+        return (long long)(last - first) * (n - 1);
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, tiles, 1, [&](long long firstTile, long long lastTile) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            std::vector<Eigen::Vector3d> tileAccelerations(tileSize);
+            long long pairsEvaluated = 0;
+            for (int tile = firstTile; tile < lastTile; tile++) {
+                pairsEvaluated = pairsEvaluated + computeTile(tile, tileAccelerations);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        });
+        return;
+    }
+#pragma omp parallel
+    {
+        {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            long long pairsEvaluated = 0;
+            std::vector<Eigen::Vector3d> tileAccelerations(tileSize);
+#pragma omp for schedule(runtime) nowait
+            for (int tile = 0; tile < tiles; tile++) {
+                pairsEvaluated = pairsEvaluated + computeTile(tile, tileAccelerations);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+        }
+    }
+}
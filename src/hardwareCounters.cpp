@@ -0,0 +1,264 @@
+#include "hardwareCounters.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* The counters are only read if they have been switched on at run time, so
+that a build with the instrumentation compiled in does not pay for the system
+calls unless somebody asks for the numbers */
+
+static std::atomic<bool> countersEnabled(false);
+static std::mutex statusMutex;
+static std::string lastStatus = "hardware counters not enabled";
+static bool eventAvailable[numberOfHardwareEvents] = {};
+
+std::string hardwareEventName(HardwareEvent event)
+{
+    switch (event) {
+    case HardwareEvent::cycles:
+        return "cycles";
+    case HardwareEvent::instructions:
+        return "instructions";
+    case HardwareEvent::l1DataMisses:
+        return "l1DataMisses";
+    case HardwareEvent::lastLevelCacheMisses:
+        return "lastLevelCacheMisses";
+    case HardwareEvent::fpOperations:
+        return "fpOperations";
+    default:
+        return "unknown";
+    }
+}
+
+#ifdef __linux__
+
+/* Fills the perf_event_attr structure for one of the events. It returns false
+for the events that have no description on this machine. */
+
+static bool describeEvent(HardwareEvent event, perf_event_attr* attributes)
+{
+    std::memset(attributes, 0, sizeof(perf_event_attr));
+    attributes->size = sizeof(perf_event_attr);
+    switch (event) {
+    case HardwareEvent::cycles:
+        attributes->type = PERF_TYPE_HARDWARE;
+        attributes->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case HardwareEvent::instructions:
+        attributes->type = PERF_TYPE_HARDWARE;
+        attributes->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case HardwareEvent::l1DataMisses:
+        attributes->type = PERF_TYPE_HW_CACHE;
+        attributes->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case HardwareEvent::lastLevelCacheMisses:
+        attributes->type = PERF_TYPE_HARDWARE;
+        attributes->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case HardwareEvent::fpOperations: {
+        /* Raw event code of the floating point counter of the CPU in use, e.g.
+        NBODY_PERF_FP_EVENT=0x15c7 on recent Intel cores */
+
+        const char* rawEvent = std::getenv("NBODY_PERF_FP_EVENT");
+        if (rawEvent == nullptr) {
+            return false;
+        }
+        attributes->type = PERF_TYPE_RAW;
+        attributes->config = std::strtoull(rawEvent, nullptr, 0);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    /* Only the user space part of the calling thread is measured, which is
+    what an unprivileged process is allowed to do with perf_event_paranoid <= 2
+    */
+
+    attributes->exclude_kernel = 1;
+    attributes->exclude_hv = 1;
+    attributes->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return true;
+}
+
+HardwareCounterGroup::HardwareCounterGroup()
+{
+    int firstError = 0;
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        fileDescriptors[event] = -1;
+        perf_event_attr attributes;
+        if (!describeEvent(static_cast<HardwareEvent>(event), &attributes)) {
+            continue;
+        }
+        attributes.disabled = leaderDescriptor == -1 ? 1 : 0;
+        int descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1,
+            leaderDescriptor, 0);
+        if (descriptor == -1) {
+            if (firstError == 0) {
+                firstError = errno;
+                status = hardwareEventName(static_cast<HardwareEvent>(event))
+                    + ": " + std::strerror(errno);
+            }
+            continue;
+        }
+        if (leaderDescriptor == -1) {
+            leaderDescriptor = descriptor;
+        }
+        fileDescriptors[event] = descriptor;
+        openedEvents++;
+    }
+    if (leaderDescriptor == -1) {
+        if (firstError == EACCES || firstError == EPERM) {
+            status = status + " (check /proc/sys/kernel/perf_event_paranoid)";
+        }
+        return;
+    }
+    ioctl(leaderDescriptor, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leaderDescriptor, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    if (status.empty()) {
+        status = "all events available";
+    }
+}
+
+HardwareCounterGroup::~HardwareCounterGroup()
+{
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        if (fileDescriptors[event] != -1) {
+            close(fileDescriptors[event]);
+        }
+    }
+}
+
+/* Reads the running totals of the group. The counters keep running, so the
+callers take the difference between two reads. If the kernel had to multiplex
+the group the values are scaled by the fraction of time it was counting. */
+
+void HardwareCounterGroup::read(long long values[numberOfHardwareEvents]) const
+{
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        values[event] = 0;
+    }
+    if (leaderDescriptor == -1) {
+        return;
+    }
+    unsigned long long buffer[3 + numberOfHardwareEvents];
+    if (::read(leaderDescriptor, buffer, sizeof(buffer)) <= 0) {
+        return;
+    }
+    unsigned long long timeEnabled = buffer[1];
+    unsigned long long timeRunning = buffer[2];
+    double scale = timeRunning > 0 ? (double)timeEnabled / timeRunning : 0.;
+    int position = 0;
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        if (fileDescriptors[event] != -1) {
+            values[event] = buffer[3 + position] * scale;
+            position++;
+        }
+    }
+}
+
+#else
+
+/* Without perf_event_open the group is never available */
+
+HardwareCounterGroup::HardwareCounterGroup()
+{
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        fileDescriptors[event] = -1;
+    }
+    status = "hardware counters need Linux perf_event_open";
+}
+
+HardwareCounterGroup::~HardwareCounterGroup() { }
+
+void HardwareCounterGroup::read(long long values[numberOfHardwareEvents]) const
+{
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        values[event] = 0;
+    }
+}
+
+#endif
+
+bool HardwareCounterGroup::isAvailable() const
+{
+    return leaderDescriptor != -1;
+}
+
+bool HardwareCounterGroup::isEventAvailable(HardwareEvent event) const
+{
+    return fileDescriptors[static_cast<int>(event)] != -1;
+}
+
+std::string HardwareCounterGroup::getStatus() const
+{
+    return status;
+}
+
+HardwareCounterGroup& threadHardwareCounters()
+{
+    thread_local HardwareCounterGroup group;
+    return group;
+}
+
+/* Switches the counters on. The group of the calling thread is opened straight
+away to find out whether the kernel allows them: if it does not, the counters
+stay off, the reason is kept in hardwareCountersStatus() and the simulation
+runs exactly as without them. */
+
+bool enableHardwareCounters()
+{
+#ifndef NBODY_INSTRUMENTATION
+    /* The kernels have no scopes that read the counters, so enabling them would
+     * only report zeros */
+
+    std::lock_guard<std::mutex> lock(statusMutex);
+    lastStatus = "the library was built with NBODY_INSTRUMENTATION=OFF";
+    countersEnabled = false;
+    return false;
+#else
+    HardwareCounterGroup& group = threadHardwareCounters();
+    std::lock_guard<std::mutex> lock(statusMutex);
+    lastStatus = group.getStatus();
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        eventAvailable[event] = group.isEventAvailable(static_cast<HardwareEvent>(event));
+    }
+    countersEnabled = group.isAvailable();
+    return countersEnabled;
+#endif
+}
+
+void disableHardwareCounters()
+{
+    countersEnabled = false;
+}
+
+bool hardwareCountersEnabled()
+{
+    return countersEnabled.load(std::memory_order_relaxed);
+}
+
+bool hardwareEventAvailable(HardwareEvent event)
+{
+    std::lock_guard<std::mutex> lock(statusMutex);
+    return countersEnabled && eventAvailable[static_cast<int>(event)];
+}
+
+std::string hardwareCountersStatus()
+{
+    std::lock_guard<std::mutex> lock(statusMutex);
+    return lastStatus;
+}
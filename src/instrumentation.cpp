@@ -0,0 +1,489 @@
+#include "instrumentation.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+/* Name of a phase as it appears in the JSON output */
+
+std::string phaseName(Phase phase)
+{
+    switch (phase) {
+    case Phase::force:
+        return "force";
+    case Phase::update:
+        return "update";
+    case Phase::energy:
+        return "energy";
+    case Phase::reordering:
+        return "reordering";
+    case Phase::io:
+        return "io";
+    case Phase::synchronisation:
+        return "synchronisation";
+    default:
+        return "unknown";
+    }
+}
+
+/* Identifier of each instance, never reused, so that a new instance built
+ * where a destroyed one was is not mistaken for it */
+
+static std::atomic<std::uint64_t> nextInstanceId { 1 };
+
+PerformanceCounters::PerformanceCounters()
+    : instanceId(nextInstanceId.fetch_add(1))
+{
+}
+
+/* Returns the counters of the calling thread, registering a new slot the first
+time a thread asks for it. Each thread caches its slot of the last instance it
+reported to in thread_local variables, so as long as it reports to the same
+instance no lock is taken; switching between instances looks the slot up again.
+The OpenMP threads are kept alive by the runtime between parallel regions, so
+each of them keeps the same slot for the whole run. */
+
+ThreadCounters& PerformanceCounters::getThreadCounters()
+{
+    thread_local std::uint64_t cachedInstance = 0;
+    thread_local ThreadCounters* cachedSlot = nullptr;
+    if (cachedInstance == instanceId) {
+        return *cachedSlot;
+    }
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    ThreadCounters*& slot = slotOfThread[std::this_thread::get_id()];
+    if (slot == nullptr) {
+        slots.push_back(std::make_unique<ThreadCounters>());
+        slot = slots.back().get();
+    }
+    cachedInstance = instanceId;
+    cachedSlot = slot;
+    return *slot;
+}
+
+/* Sets every counter back to zero. It must be called outside parallel regions
+ */
+
+void PerformanceCounters::reset()
+{
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    for (auto& slot : slots) {
+        *slot = ThreadCounters();
+    }
+}
+
+int PerformanceCounters::getNumberOfThreads() const
+{
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    return slots.size();
+}
+
+/* Copy of the counters of every thread that reported something */
+
+std::vector<ThreadCounters> PerformanceCounters::getCountersPerThread() const
+{
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    std::vector<ThreadCounters> countersPerThread;
+    for (const auto& slot : slots) {
+        countersPerThread.push_back(*slot);
+    }
+    return countersPerThread;
+}
+
+/* Sum of the counters over all the threads */
+
+ThreadCounters PerformanceCounters::getTotals() const
+{
+    ThreadCounters totals;
+    for (const ThreadCounters& counters : getCountersPerThread()) {
+        for (int phase = 0; phase < numberOfPhases; phase++) {
+            totals.phaseSeconds[phase] += counters.phaseSeconds[phase];
+            totals.phaseCalls[phase] += counters.phaseCalls[phase];
+        }
+        totals.pairInteractions += counters.pairInteractions;
+        for (int phase = 0; phase < numberOfPhases; phase++) {
+            totals.phasePairInteractions[phase] += counters.phasePairInteractions[phase];
+        }
+        totals.bytesAllocated += counters.bytesAllocated;
+        for (int phase = 0; phase < numberOfPhases; phase++) {
+            for (int event = 0; event < numberOfHardwareEvents; event++) {
+                totals.hardwareEvents[phase][event] += counters.hardwareEvents[phase][event];
+            }
+        }
+    }
+    return totals;
+}
+
+double PerformanceCounters::getPhaseSeconds(Phase phase) const
+{
+    return getTotals().phaseSeconds[static_cast<int>(phase)];
+}
+
+/* Ratio between the slowest thread and the average thread for a phase. A value
+of 1 means that the work was perfectly balanced between the threads. */
+
+double PerformanceCounters::getLoadImbalance(Phase phase) const
+{
+    double maximumSeconds = 0.;
+    double totalSeconds = 0.;
+    int threadsInPhase = 0;
+    for (const ThreadCounters& counters : getCountersPerThread()) {
+        if (counters.phaseCalls[static_cast<int>(phase)] == 0) {
+            continue;
+        }
+        double seconds = counters.phaseSeconds[static_cast<int>(phase)];
+        maximumSeconds = std::max(maximumSeconds, seconds);
+        totalSeconds = totalSeconds + seconds;
+        threadsInPhase++;
+    }
+    if (threadsInPhase == 0 || totalSeconds == 0.) {
+        return 1.;
+    }
+    return maximumSeconds / (totalSeconds / threadsInPhase);
+}
+
+long long PerformanceCounters::getPairInteractions() const
+{
+    return getTotals().pairInteractions;
+}
+
+/* Pair interactions counted inside the given phase, e.g. only those of the
+ * force evaluations and not those of the energies */
+
+long long PerformanceCounters::getPairInteractions(Phase phase) const
+{
+    return getTotals().phasePairInteractions[static_cast<int>(phase)];
+}
+
+double PerformanceCounters::getBarrierWaitSeconds() const
+{
+    return getPhaseSeconds(Phase::synchronisation);
+}
+
+long long PerformanceCounters::getBytesAllocated() const
+{
+    return getTotals().bytesAllocated;
+}
+
+/* Average number of floating point operations in one call of calcAcceleration
+(difference of the positions, squared distance, softening, the square root and
+the division, and the scaling of the vector), used when the CPU cannot count
+them */
+
+static constexpr double flopsPerInteraction = 20.;
+
+/* Combines the hardware counters of the force and update phases into the
+instructions per cycle, the cache misses per pair interaction and the FLOP rate.
+The interactions are those of the force phase only: the pairs of the energies
+are computed outside the measured phases. The rate uses the time of the slowest
+thread, which is the wall time of the measured phases. */
+
+HardwareCounterSummary PerformanceCounters::getHardwareSummary() const
+{
+    HardwareCounterSummary summary;
+    summary.available = hardwareCountersEnabled();
+    summary.status = hardwareCountersStatus();
+    if (!summary.available) {
+        return summary;
+    }
+    const Phase measuredPhases[] = { Phase::force, Phase::update };
+    long long events[numberOfHardwareEvents] = {};
+    double wallSeconds = 0.;
+    for (const ThreadCounters& counters : getCountersPerThread()) {
+        double threadSeconds = 0.;
+        for (Phase phase : measuredPhases) {
+            threadSeconds = threadSeconds + counters.phaseSeconds[static_cast<int>(phase)];
+            for (int event = 0; event < numberOfHardwareEvents; event++) {
+                events[event] += counters.hardwareEvents[static_cast<int>(phase)][event];
+            }
+        }
+        wallSeconds = std::max(wallSeconds, threadSeconds);
+    }
+    long long interactions = getPairInteractions(Phase::force);
+    long long cycles = events[static_cast<int>(HardwareEvent::cycles)];
+    if (cycles > 0) {
+        summary.instructionsPerCycle = (double)events[static_cast<int>(HardwareEvent::instructions)] / cycles;
+    }
+    if (interactions > 0) {
+        summary.l1DataMissesPerInteraction = (double)events[static_cast<int>(HardwareEvent::l1DataMisses)] / interactions;
+        summary.lastLevelCacheMissesPerInteraction = (double)events[static_cast<int>(HardwareEvent::lastLevelCacheMisses)] / interactions;
+    }
+    double flops = interactions * flopsPerInteraction;
+    if (hardwareEventAvailable(HardwareEvent::fpOperations)) {
+        flops = events[static_cast<int>(HardwareEvent::fpOperations)];
+        summary.flopsMeasured = true;
+    }
+    if (wallSeconds > 0.) {
+        summary.gigaFlopsPerSecond = flops / wallSeconds / 1e9;
+    }
+    return summary;
+}
+
+/* Writes the totals, the load imbalance of each phase and the counters of each
+thread as a JSON object */
+
+void PerformanceCounters::writeJson(std::ostream& output) const
+{
+    std::vector<ThreadCounters> countersPerThread = getCountersPerThread();
+    ThreadCounters totals = getTotals();
+    output << "{\n  \"instrumentationEnabled\": ";
+#ifdef NBODY_INSTRUMENTATION
+    output << "true";
+#else
+    output << "false";
+#endif
+    output << ",\n  \"threads\": " << countersPerThread.size()
+           << ",\n  \"pairInteractions\": " << totals.pairInteractions
+           << ",\n  \"bytesAllocated\": " << totals.bytesAllocated
+           << ",\n  \"barrierWaitSeconds\": "
+           << totals.phaseSeconds[static_cast<int>(Phase::synchronisation)]
+           << ",\n  \"phases\": {";
+    for (int phase = 0; phase < numberOfPhases; phase++) {
+        output << (phase == 0 ? "\n" : ",\n") << "    \""
+               << phaseName(static_cast<Phase>(phase)) << "\": { \"seconds\": "
+               << totals.phaseSeconds[phase]
+               << ", \"calls\": " << totals.phaseCalls[phase]
+               << ", \"pairInteractions\": " << totals.phasePairInteractions[phase]
+               << ", \"loadImbalance\": "
+               << getLoadImbalance(static_cast<Phase>(phase)) << " }";
+    }
+    HardwareCounterSummary hardware = getHardwareSummary();
+    output << "\n  },\n  \"hardwareCounters\": { \"available\": "
+           << (hardware.available ? "true" : "false") << ", \"status\": \""
+           << hardware.status << "\"";
+    if (hardware.available) {
+        output << ", \"instructionsPerCycle\": " << hardware.instructionsPerCycle
+               << ", \"l1DataMissesPerInteraction\": "
+               << hardware.l1DataMissesPerInteraction
+               << ", \"lastLevelCacheMissesPerInteraction\": "
+               << hardware.lastLevelCacheMissesPerInteraction
+               << ", \"gigaFlopsPerSecond\": " << hardware.gigaFlopsPerSecond
+               << ", \"flopsMeasured\": " << (hardware.flopsMeasured ? "true" : "false");
+        for (int event = 0; event < numberOfHardwareEvents; event++) {
+            output << ", \"" << hardwareEventName(static_cast<HardwareEvent>(event))
+                   << "\": "
+                   << totals.hardwareEvents[static_cast<int>(Phase::force)][event]
+                    + totals.hardwareEvents[static_cast<int>(Phase::update)][event];
+        }
+    }
+    output << " },\n  \"perThread\": [";
+    for (int thread = 0; thread < countersPerThread.size(); thread++) {
+        const ThreadCounters& counters = countersPerThread.at(thread);
+        output << (thread == 0 ? "\n" : ",\n") << "    { \"thread\": " << thread;
+        for (int phase = 0; phase < numberOfPhases; phase++) {
+            output << ", \"" << phaseName(static_cast<Phase>(phase))
+                   << "Seconds\": " << counters.phaseSeconds[phase];
+        }
+        output << ", \"pairInteractions\": " << counters.pairInteractions
+               << ", \"bytesAllocated\": " << counters.bytesAllocated << " }";
+    }
+    output << "\n  ]\n}\n";
+}
+
+void PerformanceCounters::writeJson(const std::string& fileName) const
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::runtime_error("\nUnable to open " + fileName
+            + " to write the performance counters.\n");
+    }
+    writeJson(output);
+}
+
+PerformanceCounters& performanceCounters()
+{
+    static PerformanceCounters counters;
+    return counters;
+}
+
+/* Starts a new timeline: the buffers of the threads that already traced are
+emptied (and resized), and the times are counted from now. The number of events
+per thread is rounded up to a power of two, so that the position in the ring is
+a mask. It must be called outside parallel regions. */
+
+void PhaseTracer::enable(std::size_t eventsPerThread)
+{
+    if (eventsPerThread == 0) {
+        throw std::invalid_argument("\nThe trace buffers need room for at least one event.\n");
+    }
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    capacity = 1;
+    while (capacity < eventsPerThread) {
+        capacity = 2 * capacity;
+    }
+    for (auto& trace : traces) {
+        trace->events.assign(capacity, TraceEvent());
+        trace->writtenEvents.store(0);
+    }
+    origin = std::chrono::steady_clock::now();
+    enabled.store(true);
+}
+
+/* Stops recording; the events recorded so far are kept for the export */
+
+void PhaseTracer::disable()
+{
+    enabled.store(false);
+}
+
+bool PhaseTracer::isEnabled() const
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+/* Buffer of the calling thread, created the first time it records an event and
+ * cached in a thread_local pointer as for the counters */
+
+PhaseTracer::ThreadTrace& PhaseTracer::getThreadTrace()
+{
+    thread_local ThreadTrace* traceOfThisThread = nullptr;
+    if (traceOfThisThread == nullptr) {
+        std::lock_guard<std::mutex> lock(tracesMutex);
+        traces.push_back(std::make_unique<ThreadTrace>());
+        traces.back()->events.assign(capacity, TraceEvent());
+        traceOfThisThread = traces.back().get();
+    }
+    return *traceOfThisThread;
+}
+
+/* Writes the event in the next slot of the ring of the calling thread. Only
+ * this thread writes the ring, so no atomic read-modify-write is needed. */
+
+void PhaseTracer::record(Phase phase, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end)
+{
+    ThreadTrace& trace = getThreadTrace();
+    std::uint64_t index = trace.writtenEvents.load(std::memory_order_relaxed);
+    TraceEvent& event = trace.events[index & (capacity - 1)];
+    event.startNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+    event.durationNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    event.phase = phase;
+    trace.writtenEvents.store(index + 1, std::memory_order_release);
+}
+
+/* Number of events held in the buffers, and of those overwritten because a
+ * buffer was full */
+
+long long PhaseTracer::getNumberOfEvents() const
+{
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    long long events = 0;
+    for (const auto& trace : traces) {
+        events = events + std::min<std::uint64_t>(trace->writtenEvents.load(), capacity);
+    }
+    return events;
+}
+
+long long PhaseTracer::getNumberOfDroppedEvents() const
+{
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    long long dropped = 0;
+    for (const auto& trace : traces) {
+        std::uint64_t written = trace->writtenEvents.load();
+        dropped = dropped + (written > capacity ? written - capacity : 0);
+    }
+    return dropped;
+}
+
+/* Writes the events as complete ("X") events of the Chrome Trace Event format,
+one track per thread with its name in a metadata event, the times in
+microseconds. The events of a thread are written from the oldest one still in
+its ring. It must be called when no thread is recording. */
+
+void PhaseTracer::writeChromeTrace(std::ostream& output) const
+{
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (int thread = 0; thread < traces.size(); thread++) {
+        const ThreadTrace& trace = *traces.at(thread);
+        output << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+               << thread << ", \"args\": {\"name\": \"thread " << thread << "\"}}";
+        first = false;
+        std::uint64_t written = trace.writtenEvents.load(std::memory_order_acquire);
+        std::uint64_t oldest = written > capacity ? written - capacity : 0;
+        for (std::uint64_t index = oldest; index < written; index++) {
+            const TraceEvent& event = trace.events[index & (capacity - 1)];
+            output << ",\n{\"name\": \"" << phaseName(event.phase)
+                   << "\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread
+                   << ", \"ts\": " << event.startNanoseconds / 1000 << "." << std::setw(3) << std::setfill('0') << event.startNanoseconds % 1000
+                   << ", \"dur\": " << event.durationNanoseconds / 1000 << "." << std::setw(3) << event.durationNanoseconds % 1000
+                   << std::setfill(' ') << "}";
+        }
+    }
+    output << "\n]}\n";
+}
+
+void PhaseTracer::writeChromeTrace(const std::string& fileName) const
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::runtime_error("\nUnable to open " + fileName
+            + " to write the trace.\n");
+    }
+    writeChromeTrace(output);
+}
+
+PhaseTracer& phaseTracer()
+{
+    static PhaseTracer tracer;
+    return tracer;
+}
+
+/* Phase the calling thread is in, -1 outside the timed phases. The timers
+ * nest, each one restoring the phase of the enclosing one. */
+
+static thread_local int currentPhase = -1;
+
+ScopedPhaseTimer::ScopedPhaseTimer(Phase phaseArgument)
+    : counters(&performanceCounters().getThreadCounters())
+    , phase(phaseArgument)
+    , previousPhase(currentPhase)
+    , start(std::chrono::steady_clock::now())
+{
+    currentPhase = static_cast<int>(phase);
+}
+
+ScopedPhaseTimer::~ScopedPhaseTimer()
+{
+    currentPhase = previousPhase;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    counters->phaseSeconds[static_cast<int>(phase)] += elapsed.count();
+    counters->phaseCalls[static_cast<int>(phase)]++;
+    if (phaseTracer().isEnabled()) {
+        phaseTracer().record(phase, start, end);
+    }
+}
+
+void countPairInteractions(long long count)
+{
+    ThreadCounters& counters = performanceCounters().getThreadCounters();
+    counters.pairInteractions += count;
+    if (currentPhase >= 0) {
+        counters.phasePairInteractions[currentPhase] += count;
+    }
+}
+
+ScopedHardwareCounters::ScopedHardwareCounters(Phase phaseArgument)
+    : active(hardwareCountersEnabled())
+    , phase(phaseArgument)
+{
+    if (active) {
+        threadHardwareCounters().read(startValues);
+    }
+}
+
+ScopedHardwareCounters::~ScopedHardwareCounters()
+{
+    if (!active) {
+        return;
+    }
+    long long endValues[numberOfHardwareEvents];
+    threadHardwareCounters().read(endValues);
+    ThreadCounters& counters = performanceCounters().getThreadCounters();
+    for (int event = 0; event < numberOfHardwareEvents; event++) {
+        counters.hardwareEvents[static_cast<int>(phase)][event] += endValues[event] - startValues[event];
+    }
+}
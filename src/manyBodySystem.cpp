@@ -1,10 +1,17 @@
 #include "manyBodySystem.hpp"
 
+#include "compaction.hpp"
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
 /* This function gives the distance between two particles, by calculating the
 norm of the difference vector between the positions of two particles */
 
 double
-getDistance(Particle* p1, Particle* p2)
+getDistance(const Particle* p1, const Particle* p2)
 {
     Eigen::Vector3d vectorDifference(p1->getPosition() - p2->getPosition());
     return vectorDifference.norm();
@@ -14,7 +21,7 @@ getDistance(Particle* p1, Particle* p2)
  * in page 4 of the assignment instructions */
 
 Eigen::Vector3d
-calcAcceleration(Particle* p1, Particle* p2, double epsilon)
+calcAcceleration(const Particle* p1, const Particle* p2, double epsilon)
 {
     double d = getDistance(p1, p2);
     Eigen::Vector3d accelerationOnP1 = (p2->getMass() * (p2->getPosition() - p1->getPosition())) / (sqrt((d * d + epsilon * epsilon) * (d * d + epsilon * epsilon) * (d * d + epsilon * epsilon)));
@@ -79,8 +86,7 @@ void solarSystemGenerator::generateInitialConditions(int particlesInTheSystem)
 
     systemOfParticles.at(0).setPosition(Eigen::Vector3d(0., 0., 0.));
     systemOfParticles.at(0).setVelocity(Eigen::Vector3d(0., 0., 0.));
-#pragma omp parallel for schedule(runtime)
-    for (int i = 1; i < 9; i++) {
+    auto placePlanet = [&](int i) {
         /* Setting initial conditions of the planets with index i in the vector of
          * planets */
 
@@ -93,24 +99,57 @@ void solarSystemGenerator::generateInitialConditions(int particlesInTheSystem)
             ((-1) * (std::cos(theta))) / std::sqrt(distanceFromCentralStar.at(i)),
             (std::sin(theta)) / std::sqrt(distanceFromCentralStar.at(i)),
             0.0));
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(1, 9, 1, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                placePlanet(i);
+            }
+        });
+        return;
+    }
+#pragma omp parallel for schedule(runtime)
+    for (int i = 1; i < 9; i++) {
+        placePlanet(i);
     }
 }
 
-/* Get the vector of particles (i.e. systemOfParticles) */
+/* Get a copy of the vector of particles (i.e. systemOfParticles) */
 
 std::vector<Particle>
 InitialConditionGenerator::getSystemInformations()
+{
+    INSTRUMENT_BYTES(systemOfParticles.capacity() * sizeof(Particle));
+    return std::vector<Particle>(systemOfParticles.begin(), systemOfParticles.end());
+}
+
+/* Get a read-only view of the particles, without copying them. The view is
+ * invalidated when the number of particles changes (e.g. after a merger). */
+
+ConstParticleSpan InitialConditionGenerator::getSystemView() const
 {
     return systemOfParticles;
 }
 
-/* Get the vector of strings with the names of the planets for printing purposes
- */
+/* Get the vector of strings with the names of the planets for printing purposes.
+ * If merged bodies have been removed, each remaining particle keeps the name it
+ * had when the system was generated. */
 
 std::vector<std::string>
 solarSystemGenerator::getIdentifierParticles()
 {
-    return namesParticles;
+    if (particleIdentifiers.size() != systemOfParticles.size()) {
+        return namesParticles;
+    }
+    std::vector<std::string> names;
+    for (int identifier : particleIdentifiers) {
+        if (identifier < namesParticles.size()) {
+            names.push_back(namesParticles.at(identifier));
+        } else {
+            names.push_back("Body " + std::to_string(identifier));
+        }
+    }
+    return names;
 }
 
 /* This function returns the number of iterations needed for the evolution of
@@ -128,12 +167,379 @@ int InitialConditionGenerator::getNumberOfParticles()
     return numberOfParticles;
 }
 
+/* Time evolved so far, summed over all the calls of evolutionOfSystem */
+
+double InitialConditionGenerator::getElapsedTime()
+{
+    return elapsedTime;
+}
+
 /* This function copy a vector of particles passed as argument into the
  * protected member systemOfParticles */
 
 void InitialConditionGenerator::copySystem(std::vector<Particle>* toCopy)
 {
-    systemOfParticles = *toCopy;
+    systemOfParticles.assign(toCopy->begin(), toCopy->end());
+    numberOfParticles = systemOfParticles.size();
+    particleIdentifiers.clear();
+}
+
+/* Identifier of each particle, i.e. its index in the system before any
+ * particle was removed */
+
+std::vector<int> InitialConditionGenerator::getParticleIdentifiers()
+{
+    fillParticleIdentifiers();
+    return particleIdentifiers;
+}
+
+/* The identifiers are only created when they are needed: until then they are
+ * simply the indices of the particles */
+
+void InitialConditionGenerator::fillParticleIdentifiers()
+{
+    if (particleIdentifiers.size() != systemOfParticles.size()) {
+        particleIdentifiers.resize(systemOfParticles.size());
+        std::iota(particleIdentifiers.begin(), particleIdentifiers.end(), 0);
+    }
+}
+
+/* Removes the particles whose flag in "keep" is zero from every vector indexed
+ * like systemOfParticles, keeping the order of the others */
+
+void InitialConditionGenerator::compactParticles(const std::vector<char>& keep)
+{
+    fillParticleIdentifiers();
+    if (distanceFromCentralStar.size() == systemOfParticles.size()) {
+        compactInParallel(distanceFromCentralStar, keep);
+    }
+    compactInParallel(particleIdentifiers, keep);
+    compactInParallel(systemOfParticles, keep);
+    numberOfParticles = systemOfParticles.size();
+    if (forceBackend) {
+        forceBackend->particlesRearranged();
+    }
+}
+
+/* Stores the particles in the order in which a space filling curve visits
+ * their positions every intervalArgument steps of evolutionOfSystem, so that
+ * particles close in space are also close in memory and the loops over the
+ * neighbours of a particle reuse the cache lines already loaded. */
+
+void InitialConditionGenerator::enableReordering(SpaceFillingCurve curve,
+    int intervalArgument)
+{
+    if (intervalArgument < 0) {
+        throw std::invalid_argument(
+            "\nThe interval between the reorderings cannot be negative.\n");
+    }
+    reorderingCurve = curve;
+    reorderingInterval = intervalArgument;
+}
+
+/* Reorders the particles along the curve now. Every vector indexed like
+ * systemOfParticles is permuted in the same way, and the identifiers follow
+ * the particles, so getParticleIdentifiers and the names of the bodies stay
+ * the same as without the reordering. */
+
+void InitialConditionGenerator::reorderParticles(SpaceFillingCurve curve)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        INSTRUMENT_PHASE(Phase::reordering);
+        fillParticleIdentifiers();
+        std::vector<int> order = spaceFillingCurveOrder(systemOfParticles, curve);
+        if (distanceFromCentralStar.size() == systemOfParticles.size()) {
+            permuteInParallel(distanceFromCentralStar, order);
+        }
+        permuteInParallel(particleIdentifiers, order);
+        permuteInParallel(systemOfParticles, order);
+    }
+    if (forceBackend) {
+        forceBackend->particlesRearranged();
+    }
+    numberOfReorderings++;
+    reorderingSeconds = reorderingSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Number of reorderings done so far and the time spent in them, to be compared
+ * with the time saved in the steps when choosing the interval */
+
+int InitialConditionGenerator::getNumberOfReorderings()
+{
+    return numberOfReorderings;
+}
+
+double InitialConditionGenerator::getReorderingSeconds()
+{
+    return reorderingSeconds;
+}
+
+/* Looks for the pairs of particles closer than encounterRadiusArgument every
+ * checkIntervalArgument steps of evolutionOfSystem. With mergeBodiesArgument
+ * each group of close particles is replaced by one body with their total mass
+ * and momentum, instead of letting the huge accelerations of the encounter
+ * blow up the integration. A radius of 0 switches the search off. */
+
+void InitialConditionGenerator::enableCloseEncounters(
+    double encounterRadiusArgument, int checkIntervalArgument,
+    bool mergeBodiesArgument)
+{
+    if (encounterRadiusArgument < 0) {
+        throw std::invalid_argument("\nThe encounter radius cannot be negative.\n");
+    }
+    if (checkIntervalArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe interval between the encounter checks must be a positive number of steps.\n");
+    }
+    encounterRadius = encounterRadiusArgument;
+    encounterCheckInterval = checkIntervalArgument;
+    mergeBodies = mergeBodiesArgument;
+}
+
+/* Number of close pairs found, summed over all the checks */
+
+int InitialConditionGenerator::getNumberOfEncounters()
+{
+    return numberOfEncounters;
+}
+
+/* Number of particles removed because they were merged into another one */
+
+int InitialConditionGenerator::getNumberOfMergers()
+{
+    return numberOfMergers;
+}
+
+/* Close pairs found by the last check, as indices before any merging */
+
+std::vector<EncounterPair> InitialConditionGenerator::getLastEncounters()
+{
+    return lastEncounters;
+}
+
+void InitialConditionGenerator::checkCloseEncounters()
+{
+    if (encounterRadius <= 0 || iterations % encounterCheckInterval != 0) {
+        return;
+    }
+    lastEncounters = findCloseEncounters(systemOfParticles, encounterRadius);
+    numberOfEncounters = numberOfEncounters + lastEncounters.size();
+    if (mergeBodies && !lastEncounters.empty()) {
+        int particlesBefore = systemOfParticles.size();
+        compactParticles(mergeCloseEncounters(systemOfParticles, lastEncounters));
+        numberOfMergers = numberOfMergers + particlesBefore - systemOfParticles.size();
+    }
+}
+
+/* Removes the escapers every checkIntervalArgument steps of evolutionOfSystem:
+ * the particles beyond escapeRadiusArgument from the centre of mass that are
+ * moving away and are no longer bound (see escapers.cpp). They cannot come
+ * back, so they only cost force evaluations; once removed the steps get
+ * cheaper as the system loses them. A radius of 0 switches the pruning off. */
+
+void InitialConditionGenerator::enableEscaperPruning(
+    double escapeRadiusArgument, int checkIntervalArgument)
+{
+    if (escapeRadiusArgument < 0) {
+        throw std::invalid_argument("\nThe escape radius cannot be negative.\n");
+    }
+    if (checkIntervalArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe interval between the escaper checks must be a positive number of steps.\n");
+    }
+    escapeRadius = escapeRadiusArgument;
+    escapeCheckInterval = checkIntervalArgument;
+}
+
+/* Particles removed as escapers so far, in the order they were removed, with
+ * the identifier, step, time and state of each one at its removal */
+
+int InitialConditionGenerator::getNumberOfEscapers()
+{
+    return escapedParticles.size();
+}
+
+std::vector<EscapedParticle> InitialConditionGenerator::getEscapers()
+{
+    return escapedParticles;
+}
+
+void InitialConditionGenerator::pruneEscapers()
+{
+    if (escapeRadius <= 0 || iterations % escapeCheckInterval != 0) {
+        return;
+    }
+    std::size_t archived = escapedParticles.size();
+    std::vector<char> keep = findEscapers(systemOfParticles, escapeRadius, escapedParticles);
+    if (escapedParticles.size() == archived) {
+        return;
+    }
+    fillParticleIdentifiers();
+    for (std::size_t k = archived; k < escapedParticles.size(); k++) {
+        escapedParticles[k].identifier = particleIdentifiers[escapedParticles[k].index];
+        escapedParticles[k].step = iterations;
+        escapedParticles[k].time = elapsedTime;
+    }
+    compactParticles(keep);
+}
+
+/* Timers and counters filled by the instrumented kernels. They are the
+ * process-wide ones of performanceCounters(), not those of one system: every
+ * system evolved in the process (and every other instrumented loop) adds to
+ * them, so they should be reset before the run one wants to measure, and they
+ * only describe one system if it is the only one evolving. */
+
+const PerformanceCounters& InitialConditionGenerator::getProcessPerformanceCounters()
+{
+    return performanceCounters();
+}
+
+void InitialConditionGenerator::resetProcessPerformanceCounters()
+{
+    performanceCounters().reset();
+}
+
+/* Selects the force backend used by evolutionOfSystem. A null pointer (the
+ * default) selects the built-in direct summation over all the pairs. */
+
+void InitialConditionGenerator::setForceBackend(
+    std::shared_ptr<ForceBackend> backend)
+{
+    forceBackend = backend;
+}
+
+/* Schedule of the parallel loops over the particles for the following calls
+ * of evolutionOfSystem, in both modes, instead of OMP_SCHEDULE (mode "time")
+ * or the static schedule (mode "steps"). The schedule in place before each run
+ * is restored at its end. */
+
+void InitialConditionGenerator::setLoopSchedule(omp_sched_t kind, int chunk)
+{
+    if (chunk < 0) {
+        throw std::invalid_argument("\nThe chunk size of the schedule cannot be negative.\n");
+    }
+    loopScheduleIsSet = true;
+    loopScheduleKind = kind;
+    loopScheduleChunk = chunk;
+}
+
+/* Planar systems (every z position and velocity exactly zero) are detected at
+ * the beginning of each call of evolutionOfSystem and integrated with the two
+ * dimensional kernels, which is the default. Disabling it keeps the three
+ * dimensional ones, e.g. to compare them. */
+
+void InitialConditionGenerator::enablePlanarKernels(bool enabled)
+{
+    planarKernelsEnabled = enabled;
+}
+
+/* True if the last call of evolutionOfSystem or evolutionInParallelInTime used
+ * the planar kernels */
+
+bool InitialConditionGenerator::usesPlanarKernels()
+{
+    return planar;
+}
+
+/* Potential and acceleration of the system at the probe points, with the
+ * interaction of the force backend (the plain direct summation without one).
+ * The probes are only targets: they do not become particles and do not add to
+ * the cost of the steps. */
+
+FieldValues InitialConditionGenerator::evaluateField(
+    const std::vector<Eigen::Vector3d>& probes, double epsilon)
+{
+    if (forceBackend) {
+        return forceBackend->evaluateField(systemOfParticles, probes, epsilon);
+    }
+    return evaluateFieldDirect(systemOfParticles, probes, epsilon);
+}
+
+std::shared_ptr<ForceBackend> InitialConditionGenerator::getForceBackend()
+{
+    return forceBackend;
+}
+
+/* Attaches a set of observers sampled during evolutionOfSystem (null, the
+ * default, for none). The observers run in the helper thread of the monitor;
+ * evolutionOfSystem waits for them to finish before returning, so the samples
+ * of the run are all in the monitor's buffer afterwards. */
+
+void InitialConditionGenerator::setDiagnostics(
+    std::shared_ptr<DiagnosticsMonitor> monitor)
+{
+    diagnostics = monitor;
+}
+
+std::shared_ptr<DiagnosticsMonitor> InitialConditionGenerator::getDiagnostics()
+{
+    return diagnostics;
+}
+
+/* Attaches a writer of periodic checkpoints (null, the default, for none).
+ * The checkpoints are written by child processes while the evolution goes
+ * on. */
+
+void InitialConditionGenerator::setCheckpointer(
+    std::shared_ptr<ForkCheckpointer> checkpointerArgument)
+{
+    checkpointer = checkpointerArgument;
+}
+
+std::shared_ptr<ForkCheckpointer> InitialConditionGenerator::getCheckpointer()
+{
+    return checkpointer;
+}
+
+/* Attaches the output of the states at given times (null for none). The times
+ * must not be earlier than the time evolved so far. */
+
+void InitialConditionGenerator::setDenseOutput(
+    std::shared_ptr<DenseOutput> output)
+{
+    if (output && output->getNextOutputTime() < elapsedTime) {
+        throw std::invalid_argument("\nThe output times cannot be earlier than the current time of the system\n");
+    }
+    denseOutput = output;
+}
+
+std::shared_ptr<DenseOutput> InitialConditionGenerator::getDenseOutput()
+{
+    return denseOutput;
+}
+
+/* Replaces the system with the one stored in a checkpoint, including the
+ * identifiers of the particles, the number of steps and the time evolved */
+
+void InitialConditionGenerator::restoreCheckpoint(const std::string& fileName)
+{
+    Checkpoint checkpoint = loadCheckpoint(fileName);
+    systemOfParticles.assign(checkpoint.particles.begin(), checkpoint.particles.end());
+    particleIdentifiers = checkpoint.identifiers;
+    iterations = checkpoint.step;
+    elapsedTime = checkpoint.time;
+    numberOfParticles = systemOfParticles.size();
+    if (distanceFromCentralStar.size() != systemOfParticles.size()) {
+        distanceFromCentralStar.clear();
+    }
+}
+
+/* Number of steps of length dt needed to reach "time": time / dt rounded up,
+ * but rounded to the nearest integer when it is one up to the rounding of the
+ * division */
+
+long long stepsToReach(double time, double dt)
+{
+    if (time <= 0) {
+        return 0;
+    }
+    double steps = time / dt;
+    double nearest = std::round(steps);
+    if (std::abs(steps - nearest) <= 1e-9 * std::max(1., nearest)) {
+        return (long long)nearest;
+    }
+    return (long long)std::ceil(steps);
 }
 
 /* Evolution of the system through the calculation of the total acceleration for
@@ -144,95 +550,351 @@ void InitialConditionGenerator::evolutionOfSystem(std::string method,
     double dt,
     double epsilon)
 {
-    /* Looping until the final time has been reached through the dt increments */
+    /* The variant of the direct summation kernel is chosen here, once for the
+     * whole run: the unsoftened one for epsilon == 0, the softened one
+     * otherwise, in two dimensions over columns if the system is planar. A
+     * force backend computes its own accelerations, so the update stays three
+     * dimensional with it, and it is told once whether the run is planar. */
+
+    bool planarSystem = planarKernelsEnabled && isPlanar(systemOfParticles);
+    planar = planarSystem && !forceBackend;
+    accelerationKernel = selectAccelerationKernel(epsilon);
+    planarColumnKernel = selectPlanarColumnKernel(epsilon);
+    updateFunction = selectUpdateFunction(planar);
+    if (forceBackend) {
+        forceBackend->startEvolution(planarSystem);
+    }
 
-    if (method == "time") {
-        double t = 0;
-        while (t < upperLimit) {
-#pragma omp parallel for schedule(runtime)
-            for (int i = 0; i < systemOfParticles.size(); i++) {
-                /* Calculation of the acceleration acting on each particle */
+    /* The initial state is sampled by the observers before the first step */
 
-                systemOfParticles.at(i).calcTotalAcceleration(systemOfParticles,
-                    epsilon);
-            }
-#pragma omp parallel for schedule(runtime)
-            for (int i = 0; i < systemOfParticles.size(); i++) {
-                /* Update of particles's position and velocity */
+    if (diagnostics && iterations == 0) {
+        diagnostics->observe(0, 0., systemOfParticles);
+    }
 
-                systemOfParticles.at(i).update(dt);
-            }
-            t = t + dt;
-            iterations++;
+    /* The clock of the steps starts from the current time, and the output
+     * times that fall on it get the current state */
+
+    clockOriginTime = elapsedTime;
+    clockOriginIteration = iterations;
+    if (denseOutput) {
+        denseOutput->emitCurrent(elapsedTime, systemOfParticles);
+    }
+
+    /* Looping until the final time has been reached through the dt increments.
+     * The number of steps is counted beforehand, so that the rounding of the
+     * sum of the increments does not add a step */
+
+    if (method == "time") {
+        omp_sched_t previousKind;
+        int previousChunk;
+        omp_get_schedule(&previousKind, &previousChunk);
+        if (loopScheduleIsSet) {
+            omp_set_schedule(loopScheduleKind, loopScheduleChunk);
+        }
+        long long steps = stepsToReach(upperLimit, dt);
+        for (long long j = 0; j < steps; j++) {
+            integrateOneStep(dt, epsilon);
         }
+        omp_set_schedule(previousKind, previousChunk);
     } else {
         /* Casting the read variable upperLimit(i.e. the number of steps in this
          * case) to an integer */
 
         int steps = (int)upperLimit;
 
+        /* The loops of this mode have always used the static schedule, whatever
+         * OMP_SCHEDULE says, so the runtime schedule is set to static for the
+         * length of the run, unless a schedule was chosen with setLoopSchedule */
+
+        omp_sched_t previousKind;
+        int previousChunk;
+        omp_get_schedule(&previousKind, &previousChunk);
+        if (loopScheduleIsSet) {
+            omp_set_schedule(loopScheduleKind, loopScheduleChunk);
+        } else {
+            omp_set_schedule(omp_sched_static, 0);
+        }
+
         /* Looping until the final number of steps has been made */
 
         for (int j = 0; j < steps; j++) {
-#pragma omp parallel for
-            for (int i = 0; i < systemOfParticles.size(); i++) {
-                /* Calculation of the acceleration acting on each particle */
+            integrateOneStep(dt, epsilon);
+        }
+        omp_set_schedule(previousKind, previousChunk);
+    }
+    if (diagnostics) {
+        diagnostics->flush();
+    }
+}
 
-                systemOfParticles.at(i).calcTotalAcceleration(systemOfParticles,
-                    epsilon);
+/* Evolution of "steps" steps split in time among the threads with Parareal
+(see parareal.cpp), for systems with too few particles to share them. It uses
+the direct summation and skips the work done between the steps (encounters,
+escapers, reordering, observers, checkpoints and dense output), since the
+intermediate states are only known once the iterations are over. The clock
+moves on by the steps as in evolutionOfSystem, and the planar kernels are
+switched off by enablePlanarKernels as they are there. */
+
+PararealResult InitialConditionGenerator::evolutionInParallelInTime(
+    long long steps, double dt, double epsilon,
+    const PararealSettings& settings)
+{
+    if (forceBackend) {
+        throw std::logic_error("\nThe Parareal evolution only uses the direct summation, not the "
+            + forceBackend->getName() + " backend\n");
+    }
+    PararealSettings generatorSettings = settings;
+    generatorSettings.planarKernels = settings.planarKernels && planarKernelsEnabled;
+    planar = generatorSettings.planarKernels && isPlanar(systemOfParticles);
+    PararealResult result = integrateParareal(systemOfParticles, steps, dt, epsilon, generatorSettings);
+    systemOfParticles.assign(result.finalState.begin(), result.finalState.end());
+    clockOriginTime = elapsedTime;
+    clockOriginIteration = iterations;
+    iterations = iterations + steps;
+    elapsedTime = clockOriginTime + steps * dt;
+    return result;
+}
+
+/* Work done after every step: the step is counted, then the close encounters
+ * are checked, the escapers removed, the particles are reordered if it is due,
+ * the observers due at this step get a snapshot of the system and a checkpoint
+ * is started if one is due */
+
+void InitialConditionGenerator::finishStep(double dt)
+{
+    iterations++;
+    elapsedTime = clockOriginTime + (iterations - clockOriginIteration) * dt;
+    checkCloseEncounters();
+    pruneEscapers();
+    if (reorderingInterval > 0 && iterations % reorderingInterval == 0) {
+        reorderParticles(reorderingCurve);
+    }
+    if (diagnostics) {
+        INSTRUMENT_PHASE(Phase::io);
+        diagnostics->observe(iterations, elapsedTime, systemOfParticles);
+    }
+    if (checkpointer && iterations % checkpointer->getInterval() == 0) {
+        INSTRUMENT_PHASE(Phase::io);
+        fillParticleIdentifiers();
+        checkpointer->checkpoint(iterations, elapsedTime, systemOfParticles,
+            particleIdentifiers);
+    }
+}
+
+/* One whole step: the step itself, the states at the output times inside it
+ * (before a merger or a pruning can change the particles) and the work done
+ * after it. The end of the step is the time finishStep will give it, so an
+ * output time built on the same clock is due exactly at its step. */
+
+void InitialConditionGenerator::integrateOneStep(double dt, double epsilon)
+{
+    double stepStartTime = elapsedTime;
+    double stepEndTime = clockOriginTime + (iterations + 1 - clockOriginIteration) * dt;
+    bool interpolate = denseOutput && denseOutput->isDue(stepEndTime);
+    if (interpolate) {
+        denseOutput->beginStep(systemOfParticles);
+    }
+    advanceOneStep(dt, epsilon);
+    if (interpolate) {
+        INSTRUMENT_PHASE(Phase::io);
+        denseOutput->endStep(stepStartTime, stepEndTime, dt, systemOfParticles);
+    }
+    finishStep(dt);
+}
+
+/* Copies the positions and masses of a planar system into the columns. It is
+ * done at every step: the positions move, and merging, pruning or reordering
+ * between steps change the particles. */
+
+void InitialConditionGenerator::gatherPlanarColumns()
+{
+    const int n = systemOfParticles.size();
+    planarX.resize(n);
+    planarY.resize(n);
+    planarMass.resize(n);
+    auto gatherParticle = [&](int i) {
+        const Eigen::Vector3d& position = systemOfParticles[i].getPosition();
+        planarX[i] = position(0);
+        planarY[i] = position(1);
+        planarMass[i] = systemOfParticles[i].getMass();
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                gatherParticle(i);
             }
-#pragma omp parallel for
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            gatherParticle(i);
+        }
+    }
+}
+
+/* One step of the evolution: accelerations from the current positions, then
+ * update of positions and velocities */
+
+void InitialConditionGenerator::advanceOneStep(double dt, double epsilon)
+{
+    if (forceBackend) {
+        forceBackend->computeAccelerations(systemOfParticles, epsilon);
+    } else if (planar) {
+        gatherPlanarColumns();
+    }
+
+    /* Acceleration on the particle at index i, from the columns for planar
+     * systems */
+
+    const std::size_t n = systemOfParticles.size();
+    auto accelerationOf = [&](int i) {
+        if (planar) {
+            return planarColumnKernel(planarX.data(), planarY.data(),
+                planarMass.data(), n, i, epsilon);
+        }
+        return accelerationKernel(systemOfParticles, i, epsilon);
+    };
+    if (usingWorkStealingPool()) {
+        /* The same loops as tasks of the pool. Waiting for a loop runs its
+        remaining pieces, so there is no barrier time to measure. */
+
+        WorkStealingPool& pool = threadPool();
+        if (!forceBackend) {
+            pool.parallelFor(0, systemOfParticles.size(), 0, [&](long long first, long long last) {
+                INSTRUMENT_PHASE(Phase::force);
+                INSTRUMENT_HARDWARE(Phase::force);
+                for (int i = first; i < last; i++) {
+                    systemOfParticles.at(i).setAcceleration(accelerationOf(i));
+                }
+                INSTRUMENT_PAIRS((last - first) * (systemOfParticles.size() - 1));
+            });
+        }
+        pool.parallelFor(0, systemOfParticles.size(), 0, [&](long long first, long long last) {
+            INSTRUMENT_PHASE(Phase::update);
+            INSTRUMENT_HARDWARE(Phase::update);
+            for (int i = first; i < last; i++) {
+                (systemOfParticles.at(i).*updateFunction)(dt);
+            }
+        });
+        return;
+    }
+#pragma omp parallel
+    {
+        /* The loops are closed with "nowait" and an explicit barrier, so
+        that the time each thread waits for the others is measured */
+
+        if (!forceBackend) {
+            {
+                INSTRUMENT_PHASE(Phase::force);
+                INSTRUMENT_HARDWARE(Phase::force);
+                long long pairsEvaluated = 0;
+#pragma omp for schedule(runtime) nowait
+                for (int i = 0; i < systemOfParticles.size(); i++) {
+                    /* Calculation of the acceleration acting on each particle */
+
+                    systemOfParticles.at(i).setAcceleration(accelerationOf(i));
+                    pairsEvaluated = pairsEvaluated + systemOfParticles.size() - 1;
+                }
+                INSTRUMENT_PAIRS(pairsEvaluated);
+            }
+            {
+                INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+            }
+        }
+        {
+            INSTRUMENT_PHASE(Phase::update);
+            INSTRUMENT_HARDWARE(Phase::update);
+#pragma omp for schedule(runtime) nowait
             for (int i = 0; i < systemOfParticles.size(); i++) {
                 /* Update of particles's position and velocity */
 
-                systemOfParticles.at(i).update(dt);
+                (systemOfParticles.at(i).*updateFunction)(dt);
             }
-            iterations++;
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
         }
     }
 }
 
-/* Function that calculates the total energy of a system of particles */
+/* Function that calculates the total energy of a system of particles, with
+ * the softened potential if epsilon > 0 */
 
 double
-calculateTotalEnergy(std::vector<Particle> particlesInTheSystem)
+calculateTotalEnergy(ConstParticleSpan particlesInTheSystem, double epsilon)
 {
+    if (usingWorkStealingPool()) {
+        return threadPool().parallelReduce(
+            0, particlesInTheSystem.size(), 0, 0., [&](long long first, long long last) {
+                INSTRUMENT_PHASE(Phase::energy);
+                double energy = 0.;
+                for (int i = first; i < last; i++) {
+                    energy = energy + particlesInTheSystem.at(i).calculateKineticEnergy()
+                        + calculatePotentialEnergyOfParticle(particlesInTheSystem, i, epsilon);
+                }
+                INSTRUMENT_PAIRS((last - first) * (particlesInTheSystem.size() - 1));
+                return energy;
+            },
+            [](double a, double b) { return a + b; });
+    }
     double totalKineticEnergy = 0.;
     double totalPotentialEnergy = 0.;
-#pragma omp parallel for reduction(+ \
-                                   : totalKineticEnergy, totalPotentialEnergy)
-    for (int i = 0; i < particlesInTheSystem.size(); i++) {
-        /* Calculation of the total kinetic energy */
+#pragma omp parallel
+    {
+        {
+            INSTRUMENT_PHASE(Phase::energy);
+#pragma omp for reduction(+ \
+                          : totalKineticEnergy, totalPotentialEnergy) nowait
+            for (int i = 0; i < particlesInTheSystem.size(); i++) {
+                /* Calculation of the total kinetic energy */
 
-        totalKineticEnergy = totalKineticEnergy + particlesInTheSystem.at(i).calculateKineticEnergy();
+                totalKineticEnergy = totalKineticEnergy + particlesInTheSystem.at(i).calculateKineticEnergy();
 
-        /* Calculation of the total potential energy */
+                /* Calculation of the total potential energy */
 
-        totalPotentialEnergy = totalPotentialEnergy + particlesInTheSystem.at(i).calculatePotentialEnergy(particlesInTheSystem);
+                totalPotentialEnergy = totalPotentialEnergy + calculatePotentialEnergyOfParticle(particlesInTheSystem, i, epsilon);
+                INSTRUMENT_PAIRS(particlesInTheSystem.size() - 1);
+            }
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+        }
     }
     return totalKineticEnergy + totalPotentialEnergy;
 }
 
-/* Initial conditions generator for a N body system. It is not parallelised
-because we are only benchmarking the evolution part, not the initialisation */
+/* Initial conditions generator for a N body system. The particles are placed
+in parallel: randomValueGenerator seeds an engine of its own at every call, so
+the value of a particle does not depend on the thread or on the order of the
+calls, and the system is the same as with a serial loop. */
 
 void nBodySystemGenerator::generateInitialConditions(int particlesInTheSystem)
 {
     numberOfParticles = particlesInTheSystem;
 
-    /* Creating the first particle (i.e. the central star), setting its initial
-     * conditions and storing it in the vector of particles */
+    /* The storage is allocated once, before the particles are created. Its
+     * pages are first touched in parallel (see numaAllocator.cpp), so they are
+     * spread over the NUMA nodes like the iterations of the compute loops. */
+
+    systemOfParticles.assign(numberOfParticles, Particle(1.));
+    distanceFromCentralStar.assign(numberOfParticles, 0.);
+    if (numberOfParticles == 0) {
+        return;
+    }
+
+    /* Setting the initial conditions of the first particle (i.e. the central
+     * star) */
 
-    systemOfParticles.push_back(Particle(1.));
     systemOfParticles.at(0).setPosition(Eigen::Vector3d(0., 0., 0.));
     systemOfParticles.at(0).setVelocity(Eigen::Vector3d(0., 0., 0.));
-    distanceFromCentralStar.push_back(0);
-    for (int i = 1; i < numberOfParticles; i++) {
-        /* Creating, setting and storing all the other particles */
+    auto placeParticle = [&](int i) {
+        /* Setting all the other particles */
 
-        systemOfParticles.push_back(
-            Particle(randomValueGenerator(1. / 6000000, 1. / 1000)));
-        distanceFromCentralStar.push_back(randomValueGenerator(0.4, 30.));
+        systemOfParticles.at(i).setMass(randomValueGenerator(1. / 6000000, 1. / 1000));
+        distanceFromCentralStar.at(i) = randomValueGenerator(0.4, 30.);
         double theta = randomValueGenerator(0., 2 * M_PI);
         systemOfParticles.at(i).setPosition(
             Eigen::Vector3d(distanceFromCentralStar.at(i) * std::sin(theta),
@@ -242,5 +904,17 @@ void nBodySystemGenerator::generateInitialConditions(int particlesInTheSystem)
             ((-1) * (std::cos(theta))) / std::sqrt(distanceFromCentralStar.at(i)),
             (std::sin(theta)) / std::sqrt(distanceFromCentralStar.at(i)),
             0.0));
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(1, numberOfParticles, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                placeParticle(i);
+            }
+        });
+        return;
+    }
+#pragma omp parallel for schedule(static)
+    for (int i = 1; i < numberOfParticles; i++) {
+        placeParticle(i);
     }
 }
\ No newline at end of file
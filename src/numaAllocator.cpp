@@ -0,0 +1,240 @@
+#include "numaAllocator.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include <atomic>
+#include <dirent.h>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+
+/* Blocks smaller than this are not worth a mapping of their own */
+
+static const std::size_t minimumMappedBytes = 256 * 1024;
+
+static std::atomic<int> currentHugePageMode { static_cast<int>(HugePageMode::none) };
+
+static std::atomic<long long> mappedBytes { 0 };
+static std::atomic<long long> firstTouchedBytes { 0 };
+static std::atomic<long long> explicitHugePageBytes { 0 };
+static std::atomic<long long> transparentHugePageBytes { 0 };
+static std::atomic<long long> hugePageFallbacks { 0 };
+static std::atomic<long long> plainBytes { 0 };
+
+/* Every block handed out is recorded with the way it was obtained, so that it
+is released in the same way even if the huge page mode changes meanwhile */
+
+struct FirstTouchBlock {
+    bool mapped;
+    std::size_t length;
+};
+
+static std::mutex blocksMutex;
+static std::unordered_map<void*, FirstTouchBlock> blocks;
+
+/* Selects the pages used by the next allocations */
+
+void setHugePageMode(HugePageMode mode)
+{
+    currentHugePageMode = static_cast<int>(mode);
+}
+
+HugePageMode getHugePageMode()
+{
+    return static_cast<HugePageMode>(currentHugePageMode.load());
+}
+
+HugePageMode hugePageModeFromName(const std::string& name)
+{
+    if (name == "none") {
+        return HugePageMode::none;
+    }
+    if (name == "transparent") {
+        return HugePageMode::transparent;
+    }
+    if (name == "hugetlb") {
+        return HugePageMode::hugetlb;
+    }
+    throw std::invalid_argument("\nUnknown huge page mode " + name
+        + ": use none, transparent or hugetlb.\n");
+}
+
+std::string hugePageModeName(HugePageMode mode)
+{
+    switch (mode) {
+    case HugePageMode::transparent:
+        return "transparent";
+    case HugePageMode::hugetlb:
+        return "hugetlb";
+    default:
+        return "none";
+    }
+}
+
+/* Number of NUMA nodes listed by the kernel (1 if the information is not
+ * available) */
+
+int getNumberOfNumaNodes()
+{
+    static const int nodes = [] {
+        int count = 0;
+        DIR* directory = opendir("/sys/devices/system/node");
+        if (directory != nullptr) {
+            while (dirent* entry = readdir(directory)) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name.find_first_not_of("0123456789", 4) == std::string::npos) {
+                    count++;
+                }
+            }
+            closedir(directory);
+        }
+        return count > 0 ? count : 1;
+    }();
+    return nodes;
+}
+
+/* Size of the explicit huge pages, read from /proc/meminfo (2 MiB if it is not
+ * there) */
+
+static std::size_t getHugePageSize()
+{
+    static const std::size_t size = [] {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        while (meminfo >> key) {
+            if (key == "Hugepagesize:") {
+                std::size_t kiloBytes = 0;
+                meminfo >> kiloBytes;
+                return kiloBytes * 1024;
+            }
+            meminfo.ignore(256, '\n');
+        }
+        return (std::size_t)2 * 1024 * 1024;
+    }();
+    return size;
+}
+
+static std::size_t roundUp(std::size_t bytes, std::size_t multiple)
+{
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+MemoryPlacementReport getMemoryPlacementReport()
+{
+    MemoryPlacementReport report;
+    report.numaNodes = getNumberOfNumaNodes();
+    report.hugePageMode = getHugePageMode();
+    report.mappedBytes = mappedBytes;
+    report.firstTouchedBytes = firstTouchedBytes;
+    report.explicitHugePageBytes = explicitHugePageBytes;
+    report.transparentHugePageBytes = transparentHugePageBytes;
+    report.hugePageFallbacks = hugePageFallbacks;
+    report.plainBytes = plainBytes;
+    return report;
+}
+
+/* Allocates a block of memory. A large block is mapped directly (from huge
+pages if they are requested and available) and one byte of each page is
+written in a parallel loop with a static schedule: the kernel places a page on
+the NUMA node of the thread that touches it first, so thread t owns the t-th
+share of the block, as it owns the t-th share of the particles in the compute
+loops. This matters only with more than one NUMA node or with huge pages;
+otherwise the block comes from operator new. */
+
+void* allocateFirstTouch(std::size_t bytes)
+{
+    HugePageMode mode = getHugePageMode();
+    bool mapBlock = bytes >= minimumMappedBytes && (getNumberOfNumaNodes() > 1 || mode != HugePageMode::none);
+    if (!mapBlock) {
+        void* memory = ::operator new(bytes);
+        std::lock_guard<std::mutex> lock(blocksMutex);
+        blocks[memory] = { false, bytes };
+        plainBytes += bytes;
+        return memory;
+    }
+    std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::size_t length = roundUp(bytes, pageSize);
+    void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (mode == HugePageMode::hugetlb) {
+        std::size_t hugeLength = roundUp(bytes, getHugePageSize());
+        memory = mmap(nullptr, hugeLength, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            length = hugeLength;
+            pageSize = getHugePageSize();
+            explicitHugePageBytes += length;
+        }
+    }
+#endif
+    if (memory == MAP_FAILED) {
+        if (mode == HugePageMode::hugetlb) {
+            hugePageFallbacks++;
+        }
+        memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (mode == HugePageMode::transparent) {
+#ifdef MADV_HUGEPAGE
+            if (madvise(memory, length, MADV_HUGEPAGE) == 0) {
+                transparentHugePageBytes += length;
+            } else {
+                hugePageFallbacks++;
+            }
+#else
+            hugePageFallbacks++;
+#endif
+        }
+    }
+
+    /* First touch with the same static partition as the compute loops. The
+     * pool gives no such placement: any worker may run any piece, here and in
+     * the loops, so the pages are only touched in parallel to share the cost of
+     * the page faults, not to put them on the node of their readers. */
+
+    char* firstByte = static_cast<char*>(memory);
+    long long pages = length / pageSize;
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, pages, 0, [&](long long first, long long last) {
+            for (long long page = first; page < last; page++) {
+                firstByte[page * pageSize] = 0;
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (long long page = 0; page < pages; page++) {
+            firstByte[page * pageSize] = 0;
+        }
+    }
+    mappedBytes += length;
+    firstTouchedBytes += length;
+    std::lock_guard<std::mutex> lock(blocksMutex);
+    blocks[memory] = { true, length };
+    return memory;
+}
+
+void deallocateFirstTouch(void* memory, std::size_t bytes)
+{
+    if (memory == nullptr) {
+        return;
+    }
+    FirstTouchBlock block = { false, bytes };
+    {
+        std::lock_guard<std::mutex> lock(blocksMutex);
+        auto found = blocks.find(memory);
+        if (found != blocks.end()) {
+            block = found->second;
+            blocks.erase(found);
+        }
+    }
+    if (block.mapped) {
+        munmap(memory, block.length);
+    } else {
+        ::operator delete(memory);
+    }
+}
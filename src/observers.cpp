@@ -0,0 +1,425 @@
+#include "observers.hpp"
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+Observer::Observer(int intervalArgument)
+{
+    if (intervalArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe sampling interval of an observer must be a positive number of steps.\n");
+    }
+    interval = intervalArgument;
+}
+
+/* Number of steps between two samples */
+
+int Observer::getInterval() const
+{
+    return interval;
+}
+
+/* Kinetic and potential energy of the particles. The observers run in a helper
+thread next to the threads integrating the system, so the sums are serial and
+do not start another OpenMP team; every pair is visited once. The potential is
+-m1 m2 / sqrt(d^2 + epsilon^2), and pairs at zero distance without softening
+add nothing, as in calculatePotentialEnergyOfParticle. */
+
+static double kineticEnergy(ConstParticleSpan particles)
+{
+    double kinetic = 0.;
+    for (const Particle& particle : particles) {
+        kinetic = kinetic + particle.calculateKineticEnergy();
+    }
+    return kinetic;
+}
+
+static double potentialEnergy(ConstParticleSpan particles, double epsilon)
+{
+    double potential = 0.;
+    double epsilonSquared = epsilon * epsilon;
+    for (int i = 0; i < particles.size(); i++) {
+        const Eigen::Vector3d& position = particles[i].getPosition();
+        double mass = particles[i].getMass();
+        for (int j = i + 1; j < particles.size(); j++) {
+            double distanceSquared = (particles[j].getPosition() - position).squaredNorm() + epsilonSquared;
+            potential = potential - (distanceSquared > 0 ? mass * particles[j].getMass() / std::sqrt(distanceSquared) : 0.);
+        }
+    }
+    return potential;
+}
+
+EnergyObserver::EnergyObserver(int intervalArgument, double epsilonArgument)
+    : Observer(intervalArgument)
+    , epsilon(epsilonArgument)
+{
+}
+
+std::string EnergyObserver::getName() const
+{
+    return "energy";
+}
+
+std::vector<std::string> EnergyObserver::getValueNames() const
+{
+    return { "kinetic", "potential", "total" };
+}
+
+std::vector<double> EnergyObserver::observe(ConstParticleSpan particles) const
+{
+    double kinetic = kineticEnergy(particles);
+    double potential = potentialEnergy(particles, epsilon);
+    return { kinetic, potential, kinetic + potential };
+}
+
+MomentumObserver::MomentumObserver(int intervalArgument)
+    : Observer(intervalArgument)
+{
+}
+
+std::string MomentumObserver::getName() const
+{
+    return "momentum";
+}
+
+std::vector<std::string> MomentumObserver::getValueNames() const
+{
+    return { "px", "py", "pz" };
+}
+
+std::vector<double> MomentumObserver::observe(ConstParticleSpan particles) const
+{
+    Eigen::Vector3d momentum(0., 0., 0.);
+    for (const Particle& particle : particles) {
+        momentum = momentum + particle.getMass() * particle.getVelocity();
+    }
+    return { momentum(0), momentum(1), momentum(2) };
+}
+
+AngularMomentumObserver::AngularMomentumObserver(int intervalArgument)
+    : Observer(intervalArgument)
+{
+}
+
+std::string AngularMomentumObserver::getName() const
+{
+    return "angularMomentum";
+}
+
+std::vector<std::string> AngularMomentumObserver::getValueNames() const
+{
+    return { "lx", "ly", "lz" };
+}
+
+std::vector<double> AngularMomentumObserver::observe(
+    ConstParticleSpan particles) const
+{
+    Eigen::Vector3d angularMomentum(0., 0., 0.);
+    for (const Particle& particle : particles) {
+        angularMomentum = angularMomentum + particle.getMass() * particle.getPosition().cross(particle.getVelocity());
+    }
+    return { angularMomentum(0), angularMomentum(1), angularMomentum(2) };
+}
+
+CentreOfMassObserver::CentreOfMassObserver(int intervalArgument)
+    : Observer(intervalArgument)
+{
+}
+
+std::string CentreOfMassObserver::getName() const
+{
+    return "centreOfMass";
+}
+
+std::vector<std::string> CentreOfMassObserver::getValueNames() const
+{
+    return { "x", "y", "z" };
+}
+
+std::vector<double> CentreOfMassObserver::observe(
+    ConstParticleSpan particles) const
+{
+    double totalMass = 0.;
+    Eigen::Vector3d weightedPosition(0., 0., 0.);
+    for (const Particle& particle : particles) {
+        totalMass = totalMass + particle.getMass();
+        weightedPosition = weightedPosition + particle.getMass() * particle.getPosition();
+    }
+    if (totalMass == 0) {
+        return { 0., 0., 0. };
+    }
+    Eigen::Vector3d centre = weightedPosition / totalMass;
+    return { centre(0), centre(1), centre(2) };
+}
+
+VirialRatioObserver::VirialRatioObserver(int intervalArgument,
+    double epsilonArgument)
+    : Observer(intervalArgument)
+    , epsilon(epsilonArgument)
+{
+}
+
+std::string VirialRatioObserver::getName() const
+{
+    return "virialRatio";
+}
+
+std::vector<std::string> VirialRatioObserver::getValueNames() const
+{
+    return { "ratio" };
+}
+
+std::vector<double> VirialRatioObserver::observe(
+    ConstParticleSpan particles) const
+{
+    double potential = potentialEnergy(particles, epsilon);
+    if (potential == 0) {
+        return { 0. };
+    }
+    return { 2. * kineticEnergy(particles) / std::abs(potential) };
+}
+
+SampleRingBuffer::SampleRingBuffer(int capacityArgument)
+{
+    if (capacityArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe capacity of the buffer of samples must be positive.\n");
+    }
+    capacity = capacityArgument;
+}
+
+/* Stores a sample, overwriting the oldest one if the buffer is full */
+
+void SampleRingBuffer::push(DiagnosticSample sample)
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (samples.size() < capacity) {
+        samples.push_back(std::move(sample));
+    } else {
+        samples.at(next) = std::move(sample);
+    }
+    next = (next + 1) % capacity;
+    pushed++;
+}
+
+/* Samples still in the buffer, from the oldest to the newest */
+
+std::vector<DiagnosticSample> SampleRingBuffer::getSamples() const
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (samples.size() < capacity) {
+        return samples;
+    }
+    std::vector<DiagnosticSample> ordered(samples.begin() + next, samples.end());
+    ordered.insert(ordered.end(), samples.begin(), samples.begin() + next);
+    return ordered;
+}
+
+std::vector<DiagnosticSample> SampleRingBuffer::getSamples(
+    const std::string& observer) const
+{
+    std::vector<DiagnosticSample> selected;
+    for (DiagnosticSample& sample : getSamples()) {
+        if (sample.observer == observer) {
+            selected.push_back(std::move(sample));
+        }
+    }
+    return selected;
+}
+
+int SampleRingBuffer::getCapacity() const
+{
+    return capacity;
+}
+
+/* Number of samples pushed since the buffer was created or cleared,
+ * including the ones already overwritten */
+
+long long SampleRingBuffer::getNumberOfPushed() const
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    return pushed;
+}
+
+void SampleRingBuffer::clear()
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    samples.clear();
+    next = 0;
+    pushed = 0;
+}
+
+/* The helper thread starts with the monitor and waits for snapshots. At most
+maximumPendingSnapshotsArgument snapshots wait to be processed: if the
+observers are slower than the integration, observe blocks instead of letting
+the memory grow. */
+
+DiagnosticsMonitor::DiagnosticsMonitor(int bufferCapacity,
+    int maximumPendingSnapshotsArgument)
+    : buffer(bufferCapacity)
+{
+    if (maximumPendingSnapshotsArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe number of pending snapshots must be positive.\n");
+    }
+    maximumPendingSnapshots = maximumPendingSnapshotsArgument;
+    helper = std::thread(&DiagnosticsMonitor::helperLoop, this);
+}
+
+/* The snapshots already taken are processed before the helper thread stops */
+
+DiagnosticsMonitor::~DiagnosticsMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    helper.join();
+}
+
+/* Observers must be added before the first call of observe */
+
+void DiagnosticsMonitor::addObserver(std::shared_ptr<Observer> observer)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    observers.push_back(observer);
+}
+
+/* Called by the integrator after each step. If at least one observer is due at
+ * this step the particles are copied into a snapshot and handed to the helper
+ * thread; otherwise nothing is done. */
+
+void DiagnosticsMonitor::observe(int step, double time,
+    ConstParticleSpan particles)
+{
+    bool due = false;
+    for (const std::shared_ptr<Observer>& observer : observers) {
+        due = due || step % observer->getInterval() == 0;
+    }
+    if (!due) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock,
+        [this] { return pendingSnapshots.size() < maximumPendingSnapshots; });
+    std::vector<Particle> copy;
+    if (!freeSnapshots.empty()) {
+        copy = std::move(freeSnapshots.back());
+        freeSnapshots.pop_back();
+    }
+    copy.assign(particles.begin(), particles.end());
+    pendingSnapshots.push_back({ step, time, std::move(copy) });
+    lock.unlock();
+    queueChanged.notify_all();
+}
+
+/* Waits until every snapshot taken so far has been observed */
+
+void DiagnosticsMonitor::flush()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock,
+        [this] { return pendingSnapshots.empty() && !helperBusy; });
+}
+
+void DiagnosticsMonitor::helperLoop()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        queueChanged.wait(lock,
+            [this] { return stopping || !pendingSnapshots.empty(); });
+        if (pendingSnapshots.empty()) {
+            return;
+        }
+        Snapshot snapshot = std::move(pendingSnapshots.front());
+        pendingSnapshots.pop_front();
+        helperBusy = true;
+        lock.unlock();
+        queueChanged.notify_all();
+
+        for (const std::shared_ptr<Observer>& observer : observers) {
+            if (snapshot.step % observer->getInterval() == 0) {
+                buffer.push({ observer->getName(), snapshot.step, snapshot.time,
+                    observer->observe(snapshot.particles) });
+            }
+        }
+
+        lock.lock();
+        freeSnapshots.push_back(std::move(snapshot.particles));
+        helperBusy = false;
+        queueChanged.notify_all();
+    }
+}
+
+const SampleRingBuffer& DiagnosticsMonitor::getBuffer() const
+{
+    return buffer;
+}
+
+/* Largest |E - E0| / |E0| over the energy samples in the buffer, E0 being the
+ * oldest energy sample still stored */
+
+double DiagnosticsMonitor::getMaximumRelativeEnergyDrift() const
+{
+    std::vector<DiagnosticSample> energies = buffer.getSamples("energy");
+    if (energies.empty() || energies.front().values.at(2) == 0) {
+        return 0.;
+    }
+    double initialEnergy = energies.front().values.at(2);
+    double maximumDrift = 0.;
+    for (const DiagnosticSample& sample : energies) {
+        maximumDrift = std::max(maximumDrift,
+            std::abs((sample.values.at(2) - initialEnergy) / initialEnergy));
+    }
+    return maximumDrift;
+}
+
+/* Writes the samples in the buffer as "observer,step,time,name,value" lines,
+ * one line per value */
+
+void DiagnosticsMonitor::writeCsv(std::ostream& output) const
+{
+    output.precision(17);
+    output << "observer,step,time,name,value\n";
+    for (const DiagnosticSample& sample : buffer.getSamples()) {
+        std::vector<std::string> valueNames;
+        for (const std::shared_ptr<Observer>& observer : observers) {
+            if (observer->getName() == sample.observer) {
+                valueNames = observer->getValueNames();
+            }
+        }
+        for (int v = 0; v < sample.values.size(); v++) {
+            output << sample.observer << "," << sample.step << "," << sample.time
+                   << "," << (v < valueNames.size() ? valueNames.at(v) : std::to_string(v))
+                   << "," << sample.values.at(v) << "\n";
+        }
+    }
+}
+
+void DiagnosticsMonitor::writeCsv(const std::string& fileName) const
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    writeCsv(output);
+}
+
+/* Monitor with all the observers above, sampled every "interval" steps, for an
+ * evolution with softening factor epsilon */
+
+std::shared_ptr<DiagnosticsMonitor> makeStandardDiagnostics(int interval,
+    double epsilon)
+{
+    std::shared_ptr<DiagnosticsMonitor> monitor = std::make_shared<DiagnosticsMonitor>();
+    monitor->addObserver(std::make_shared<EnergyObserver>(interval, epsilon));
+    monitor->addObserver(std::make_shared<MomentumObserver>(interval));
+    monitor->addObserver(std::make_shared<AngularMomentumObserver>(interval));
+    monitor->addObserver(std::make_shared<CentreOfMassObserver>(interval));
+    monitor->addObserver(std::make_shared<VirialRatioObserver>(interval, epsilon));
+    return monitor;
+}
@@ -0,0 +1,502 @@
+#include "outOfCore.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+/* Layout of the file: a header of one page (magic string, number of particles
+ * and number of steps made), then the ten columns of numberOfParticles doubles
+ * each, in the order mass, x, y, z, vx, vy, vz, ax, ay, az. The columns start
+ * on a page boundary, so that parts of them can be advised and synchronised on
+ * their own. */
+
+static const char outOfCoreMagic[8] = { 'N', 'B', 'O', 'D', 'Y', 'O', 'O', 'C' };
+static const std::size_t outOfCoreHeaderBytes = 4096;
+static const int outOfCoreColumns = 10;
+static const int massColumn = 0;
+static const int positionColumn = 1;
+static const int velocityColumn = 4;
+static const int accelerationColumn = 7;
+
+struct OutOfCoreHeader {
+    char magic[8];
+    std::int64_t numberOfParticles;
+    std::int64_t iterations;
+};
+
+static std::size_t fileBytes(long long numberOfParticles)
+{
+    return outOfCoreHeaderBytes + (std::size_t)outOfCoreColumns * numberOfParticles * sizeof(double);
+}
+
+static off_t columnOffset(int index, long long numberOfParticles)
+{
+    return outOfCoreHeaderBytes + (off_t)index * numberOfParticles * sizeof(double);
+}
+
+/* Applies madvise or msync to the pages that hold "bytes" bytes from
+ * "address", which does not need to be on a page boundary */
+
+static void advisePages(const void* address, std::size_t bytes, int advice)
+{
+    std::uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    std::uintptr_t start = (std::uintptr_t)address & ~(pageSize - 1);
+    madvise((void*)start, (std::uintptr_t)address + bytes - start, advice);
+}
+
+static void synchronisePages(const void* address, std::size_t bytes)
+{
+    std::uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    std::uintptr_t start = (std::uintptr_t)address & ~(pageSize - 1);
+    msync((void*)start, (std::uintptr_t)address + bytes - start, MS_ASYNC);
+}
+
+/* Creates the file of a system of numberOfParticles particles, all at rest at
+ * the origin with zero mass, replacing any file with the same name */
+
+void OutOfCoreSystem::create(const std::string& fileName,
+    long long numberOfParticles)
+{
+    if (numberOfParticles <= 0) {
+        throw std::invalid_argument("\nThe number of particles should be higher than 0\n");
+    }
+    int descriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (descriptor < 0) {
+        throw std::runtime_error("\nCannot create the out-of-core file " + fileName + ".\n");
+    }
+    OutOfCoreHeader header {};
+    std::memcpy(header.magic, outOfCoreMagic, sizeof(outOfCoreMagic));
+    header.numberOfParticles = numberOfParticles;
+    header.iterations = 0;
+    bool written = ftruncate(descriptor, fileBytes(numberOfParticles)) == 0
+        && pwrite(descriptor, &header, sizeof(header), 0) == sizeof(header);
+    close(descriptor);
+    if (!written) {
+        throw std::runtime_error("\nCannot create the out-of-core file " + fileName + ".\n");
+    }
+}
+
+/* Number of particles stored in an out-of-core file, 0 if the file does not
+ * exist or is not one */
+
+long long OutOfCoreSystem::numberOfParticlesInFile(const std::string& fileName)
+{
+    int descriptor = open(fileName.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return 0;
+    }
+    OutOfCoreHeader header {};
+    bool valid = pread(descriptor, &header, sizeof(header), 0) == sizeof(header)
+        && std::memcmp(header.magic, outOfCoreMagic, sizeof(outOfCoreMagic)) == 0;
+    close(descriptor);
+    return valid ? header.numberOfParticles : 0;
+}
+
+/* Maps an existing file made by create. The mapping is shared, so what is
+ * written to the particles goes back to the file. */
+
+OutOfCoreSystem::OutOfCoreSystem(const std::string& fileNameArgument,
+    long long blockSizeArgument)
+{
+    if (blockSizeArgument <= 0) {
+        throw std::invalid_argument("\nThe out-of-core block size must be a positive number of particles.\n");
+    }
+    fileName = fileNameArgument;
+    blockSize = blockSizeArgument;
+    numberOfParticles = numberOfParticlesInFile(fileName);
+    if (numberOfParticles <= 0) {
+        throw std::runtime_error("\nThe file " + fileName + " is not an out-of-core system.\n");
+    }
+    file = open(fileName.c_str(), O_RDWR);
+    struct stat status;
+    if (file < 0 || fstat(file, &status) != 0 || (std::size_t)status.st_size < fileBytes(numberOfParticles)) {
+        if (file >= 0) {
+            close(file);
+        }
+        throw std::runtime_error("\nThe out-of-core file " + fileName + " is truncated.\n");
+    }
+    mappingBytes = fileBytes(numberOfParticles);
+    void* address = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (address == MAP_FAILED) {
+        close(file);
+        throw std::runtime_error("\nCannot map the out-of-core file " + fileName + ".\n");
+    }
+    mapping = (char*)address;
+    iterations = ((OutOfCoreHeader*)mapping)->iterations;
+}
+
+OutOfCoreSystem::~OutOfCoreSystem()
+{
+    munmap(mapping, mappingBytes);
+    close(file);
+}
+
+double* OutOfCoreSystem::column(int index) const
+{
+    return (double*)(mapping + columnOffset(index, numberOfParticles));
+}
+
+long long OutOfCoreSystem::getNumberOfParticles() const
+{
+    return numberOfParticles;
+}
+
+long long OutOfCoreSystem::getBlockSize() const
+{
+    return blockSize;
+}
+
+int OutOfCoreSystem::getIterations() const
+{
+    return iterations;
+}
+
+const OutOfCoreStatistics& OutOfCoreSystem::getStatistics() const
+{
+    return statistics;
+}
+
+std::vector<Particle> OutOfCoreSystem::readParticles(long long first,
+    long long count) const
+{
+    if (first < 0 || count < 0 || first + count > numberOfParticles) {
+        throw std::out_of_range("\nThe particles asked for are not in the out-of-core system.\n");
+    }
+    std::vector<Particle> particles;
+    particles.reserve(count);
+    for (long long i = first; i < first + count; i++) {
+        Particle particle(column(massColumn)[i]);
+        particle.setPosition(Eigen::Vector3d(column(positionColumn)[i],
+            column(positionColumn + 1)[i], column(positionColumn + 2)[i]));
+        particle.setVelocity(Eigen::Vector3d(column(velocityColumn)[i],
+            column(velocityColumn + 1)[i], column(velocityColumn + 2)[i]));
+        particle.setAcceleration(Eigen::Vector3d(column(accelerationColumn)[i],
+            column(accelerationColumn + 1)[i], column(accelerationColumn + 2)[i]));
+        particles.push_back(particle);
+    }
+    return particles;
+}
+
+void OutOfCoreSystem::writeParticles(long long first,
+    ConstParticleSpan particles)
+{
+    if (first < 0 || first + (long long)particles.size() > numberOfParticles) {
+        throw std::out_of_range("\nThe particles written do not fit in the out-of-core system.\n");
+    }
+    for (std::size_t k = 0; k < particles.size(); k++) {
+        long long i = first + k;
+        column(massColumn)[i] = particles[k].getMass();
+        for (int axis = 0; axis < 3; axis++) {
+            column(positionColumn + axis)[i] = particles[k].getPosition()(axis);
+            column(velocityColumn + axis)[i] = particles[k].getVelocity()(axis);
+            column(accelerationColumn + axis)[i] = particles[k].getAcceleration()(axis);
+        }
+    }
+}
+
+/* Fills the file with the system of nBodySystemGenerator: a central star of
+ * mass 1 at rest and bodies on circular orbits with radius between 0.4 and 30.
+ * The values come from one generator seeded with "seed", so the bodies are
+ * all different, and they are written a block at a time. */
+
+void OutOfCoreSystem::fillWithNBodySystem(unsigned int seed)
+{
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<double> mass(1. / 6000000, 1. / 1000);
+    std::uniform_real_distribution<double> radius(0.4, 30.);
+    std::uniform_real_distribution<double> angle(0., 2 * M_PI);
+    std::vector<Particle> block;
+    for (long long first = 0; first < numberOfParticles; first = first + blockSize) {
+        long long count = std::min(blockSize, numberOfParticles - first);
+        block.assign(count, Particle(0.));
+        for (long long k = 0; k < count; k++) {
+            if (first + k == 0) {
+                block.at(k) = Particle(1.);
+                block.at(k).setPosition(Eigen::Vector3d(0., 0., 0.));
+                block.at(k).setVelocity(Eigen::Vector3d(0., 0., 0.));
+                continue;
+            }
+            block.at(k) = Particle(mass(generator));
+            double r = radius(generator);
+            double theta = angle(generator);
+            block.at(k).setPosition(Eigen::Vector3d(r * std::sin(theta), r * std::cos(theta), 0.));
+            block.at(k).setVelocity(Eigen::Vector3d(-std::cos(theta) / std::sqrt(r),
+                std::sin(theta) / std::sqrt(r), 0.));
+        }
+        writeParticles(first, block);
+        synchronisePages(column(massColumn) + first, count * sizeof(double));
+    }
+}
+
+/* Makes "steps" steps of the forward Euler scheme of Particle::update. Each
+ * step first computes all the accelerations from the old positions, then
+ * moves the particles. */
+
+void OutOfCoreSystem::advance(int steps, double dt, double epsilon)
+{
+    for (int step = 0; step < steps; step++) {
+        computeAccelerations(epsilon);
+        updateParticles(dt);
+        iterations++;
+        ((OutOfCoreHeader*)mapping)->iterations = iterations;
+    }
+    if (statistics.ioSeconds > 0) {
+        statistics.overlapFraction = std::max(0., 1. - statistics.waitSeconds / statistics.ioSeconds);
+    }
+}
+
+/* Copies the masses and positions of "count" particles from "first" with
+ * pread, which the kernel serves from the page cache if they are there, and
+ * asks for the next block to be read ahead meanwhile */
+
+void OutOfCoreSystem::readSourceBlock(SourceBlock& block, long long first,
+    long long count)
+{
+    for (int c = 0; c < 4; c++) {
+        block.columns[c].resize(count);
+        std::size_t bytes = count * sizeof(double);
+        off_t offset = columnOffset(massColumn + c, numberOfParticles) + first * sizeof(double);
+        std::size_t done = 0;
+        while (done < bytes) {
+            ssize_t result = pread(file, (char*)block.columns[c].data() + done, bytes - done, offset + done);
+            if (result <= 0) {
+                throw std::runtime_error("\nCannot read the out-of-core file " + fileName + ".\n");
+            }
+            done = done + result;
+        }
+        long long next = (first + count) % numberOfParticles;
+        long long nextCount = std::min(blockSize, numberOfParticles - next);
+        posix_fadvise(file, columnOffset(massColumn + c, numberOfParticles) + next * sizeof(double),
+            nextCount * sizeof(double), POSIX_FADV_WILLNEED);
+    }
+    block.first = first;
+    block.count = count;
+    statistics.bytesRead = statistics.bytesRead + 4 * count * sizeof(double);
+    statistics.blocksRead++;
+}
+
+/* Accelerations of all the particles, one resident block of targets at a time.
+For every target block the source blocks are streamed through the two buffers
+of sourceBlocks by a reading thread, which reads the next block while the
+threads of the execution backend compute on the current one. The accelerations of a target block
+are written to the file when all the sources have been summed. A particle is
+excluded from its own sum by its index; as in the Ewald backend, coincident
+particles without softening do not interact. */
+
+void OutOfCoreSystem::computeAccelerations(double epsilon)
+{
+    const long long blocks = (numberOfParticles + blockSize - 1) / blockSize;
+    const long long streamed = blocks * blocks;
+    const double epsilonSquared = epsilon * epsilon;
+    for (SourceBlock& block : sourceBlocks) {
+        block.ready = false;
+    }
+    std::string readError;
+    bool stopReading = false;
+    std::thread reader([&] {
+        for (long long k = 0; k < streamed; k++) {
+            SourceBlock& block = sourceBlocks[k % 2];
+            {
+                std::unique_lock<std::mutex> lock(sourceMutex);
+                sourceReady.wait(lock, [&] { return !block.ready || stopReading; });
+                if (stopReading) {
+                    return;
+                }
+            }
+            long long first = (k % blocks) * blockSize;
+            double start = omp_get_wtime();
+            try {
+                readSourceBlock(block, first, std::min(blockSize, numberOfParticles - first));
+            } catch (const std::runtime_error& error) {
+                std::lock_guard<std::mutex> lock(sourceMutex);
+                readError = error.what();
+            }
+            statistics.ioSeconds = statistics.ioSeconds + omp_get_wtime() - start;
+            {
+                std::lock_guard<std::mutex> lock(sourceMutex);
+                block.ready = true;
+            }
+            sourceReady.notify_all();
+            if (!readError.empty()) {
+                return;
+            }
+        }
+    });
+    std::vector<double> targetAccelerations;
+    bool failed = false;
+    for (long long target = 0; target < blocks && !failed; target++) {
+        long long first = target * blockSize;
+        long long count = std::min(blockSize, numberOfParticles - first);
+        const double* x = column(positionColumn) + first;
+        const double* y = column(positionColumn + 1) + first;
+        const double* z = column(positionColumn + 2) + first;
+        targetAccelerations.assign(3 * count, 0.);
+        double* accelerations = targetAccelerations.data();
+        if (target + 1 < blocks) {
+            long long nextCount = std::min(blockSize, numberOfParticles - first - count);
+            for (int axis = 0; axis < 3; axis++) {
+                advisePages(column(positionColumn + axis) + first + count, nextCount * sizeof(double), MADV_WILLNEED);
+            }
+        }
+        for (long long source = 0; source < blocks; source++) {
+            SourceBlock& block = sourceBlocks[(target * blocks + source) % 2];
+            double start = omp_get_wtime();
+            {
+                std::unique_lock<std::mutex> lock(sourceMutex);
+                sourceReady.wait(lock, [&] { return block.ready; });
+                failed = !readError.empty();
+            }
+            if (failed) {
+                break;
+            }
+            double computeStart = omp_get_wtime();
+            statistics.waitSeconds = statistics.waitSeconds + computeStart - start;
+            const double* mass = block.columns[0].data();
+            const double* sourceX = block.columns[1].data();
+            const double* sourceY = block.columns[2].data();
+            const double* sourceZ = block.columns[3].data();
+            const long long sourceFirst = block.first;
+            const long long sourceCount = block.count;
+            auto accelerateTarget = [&](long long i) {
+                double ax = 0., ay = 0., az = 0.;
+                for (long long j = 0; j < sourceCount; j++) {
+                    double dx = sourceX[j] - x[i];
+                    double dy = sourceY[j] - y[i];
+                    double dz = sourceZ[j] - z[i];
+                    double softened = dx * dx + dy * dy + dz * dz + epsilonSquared;
+                    if (softened > 0 && sourceFirst + j != first + i) {
+                        double factor = mass[j] / (softened * std::sqrt(softened));
+                        ax = ax + factor * dx;
+                        ay = ay + factor * dy;
+                        az = az + factor * dz;
+                    }
+                }
+                accelerations[3 * i] = accelerations[3 * i] + ax;
+                accelerations[3 * i + 1] = accelerations[3 * i + 1] + ay;
+                accelerations[3 * i + 2] = accelerations[3 * i + 2] + az;
+            };
+            if (usingWorkStealingPool()) {
+                threadPool().parallelFor(0, count, 0, [&](long long firstTarget, long long lastTarget) {
+                    INSTRUMENT_PHASE(Phase::force);
+                    INSTRUMENT_HARDWARE(Phase::force);
+                    for (long long i = firstTarget; i < lastTarget; i++) {
+                        accelerateTarget(i);
+                    }
+                    INSTRUMENT_PAIRS((lastTarget - firstTarget) * sourceCount);
+                });
+            } else {
+#pragma omp parallel
+                {
+                    {
+                        INSTRUMENT_PHASE(Phase::force);
+                        INSTRUMENT_HARDWARE(Phase::force);
+                        long long pairsEvaluated = 0;
+#pragma omp for schedule(static) nowait
+                        for (long long i = 0; i < count; i++) {
+                            accelerateTarget(i);
+                            pairsEvaluated = pairsEvaluated + sourceCount;
+                        }
+                        INSTRUMENT_PAIRS(pairsEvaluated);
+                    }
+                    {
+                        INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+                    }
+                }
+            }
+            statistics.computeSeconds = statistics.computeSeconds + omp_get_wtime() - computeStart;
+            {
+                std::lock_guard<std::mutex> lock(sourceMutex);
+                block.ready = false;
+            }
+            sourceReady.notify_all();
+        }
+        if (failed) {
+            break;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            double* destination = column(accelerationColumn + axis) + first;
+            for (long long i = 0; i < count; i++) {
+                destination[i] = accelerations[3 * i + axis];
+            }
+            synchronisePages(destination, count * sizeof(double));
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(sourceMutex);
+        stopReading = true;
+    }
+    sourceReady.notify_all();
+    reader.join();
+    if (!readError.empty()) {
+        throw std::runtime_error(readError);
+    }
+}
+
+/* Update of the positions and velocities as in Particle::update, a block at a
+ * time: the block is advised before it is used and written back to the file
+ * asynchronously after it */
+
+void OutOfCoreSystem::updateParticles(double dt)
+{
+    double start = omp_get_wtime();
+    for (long long first = 0; first < numberOfParticles; first = first + blockSize) {
+        long long count = std::min(blockSize, numberOfParticles - first);
+        for (int c = positionColumn; c < outOfCoreColumns; c++) {
+            advisePages(column(c) + first, count * sizeof(double), MADV_WILLNEED);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            double* position = column(positionColumn + axis) + first;
+            double* velocity = column(velocityColumn + axis) + first;
+            const double* acceleration = column(accelerationColumn + axis) + first;
+            if (usingWorkStealingPool()) {
+                threadPool().parallelFor(0, count, 0, [&](long long firstParticle, long long lastParticle) {
+                    INSTRUMENT_PHASE(Phase::update);
+                    for (long long i = firstParticle; i < lastParticle; i++) {
+                        position[i] = position[i] + dt * velocity[i];
+                        velocity[i] = velocity[i] + dt * acceleration[i];
+                    }
+                });
+            } else {
+#pragma omp parallel
+                {
+                    {
+                        INSTRUMENT_PHASE(Phase::update);
+#pragma omp for schedule(static) nowait
+                        for (long long i = 0; i < count; i++) {
+                            position[i] = position[i] + dt * velocity[i];
+                            velocity[i] = velocity[i] + dt * acceleration[i];
+                        }
+                    }
+                    {
+                        INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+                    }
+                }
+            }
+            synchronisePages(position, count * sizeof(double));
+            synchronisePages(velocity, count * sizeof(double));
+        }
+    }
+    statistics.updateSeconds = statistics.updateSeconds + omp_get_wtime() - start;
+}
+
+/* Waits until everything written to the particles is in the file */
+
+void OutOfCoreSystem::flush()
+{
+    if (msync(mapping, mappingBytes, MS_SYNC) != 0) {
+        throw std::runtime_error("\nCannot write the out-of-core file " + fileName + ".\n");
+    }
+}
@@ -0,0 +1,107 @@
+#include "parallelSort.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include <stdexcept>
+
+/* Sorts the keys in increasing order and applies the same permutation to the
+values. It is a least significant digit radix sort on 8 bits at a time: for
+each digit every thread counts the digits of its (static) share of the
+elements, the counts are turned into the first output position of each
+(digit, thread) pair, and every thread scatters its elements in order. On the
+pool every share is a task. The sort
+is stable, so equal keys keep the order of their values, and the result does
+not depend on the number of threads. The passes over digits that are the same
+for all the keys are skipped. */
+
+void parallelRadixSort(std::vector<std::uint64_t>& keys,
+    std::vector<int>& values)
+{
+    if (keys.size() != values.size()) {
+        throw std::invalid_argument(
+            "\nThe keys and the values to sort must have the same size.\n");
+    }
+    const int n = keys.size();
+    const int bitsPerDigit = 8;
+    const int buckets = 1 << bitsPerDigit;
+    std::uint64_t differentBits = 0;
+    for (int i = 1; i < n; i++) {
+        differentBits = differentBits | (keys[i] ^ keys[0]);
+    }
+    std::vector<std::uint64_t> keysBuffer(n);
+    std::vector<int> valuesBuffer(n);
+    const bool pool = usingWorkStealingPool();
+    int threads = pool ? threadPool().getNumberOfThreads() : omp_get_max_threads();
+    std::vector<int> offsets(threads * buckets);
+
+    /* Counts the digits of share "share" of "shares", turns the counts into
+     * output positions and scatters the elements of a share */
+
+    auto countShare = [&](int share, int shares, int shift) {
+        int* counts = offsets.data() + share * buckets;
+        for (int bucket = 0; bucket < buckets; bucket++) {
+            counts[bucket] = 0;
+        }
+        int begin = (long long)n * share / shares;
+        int end = (long long)n * (share + 1) / shares;
+        for (int i = begin; i < end; i++) {
+            counts[(keys[i] >> shift) & (buckets - 1)]++;
+        }
+    };
+    auto computeOffsets = [&](int shares) {
+        int position = 0;
+        for (int bucket = 0; bucket < buckets; bucket++) {
+            for (int t = 0; t < shares; t++) {
+                int count = offsets[t * buckets + bucket];
+                offsets[t * buckets + bucket] = position;
+                position = position + count;
+            }
+        }
+    };
+    auto scatterShare = [&](int share, int shares, int shift) {
+        int* counts = offsets.data() + share * buckets;
+        int begin = (long long)n * share / shares;
+        int end = (long long)n * (share + 1) / shares;
+        for (int i = begin; i < end; i++) {
+            int slot = counts[(keys[i] >> shift) & (buckets - 1)]++;
+            keysBuffer[slot] = keys[i];
+            valuesBuffer[slot] = values[i];
+        }
+    };
+    for (int shift = 0; shift < 64; shift = shift + bitsPerDigit) {
+        if (((differentBits >> shift) & (buckets - 1)) == 0) {
+            continue;
+        }
+        if (pool) {
+            /* One share per thread of the pool, as on OpenMP */
+
+            WorkStealingPool& workers = threadPool();
+            workers.parallelFor(0, threads, 1, [&](long long first, long long last) {
+                for (int share = first; share < last; share++) {
+                    countShare(share, threads, shift);
+                }
+            });
+            computeOffsets(threads);
+            workers.parallelFor(0, threads, 1, [&](long long first, long long last) {
+                for (int share = first; share < last; share++) {
+                    scatterShare(share, threads, shift);
+                }
+            });
+        } else {
+#pragma omp parallel num_threads(threads)
+            {
+                /* The runtime may give fewer threads than requested */
+
+                int activeThreads = omp_get_num_threads();
+                int thread = omp_get_thread_num();
+                countShare(thread, activeThreads, shift);
+#pragma omp barrier
+#pragma omp single
+                computeOffsets(activeThreads);
+                scatterShare(thread, activeThreads, shift);
+            }
+        }
+        keys.swap(keysBuffer);
+        values.swap(valuesBuffer);
+    }
+}
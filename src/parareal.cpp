@@ -0,0 +1,164 @@
+#include "parareal.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/* Parallel-in-time integration for systems too small to share their particles
+among threads, such as the solar system. The interval of "steps" steps of
+length dt is split into slices, and two propagators advance a state over a
+slice with the forward Euler scheme of the evolution: the fine one with the
+steps of length dt, the coarse one with steps coarseFactor times longer. After
+a first coarse sweep, every iteration runs the fine propagator on all the
+slices at once, one slice per thread, and corrects the start of every slice in
+a serial coarse sweep:
+
+U[n + 1] = F(U[n] old) + G(U[n] new) - G(U[n] old)
+
+After k iterations the first k slices hold the fine solution exactly, so at
+most "slices" iterations give the serial fine result, and the iterations stop
+earlier once the correction is below the tolerance. */
+
+/* Advances the state by "steps" steps of length dt, on the calling thread
+ * only: all the accelerations first, then the updates, as evolutionOfSystem
+ * does, with its planar kernels for planar systems */
+
+static void propagate(std::vector<Particle>& state, long long steps, double dt,
+    AccelerationKernel kernel, UpdateFunction update, double epsilon)
+{
+    for (long long step = 0; step < steps; step++) {
+        for (std::size_t i = 0; i < state.size(); i++) {
+            state[i].setAcceleration(kernel(state, i, epsilon));
+        }
+        for (Particle& particle : state) {
+            (particle.*update)(dt);
+        }
+    }
+}
+
+/* One slice per thread of the execution backend unless the number is given */
+
+static int defaultSlices()
+{
+    return usingWorkStealingPool() ? threadPool().getNumberOfThreads() : omp_get_max_threads();
+}
+
+/* U = F + (G new - G old), written so that when the two coarse states are the
+ * same the result is the fine state exactly */
+
+static void correct(const std::vector<Particle>& fine,
+    const std::vector<Particle>& coarseNew, const std::vector<Particle>& coarseOld,
+    std::vector<Particle>& corrected)
+{
+    corrected = fine;
+    for (std::size_t i = 0; i < corrected.size(); i++) {
+        corrected[i].setPosition(fine[i].getPosition() + (coarseNew[i].getPosition() - coarseOld[i].getPosition()));
+        corrected[i].setVelocity(fine[i].getVelocity() + (coarseNew[i].getVelocity() - coarseOld[i].getVelocity()));
+    }
+}
+
+/* Largest change of a position and of a velocity between two states, each
+ * relative to the largest position or velocity of the new state */
+
+static double relativeChange(const std::vector<Particle>& newState,
+    const std::vector<Particle>& oldState)
+{
+    double positionScale = 0., velocityScale = 0., positionChange = 0., velocityChange = 0.;
+    for (std::size_t i = 0; i < newState.size(); i++) {
+        positionScale = std::max(positionScale, newState[i].getPosition().norm());
+        velocityScale = std::max(velocityScale, newState[i].getVelocity().norm());
+        positionChange = std::max(positionChange, (newState[i].getPosition() - oldState[i].getPosition()).norm());
+        velocityChange = std::max(velocityChange, (newState[i].getVelocity() - oldState[i].getVelocity()).norm());
+    }
+    return std::max(positionChange / (positionScale > 0 ? positionScale : 1.),
+        velocityChange / (velocityScale > 0 ? velocityScale : 1.));
+}
+
+PararealResult integrateParareal(ConstParticleSpan initial, long long steps,
+    double dt, double epsilon, const PararealSettings& settings)
+{
+    if (steps <= 0 || dt <= 0) {
+        throw std::invalid_argument("\nParareal needs a positive number of steps and a positive dt\n");
+    }
+    if (settings.slices < 0 || settings.coarseFactor <= 0 || settings.maximumIterations < 0 || settings.tolerance < 0) {
+        throw std::invalid_argument("\nThe slices, the coarse factor, the iterations and the tolerance of Parareal cannot be negative\n");
+    }
+    const int slices = (int)std::min<long long>(steps, settings.slices > 0 ? settings.slices : defaultSlices());
+    const int maximumIterations = settings.maximumIterations > 0 ? std::min(settings.maximumIterations, slices) : slices;
+    const bool planar = settings.planarKernels && isPlanar(initial);
+    AccelerationKernel kernel = selectAccelerationKernel(epsilon, planar);
+    UpdateFunction update = selectUpdateFunction(planar);
+
+    /* Slice s is made of the fine steps from first[s] to first[s + 1] */
+
+    std::vector<long long> first(slices + 1);
+    std::vector<long long> coarseSteps(slices);
+    for (int s = 0; s <= slices; s++) {
+        first[s] = steps * s / slices;
+    }
+    for (int s = 0; s < slices; s++) {
+        coarseSteps[s] = std::max(1LL, (long long)std::llround((double)(first[s + 1] - first[s]) / settings.coarseFactor));
+    }
+    auto coarse = [&](std::vector<Particle>& state, int s) {
+        propagate(state, coarseSteps[s], (first[s + 1] - first[s]) * dt / coarseSteps[s], kernel, update, epsilon);
+    };
+
+    std::vector<std::vector<Particle>> starts(slices + 1);
+    std::vector<std::vector<Particle>> coarseEnds(slices);
+    std::vector<std::vector<Particle>> fineEnds(slices);
+    starts[0].assign(initial.begin(), initial.end());
+    for (int s = 0; s < slices; s++) {
+        coarseEnds[s] = starts[s];
+        coarse(coarseEnds[s], s);
+        starts[s + 1] = coarseEnds[s];
+    }
+
+    PararealResult result;
+    result.slices = slices;
+    for (int iteration = 1; iteration <= maximumIterations; iteration++) {
+        /* The slices before iteration - 1 already start from the fine
+         * solution and are not propagated again */
+
+        auto fine = [&](int s) {
+            fineEnds[s] = starts[s];
+            propagate(fineEnds[s], first[s + 1] - first[s], dt, kernel, update, epsilon);
+        };
+        {
+            INSTRUMENT_PHASE(Phase::force);
+            if (usingWorkStealingPool()) {
+                threadPool().parallelFor(iteration - 1, slices, 1, [&](long long firstSlice, long long lastSlice) {
+                    for (int s = firstSlice; s < lastSlice; s++) {
+                        fine(s);
+                    }
+                });
+            } else {
+#pragma omp parallel for schedule(dynamic, 1)
+                for (int s = iteration - 1; s < slices; s++) {
+                    fine(s);
+                }
+            }
+        }
+        double residual = 0.;
+        std::vector<Particle> coarseEnd;
+        std::vector<Particle> corrected;
+        for (int s = iteration - 1; s < slices; s++) {
+            coarseEnd = starts[s];
+            coarse(coarseEnd, s);
+            correct(fineEnds[s], coarseEnd, coarseEnds[s], corrected);
+            residual = std::max(residual, relativeChange(corrected, starts[s + 1]));
+            coarseEnds[s] = coarseEnd;
+            starts[s + 1] = corrected;
+        }
+        result.iterations = iteration;
+        result.residuals.push_back(residual);
+        if (residual <= settings.tolerance || iteration == slices) {
+            result.converged = true;
+            break;
+        }
+    }
+    result.finalState = starts[slices];
+    return result;
+}
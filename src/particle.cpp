@@ -1,6 +1,10 @@
 #include "particle.hpp"
 
+#include "instrumentation.hpp"
 #include "manyBodySystem.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
 Particle::Particle(double massArgument)
 {
@@ -13,20 +17,20 @@ Particle::getMass() const
     return mass;
 }
 
-Eigen::Vector3d
-Particle::getPosition()
+const Eigen::Vector3d&
+Particle::getPosition() const
 {
     return positionParticle;
 }
 
-Eigen::Vector3d
-Particle::getVelocity()
+const Eigen::Vector3d&
+Particle::getVelocity() const
 {
     return velocityParticle;
 }
 
-Eigen::Vector3d
-Particle::getAcceleration()
+const Eigen::Vector3d&
+Particle::getAcceleration() const
 {
     return accelerationParticle;
 }
@@ -94,47 +98,225 @@ void Particle::setRandomAcceleration(double minRandomValue, double maxRandomValu
 
 void Particle::update(double dt)
 {
-    positionParticle = this->getPosition() + dt * this->getVelocity();
-    velocityParticle = this->getVelocity() + dt * this->getAcceleration();
+    updateComponents<3>(dt);
 }
 
-/* Calculate the total acceleration on a particle. The particle excludes itself
-from the calculation through a check that involves the mass and the distance
-with a particle (i.e. if two particles have the same mass and are in the same
-position, then the program treat them as the same particle). */
+/* The same update restricted to the first "Dimensions" components, so that a
+ * planar system neither reads nor writes the z components */
 
-void Particle::calcTotalAcceleration(std::vector<Particle> particlesInTheSystem,
-    double epsilon)
+template <int Dimensions>
+void Particle::updateComponents(double dt)
 {
-    /* Variable that stores the acceleration to copy to the private member
-     * "accelerationParticle" of the Particle class */
+    positionParticle.head<Dimensions>() = positionParticle.head<Dimensions>() + dt * velocityParticle.head<Dimensions>();
+    velocityParticle.head<Dimensions>() = velocityParticle.head<Dimensions>() + dt * accelerationParticle.head<Dimensions>();
+}
 
-    Eigen::Vector3d totalAcceleration(0., 0., 0.);
-#pragma omp parallel
-    {
-        /* "accelerationPrivateInThread" is a private variable created for each loop.
-        No default reduction exists for the type Eigen::Vector3d() */
-
-        Eigen::Vector3d accelerationPrivateInThread(0., 0., 0.);
-#pragma omp for schedule(runtime)
-        for (int i = 0; i < particlesInTheSystem.size(); i++) {
-            /* Check to exclude interactions of particles with themselves */
-
-            if (getDistance(this, &(particlesInTheSystem.at(i))) != 0 || (this->getMass() != particlesInTheSystem.at(i).getMass())) {
-                accelerationPrivateInThread = accelerationPrivateInThread + calcAcceleration(this, &(particlesInTheSystem.at(i)), epsilon);
-            }
+template void Particle::updateComponents<2>(double dt);
+template void Particle::updateComponents<3>(double dt);
+
+UpdateFunction selectUpdateFunction(bool planar)
+{
+    if (planar) {
+        return &Particle::updateComponents<2>;
+    }
+    return &Particle::updateComponents<3>;
+}
+
+/* True if every particle is in the plane z = 0 and moves in it */
+
+bool isPlanar(ConstParticleSpan particles)
+{
+    for (const Particle& particle : particles) {
+        if (particle.getPosition().z() != 0 || particle.getVelocity().z() != 0) {
+            return false;
         }
+    }
+    return true;
+}
+
+/* Sum of the accelerations exerted by the particles from "first" to "last" on
+a particle at "position". Softened selects at compile time between the force of
+calcAcceleration with epsilon > 0 and the unsoftened one, so that neither
+variant tests epsilon inside the loop. The callers leave the particle itself
+out of the range, so the loop has no branch at all. Dimensions is 2 for planar
+systems: only x and y are loaded and summed, and z is left at zero. */
+
+template <bool Softened, int Dimensions>
+static Eigen::Vector3d sumAccelerations(const Eigen::Vector3d& position,
+    const Particle* first, const Particle* last, double epsilonSquared)
+{
+    typedef Eigen::Matrix<double, Dimensions, 1> Vector;
+    const Vector origin = position.head<Dimensions>();
+    Vector acceleration = Vector::Zero();
+    for (const Particle* other = first; other != last; other++) {
+        Vector difference = other->getPosition().head<Dimensions>() - origin;
+        double distanceSquared = difference.squaredNorm();
+        if (Softened) {
+            distanceSquared = distanceSquared + epsilonSquared;
+        }
+        acceleration = acceleration + other->getMass() / (distanceSquared * std::sqrt(distanceSquared)) * difference;
+    }
+    Eigen::Vector3d result(0., 0., 0.);
+    result.head<Dimensions>() = acceleration;
+    return result;
+}
+
+/* Acceleration on the particle at index "self" of the view due to the
+particles from index "first" to "last" (excluded). The particle is excluded by
+its index, splitting the loop in the part before and the part after it, so
+bodies that happen to share a position still attract each other (through the
+softened force; without softening their force is not defined). */
+
+template <bool Softened, int Dimensions>
+static Eigen::Vector3d accelerationFromRange(ConstParticleSpan particles,
+    std::size_t self, std::size_t first, std::size_t last, double epsilon)
+{
+    const Eigen::Vector3d& position = particles[self].getPosition();
+    double epsilonSquared = epsilon * epsilon;
+    if (self < first || self >= last) {
+        return sumAccelerations<Softened, Dimensions>(position,
+            particles.begin() + first, particles.begin() + last, epsilonSquared);
+    }
+    return sumAccelerations<Softened, Dimensions>(position,
+               particles.begin() + first, particles.begin() + self, epsilonSquared)
+        + sumAccelerations<Softened, Dimensions>(position,
+            particles.begin() + self + 1, particles.begin() + last, epsilonSquared);
+}
+
+/* Acceleration on the particle at index "self" due to all the others */
+
+template <bool Softened, int Dimensions>
+static Eigen::Vector3d accelerationOnParticle(ConstParticleSpan particles,
+    std::size_t self, double epsilon)
+{
+    return accelerationFromRange<Softened, Dimensions>(particles, self, 0,
+        particles.size(), epsilon);
+}
+
+/* The planar sum over columns, from "first" to "last" (excluded): the loads
+are contiguous, so the loop vectorises */
+
+template <bool Softened>
+static void sumPlanarColumns(double originX, double originY, const double* x,
+    const double* y, const double* mass, std::size_t first, std::size_t last,
+    double epsilonSquared, double& ax, double& ay)
+{
+    double sumX = 0.;
+    double sumY = 0.;
+#pragma omp simd reduction(+ : sumX, sumY)
+    for (std::size_t j = first; j < last; j++) {
+        double dx = x[j] - originX;
+        double dy = y[j] - originY;
+        double distanceSquared = dx * dx + dy * dy;
+        if (Softened) {
+            distanceSquared = distanceSquared + epsilonSquared;
+        }
+        double factor = mass[j] / (distanceSquared * std::sqrt(distanceSquared));
+        sumX = sumX + factor * dx;
+        sumY = sumY + factor * dy;
+    }
+    ax = ax + sumX;
+    ay = ay + sumY;
+}
+
+/* Acceleration on the particle at index "self" of the columns, excluded by
+ * index as in accelerationFromRange */
+
+template <bool Softened>
+static Eigen::Vector3d planarAccelerationFromColumns(const double* x,
+    const double* y, const double* mass, std::size_t n, std::size_t self,
+    double epsilon)
+{
+    double epsilonSquared = epsilon * epsilon;
+    double ax = 0.;
+    double ay = 0.;
+    sumPlanarColumns<Softened>(x[self], y[self], x, y, mass, 0, self,
+        epsilonSquared, ax, ay);
+    sumPlanarColumns<Softened>(x[self], y[self], x, y, mass, self + 1, n,
+        epsilonSquared, ax, ay);
+    return Eigen::Vector3d(ax, ay, 0.);
+}
 
-        /* Putting together the private variables created for each loop */
+/* Chooses the variant of the kernel for a softening factor and for planar
+ * systems, once before the loops over the particles */
 
-#pragma omp critical
-        {
-            totalAcceleration = totalAcceleration + accelerationPrivateInThread;
+AccelerationKernel selectAccelerationKernel(double epsilon, bool planar)
+{
+    if (planar) {
+        if (epsilon == 0) {
+            return &accelerationOnParticle<false, 2>;
         }
+        return &accelerationOnParticle<true, 2>;
     }
-    /* Copying the totalAcceleration variable to the private member
-     * "accelerationParticle" of the class Particle */
+    if (epsilon == 0) {
+        return &accelerationOnParticle<false, 3>;
+    }
+    return &accelerationOnParticle<true, 3>;
+}
 
+PartialAccelerationKernel selectPartialAccelerationKernel(double epsilon,
+    bool planar)
+{
+    if (planar) {
+        if (epsilon == 0) {
+            return &accelerationFromRange<false, 2>;
+        }
+        return &accelerationFromRange<true, 2>;
+    }
+    if (epsilon == 0) {
+        return &accelerationFromRange<false, 3>;
+    }
+    return &accelerationFromRange<true, 3>;
+}
+
+PlanarColumnKernel selectPlanarColumnKernel(double epsilon)
+{
+    if (epsilon == 0) {
+        return &planarAccelerationFromColumns<false>;
+    }
+    return &planarAccelerationFromColumns<true>;
+}
+
+/* Index of the particle in the view, or the size of the view if the particle
+ * is not one of the viewed ones (e.g. a copy) */
+
+static std::size_t indexInView(const Particle* particle,
+    ConstParticleSpan particles)
+{
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(particle);
+    std::uintptr_t first = reinterpret_cast<std::uintptr_t>(particles.begin());
+    std::uintptr_t last = reinterpret_cast<std::uintptr_t>(particles.end());
+    if (address < first || address >= last) {
+        return particles.size();
+    }
+    return (address - first) / sizeof(Particle);
+}
+
+/* Calculate the total acceleration on a particle. If the particle is one of
+the viewed particles it is excluded by its index, with the kernel chosen by
+selectAccelerationKernel. A particle that is not in the view (e.g. a copy of
+one of them) cannot be found by index, so it excludes the particles with its
+own mass and position, as it always did. The loops of the system call the
+kernel directly, so this function is serial. */
+
+void Particle::calcTotalAcceleration(ConstParticleSpan particlesInTheSystem,
+    double epsilon)
+{
+    std::size_t self = indexInView(this, particlesInTheSystem);
+    if (self < particlesInTheSystem.size()) {
+        accelerationParticle = selectAccelerationKernel(epsilon)(particlesInTheSystem, self, epsilon);
+        INSTRUMENT_PAIRS(particlesInTheSystem.size() - 1);
+        return;
+    }
+    Eigen::Vector3d totalAcceleration(0., 0., 0.);
+    long long pairsEvaluated = 0;
+    for (const Particle& other : particlesInTheSystem) {
+        if (getDistance(this, &other) != 0 || this->getMass() != other.getMass()) {
+            totalAcceleration = totalAcceleration + calcAcceleration(this, &other, epsilon);
+            pairsEvaluated++;
+        }
+    }
+    INSTRUMENT_PAIRS(pairsEvaluated);
     accelerationParticle = totalAcceleration;
 }
 
@@ -167,25 +349,190 @@ randomValueGenerator(double minRandomValue,
 /* This function returns the kinetic energy of the particle */
 
 double
-Particle::calculateKineticEnergy()
+Particle::calculateKineticEnergy() const
 {
     return 0.5 * this->getMass() * this->getVelocity().dot(this->getVelocity());
 }
 
-/* This function calculates the potential energy acting on a particle */
+/* Half of the potential energy between a particle at "position" and the
+ * particles from "first" to "last", -m1 m2 / sqrt(d^2 + epsilon^2), which is
+ * the potential of the softened force. Pairs at zero distance, where the
+ * unsoftened potential is infinite, add nothing. */
 
-double
-Particle::calculatePotentialEnergy(std::vector<Particle> particlesInTheSystem)
+static double sumPotentialEnergy(const Eigen::Vector3d& position, double mass,
+    const Particle* first, const Particle* last, double epsilonSquared)
 {
     double potentialEnergy = 0.;
-#pragma omp parallel for reduction(- \
-                                   : potentialEnergy)
-    for (int i = 0; i < particlesInTheSystem.size(); i++) {
-        /* Check to exclude interactions of particles with themselves */
+    for (const Particle* other = first; other != last; other++) {
+        double distanceSquared = (other->getPosition() - position).squaredNorm() + epsilonSquared;
+        potentialEnergy = potentialEnergy - (distanceSquared > 0 ? 0.5 * mass * other->getMass() / std::sqrt(distanceSquared) : 0.);
+    }
+    return potentialEnergy;
+}
 
-        if (getDistance(this, &(particlesInTheSystem.at(i))) != 0 || (this->getMass() != particlesInTheSystem.at(i).getMass())) {
-            potentialEnergy = potentialEnergy - 0.5 * ((this->getMass() * particlesInTheSystem.at(i).getMass()) / (getDistance(this, &(particlesInTheSystem.at(i)))));
+/* Potential energy of the particle at index "self" of the view (half of each
+ * pair, so that the sum over all the particles counts every pair once). The
+ * particle is excluded by its index, with the same split loop as the
+ * accelerations. */
+
+double calculatePotentialEnergyOfParticle(ConstParticleSpan particles,
+    std::size_t self, double epsilon)
+{
+    const Eigen::Vector3d& position = particles[self].getPosition();
+    double mass = particles[self].getMass();
+    double epsilonSquared = epsilon * epsilon;
+    return sumPotentialEnergy(position, mass, particles.begin(),
+               particles.begin() + self, epsilonSquared)
+        + sumPotentialEnergy(position, mass, particles.begin() + self + 1,
+            particles.end(), epsilonSquared);
+}
+
+/* This function calculates the potential energy acting on a particle. As for
+ * calcTotalAcceleration, a particle that is not in the view excludes the
+ * particles with its own mass and position. */
+
+double
+Particle::calculatePotentialEnergy(ConstParticleSpan particlesInTheSystem) const
+{
+    std::size_t self = indexInView(this, particlesInTheSystem);
+    if (self < particlesInTheSystem.size()) {
+        return calculatePotentialEnergyOfParticle(particlesInTheSystem, self);
+    }
+    double potentialEnergy = 0.;
+    for (const Particle& other : particlesInTheSystem) {
+        if (getDistance(this, &other) != 0 || this->getMass() != other.getMass()) {
+            potentialEnergy = potentialEnergy - 0.5 * ((this->getMass() * other.getMass()) / (getDistance(this, &other)));
         }
     }
     return potentialEnergy;
-}
\ No newline at end of file
+}
+
+/* View on "sizeArgument" contiguous particles starting at "dataArgument" */
+
+ConstParticleSpan::ConstParticleSpan(const Particle* dataArgument,
+    std::size_t sizeArgument)
+{
+    particlesData = dataArgument;
+    particlesSize = sizeArgument;
+}
+
+std::size_t ConstParticleSpan::size() const
+{
+    return particlesSize;
+}
+
+bool ConstParticleSpan::empty() const
+{
+    return particlesSize == 0;
+}
+
+const Particle* ConstParticleSpan::data() const
+{
+    return particlesData;
+}
+
+const Particle* ConstParticleSpan::begin() const
+{
+    return particlesData;
+}
+
+const Particle* ConstParticleSpan::end() const
+{
+    return particlesData + particlesSize;
+}
+
+const Particle& ConstParticleSpan::operator[](std::size_t i) const
+{
+    return particlesData[i];
+}
+
+/* Access with bounds checking, like std::vector::at */
+
+const Particle& ConstParticleSpan::at(std::size_t i) const
+{
+    if (i >= particlesSize) {
+        throw std::out_of_range("\nIndex out of the range of the particles.\n");
+    }
+    return particlesData[i];
+}
+
+/* 3xN matrices whose column i is the position, velocity or acceleration of
+ * particle i. They are mapped on the particles themselves: consecutive columns
+ * are sizeof(Particle) bytes apart. */
+
+ConstParticleColumns ConstParticleSpan::positions() const
+{
+    return columns(offsetof(Particle, positionParticle));
+}
+
+ConstParticleColumns ConstParticleSpan::velocities() const
+{
+    return columns(offsetof(Particle, velocityParticle));
+}
+
+ConstParticleColumns ConstParticleSpan::accelerations() const
+{
+    return columns(offsetof(Particle, accelerationParticle));
+}
+
+ConstParticleColumns ConstParticleSpan::columns(std::size_t offset) const
+{
+    static_assert(sizeof(Particle) % sizeof(double) == 0,
+        "The particles must be made of whole doubles to be mapped as columns");
+    const double* first = reinterpret_cast<const double*>(
+        reinterpret_cast<const char*>(particlesData) + offset);
+    return ConstParticleColumns(particlesSize == 0 ? nullptr : first, 3,
+        particlesSize, Eigen::OuterStride<>(sizeof(Particle) / sizeof(double)));
+}
+
+/* View on "sizeArgument" contiguous particles starting at "dataArgument",
+ * through which they can be modified */
+
+ParticleSpan::ParticleSpan(Particle* dataArgument, std::size_t sizeArgument)
+{
+    particlesData = dataArgument;
+    particlesSize = sizeArgument;
+}
+
+ParticleSpan::operator ConstParticleSpan() const
+{
+    return ConstParticleSpan(particlesData, particlesSize);
+}
+
+std::size_t ParticleSpan::size() const
+{
+    return particlesSize;
+}
+
+bool ParticleSpan::empty() const
+{
+    return particlesSize == 0;
+}
+
+Particle* ParticleSpan::data() const
+{
+    return particlesData;
+}
+
+Particle* ParticleSpan::begin() const
+{
+    return particlesData;
+}
+
+Particle* ParticleSpan::end() const
+{
+    return particlesData + particlesSize;
+}
+
+Particle& ParticleSpan::operator[](std::size_t i) const
+{
+    return particlesData[i];
+}
+
+Particle& ParticleSpan::at(std::size_t i) const
+{
+    if (i >= particlesSize) {
+        throw std::out_of_range("\nIndex out of the range of the particles.\n");
+    }
+    return particlesData[i];
+}
@@ -0,0 +1,452 @@
+#include "periodicEwald.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include "omp.h"
+#include <cmath>
+#include <stdexcept>
+
+/* With the default split parameter erfc(splitParameter * realSpaceCutoff) is
+ * about 1e-6, so the pairs beyond the cutoff can be ignored */
+
+static const double defaultSplitTimesCutoff = 3.5;
+
+/* Intervals of the table of the short-range factor: the interpolation error is
+ * below 1e-7 for any split parameter */
+
+static const int shortRangeTableIntervals = 4096;
+
+PeriodicEwaldBackend::PeriodicEwaldBackend(double boxSizeArgument,
+    double splitParameterArgument, int maximumWaveNumberArgument,
+    double realSpaceCutoffArgument)
+{
+    if (boxSizeArgument <= 0) {
+        throw std::invalid_argument("\nThe side of the periodic box must be a positive value.\n");
+    }
+    if (splitParameterArgument < 0) {
+        throw std::invalid_argument("\nThe Ewald split parameter cannot be negative.\n");
+    }
+    if (maximumWaveNumberArgument <= 0) {
+        throw std::invalid_argument(
+            "\nThe Fourier space sum needs a positive maximum wave number.\n");
+    }
+    if (realSpaceCutoffArgument < 0 || realSpaceCutoffArgument > 0.5 * boxSizeArgument) {
+        throw std::invalid_argument(
+            "\nThe real space cutoff must be between 0 and half the side of the box.\n");
+    }
+    boxSize = boxSizeArgument;
+    realSpaceCutoff = realSpaceCutoffArgument > 0 ? realSpaceCutoffArgument : 0.5 * boxSize;
+    splitParameter = splitParameterArgument > 0 ? splitParameterArgument : defaultSplitTimesCutoff / realSpaceCutoff;
+    maximumWaveNumber = maximumWaveNumberArgument;
+
+    /* Table of the short-range factor, so that the real space sum does not
+     * evaluate erfc and exp for every pair. The last entry is repeated, for
+     * distances that round to the end of the table. */
+
+    tableSpacing = realSpaceCutoff / shortRangeTableIntervals;
+    for (int entry = 0; entry <= shortRangeTableIntervals; entry++) {
+        double r = entry * tableSpacing;
+        shortRangeTable.push_back(std::erfc(splitParameter * r) + 2. * splitParameter * r / std::sqrt(M_PI) * std::exp(-splitParameter * splitParameter * r * r));
+        shortRangePotentialTable.push_back(std::erfc(splitParameter * r));
+    }
+    shortRangeTable.push_back(shortRangeTable.back());
+    shortRangePotentialTable.push_back(shortRangePotentialTable.back());
+
+    /* Table of the wave vectors: k and -k contribute the same amount, so only
+     * the half with the first non-zero component positive is kept, with its
+     * coefficient doubled. The Fourier space term of the acceleration is
+     * -(4 pi / V) exp(-k^2 / (4 alpha^2)) / k^2 k sin(k.(x_i - x_j)) m_j. */
+
+    double volume = boxSize * boxSize * boxSize;
+    double fundamental = 2. * M_PI / boxSize;
+    int m = maximumWaveNumber;
+    for (int nx = 0; nx <= m; nx++) {
+        for (int ny = -m; ny <= m; ny++) {
+            for (int nz = -m; nz <= m; nz++) {
+                bool upperHalf = nx > 0 || (nx == 0 && ny > 0) || (nx == 0 && ny == 0 && nz > 0);
+                if (!upperHalf || nx * nx + ny * ny + nz * nz > m * m) {
+                    continue;
+                }
+                WaveVector wave;
+                wave.n[0] = nx;
+                wave.n[1] = ny;
+                wave.n[2] = nz;
+                wave.k = fundamental * Eigen::Vector3d(nx, ny, nz);
+                double kSquared = wave.k.squaredNorm();
+                wave.coefficient = 2. * 4. * M_PI / volume * std::exp(-kSquared / (4. * splitParameter * splitParameter)) / kSquared;
+                waveVectors.push_back(wave);
+            }
+        }
+    }
+}
+
+std::string PeriodicEwaldBackend::getName() const
+{
+    return "ewald";
+}
+
+double PeriodicEwaldBackend::getBoxSize() const
+{
+    return boxSize;
+}
+
+double PeriodicEwaldBackend::getSplitParameter() const
+{
+    return splitParameter;
+}
+
+int PeriodicEwaldBackend::getMaximumWaveNumber() const
+{
+    return maximumWaveNumber;
+}
+
+double PeriodicEwaldBackend::getRealSpaceCutoff() const
+{
+    return realSpaceCutoff;
+}
+
+int PeriodicEwaldBackend::getNumberOfWaveVectors() const
+{
+    return waveVectors.size();
+}
+
+/* Computes the periodic accelerations. The particles do not need to lie inside
+the box: both sums only depend on the positions modulo boxSize.
+
+Real space: the positions are first wrapped into the box, so that the nearest
+image of every other particle is found with one comparison per axis. The
+softened force of calcAcceleration is multiplied by erfc(alpha r) +
+2 alpha r / sqrt(pi) exp(-alpha^2 r^2), the share of the force that the Fourier
+sum does not carry, read from the table built in the constructor. Softening
+is applied to this short-range part only.
+
+Fourier space: exp(i k.x) of every particle is the product of three entries of
+the phase table, filled with one complex exponential per axis and particle and
+then by repeated multiplication. The structure factor S(k) = sum_j m_j
+exp(i k.x_j) of each wave vector is summed once: every thread sums its share
+of the particles into its own row of partialStructureFactors, and the rows are
+added in thread order, so the result does not change from run to run. The
+acceleration of particle i is -sum_k c(k) k Im(exp(i k.x_i) conj(S(k))),
+which costs O(N * number of wave vectors) instead of
+O(N^2 * number of wave vectors). The uniform background that makes the
+periodic problem well defined exerts no force.
+
+Coincident particles without softening do not interact, as in
+calcTotalAcceleration. */
+
+void PeriodicEwaldBackend::computeAccelerations(ParticleSpan particles,
+    double epsilon)
+{
+    const int n = particles.size();
+    const int waves = waveVectors.size();
+    const int harmonics = maximumWaveNumber + 1;
+    const double fundamental = 2. * M_PI / boxSize;
+    const double cutoffSquared = realSpaceCutoff * realSpaceCutoff;
+    const double epsilonSquared = epsilon * epsilon;
+    const double inverseSpacing = 1. / tableSpacing;
+    const double* table = shortRangeTable.data();
+    const int threads = omp_get_max_threads();
+    const double inverseBox = 1. / boxSize;
+    const double halfBox = 0.5 * boxSize;
+    wrappedPositions.resize(n);
+    phaseTable.resize((std::size_t)n * 3 * harmonics);
+    structureFactors.resize(waves);
+
+    /* exp(i k.x) of particle "particle" for the wave vector "wave": negative
+     * components use the complex conjugate of the table entry */
+
+    auto phase = [&](int particle, const WaveVector& wave) {
+        std::complex<double> product(1., 0.);
+        for (int axis = 0; axis < 3; axis++) {
+            int m = wave.n[axis];
+            std::complex<double> entry = phaseTable[((std::size_t)particle * 3 + axis) * harmonics + std::abs(m)];
+            product = product * (m < 0 ? std::conj(entry) : entry);
+        }
+        return product;
+    };
+
+    /* Wrapped position and phase table of particle i */
+
+    auto tabulateParticle = [&](int i) {
+        const Eigen::Vector3d& position = particles.at(i).getPosition();
+        for (int axis = 0; axis < 3; axis++) {
+            wrappedPositions[i](axis) = position(axis) - boxSize * std::floor(position(axis) * inverseBox);
+            std::complex<double>* entry = &phaseTable[((std::size_t)i * 3 + axis) * harmonics];
+            std::complex<double> base = std::polar(1., fundamental * position(axis));
+            entry[0] = 1.;
+            for (int m = 1; m < harmonics; m++) {
+                entry[m] = entry[m - 1] * base;
+            }
+        }
+    };
+
+    /* Adds the terms of particle j to the partial structure factors "partial" */
+
+    auto addToStructureFactors = [&](int j, std::complex<double>* partial) {
+        double mass = particles.at(j).getMass();
+        for (int w = 0; w < waves; w++) {
+            partial[w] = partial[w] + mass * phase(j, waveVectors[w]);
+        }
+    };
+
+    /* Sets the acceleration of particle i and returns the number of pairs
+     * summed in real space */
+
+    auto accelerateParticle = [&](int i) {
+        const Eigen::Vector3d position = wrappedPositions[i];
+        Eigen::Vector3d acceleration(0., 0., 0.);
+        long long pairsEvaluated = 0;
+        for (int j = 0; j < n; j++) {
+            if (j == i) {
+                continue;
+            }
+            Eigen::Vector3d difference = wrappedPositions[j] - position;
+            for (int axis = 0; axis < 3; axis++) {
+                if (difference(axis) > halfBox) {
+                    difference(axis) = difference(axis) - boxSize;
+                } else if (difference(axis) < -halfBox) {
+                    difference(axis) = difference(axis) + boxSize;
+                }
+            }
+            double distanceSquared = difference.squaredNorm();
+            double softened = distanceSquared + epsilonSquared;
+            if (distanceSquared < cutoffSquared && softened > 0) {
+                double distance = std::sqrt(distanceSquared);
+                double position = distance * inverseSpacing;
+                int entry = (int)position;
+                double shortRange = table[entry] + (position - entry) * (table[entry + 1] - table[entry]);
+                acceleration = acceleration + particles.at(j).getMass() * shortRange / (softened * std::sqrt(softened)) * difference;
+                pairsEvaluated++;
+            }
+        }
+        for (int w = 0; w < waves; w++) {
+            double sine = std::imag(phase(i, waveVectors[w]) * std::conj(structureFactors[w]));
+            acceleration = acceleration - waveVectors[w].coefficient * sine * waveVectors[w].k;
+        }
+        particles.at(i).setAcceleration(acceleration);
+        return pairsEvaluated;
+    };
+
+    /* On the pool the partial structure factors belong to the pieces of the
+     * reduction instead of the threads */
+
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            for (int i = first; i < last; i++) {
+                tabulateParticle(i);
+            }
+        });
+        typedef std::vector<std::complex<double>> Factors;
+        structureFactors = pool.parallelReduce(
+            0, n, 0, Factors(waves, 0.), [&](long long first, long long last) {
+                INSTRUMENT_PHASE(Phase::force);
+                INSTRUMENT_HARDWARE(Phase::force);
+                Factors partial(waves, 0.);
+                for (int j = first; j < last; j++) {
+                    addToStructureFactors(j, partial.data());
+                }
+                return partial;
+            },
+            [](Factors sum, const Factors& partial) {
+                for (std::size_t w = 0; w < sum.size(); w++) {
+                    sum[w] = sum[w] + partial[w];
+                }
+                return sum;
+            });
+        pool.parallelFor(0, n, 0, [&](long long first, long long last) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            long long pairsEvaluated = 0;
+            for (int i = first; i < last; i++) {
+                pairsEvaluated = pairsEvaluated + accelerateParticle(i);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        });
+        return;
+    }
+    partialStructureFactors.assign((std::size_t)threads * waves, 0.);
+#pragma omp parallel num_threads(threads)
+    {
+        {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+#pragma omp for schedule(static)
+            for (int i = 0; i < n; i++) {
+                tabulateParticle(i);
+            }
+            std::complex<double>* partial = &partialStructureFactors[(std::size_t)omp_get_thread_num() * waves];
+#pragma omp for schedule(static)
+            for (int j = 0; j < n; j++) {
+                addToStructureFactors(j, partial);
+            }
+            int activeThreads = omp_get_num_threads();
+#pragma omp for schedule(static)
+            for (int w = 0; w < waves; w++) {
+                std::complex<double> sum(0., 0.);
+                for (int t = 0; t < activeThreads; t++) {
+                    sum = sum + partialStructureFactors[(std::size_t)t * waves + w];
+                }
+                structureFactors[w] = sum;
+            }
+            long long pairsEvaluated = 0;
+#pragma omp for schedule(runtime) nowait
+            for (int i = 0; i < n; i++) {
+                pairsEvaluated = pairsEvaluated + accelerateParticle(i);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        }
+        {
+            INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+        }
+    }
+}
+
+/* Periodic field at the probes, with the same two sums as
+computeAccelerations. The potential is -sum_j m_j erfc(alpha r) / r over the
+nearest images in real space, -sum_k c(k) Re(exp(i k.x) conj(S(k))) in Fourier
+space and pi M / (V alpha^2) for the uniform background of total mass M that
+makes the periodic potential finite; its zero is the average over the box. The
+probes are targets only, so they do not enter the structure factors. Softening
+divides the real space potential by sqrt(r^2 + epsilon^2) like the force, so
+with epsilon > 0 the acceleration is only approximately minus its gradient. */
+
+FieldValues PeriodicEwaldBackend::evaluateField(ConstParticleSpan sources,
+    const std::vector<Eigen::Vector3d>& probes, double epsilon)
+{
+    const int n = sources.size();
+    const int numberOfProbes = probes.size();
+    const int waves = waveVectors.size();
+    const int harmonics = maximumWaveNumber + 1;
+    const double fundamental = 2. * M_PI / boxSize;
+    const double cutoffSquared = realSpaceCutoff * realSpaceCutoff;
+    const double epsilonSquared = epsilon * epsilon;
+    const double inverseSpacing = 1. / tableSpacing;
+    const double halfBox = 0.5 * boxSize;
+    double totalMass = 0.;
+    std::vector<Eigen::Vector3d> wrappedSources(n);
+    std::vector<std::complex<double>> sourcePhases((std::size_t)n * 3 * harmonics);
+    std::vector<std::complex<double>> factors(waves);
+
+    /* Positions brought into the box and exp(i 2 pi m x / boxSize) of a point,
+     * as in computeAccelerations */
+
+    auto wrap = [&](const Eigen::Vector3d& position, std::complex<double>* entries) {
+        Eigen::Vector3d wrapped;
+        for (int axis = 0; axis < 3; axis++) {
+            wrapped(axis) = position(axis) - boxSize * std::floor(position(axis) / boxSize);
+            std::complex<double>* entry = entries + axis * harmonics;
+            std::complex<double> base = std::polar(1., fundamental * position(axis));
+            entry[0] = 1.;
+            for (int m = 1; m < harmonics; m++) {
+                entry[m] = entry[m - 1] * base;
+            }
+        }
+        return wrapped;
+    };
+    auto phase = [&](const std::complex<double>* entries, const WaveVector& wave) {
+        std::complex<double> product(1., 0.);
+        for (int axis = 0; axis < 3; axis++) {
+            int m = wave.n[axis];
+            std::complex<double> entry = entries[axis * harmonics + std::abs(m)];
+            product = product * (m < 0 ? std::conj(entry) : entry);
+        }
+        return product;
+    };
+    auto sumFactor = [&](int w) {
+        std::complex<double> sum(0., 0.);
+        for (int j = 0; j < n; j++) {
+            sum = sum + sources[j].getMass() * phase(&sourcePhases[(std::size_t)j * 3 * harmonics], waveVectors[w]);
+        }
+        factors[w] = sum;
+    };
+    FieldValues field;
+    field.potential.assign(numberOfProbes, 0.);
+    field.acceleration.assign(numberOfProbes, Eigen::Vector3d(0., 0., 0.));
+
+    /* Field at probe p, with probePhases as scratch for its phase table */
+
+    auto evaluateProbe = [&](int p, double background, std::complex<double>* probePhases) {
+        const Eigen::Vector3d position = wrap(probes[p], probePhases);
+        Eigen::Vector3d acceleration(0., 0., 0.);
+        double potential = background;
+        for (int j = 0; j < n; j++) {
+            Eigen::Vector3d difference = wrappedSources[j] - position;
+            for (int axis = 0; axis < 3; axis++) {
+                if (difference(axis) > halfBox) {
+                    difference(axis) = difference(axis) - boxSize;
+                } else if (difference(axis) < -halfBox) {
+                    difference(axis) = difference(axis) + boxSize;
+                }
+            }
+            double distanceSquared = difference.squaredNorm();
+            double softened = distanceSquared + epsilonSquared;
+            if (distanceSquared < cutoffSquared && softened > 0) {
+                double distance = std::sqrt(distanceSquared);
+                double tablePosition = distance * inverseSpacing;
+                int entry = (int)tablePosition;
+                double fraction = tablePosition - entry;
+                double shortRange = shortRangeTable[entry] + fraction * (shortRangeTable[entry + 1] - shortRangeTable[entry]);
+                double shortRangePotential = shortRangePotentialTable[entry] + fraction * (shortRangePotentialTable[entry + 1] - shortRangePotentialTable[entry]);
+                double mass = sources[j].getMass();
+                acceleration = acceleration + mass * shortRange / (softened * std::sqrt(softened)) * difference;
+                potential = potential - mass * shortRangePotential / std::sqrt(softened);
+            }
+        }
+        for (int w = 0; w < waves; w++) {
+            std::complex<double> term = phase(probePhases, waveVectors[w]) * std::conj(factors[w]);
+            acceleration = acceleration - waveVectors[w].coefficient * std::imag(term) * waveVectors[w].k;
+            potential = potential - waveVectors[w].coefficient * std::real(term);
+        }
+        field.potential[p] = potential;
+        field.acceleration[p] = acceleration;
+    };
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        totalMass = pool.parallelReduce(
+            0, n, 0, 0., [&](long long first, long long last) {
+                double pieceMass = 0.;
+                for (int j = first; j < last; j++) {
+                    wrappedSources[j] = wrap(sources[j].getPosition(), &sourcePhases[(std::size_t)j * 3 * harmonics]);
+                    pieceMass = pieceMass + sources[j].getMass();
+                }
+                return pieceMass;
+            },
+            [](double a, double b) { return a + b; });
+        pool.parallelFor(0, waves, 0, [&](long long first, long long last) {
+            for (int w = first; w < last; w++) {
+                sumFactor(w);
+            }
+        });
+        const double background = M_PI * totalMass / (boxSize * boxSize * boxSize * splitParameter * splitParameter);
+        pool.parallelFor(0, numberOfProbes, 0, [&](long long first, long long last) {
+            std::vector<std::complex<double>> probePhases(3 * harmonics);
+            for (int p = first; p < last; p++) {
+                evaluateProbe(p, background, probePhases.data());
+            }
+        });
+        return field;
+    }
+#pragma omp parallel for schedule(static) reduction(+ : totalMass)
+    for (int j = 0; j < n; j++) {
+        wrappedSources[j] = wrap(sources[j].getPosition(), &sourcePhases[(std::size_t)j * 3 * harmonics]);
+        totalMass = totalMass + sources[j].getMass();
+    }
+#pragma omp parallel for schedule(static)
+    for (int w = 0; w < waves; w++) {
+        sumFactor(w);
+    }
+    const double background = M_PI * totalMass / (boxSize * boxSize * boxSize * splitParameter * splitParameter);
+#pragma omp parallel
+    {
+        std::vector<std::complex<double>> probePhases(3 * harmonics);
+#pragma omp for schedule(static)
+        for (int p = 0; p < numberOfProbes; p++) {
+            evaluateProbe(p, background, probePhases.data());
+        }
+    }
+    return field;
+}
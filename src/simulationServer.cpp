@@ -0,0 +1,477 @@
+#include "simulationServer.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Limits on what a request may ask the server to allocate. The payload is
+ * also checked against what the command needs, and its buffer only grows as
+ * its bytes arrive, by at most payloadGrowthBytes at a time beyond what was
+ * already received. */
+
+static const std::uint32_t maximumNameBytes = 4096;
+static const std::uint64_t maximumPayloadBytes = (std::uint64_t)1 << 34;
+static const std::size_t payloadGrowthBytes = 1 << 20;
+
+/* Time a client is given to take the bytes of a response before it is
+ * disconnected, so that it cannot stall the others */
+
+static const int sendTimeoutMilliseconds = 10000;
+
+static_assert(sizeof(Particle) == 10 * sizeof(double),
+    "The particles are sent as 10 contiguous doubles");
+
+/* Writes all the buffers, going on after partial writes. MSG_NOSIGNAL keeps a
+ * peer that went away from killing the process with SIGPIPE. On a non-blocking
+ * socket it waits for room, for at most sendTimeoutMilliseconds each time. */
+
+static bool sendAll(int socket, iovec* vectors, int count)
+{
+    while (count > 0) {
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+        ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd writable = { socket, POLLOUT, 0 };
+            if (poll(&writable, 1, sendTimeoutMilliseconds) <= 0) {
+                return false;
+            }
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        while (count > 0 && (std::size_t)sent >= vectors->iov_len) {
+            sent = sent - vectors->iov_len;
+            vectors++;
+            count--;
+        }
+        if (count > 0) {
+            vectors->iov_base = static_cast<char*>(vectors->iov_base) + sent;
+            vectors->iov_len = vectors->iov_len - sent;
+        }
+    }
+    return true;
+}
+
+static bool receiveAll(int socket, void* data, std::size_t bytes)
+{
+    char* next = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t received = recv(socket, next, bytes, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        next = next + received;
+        bytes = bytes - received;
+    }
+    return true;
+}
+
+/* Particles from their 10 doubles each, as they travel on the socket */
+
+static std::vector<Particle> particlesFromValues(const std::vector<double>& values)
+{
+    std::vector<Particle> particles;
+    for (std::size_t i = 0; i + 10 <= values.size(); i = i + 10) {
+        const double* value = &values[i];
+        Particle particle(value[0]);
+        particle.setPosition(Eigen::Vector3d(value[1], value[2], value[3]));
+        particle.setVelocity(Eigen::Vector3d(value[4], value[5], value[6]));
+        particle.setAcceleration(Eigen::Vector3d(value[7], value[8], value[9]));
+        particles.push_back(particle);
+    }
+    return particles;
+}
+
+static sockaddr_un socketAddress(const std::string& path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("\nThe socket path must have between 1 and "
+            + std::to_string(sizeof(address.sun_path) - 1) + " characters.\n");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return address;
+}
+
+/* Creates the socket and starts listening. A socket left behind by a previous
+ * server at the same path is removed; any other file there is an error. */
+
+SimulationServer::SimulationServer(std::string socketPathArgument)
+{
+    sockaddr_un address = socketAddress(socketPathArgument);
+    socketPath = socketPathArgument;
+    struct stat status;
+    if (lstat(socketPath.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            throw std::invalid_argument("\n" + socketPath + " exists and is not a socket.\n");
+        }
+        unlink(socketPath.c_str());
+    }
+    listeningSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listeningSocket < 0) {
+        throw std::runtime_error("\nCannot create the socket of the server.\n");
+    }
+    if (bind(listeningSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listeningSocket, 16) != 0) {
+        close(listeningSocket);
+        throw std::runtime_error("\nCannot listen on " + socketPath + ": "
+            + std::strerror(errno) + "\n");
+    }
+}
+
+SimulationServer::~SimulationServer()
+{
+    if (listeningSocket >= 0) {
+        close(listeningSocket);
+        unlink(socketPath.c_str());
+    }
+}
+
+int SimulationServer::getNumberOfSimulations() const
+{
+    return simulations.size();
+}
+
+long long SimulationServer::getNumberOfRequests() const
+{
+    return requests;
+}
+
+/* Serves the clients until one of them sends a shutdown request. Several
+clients can be connected at the same time; the bytes of their requests are
+read as they arrive, and each complete request is executed on its own, so each
+request has all the threads for itself and a slow client only delays itself. */
+
+void SimulationServer::run()
+{
+    std::vector<pollfd> descriptors { { listeningSocket, POLLIN, 0 } };
+    stopping = false;
+    while (!stopping) {
+        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("\nThe server could not wait for requests.\n");
+        }
+        for (int slot = descriptors.size() - 1; slot >= 1 && !stopping; slot--) {
+            if (descriptors[slot].revents == 0) {
+                continue;
+            }
+            int client = descriptors[slot].fd;
+            if (!receiveFromClient(client, connections[client])) {
+                close(client);
+                connections.erase(client);
+                descriptors.erase(descriptors.begin() + slot);
+            }
+        }
+        if (!stopping && (descriptors[0].revents & POLLIN)) {
+            int client = accept(listeningSocket, nullptr, nullptr);
+            if (client >= 0) {
+                fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+                descriptors.push_back({ client, POLLIN, 0 });
+                connections[client] = ClientConnection();
+            }
+        }
+    }
+    for (int slot = 1; slot < descriptors.size(); slot++) {
+        close(descriptors[slot].fd);
+    }
+    connections.clear();
+}
+
+/* Checks a request header before anything is allocated for it: the name must
+ * be short, and the payload must be the one of its command, the 10 doubles of
+ * each of the "count" particles of a load and nothing for the others */
+
+bool SimulationServer::checkRequestHeader(const ServerRequestHeader& request) const
+{
+    if (request.nameBytes > maximumNameBytes) {
+        return false;
+    }
+    if (static_cast<ServerCommand>(request.command) != ServerCommand::load) {
+        return request.payloadBytes == 0;
+    }
+    return request.count > 0
+        && (std::uint64_t)request.count <= maximumPayloadBytes / sizeof(Particle)
+        && request.payloadBytes == (std::uint64_t)request.count * sizeof(Particle);
+}
+
+/* Reads the bytes the client has sent so far into its request, without
+blocking: first the header, then the name, then the payload. Once a request is
+complete it is served and the next one starts; at most one request is served
+per call, so that a client sending many requests does not starve the others.
+Returns false if the connection should be closed. */
+
+bool SimulationServer::receiveFromClient(int client, ClientConnection& connection)
+{
+    while (true) {
+        char* destination = nullptr;
+        std::size_t wanted = 0;
+        std::size_t* received = nullptr;
+        if (connection.headerBytesReceived < sizeof(ServerRequestHeader)) {
+            destination = reinterpret_cast<char*>(&connection.request) + connection.headerBytesReceived;
+            wanted = sizeof(ServerRequestHeader) - connection.headerBytesReceived;
+            received = &connection.headerBytesReceived;
+        } else if (connection.nameBytesReceived < connection.request.nameBytes) {
+            destination = &connection.name[connection.nameBytesReceived];
+            wanted = connection.request.nameBytes - connection.nameBytesReceived;
+            received = &connection.nameBytesReceived;
+        } else if (connection.payloadBytesReceived < connection.request.payloadBytes) {
+            std::size_t capacity = connection.payload.size() * sizeof(double);
+            if (connection.payloadBytesReceived == capacity) {
+                std::size_t grown = std::min<std::uint64_t>(connection.request.payloadBytes,
+                    capacity + std::max(capacity, payloadGrowthBytes));
+                connection.payload.resize(grown / sizeof(double));
+                capacity = grown;
+            }
+            destination = reinterpret_cast<char*>(connection.payload.data()) + connection.payloadBytesReceived;
+            wanted = capacity - connection.payloadBytesReceived;
+            received = &connection.payloadBytesReceived;
+        } else {
+            bool keep = serveRequest(client, connection);
+            connection = ClientConnection();
+            return keep;
+        }
+        ssize_t bytes = recv(client, destination, wanted, MSG_DONTWAIT);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        *received = *received + bytes;
+        if (received == &connection.headerBytesReceived && connection.headerBytesReceived == sizeof(ServerRequestHeader)) {
+            if (!checkRequestHeader(connection.request)) {
+                return false;
+            }
+            connection.name.assign(connection.request.nameBytes, '\0');
+        }
+    }
+}
+
+/* Executes a complete request and sends the response. Returns false if the
+connection should be closed. The particles of a snapshot are sent straight from
+the memory of the simulation, with the header in the same sendmsg call. */
+
+bool SimulationServer::serveRequest(int client, ClientConnection& connection)
+{
+    const ServerRequestHeader& request = connection.request;
+    const std::string& name = connection.name;
+    requests++;
+    ServerResponseHeader response;
+    std::string message;
+    const void* responsePayload = nullptr;
+    try {
+        response = execute(request, name, connection.payload);
+        if (static_cast<ServerCommand>(request.command) == ServerCommand::snapshot) {
+            ConstParticleSpan particles = findSimulation(name).getSystemView();
+            responsePayload = particles.data();
+            response.payloadBytes = particles.size() * sizeof(Particle);
+        }
+    } catch (const std::exception& error) {
+        message = error.what();
+        response = ServerResponseHeader();
+        response.status = 1;
+        response.payloadBytes = message.size();
+        responsePayload = message.data();
+    }
+    iovec vectors[2] = { { &response, sizeof(response) },
+        { const_cast<void*>(responsePayload), response.payloadBytes } };
+    return sendAll(client, vectors, response.payloadBytes > 0 ? 2 : 1);
+}
+
+InitialConditionGenerator& SimulationServer::findSimulation(
+    const std::string& name)
+{
+    auto simulation = simulations.find(name);
+    if (simulation == simulations.end()) {
+        throw std::invalid_argument("\nThere is no simulation called " + name + ".\n");
+    }
+    return *simulation->second;
+}
+
+/* Executes a request on the simulations. Generating or loading a system with
+ * the name of an existing one replaces it. */
+
+ServerResponseHeader SimulationServer::execute(
+    const ServerRequestHeader& request, const std::string& name,
+    const std::vector<double>& payload)
+{
+    ServerCommand command = static_cast<ServerCommand>(request.command);
+    if (command == ServerCommand::shutdown) {
+        stopping = true;
+        return ServerResponseHeader();
+    }
+    if (command == ServerCommand::generateNBody || command == ServerCommand::generateSolarSystem) {
+        std::unique_ptr<InitialConditionGenerator> system;
+        if (command == ServerCommand::generateNBody) {
+            if (request.count <= 0) {
+                throw std::invalid_argument("\nThe number of particles should be higher than 0\n");
+            }
+            system = std::make_unique<nBodySystemGenerator>();
+            system->generateInitialConditions(request.count);
+        } else {
+            system = std::make_unique<solarSystemGenerator>();
+            system->generateInitialConditions(9);
+        }
+        simulations[name] = std::move(system);
+    } else if (command == ServerCommand::load) {
+        std::vector<Particle> particles = particlesFromValues(payload);
+        if (particles.empty() || particles.size() * 10 != payload.size()) {
+            throw std::invalid_argument("\nThe payload must hold 10 doubles per particle.\n");
+        }
+        std::unique_ptr<InitialConditionGenerator> system = std::make_unique<nBodySystemGenerator>();
+        system->copySystem(&particles);
+        simulations[name] = std::move(system);
+    } else if (command == ServerCommand::remove) {
+        findSimulation(name);
+        simulations.erase(name);
+        return ServerResponseHeader();
+    } else if (command == ServerCommand::advance) {
+        if (request.count <= 0 || request.dt <= 0 || request.epsilon < 0) {
+            throw std::invalid_argument(
+                "\nAdvancing needs a positive number of steps, a positive dt and a non negative epsilon.\n");
+        }
+        findSimulation(name).evolutionOfSystem("steps", request.count, request.dt,
+            request.epsilon);
+    } else if (command != ServerCommand::energy && command != ServerCommand::snapshot) {
+        throw std::invalid_argument("\nUnknown command "
+            + std::to_string(request.command) + ".\n");
+    }
+    InitialConditionGenerator& simulation = findSimulation(name);
+    ServerResponseHeader response;
+    response.iterations = simulation.getIterations();
+    response.numberOfParticles = simulation.getSystemView().size();
+    response.time = simulation.getElapsedTime();
+    if (command == ServerCommand::energy) {
+        response.energy = calculateTotalEnergy(simulation.getSystemView());
+    }
+    return response;
+}
+
+SimulationClient::SimulationClient(const std::string& socketPath)
+{
+    sockaddr_un address = socketAddress(socketPath);
+    connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (connection >= 0) {
+            close(connection);
+        }
+        throw std::runtime_error("\nCannot connect to the server at " + socketPath + ".\n");
+    }
+}
+
+SimulationClient::~SimulationClient()
+{
+    close(connection);
+}
+
+/* Sends one request and waits for its response. A payload of particles is
+ * sent straight from their memory. */
+
+ServerResponseHeader SimulationClient::call(ServerCommand command,
+    const std::string& name, std::int64_t count, double dt, double epsilon,
+    const void* payload, std::size_t payloadBytes,
+    std::vector<double>* responsePayload)
+{
+    ServerRequestHeader request;
+    request.command = static_cast<std::uint32_t>(command);
+    request.nameBytes = name.size();
+    request.count = count;
+    request.dt = dt;
+    request.epsilon = epsilon;
+    request.payloadBytes = payloadBytes;
+    iovec vectors[3] = { { &request, sizeof(request) },
+        { const_cast<char*>(name.data()), name.size() },
+        { const_cast<void*>(payload), payloadBytes } };
+    ServerResponseHeader response;
+    if (!sendAll(connection, vectors, 3) || !receiveAll(connection, &response, sizeof(response))) {
+        throw std::runtime_error("\nThe connection to the server was lost.\n");
+    }
+    if (response.status != 0) {
+        std::string message(response.payloadBytes, '\0');
+        if (!receiveAll(connection, &message[0], message.size())) {
+            throw std::runtime_error("\nThe connection to the server was lost.\n");
+        }
+        throw std::runtime_error(message);
+    }
+    std::vector<double> values(response.payloadBytes / sizeof(double));
+    if (!receiveAll(connection, values.data(), response.payloadBytes)) {
+        throw std::runtime_error("\nThe connection to the server was lost.\n");
+    }
+    if (responsePayload != nullptr) {
+        responsePayload->swap(values);
+    }
+    return response;
+}
+
+ServerResponseHeader SimulationClient::generateNBody(const std::string& name,
+    int numberOfParticles)
+{
+    return call(ServerCommand::generateNBody, name, numberOfParticles, 0., 0.,
+        nullptr, 0, nullptr);
+}
+
+ServerResponseHeader SimulationClient::generateSolarSystem(
+    const std::string& name)
+{
+    return call(ServerCommand::generateSolarSystem, name, 9, 0., 0., nullptr, 0,
+        nullptr);
+}
+
+ServerResponseHeader SimulationClient::load(const std::string& name,
+    ConstParticleSpan particles)
+{
+    return call(ServerCommand::load, name, particles.size(), 0., 0.,
+        particles.data(), particles.size() * sizeof(Particle), nullptr);
+}
+
+ServerResponseHeader SimulationClient::advance(const std::string& name,
+    int steps, double dt, double epsilon)
+{
+    return call(ServerCommand::advance, name, steps, dt, epsilon, nullptr, 0,
+        nullptr);
+}
+
+ServerResponseHeader SimulationClient::energy(const std::string& name)
+{
+    return call(ServerCommand::energy, name, 0, 0., 0., nullptr, 0, nullptr);
+}
+
+std::vector<Particle> SimulationClient::snapshot(const std::string& name)
+{
+    std::vector<double> values;
+    call(ServerCommand::snapshot, name, 0, 0., 0., nullptr, 0, &values);
+    return particlesFromValues(values);
+}
+
+ServerResponseHeader SimulationClient::remove(const std::string& name)
+{
+    return call(ServerCommand::remove, name, 0, 0., 0., nullptr, 0, nullptr);
+}
+
+void SimulationClient::shutdown()
+{
+    call(ServerCommand::shutdown, "", 0, 0., 0., nullptr, 0, nullptr);
+}
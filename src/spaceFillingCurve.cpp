@@ -0,0 +1,184 @@
+#include "spaceFillingCurve.hpp"
+
+#include "execution.hpp"
+#include "omp.h"
+#include "parallelSort.hpp"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+SpaceFillingCurve spaceFillingCurveFromName(const std::string& name)
+{
+    if (name == "morton") {
+        return SpaceFillingCurve::morton;
+    }
+    if (name == "hilbert") {
+        return SpaceFillingCurve::hilbert;
+    }
+    throw std::invalid_argument("\nUnknown space filling curve " + name
+        + ": use morton or hilbert.\n");
+}
+
+std::string spaceFillingCurveName(SpaceFillingCurve curve)
+{
+    switch (curve) {
+    case SpaceFillingCurve::hilbert:
+        return "hilbert";
+    default:
+        return "morton";
+    }
+}
+
+/* Moves bit b of a 21-bit value to bit 3b, leaving two zero bits between
+ * consecutive bits of the value */
+
+static std::uint64_t spreadBits(std::uint32_t value)
+{
+    std::uint64_t x = value & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+/* Morton key of a grid cell: the bits of the three coordinates interleaved,
+ * x giving the most significant bit of each group of three */
+
+std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+    return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
+
+/* Hilbert key of a grid cell, with the algorithm of J. Skilling ("Programming
+the Hilbert curve", AIP Conf. Proc. 707, 2004): the coordinates are turned into
+the "transposed" form of the Hilbert index, whose bits interleaved like a
+Morton key give the distance along the curve. The first 8^k cells of the curve
+fill the cube of side 2^k at the origin, and consecutive cells always share a
+face. */
+
+std::uint64_t hilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+    const std::uint32_t highestBit = 1u << (curveBitsPerDimension - 1);
+    std::uint32_t coordinates[3] = { x & 0x1fffff, y & 0x1fffff, z & 0x1fffff };
+
+    /* Inverse undo of the rotations and reflections */
+
+    for (std::uint32_t bit = highestBit; bit > 1; bit >>= 1) {
+        std::uint32_t lowerBits = bit - 1;
+        for (int i = 0; i < 3; i++) {
+            if (coordinates[i] & bit) {
+                coordinates[0] ^= lowerBits;
+            } else {
+                std::uint32_t swapped = (coordinates[0] ^ coordinates[i]) & lowerBits;
+                coordinates[0] ^= swapped;
+                coordinates[i] ^= swapped;
+            }
+        }
+    }
+
+    /* Gray encoding */
+
+    coordinates[1] ^= coordinates[0];
+    coordinates[2] ^= coordinates[1];
+    std::uint32_t flips = 0;
+    for (std::uint32_t bit = highestBit; bit > 1; bit >>= 1) {
+        if (coordinates[2] & bit) {
+            flips ^= bit - 1;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        coordinates[i] ^= flips;
+    }
+    return mortonKey(coordinates[0], coordinates[1], coordinates[2]);
+}
+
+/* Order of the particles along the curve: order[k] is the index of the
+particle that should be stored at position k. The bounding box of the positions
+is divided into 2^21 cells per side, the key of the cell of every particle is
+computed in parallel and the keys are sorted with parallelRadixSort. The sort
+is stable, so particles in the same cell keep their relative order. */
+
+std::vector<int> spaceFillingCurveOrder(ConstParticleSpan particles,
+    SpaceFillingCurve curve)
+{
+    const int n = particles.size();
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    if (n < 2) {
+        return order;
+    }
+    double minimumX = std::numeric_limits<double>::max();
+    double minimumY = minimumX;
+    double minimumZ = minimumX;
+    double maximumX = std::numeric_limits<double>::lowest();
+    double maximumY = maximumX;
+    double maximumZ = maximumX;
+    if (usingWorkStealingPool()) {
+        typedef std::pair<Eigen::Vector3d, Eigen::Vector3d> Box;
+        Box box = threadPool().parallelReduce(
+            0, n, 0, Box(Eigen::Vector3d::Constant(minimumX), Eigen::Vector3d::Constant(maximumX)),
+            [&](long long first, long long last) {
+                Box pieceBox(Eigen::Vector3d::Constant(minimumX), Eigen::Vector3d::Constant(maximumX));
+                for (int i = first; i < last; i++) {
+                    pieceBox.first = pieceBox.first.cwiseMin(particles[i].getPosition());
+                    pieceBox.second = pieceBox.second.cwiseMax(particles[i].getPosition());
+                }
+                return pieceBox;
+            },
+            [](const Box& a, const Box& b) {
+                return Box(a.first.cwiseMin(b.first), a.second.cwiseMax(b.second));
+            });
+        minimumX = box.first.x();
+        minimumY = box.first.y();
+        minimumZ = box.first.z();
+        maximumX = box.second.x();
+        maximumY = box.second.y();
+        maximumZ = box.second.z();
+    } else {
+#pragma omp parallel for schedule(static) reduction(min : minimumX, minimumY, minimumZ) reduction(max : maximumX, maximumY, maximumZ)
+        for (int i = 0; i < n; i++) {
+            const Eigen::Vector3d& position = particles[i].getPosition();
+            minimumX = std::min(minimumX, position.x());
+            minimumY = std::min(minimumY, position.y());
+            minimumZ = std::min(minimumZ, position.z());
+            maximumX = std::max(maximumX, position.x());
+            maximumY = std::max(maximumY, position.y());
+            maximumZ = std::max(maximumZ, position.z());
+        }
+    }
+
+    /* The same scale is used along the three axes, so that the cells are
+     * cubes */
+
+    double side = std::max({ maximumX - minimumX, maximumY - minimumY,
+        maximumZ - minimumZ });
+    const double cells = (double)(1u << curveBitsPerDimension);
+    double scale = side > 0 ? (cells - 1) / side : 0.;
+    std::vector<std::uint64_t> keys(n);
+    auto computeKey = [&](int i) {
+        const Eigen::Vector3d& position = particles[i].getPosition();
+        std::uint32_t x = (position.x() - minimumX) * scale;
+        std::uint32_t y = (position.y() - minimumY) * scale;
+        std::uint32_t z = (position.z() - minimumZ) * scale;
+        keys[i] = curve == SpaceFillingCurve::hilbert ? hilbertKey(x, y, z)
+                                                      : mortonKey(x, y, z);
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                computeKey(i);
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            computeKey(i);
+        }
+    }
+    parallelRadixSort(keys, order);
+    return order;
+}
@@ -0,0 +1,248 @@
+#include "testParticles.hpp"
+
+#include "execution.hpp"
+#include "instrumentation.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/* Number of particles whose accelerations a thread sums at once: the loops
+ * over the massive bodies run over the particles of a block, which vectorise
+ * and stay in cache */
+
+static const int particleBlock = 256;
+
+MassiveTestParticleBackend::MassiveTestParticleBackend(
+    double massThresholdArgument)
+{
+    if (massThresholdArgument < 0) {
+        throw std::invalid_argument("\nThe mass threshold of the test particles cannot be negative.\n");
+    }
+    massThreshold = massThresholdArgument;
+}
+
+std::string MassiveTestParticleBackend::getName() const
+{
+    return "split";
+}
+
+double MassiveTestParticleBackend::getMassThreshold() const
+{
+    return massThreshold;
+}
+
+/* Number of massive bodies found in the last call of computeAccelerations */
+
+int MassiveTestParticleBackend::getNumberOfMassiveParticles() const
+{
+    return massiveParticles.size();
+}
+
+/* Splits the particles again at every step, since their masses can change
+ * (e.g. when bodies merge), and copies their positions into the columns */
+
+void MassiveTestParticleBackend::gatherColumns(ConstParticleSpan particles)
+{
+    const int n = particles.size();
+    positionX.resize(n);
+    positionY.resize(n);
+    positionZ.resize(n);
+    testMass.resize(n);
+    massiveParticles.clear();
+    for (int i = 0; i < n; i++) {
+        if (particles[i].getMass() >= massThreshold) {
+            massiveParticles.push_back(i);
+        }
+    }
+    auto gatherParticle = [&](int i) {
+        const Eigen::Vector3d& position = particles[i].getPosition();
+        positionX[i] = position(0);
+        positionY[i] = position(1);
+        positionZ[i] = position(2);
+        testMass[i] = particles[i].getMass() >= massThreshold ? 0. : particles[i].getMass();
+    };
+    if (usingWorkStealingPool()) {
+        threadPool().parallelFor(0, n, 0, [&](long long first, long long last) {
+            for (int i = first; i < last; i++) {
+                gatherParticle(i);
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            gatherParticle(i);
+        }
+    }
+    const int m = massiveParticles.size();
+    massiveX.resize(m);
+    massiveY.resize(m);
+    massiveZ.resize(m);
+    massiveMass.resize(m);
+    for (int k = 0; k < m; k++) {
+        massiveX[k] = positionX[massiveParticles[k]];
+        massiveY[k] = positionY[massiveParticles[k]];
+        massiveZ[k] = positionZ[massiveParticles[k]];
+        massiveMass[k] = particles[massiveParticles[k]].getMass();
+    }
+}
+
+/* First every particle, massive or not, sums the force of the massive bodies,
+looping over the particles of its block in the inner loop. A massive body meets
+itself at zero distance, which adds nothing. Then the massive bodies sum the
+force of the test particles: every thread goes through its blocks of particles
+with the mass of the massive ones set to zero, and the per-thread sums (the
+per-piece sums of the reduction on the pool) are added at the end. */
+
+void MassiveTestParticleBackend::computeAccelerations(ParticleSpan particles,
+    double epsilon)
+{
+    gatherColumns(particles);
+    const int n = particles.size();
+    const int m = massiveParticles.size();
+    const int blocks = (n + particleBlock - 1) / particleBlock;
+    const double epsilonSquared = epsilon * epsilon;
+    std::vector<double> backReaction(3 * m, 0.);
+
+    /* Force of the massive bodies on the particles of a block, with ax, ay and
+     * az as scratch; returns the number of pairs */
+
+    auto accelerateBlock = [&](int block, double* ax, double* ay, double* az) {
+        int first = block * particleBlock;
+        int count = std::min(n, first + particleBlock) - first;
+        const double* x = positionX.data() + first;
+        const double* y = positionY.data() + first;
+        const double* z = positionZ.data() + first;
+        std::fill(ax, ax + count, 0.);
+        std::fill(ay, ay + count, 0.);
+        std::fill(az, az + count, 0.);
+        for (int k = 0; k < m; k++) {
+            const double sourceX = massiveX[k];
+            const double sourceY = massiveY[k];
+            const double sourceZ = massiveZ[k];
+            const double sourceMass = massiveMass[k];
+#pragma omp simd
+            for (int i = 0; i < count; i++) {
+                double dx = sourceX - x[i];
+                double dy = sourceY - y[i];
+                double dz = sourceZ - z[i];
+                double distanceSquared = dx * dx + dy * dy + dz * dz + epsilonSquared;
+                double factor = distanceSquared > 0 ? sourceMass / (distanceSquared * std::sqrt(distanceSquared)) : 0.;
+                ax[i] = ax[i] + factor * dx;
+                ay[i] = ay[i] + factor * dy;
+                az[i] = az[i] + factor * dz;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            particles[first + i].setAcceleration(Eigen::Vector3d(ax[i], ay[i], az[i]));
+        }
+        return (long long)count * m;
+    };
+
+    /* Force of the test particles of a block on the massive bodies, added to
+     * localBackReaction; returns the number of pairs */
+
+    auto reactOnMassive = [&](int block, std::vector<double>& localBackReaction) {
+        int first = block * particleBlock;
+        int last = std::min(n, first + particleBlock);
+        for (int k = 0; k < m; k++) {
+            const double targetX = massiveX[k];
+            const double targetY = massiveY[k];
+            const double targetZ = massiveZ[k];
+            double sumX = 0., sumY = 0., sumZ = 0.;
+#pragma omp simd reduction(+ : sumX, sumY, sumZ)
+            for (int j = first; j < last; j++) {
+                double dx = positionX[j] - targetX;
+                double dy = positionY[j] - targetY;
+                double dz = positionZ[j] - targetZ;
+                double distanceSquared = dx * dx + dy * dy + dz * dz + epsilonSquared;
+                double factor = distanceSquared > 0 ? testMass[j] / (distanceSquared * std::sqrt(distanceSquared)) : 0.;
+                sumX = sumX + factor * dx;
+                sumY = sumY + factor * dy;
+                sumZ = sumZ + factor * dz;
+            }
+            localBackReaction[3 * k] += sumX;
+            localBackReaction[3 * k + 1] += sumY;
+            localBackReaction[3 * k + 2] += sumZ;
+        }
+        return (long long)(last - first) * m;
+    };
+    if (usingWorkStealingPool()) {
+        WorkStealingPool& pool = threadPool();
+        pool.parallelFor(0, blocks, 1, [&](long long firstBlock, long long lastBlock) {
+            INSTRUMENT_PHASE(Phase::force);
+            INSTRUMENT_HARDWARE(Phase::force);
+            double ax[particleBlock], ay[particleBlock], az[particleBlock];
+            long long pairsEvaluated = 0;
+            for (int block = firstBlock; block < lastBlock; block++) {
+                pairsEvaluated = pairsEvaluated + accelerateBlock(block, ax, ay, az);
+            }
+            INSTRUMENT_PAIRS(pairsEvaluated);
+        });
+        backReaction = pool.parallelReduce(
+            0, blocks, 0, backReaction, [&](long long firstBlock, long long lastBlock) {
+                INSTRUMENT_PHASE(Phase::force);
+                INSTRUMENT_HARDWARE(Phase::force);
+                std::vector<double> localBackReaction(3 * m, 0.);
+                long long pairsEvaluated = 0;
+                for (int block = firstBlock; block < lastBlock; block++) {
+                    pairsEvaluated = pairsEvaluated + reactOnMassive(block, localBackReaction);
+                }
+                INSTRUMENT_PAIRS(pairsEvaluated);
+                return localBackReaction;
+            },
+            [](std::vector<double> sum, const std::vector<double>& partial) {
+                for (std::size_t c = 0; c < sum.size(); c++) {
+                    sum[c] += partial[c];
+                }
+                return sum;
+            });
+    } else {
+#pragma omp parallel
+        {
+            {
+                INSTRUMENT_PHASE(Phase::force);
+                INSTRUMENT_HARDWARE(Phase::force);
+                long long pairsEvaluated = 0;
+                double ax[particleBlock], ay[particleBlock], az[particleBlock];
+#pragma omp for schedule(runtime) nowait
+                for (int block = 0; block < blocks; block++) {
+                    pairsEvaluated = pairsEvaluated + accelerateBlock(block, ax, ay, az);
+                }
+
+                std::vector<double> localBackReaction(3 * m, 0.);
+#pragma omp for schedule(runtime) nowait
+                for (int block = 0; block < blocks; block++) {
+                    pairsEvaluated = pairsEvaluated + reactOnMassive(block, localBackReaction);
+                }
+#pragma omp critical
+                for (int c = 0; c < 3 * m; c++) {
+                    backReaction[c] += localBackReaction[c];
+                }
+                INSTRUMENT_PAIRS(pairsEvaluated);
+            }
+            {
+                INSTRUMENT_PHASE(Phase::synchronisation);
+#pragma omp barrier
+            }
+        }
+    }
+    for (int k = 0; k < m; k++) {
+        Particle& massive = particles[massiveParticles[k]];
+        massive.setAcceleration(massive.getAcceleration() + Eigen::Vector3d(backReaction[3 * k], backReaction[3 * k + 1], backReaction[3 * k + 2]));
+    }
+}
+
+/* The probes are test particles too: they only feel the massive bodies */
+
+FieldValues MassiveTestParticleBackend::evaluateField(
+    ConstParticleSpan sources, const std::vector<Eigen::Vector3d>& probes,
+    double epsilon)
+{
+    std::vector<Particle> massive;
+    for (const Particle& particle : sources) {
+        if (particle.getMass() >= massThreshold) {
+            massive.push_back(particle);
+        }
+    }
+    return evaluateFieldDirect(massive, probes, epsilon);
+}
@@ -0,0 +1,126 @@
+#include "threadPlacement.hpp"
+
+#include "execution.hpp"
+#include "numaAllocator.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+/* NUMA node of a CPU, from the nodeN link in its sysfs directory (0 if it is
+ * not there) */
+
+static int numaNodeOfCpu(int cpu)
+{
+    for (int node = 0; node < getNumberOfNumaNodes(); node++) {
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node" + std::to_string(node);
+        if (access(path.c_str(), F_OK) == 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+static std::string procBindName(omp_proc_bind_t binding)
+{
+    switch (binding) {
+    case omp_proc_bind_false:
+        return "false";
+    case omp_proc_bind_true:
+        return "true";
+    case omp_proc_bind_master:
+        return "master";
+    case omp_proc_bind_close:
+        return "close";
+    case omp_proc_bind_spread:
+        return "spread";
+    default:
+        return "unknown";
+    }
+}
+
+/* Pins every OpenMP thread to one CPU. If the runtime already binds the
+threads (OMP_PROC_BIND / OMP_PLACES) its placement is kept. Otherwise thread t
+is pinned to the t-th CPU the process may run on, with the CPUs ordered by NUMA
+node: consecutive threads share a node, the same compact order in which the
+static schedule hands out consecutive shares of the particles. The threads of
+later parallel regions of the same size are the same, so the pinning lasts.
+Returns false if some thread could not be pinned. The threads of the pool are
+not OpenMP threads, so pinning is refused when the loops run on it. */
+
+bool pinThreads()
+{
+    if (usingWorkStealingPool()) {
+        throw std::logic_error("\nOnly the OpenMP threads can be pinned: the loops "
+                               "run on the work-stealing pool.\n");
+    }
+    if (omp_get_proc_bind() != omp_proc_bind_false) {
+        return true;
+    }
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return false;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        return false;
+    }
+    std::stable_sort(cpus.begin(), cpus.end(), [](int a, int b) {
+        return numaNodeOfCpu(a) < numaNodeOfCpu(b);
+    });
+    bool allPinned = true;
+#pragma omp parallel reduction(&& \
+                               : allPinned)
+    {
+        cpu_set_t single;
+        CPU_ZERO(&single);
+        CPU_SET(cpus.at(omp_get_thread_num() % cpus.size()), &single);
+        allPinned = sched_setaffinity(0, sizeof(single), &single) == 0;
+    }
+    return allPinned;
+}
+
+/* CPU and NUMA node each OpenMP thread is running on. A thread counts as
+ * pinned if it may only run on one CPU or if the runtime binds it to a
+ * place. */
+
+std::vector<ThreadPlacement> getThreadPlacement()
+{
+    std::vector<ThreadPlacement> placement(omp_get_max_threads());
+    bool runtimeBinding = omp_get_proc_bind() != omp_proc_bind_false;
+#pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        bool singleCpu = sched_getaffinity(0, sizeof(mask), &mask) == 0 && CPU_COUNT(&mask) == 1;
+        int cpu = sched_getcpu();
+        placement.at(thread) = { thread, cpu, cpu < 0 ? 0 : numaNodeOfCpu(cpu),
+            singleCpu || (runtimeBinding && omp_get_place_num() >= 0) };
+    }
+    return placement;
+}
+
+/* Human readable report of the binding policy and of the placement achieved */
+
+std::string describeThreadBinding()
+{
+    std::ostringstream description;
+    description << "proc_bind = " << procBindName(omp_get_proc_bind())
+                << ", places = " << omp_get_num_places()
+                << ", NUMA nodes = " << getNumberOfNumaNodes();
+    for (const ThreadPlacement& thread : getThreadPlacement()) {
+        description << "\n   thread " << thread.thread << ": cpu " << thread.cpu
+                    << " (node " << thread.numaNode << ", "
+                    << (thread.pinned ? "pinned" : "not pinned") << ")";
+    }
+    return description.str();
+}
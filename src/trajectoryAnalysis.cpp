@@ -0,0 +1,428 @@
+#include "trajectoryAnalysis.hpp"
+
+#include "checkpoint.hpp"
+#include "execution.hpp"
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <unistd.h>
+
+/* Analysis of the checkpoints of a run, which are mapped into memory (see
+MappedCheckpoint) rather than loaded, so that a trajectory larger than the
+memory can be gone through. Every frame gives its conserved quantities, the
+Keplerian elements of every body around the central body (the one with
+identifier 0, the star of the generators) and the histograms of the distance
+and speed relative to it. */
+
+static const double elementsTolerance = 1e-11;
+static const char elementsMagic[8] = { 'N', 'B', 'O', 'D', 'Y', 'E', 'L', '1' };
+
+/* Layout of the elements file: this header, then for every frame its step,
+time and number of particles followed, for every particle, by its identifier
+and its six elements as doubles (NaN for the central body) */
+
+struct ElementsFileHeader {
+    char magic[8];
+    long long numberOfFrames;
+};
+
+static const std::size_t valuesPerBody = 7;
+static const std::size_t frameHeaderBytes = 3 * sizeof(double);
+
+/* Angle in [0, 2 pi) that turns the direction "from" into the direction "to"
+ * counterclockwise around "normal" */
+
+static double angleAround(const Eigen::Vector3d& from, const Eigen::Vector3d& to,
+    const Eigen::Vector3d& normal)
+{
+    double angle = std::atan2(normal.dot(from.cross(to)), from.dot(to));
+    return angle < 0 ? angle + 2 * M_PI : angle;
+}
+
+/* Elements of the relative orbit of position and velocity, with
+gravitationalParameter = G (m_central + m_body). The angles that are not
+defined fall back to the usual conventions: on an equatorial orbit the node is
+taken on the x axis (so that the argument of pericentre is the longitude of
+pericentre), and on a circular orbit the pericentre is taken at the node (so
+that the true anomaly is the argument of latitude). */
+
+OrbitalElements keplerianElements(const Eigen::Vector3d& position,
+    const Eigen::Vector3d& velocity, double gravitationalParameter)
+{
+    double distance = position.norm();
+    if (gravitationalParameter <= 0 || distance == 0) {
+        throw std::invalid_argument("\nThe elements need a positive gravitational parameter and a non-zero distance\n");
+    }
+    Eigen::Vector3d angularMomentum = position.cross(velocity);
+    double angularMomentumNorm = angularMomentum.norm();
+    Eigen::Vector3d normal = angularMomentumNorm > 0 ? Eigen::Vector3d(angularMomentum / angularMomentumNorm)
+                                                     : Eigen::Vector3d(0., 0., 1.);
+    Eigen::Vector3d eccentricityVector = ((velocity.squaredNorm() - gravitationalParameter / distance) * position
+                                             - position.dot(velocity) * velocity)
+        / gravitationalParameter;
+    double energy = 0.5 * velocity.squaredNorm() - gravitationalParameter / distance;
+
+    OrbitalElements elements;
+    elements.eccentricity = eccentricityVector.norm();
+    elements.semiMajorAxis = energy != 0 ? -gravitationalParameter / (2 * energy)
+                                         : std::numeric_limits<double>::infinity();
+    elements.inclination = std::acos(std::clamp(normal.z(), -1., 1.));
+
+    Eigen::Vector3d node(-normal.y(), normal.x(), 0.);
+    if (node.norm() > elementsTolerance) {
+        node.normalize();
+        elements.longitudeOfAscendingNode = angleAround(Eigen::Vector3d(1., 0., 0.), node, Eigen::Vector3d(0., 0., 1.));
+    } else {
+        node = Eigen::Vector3d(1., 0., 0.);
+    }
+    Eigen::Vector3d pericentre = node;
+    if (elements.eccentricity > elementsTolerance) {
+        pericentre = eccentricityVector / elements.eccentricity;
+        elements.argumentOfPericentre = angleAround(node, pericentre, normal);
+    }
+    elements.trueAnomaly = angleAround(pericentre, position / distance, normal);
+    return elements;
+}
+
+/* Index of the central body: the particle with identifier 0, or the first one
+ * if no identifier is 0 */
+
+static std::size_t centralBodyIndex(const int* identifiers, std::size_t numberOfParticles)
+{
+    for (std::size_t i = 0; i < numberOfParticles; i++) {
+        if (identifiers[i] == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static std::size_t histogramBin(double value, double maximum, int bins)
+{
+    long long bin = (long long)(value / maximum * bins);
+    return (std::size_t)std::clamp(bin, 0LL, (long long)bins - 1);
+}
+
+/* Sums of a frame, reduced over the particles: kinetic, pairwise and central
+ * potential energy, momentum, angular momentum, mass-weighted position, mass,
+ * bound bodies and the sums of their eccentricities and semi-major axes */
+
+enum FrameSum {
+    kineticSum,
+    potentialSum,
+    centralPotentialSum,
+    momentumSum,
+    angularMomentumSum = momentumSum + 3,
+    massPositionSum = angularMomentumSum + 3,
+    massSum = massPositionSum + 3,
+    boundSum,
+    eccentricitySum,
+    semiMajorAxisSum,
+    numberOfFrameSums
+};
+
+/* Sums and histograms of a range of the particles of a frame, the partial
+ * value of the reduction over the particles on the pool */
+
+struct FramePartial {
+    double sums[numberOfFrameSums] = {};
+    std::vector<long long> radialHistogram {};
+    std::vector<long long> speedHistogram {};
+};
+
+/* Analyses one frame, going through its particles in parallel if
+"parallelParticles" (when there are fewer frames than threads), and writes the
+elements of its bodies to "elements" if it is not null. On the pool the
+particles are always shared, as the loop over them becomes more tasks on the
+threads that analyse the frames. */
+
+static FrameSummary analyzeFrame(const MappedCheckpoint& frame,
+    const AnalysisSettings& settings, double* elements, bool parallelParticles)
+{
+    ConstParticleSpan particles = frame.getParticles();
+    const int* identifiers = frame.getIdentifiers();
+    std::size_t numberOfParticles = particles.size();
+    std::size_t central = centralBodyIndex(identifiers, numberOfParticles);
+    bool pairwise = (long long)numberOfParticles <= settings.pairwiseEnergyLimit;
+    const Particle& centralBody = particles[central];
+    double nan = std::numeric_limits<double>::quiet_NaN();
+
+    FrameSummary summary;
+    summary.step = frame.getStep();
+    summary.time = frame.getTime();
+    summary.numberOfParticles = numberOfParticles;
+    summary.radialHistogram.assign(settings.bins, 0);
+    summary.speedHistogram.assign(settings.bins, 0);
+    double sums[numberOfFrameSums] = {};
+
+    auto analyzeParticle = [&](std::size_t i, double* particleSums,
+        std::vector<long long>& radialHistogram, std::vector<long long>& speedHistogram) {
+        const Particle& particle = particles[i];
+        double mass = particle.getMass();
+        const Eigen::Vector3d& position = particle.getPosition();
+        const Eigen::Vector3d& velocity = particle.getVelocity();
+        Eigen::Vector3d momentum = mass * velocity;
+        Eigen::Vector3d angularMomentum = position.cross(momentum);
+        particleSums[kineticSum] += particle.calculateKineticEnergy();
+        if (pairwise) {
+            particleSums[potentialSum] += calculatePotentialEnergyOfParticle(particles, i);
+        }
+        for (int k = 0; k < 3; k++) {
+            particleSums[momentumSum + k] += momentum[k];
+            particleSums[angularMomentumSum + k] += angularMomentum[k];
+            particleSums[massPositionSum + k] += mass * position[k];
+        }
+        particleSums[massSum] += mass;
+
+        double* row = elements ? elements + i * valuesPerBody : nullptr;
+        if (row) {
+            row[0] = identifiers[i];
+            std::fill(row + 1, row + valuesPerBody, nan);
+        }
+        Eigen::Vector3d relativePosition = position - centralBody.getPosition();
+        Eigen::Vector3d relativeVelocity = velocity - centralBody.getVelocity();
+        double distance = relativePosition.norm();
+        if (i == central || distance == 0) {
+            return;
+        }
+        particleSums[centralPotentialSum] -= centralBody.getMass() * mass / distance;
+        radialHistogram[histogramBin(distance, settings.maximumRadius, settings.bins)]++;
+        speedHistogram[histogramBin(relativeVelocity.norm(), settings.maximumSpeed, settings.bins)]++;
+        double gravitationalParameter = centralBody.getMass() + mass;
+        if (gravitationalParameter <= 0) {
+            return;
+        }
+        OrbitalElements orbit = keplerianElements(relativePosition, relativeVelocity, gravitationalParameter);
+        if (orbit.semiMajorAxis > 0 && orbit.eccentricity < 1) {
+            particleSums[boundSum] += 1;
+            particleSums[eccentricitySum] += orbit.eccentricity;
+            particleSums[semiMajorAxisSum] += orbit.semiMajorAxis;
+        }
+        if (row) {
+            row[1] = orbit.semiMajorAxis;
+            row[2] = orbit.eccentricity;
+            row[3] = orbit.inclination;
+            row[4] = orbit.longitudeOfAscendingNode;
+            row[5] = orbit.argumentOfPericentre;
+            row[6] = orbit.trueAnomaly;
+        }
+    };
+    if (usingWorkStealingPool()) {
+        FramePartial identity;
+        identity.radialHistogram.assign(settings.bins, 0);
+        identity.speedHistogram.assign(settings.bins, 0);
+        FramePartial total = threadPool().parallelReduce(
+            0, numberOfParticles, 0, identity, [&](long long first, long long last) {
+                FramePartial partial = identity;
+                for (long long i = first; i < last; i++) {
+                    analyzeParticle(i, partial.sums, partial.radialHistogram, partial.speedHistogram);
+                }
+                return partial;
+            },
+            [](FramePartial sum, const FramePartial& partial) {
+                for (int k = 0; k < numberOfFrameSums; k++) {
+                    sum.sums[k] += partial.sums[k];
+                }
+                for (std::size_t bin = 0; bin < sum.radialHistogram.size(); bin++) {
+                    sum.radialHistogram[bin] += partial.radialHistogram[bin];
+                    sum.speedHistogram[bin] += partial.speedHistogram[bin];
+                }
+                return sum;
+            });
+        std::copy(total.sums, total.sums + numberOfFrameSums, sums);
+        summary.radialHistogram = total.radialHistogram;
+        summary.speedHistogram = total.speedHistogram;
+    } else {
+#pragma omp parallel if (parallelParticles)
+        {
+            std::vector<long long> radialHistogram(settings.bins, 0);
+            std::vector<long long> speedHistogram(settings.bins, 0);
+#pragma omp for schedule(static) reduction(+ : sums[:numberOfFrameSums])
+            for (std::size_t i = 0; i < numberOfParticles; i++) {
+                analyzeParticle(i, sums, radialHistogram, speedHistogram);
+            }
+#pragma omp critical
+            for (int bin = 0; bin < settings.bins; bin++) {
+                summary.radialHistogram[bin] += radialHistogram[bin];
+                summary.speedHistogram[bin] += speedHistogram[bin];
+            }
+        }
+    }
+
+    summary.kineticEnergy = sums[kineticSum];
+    summary.potentialEnergy = pairwise ? sums[potentialSum] : nan;
+    summary.centralPotentialEnergy = sums[centralPotentialSum];
+    for (int k = 0; k < 3; k++) {
+        summary.momentum[k] = sums[momentumSum + k];
+        summary.angularMomentum[k] = sums[angularMomentumSum + k];
+        summary.centreOfMass[k] = sums[massSum] != 0 ? sums[massPositionSum + k] / sums[massSum] : 0.;
+    }
+    summary.boundBodies = (long long)sums[boundSum];
+    if (summary.boundBodies > 0) {
+        summary.meanEccentricity = sums[eccentricitySum] / summary.boundBodies;
+        summary.meanSemiMajorAxis = sums[semiMajorAxisSum] / summary.boundBodies;
+    }
+    return summary;
+}
+
+static void writeAll(int file, const void* data, std::size_t bytes, off_t offset,
+    const std::string& fileName)
+{
+    const char* bytesToWrite = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(file, bytesToWrite, bytes, offset);
+        if (written <= 0) {
+            throw std::runtime_error("\nCannot write the elements to " + fileName + ".\n");
+        }
+        bytesToWrite += written;
+        bytes -= written;
+        offset += written;
+    }
+}
+
+/* Analyses the checkpoints in "files", in the order of their steps. With at
+least as many frames as threads every thread analyses whole frames, otherwise
+the frames are analysed one after the other with their particles shared among
+the threads. Every frame writes its elements to its own region of the elements
+file, at an offset given by the sizes of the frames before it, so the threads
+never wait for each other. */
+
+std::vector<FrameSummary> analyzeTrajectory(
+    const std::vector<std::string>& files, const AnalysisSettings& settings)
+{
+    if (settings.bins <= 0 || settings.maximumRadius <= 0 || settings.maximumSpeed <= 0) {
+        throw std::invalid_argument("\nThe number of bins and the histogram ranges should be higher than 0\n");
+    }
+    std::vector<std::unique_ptr<MappedCheckpoint>> frames;
+    for (const std::string& fileName : files) {
+        frames.push_back(std::make_unique<MappedCheckpoint>(fileName));
+    }
+    std::stable_sort(frames.begin(), frames.end(),
+        [](const std::unique_ptr<MappedCheckpoint>& a, const std::unique_ptr<MappedCheckpoint>& b) {
+            return a->getStep() < b->getStep();
+        });
+    long long numberOfFrames = frames.size();
+
+    std::vector<off_t> offsets(numberOfFrames + 1, sizeof(ElementsFileHeader));
+    for (long long f = 0; f < numberOfFrames; f++) {
+        offsets[f + 1] = offsets[f] + frameHeaderBytes + frames[f]->getNumberOfParticles() * valuesPerBody * sizeof(double);
+    }
+    int elementsFile = -1;
+    if (!settings.elementsFile.empty()) {
+        elementsFile = open(settings.elementsFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (elementsFile < 0) {
+            throw std::invalid_argument("\nCannot open " + settings.elementsFile + " for writing.\n");
+        }
+        ElementsFileHeader header;
+        std::memcpy(header.magic, elementsMagic, sizeof(elementsMagic));
+        header.numberOfFrames = numberOfFrames;
+        writeAll(elementsFile, &header, sizeof(header), 0, settings.elementsFile);
+    }
+
+    std::vector<FrameSummary> summaries(numberOfFrames);
+    bool pool = usingWorkStealingPool();
+    bool parallelFrames = pool || numberOfFrames >= omp_get_max_threads();
+    bool failed = false;
+    std::string failure;
+    std::mutex failureMutex;
+    auto analyzeFrameToFile = [&](long long f) {
+        try {
+            const MappedCheckpoint& frame = *frames[f];
+            std::vector<double> elements;
+            if (elementsFile >= 0) {
+                elements.resize(3 + frame.getNumberOfParticles() * valuesPerBody);
+            }
+            summaries[f] = analyzeFrame(frame, settings, elementsFile >= 0 ? elements.data() + 3 : nullptr, !parallelFrames);
+            if (elementsFile >= 0) {
+                elements[0] = frame.getStep();
+                elements[1] = frame.getTime();
+                elements[2] = frame.getNumberOfParticles();
+                writeAll(elementsFile, elements.data(), elements.size() * sizeof(double), offsets[f], settings.elementsFile);
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            failed = true;
+            failure = e.what();
+        }
+    };
+    if (pool) {
+        threadPool().parallelFor(0, numberOfFrames, 1, [&](long long first, long long last) {
+            for (long long f = first; f < last; f++) {
+                analyzeFrameToFile(f);
+            }
+        });
+    } else {
+#pragma omp parallel for schedule(dynamic, 1) if (parallelFrames)
+        for (long long f = 0; f < numberOfFrames; f++) {
+            analyzeFrameToFile(f);
+        }
+    }
+    if (elementsFile >= 0) {
+        close(elementsFile);
+    }
+    if (failed) {
+        throw std::runtime_error(failure);
+    }
+    return summaries;
+}
+
+/* Time series of the conserved quantities and of the bound bodies, one line
+ * per frame */
+
+void writeSeriesCsv(const std::string& fileName,
+    const std::vector<FrameSummary>& frames)
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    output.precision(17);
+    output << "step,time,particles,kinetic_energy,potential_energy,total_energy,"
+              "central_potential_energy,px,py,pz,lx,ly,lz,xcm,ycm,zcm,bound_bodies,"
+              "mean_eccentricity,mean_semi_major_axis\n";
+    for (const FrameSummary& frame : frames) {
+        output << frame.step << "," << frame.time << "," << frame.numberOfParticles
+               << "," << frame.kineticEnergy << "," << frame.potentialEnergy << ","
+               << frame.kineticEnergy + frame.potentialEnergy << ","
+               << frame.centralPotentialEnergy;
+        for (const Eigen::Vector3d* vector : { &frame.momentum, &frame.angularMomentum, &frame.centreOfMass }) {
+            output << "," << vector->x() << "," << vector->y() << "," << vector->z();
+        }
+        output << "," << frame.boundBodies << "," << frame.meanEccentricity << ","
+               << frame.meanSemiMajorAxis << "\n";
+    }
+}
+
+/* Histograms of every frame, one line per bin with its lower and upper edge
+ * (the last bin also holds the values beyond the range) */
+
+void writeHistogramsCsv(const std::string& fileName,
+    const std::vector<FrameSummary>& frames, const AnalysisSettings& settings)
+{
+    std::ofstream output(fileName);
+    if (!output) {
+        throw std::invalid_argument("\nCannot open " + fileName + " for writing.\n");
+    }
+    output.precision(17);
+    output << "step,quantity,lower,upper,count\n";
+    for (const FrameSummary& frame : frames) {
+        for (int bin = 0; bin < (int)frame.radialHistogram.size(); bin++) {
+            output << frame.step << ",distance," << settings.maximumRadius * bin / settings.bins
+                   << "," << settings.maximumRadius * (bin + 1) / settings.bins << ","
+                   << frame.radialHistogram[bin] << "\n";
+        }
+        for (int bin = 0; bin < (int)frame.speedHistogram.size(); bin++) {
+            output << frame.step << ",speed," << settings.maximumSpeed * bin / settings.bins
+                   << "," << settings.maximumSpeed * (bin + 1) / settings.bins << ","
+                   << frame.speedHistogram[bin] << "\n";
+        }
+    }
+}
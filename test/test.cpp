@@ -1,7 +1,31 @@
+#include "autotuner.hpp"
+#include "benchmark.hpp"
+#include "cellList.hpp"
+#include "closeEncounters.hpp"
+#include "compaction.hpp"
+#include "ensemble.hpp"
+#include "escapers.hpp"
+#include "execution.hpp"
 #include "manyBodySystem.hpp"
+#include "outOfCore.hpp"
+#include "parallelSort.hpp"
 #include "particle.hpp"
+#include "periodicEwald.hpp"
+#include "simulationServer.hpp"
+#include "spaceFillingCurve.hpp"
+#include "testParticles.hpp"
+#include "threadPlacement.hpp"
+#include "trajectoryAnalysis.hpp"
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using Catch::Matchers::WithinRel;
 
@@ -331,4 +355,1581 @@ TEST_CASE("Testing the correct parsing of the softening factor epsilon",
     system.evolutionOfSystem("step", 1, 0.1, 0.1);
     REQUIRE(system.getSystemInformations().at(0).getAcceleration().isApprox(
         Eigen::Vector3d(0.985, 0., 0.), 0.01));
-}
\ No newline at end of file
+}
+/* Testing the counters collected by the instrumented evolution of the system */
+
+TEST_CASE("Testing the performance counters of the evolution of the system",
+    "[performanceCounters]")
+{
+    solarSystemGenerator system;
+    system.generateInitialConditions(9);
+    system.resetProcessPerformanceCounters();
+    system.evolutionOfSystem("steps", 3, 0.01, 0.0);
+    const PerformanceCounters& counters = system.getProcessPerformanceCounters();
+#ifdef NBODY_INSTRUMENTATION
+    REQUIRE(counters.getPairInteractions() == 3 * 9 * 8);
+    REQUIRE(counters.getTotals().phaseCalls[static_cast<int>(Phase::force)] > 0);
+    REQUIRE(counters.getPhaseSeconds(Phase::force) > 0.);
+    REQUIRE(counters.getBytesAllocated() == 0);
+    calculateTotalEnergy(system.getSystemView());
+    REQUIRE(counters.getPairInteractions() == 3 * 9 * 8 + 9 * 8);
+    REQUIRE(counters.getPairInteractions(Phase::force) == 3 * 9 * 8);
+    REQUIRE(counters.getPairInteractions(Phase::energy) == 9 * 8);
+#endif
+    std::ostringstream json;
+    counters.writeJson(json);
+    REQUIRE(json.str().find("\"pairInteractions\"") != std::string::npos);
+}
+
+/* Testing that two sets of counters keep separate slots for the same thread,
+ * however the thread alternates between them */
+
+TEST_CASE("Testing separate instances of the performance counters",
+    "[performanceCounters]")
+{
+    PerformanceCounters first;
+    PerformanceCounters second;
+    first.getThreadCounters().pairInteractions += 5;
+    second.getThreadCounters().pairInteractions += 7;
+    first.getThreadCounters().pairInteractions += 1;
+    REQUIRE(first.getPairInteractions() == 6);
+    REQUIRE(second.getPairInteractions() == 7);
+    REQUIRE(first.getNumberOfThreads() == 1);
+    REQUIRE(second.getNumberOfThreads() == 1);
+    std::thread other([&]() { first.getThreadCounters().pairInteractions += 2; });
+    other.join();
+    REQUIRE(first.getNumberOfThreads() == 2);
+    REQUIRE(first.getPairInteractions() == 8);
+    {
+        PerformanceCounters shortLived;
+        shortLived.getThreadCounters().pairInteractions += 3;
+    }
+    PerformanceCounters third;
+    REQUIRE(third.getPairInteractions() == 0);
+    third.getThreadCounters().pairInteractions += 4;
+    REQUIRE(third.getPairInteractions() == 4);
+    REQUIRE(third.getNumberOfThreads() == 1);
+}
+
+/* Testing that the evolution runs whether or not the kernel allows the
+ * hardware performance counters */
+
+TEST_CASE("Testing the fallback of the hardware performance counters",
+    "[hardwareCounters]")
+{
+    solarSystemGenerator system;
+    system.generateInitialConditions(9);
+    bool available = enableHardwareCounters();
+    REQUIRE(!hardwareCountersStatus().empty());
+#ifndef NBODY_INSTRUMENTATION
+    REQUIRE_FALSE(available);
+    REQUIRE(hardwareCountersStatus().find("NBODY_INSTRUMENTATION=OFF") != std::string::npos);
+#endif
+    system.resetProcessPerformanceCounters();
+    system.evolutionOfSystem("steps", 2, 0.01, 0.0);
+    HardwareCounterSummary summary = system.getProcessPerformanceCounters().getHardwareSummary();
+    REQUIRE(summary.available == available);
+    if (!available) {
+        REQUIRE(summary.instructionsPerCycle == 0.);
+    }
+    disableHardwareCounters();
+    REQUIRE(!hardwareCountersEnabled());
+}
+
+/* Testing that a member of the batched ensemble evolves exactly like the same
+ * system evolved on its own */
+
+TEST_CASE("Testing the evolution of a member of an ensemble", "[ensemble]")
+{
+    solarSystemGenerator systemOne;
+    systemOne.generateInitialConditions(9);
+    SystemEnsemble ensemble(9);
+    ensemble.generateSolarSystemEnsemble(40, 7);
+    ensemble.addMember(systemOne.getSystemInformations());
+    REQUIRE(ensemble.getNumberOfMembers() == 41);
+    REQUIRE_THAT(ensemble.calculateEnergies().at(40),
+        WithinRel(calculateTotalEnergy(systemOne.getSystemInformations()), 1e-12));
+    systemOne.evolutionOfSystem("steps", 100, 0.001, 0.0);
+    ensemble.evolve(100, 0.001, 0.0);
+    std::vector<Particle> member = ensemble.getMember(40);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(member.at(i).getPosition().isApprox(
+            systemOne.getSystemInformations().at(i).getPosition(), 1e-9));
+        REQUIRE(member.at(i).getVelocity().isApprox(
+            systemOne.getSystemInformations().at(i).getVelocity(), 1e-9));
+    }
+    for (double drift : ensemble.getRelativeEnergyDrift()) {
+        REQUIRE(std::abs(drift) < 0.01);
+    }
+
+    /* With softening the energies are the ones of the softened potential, from
+     * the first step on */
+
+    SystemEnsemble softened(9);
+    softened.addMember(systemOne.getSystemInformations());
+    softened.evolve(10, 0.001, 0.05);
+    REQUIRE_THAT(softened.getInitialEnergies().at(0),
+        WithinRel(calculateTotalEnergy(systemOne.getSystemInformations(), 0.05), 1e-12));
+    REQUIRE_THAT(softened.calculateEnergies().at(0),
+        WithinRel(calculateTotalEnergy(softened.getMember(0), 0.05), 1e-12));
+    REQUIRE_THROWS_AS(softened.evolve(10, 0.001, 0.), std::invalid_argument);
+}
+
+/* Testing the cell list and Verlet list backends against a brute force sum
+ * with the same cutoff */
+
+TEST_CASE("Testing the cell list backend against a direct sum with cutoff",
+    "[cellList]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 300; i++) {
+        Particle p(0.5 + (i % 7) * 0.1);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 5.), std::fmod(i * 0.414, 5.),
+            std::fmod(i * 0.732, 5.)));
+        particles.push_back(p);
+    }
+    double cutoff = 1.2;
+    double epsilon = 0.05;
+    std::vector<Eigen::Vector3d> expected;
+    for (int i = 0; i < particles.size(); i++) {
+        Eigen::Vector3d acceleration(0., 0., 0.);
+        for (int j = 0; j < particles.size(); j++) {
+            if (j != i && getDistance(&particles.at(i), &particles.at(j)) < cutoff) {
+                acceleration = acceleration + calcAcceleration(&particles.at(i), &particles.at(j), epsilon);
+            }
+        }
+        expected.push_back(acceleration);
+    }
+    CellListBackend cells(cutoff);
+    CellListBackend verlet(cutoff, 0.3, true);
+    std::vector<Particle> withCells = particles;
+    std::vector<Particle> withVerlet = particles;
+    cells.computeAccelerations(withCells, epsilon);
+    verlet.computeAccelerations(withVerlet, epsilon);
+    for (int i = 0; i < particles.size(); i++) {
+        REQUIRE(withCells.at(i).getAcceleration().isApprox(expected.at(i), 1e-10));
+        REQUIRE(withVerlet.at(i).getAcceleration().isApprox(expected.at(i), 1e-10));
+    }
+
+    /* Small displacements reuse the Verlet lists */
+
+    for (Particle& p : withVerlet) {
+        p.setPosition(p.getPosition() + Eigen::Vector3d(0.01, 0., 0.));
+    }
+    verlet.computeAccelerations(withVerlet, epsilon);
+    REQUIRE(verlet.getNumberOfRebuilds() == 1);
+}
+
+/* Testing that a cutoff many orders of magnitude smaller than the system
+ * still gives a grid of at most 2 N cells, and no interactions */
+
+TEST_CASE("Testing the cell list with a tiny cutoff", "[cellList]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 100; i++) {
+        Particle p(1.);
+        p.setPosition(Eigen::Vector3d(100. * std::cos(i * 0.7), 100. * std::sin(i * 0.7), (i % 3) * 50.));
+        particles.push_back(p);
+    }
+    CellListBackend cells(1e-9);
+    cells.computeAccelerations(particles, 0.);
+    REQUIRE(cells.getNumberOfCells() > 0);
+    REQUIRE(cells.getNumberOfCells() <= 200);
+    for (const Particle& p : particles) {
+        REQUIRE(p.getAcceleration() == Eigen::Vector3d(0., 0., 0.));
+    }
+}
+
+/* Testing that a cutoff larger than the system gives the direct summation */
+
+TEST_CASE("Testing the evolution of the system with the cell list backend",
+    "[cellListEvolution]")
+{
+    solarSystemGenerator systemOne;
+    solarSystemGenerator systemTwo;
+    systemOne.generateInitialConditions(9);
+    systemTwo.generateInitialConditions(9);
+    systemTwo.setForceBackend(std::make_shared<CellListBackend>(100., 1., true));
+    systemOne.evolutionOfSystem("steps", 50, 0.001, 0.0);
+    systemTwo.evolutionOfSystem("steps", 50, 0.001, 0.0);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(systemTwo.getSystemInformations().at(i).getPosition().isApprox(
+            systemOne.getSystemInformations().at(i).getPosition(), 1e-10));
+    }
+}
+
+/* Testing the spatial hash search of the close encounters against all the
+ * pairs */
+
+TEST_CASE("Testing the detection of close encounters", "[closeEncounters]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 300; i++) {
+        Particle p(1.);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 5.) - 2.5, std::fmod(i * 0.414, 5.),
+            std::fmod(i * 0.732, 5.) - 1.));
+        particles.push_back(p);
+    }
+    double radius = 0.4;
+    std::vector<EncounterPair> expected;
+    for (int i = 0; i < particles.size(); i++) {
+        for (int j = i + 1; j < particles.size(); j++) {
+            if (getDistance(&particles.at(i), &particles.at(j)) < radius) {
+                expected.push_back({ i, j, getDistance(&particles.at(i), &particles.at(j)) });
+            }
+        }
+    }
+    std::vector<EncounterPair> found = findCloseEncounters(particles, radius);
+    REQUIRE(!expected.empty());
+    REQUIRE(found.size() == expected.size());
+    for (int k = 0; k < found.size(); k++) {
+        REQUIRE(found.at(k).first == expected.at(k).first);
+        REQUIRE(found.at(k).second == expected.at(k).second);
+        REQUIRE_THAT(found.at(k).distance, WithinRel(expected.at(k).distance, 1e-12));
+    }
+}
+
+/* Testing that the parallel compaction keeps the order of the elements */
+
+TEST_CASE("Testing the parallel compaction", "[compaction]")
+{
+    std::vector<int> values;
+    std::vector<char> keep;
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; i++) {
+        values.push_back(i);
+        keep.push_back(i % 3 != 0);
+        if (i % 3 != 0) {
+            expected.push_back(i);
+        }
+    }
+    compactInParallel(values, keep);
+    REQUIRE(values == expected);
+}
+
+/* Testing that merging two planets conserves mass and momentum and that the
+ * remaining planets keep their names */
+
+TEST_CASE("Testing the merging of close encounters", "[closeEncounters]")
+{
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(9);
+    std::vector<Particle> particles = solarSystem.getSystemInformations();
+    particles.at(4).setPosition(particles.at(3).getPosition() + Eigen::Vector3d(1e-4, 0., 0.));
+    particles.at(4).setVelocity(particles.at(3).getVelocity());
+    solarSystem.copySystem(&particles);
+    double massBefore = 0.;
+    Eigen::Vector3d momentumBefore(0., 0., 0.);
+    for (const Particle& p : particles) {
+        massBefore = massBefore + p.getMass();
+        momentumBefore = momentumBefore + p.getMass() * p.getVelocity();
+    }
+    solarSystem.enableCloseEncounters(1e-2, 1, true);
+    solarSystem.evolutionOfSystem("steps", 1, 0.001, 0.0);
+    REQUIRE(solarSystem.getNumberOfEncounters() == 1);
+    REQUIRE(solarSystem.getNumberOfMergers() == 1);
+    REQUIRE(solarSystem.getNumberOfParticles() == 8);
+    double massAfter = 0.;
+    Eigen::Vector3d momentumAfter(0., 0., 0.);
+    for (const Particle& p : solarSystem.getSystemInformations()) {
+        massAfter = massAfter + p.getMass();
+        momentumAfter = momentumAfter + p.getMass() * p.getVelocity();
+    }
+    REQUIRE_THAT(massAfter, WithinRel(massBefore, 1e-14));
+    REQUIRE((momentumAfter - momentumBefore).norm() < 1e-12);
+    std::vector<std::string> names = solarSystem.getIdentifierParticles();
+    REQUIRE(names.size() == 8);
+    REQUIRE(names.at(3) == "Earth");
+    REQUIRE(names.at(4) == "Jupiter");
+    REQUIRE(solarSystem.getParticleIdentifiers().at(4) == 5);
+}
+
+/* Testing that the view of the system reads the particles in place */
+
+TEST_CASE("Testing the read-only view of the particles", "[particleSpan]")
+{
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(9);
+    ConstParticleSpan view = solarSystem.getSystemView();
+    std::vector<Particle> copy = solarSystem.getSystemInformations();
+    REQUIRE(view.size() == 9);
+    REQUIRE(&view.at(3).getPosition() == &view[3].getPosition());
+    REQUIRE_THROWS_AS(view.at(9), std::out_of_range);
+    ConstParticleColumns positions = view.positions();
+    ConstParticleColumns velocities = view.velocities();
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(positions.col(i) == copy.at(i).getPosition());
+        REQUIRE(velocities.col(i) == copy.at(i).getVelocity());
+    }
+    REQUIRE_THAT(calculateTotalEnergy(view), WithinRel(calculateTotalEnergy(copy), 1e-15));
+    solarSystem.evolutionOfSystem("steps", 1, 0.01, 0.0);
+    REQUIRE(view.accelerations().col(5) == solarSystem.getSystemInformations().at(5).getAcceleration());
+}
+
+/* Testing the observers sampled in the helper thread during the evolution */
+
+TEST_CASE("Testing the observers of the evolution of the system", "[observers]")
+{
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(9);
+    double initialEnergy = calculateTotalEnergy(solarSystem.getSystemView());
+    std::shared_ptr<DiagnosticsMonitor> monitor = std::make_shared<DiagnosticsMonitor>();
+    monitor->addObserver(std::make_shared<EnergyObserver>(5));
+    monitor->addObserver(std::make_shared<MomentumObserver>(10));
+    solarSystem.setDiagnostics(monitor);
+    solarSystem.evolutionOfSystem("steps", 20, 0.001, 0.0);
+    std::vector<DiagnosticSample> energies = monitor->getBuffer().getSamples("energy");
+    std::vector<DiagnosticSample> momenta = monitor->getBuffer().getSamples("momentum");
+    REQUIRE(energies.size() == 5);
+    REQUIRE(momenta.size() == 3);
+    REQUIRE(energies.front().step == 0);
+    REQUIRE(energies.back().step == 20);
+    REQUIRE_THAT(energies.back().time, WithinRel(0.02, 1e-12));
+    REQUIRE_THAT(energies.front().values.at(2), WithinRel(initialEnergy, 1e-12));
+    REQUIRE_THAT(energies.back().values.at(2),
+        WithinRel(calculateTotalEnergy(solarSystem.getSystemView()), 1e-12));
+    REQUIRE(monitor->getMaximumRelativeEnergyDrift() < 1e-3);
+    REQUIRE(std::abs(momenta.back().values.at(0) - momenta.front().values.at(0)) < 1e-12);
+
+    /* With softening the energy is the one of the softened potential */
+
+    nBodySystemGenerator softened;
+    softened.generateInitialConditions(50);
+    std::shared_ptr<DiagnosticsMonitor> standard = makeStandardDiagnostics(5, 0.05);
+    softened.setDiagnostics(standard);
+    softened.evolutionOfSystem("steps", 10, 0.001, 0.05);
+    standard->flush();
+    std::vector<DiagnosticSample> softenedEnergies = standard->getBuffer().getSamples("energy");
+    REQUIRE_THAT(softenedEnergies.back().values.at(2),
+        WithinRel(calculateTotalEnergy(softened.getSystemView(), 0.05), 1e-12));
+    REQUIRE(std::abs(softenedEnergies.back().values.at(2) - calculateTotalEnergy(softened.getSystemView())) > 1e-6 * std::abs(softenedEnergies.back().values.at(2)));
+}
+
+/* Testing that the ring buffer keeps the latest samples in order */
+
+TEST_CASE("Testing the ring buffer of the samples", "[observers]")
+{
+    SampleRingBuffer buffer(4);
+    for (int step = 0; step < 10; step++) {
+        buffer.push({ "energy", step, 0.1 * step, { 1. * step } });
+    }
+    std::vector<DiagnosticSample> samples = buffer.getSamples();
+    REQUIRE(buffer.getNumberOfPushed() == 10);
+    REQUIRE(samples.size() == 4);
+    for (int k = 0; k < 4; k++) {
+        REQUIRE(samples.at(k).step == 6 + k);
+    }
+}
+
+/* Testing the checkpoints written by forked children and the restart from
+ * them */
+
+TEST_CASE("Testing the fork-based checkpoints", "[checkpoint]")
+{
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(9);
+    std::shared_ptr<ForkCheckpointer> checkpointer = std::make_shared<ForkCheckpointer>("/tmp", 10, 1);
+    solarSystem.setCheckpointer(checkpointer);
+    solarSystem.evolutionOfSystem("steps", 20, 0.001, 0.0);
+    checkpointer->waitForAll();
+    REQUIRE(checkpointer->getNumberOfCheckpoints() == 2);
+    REQUIRE(checkpointer->getNumberOfFailures() == 0);
+    REQUIRE(checkpointer->getNumberOfOutstanding() == 0);
+
+    Checkpoint checkpoint = loadCheckpoint(checkpointer->getFileName(20));
+    REQUIRE(checkpoint.step == 20);
+    REQUIRE_THAT(checkpoint.time, WithinRel(0.02, 1e-12));
+    REQUIRE(checkpoint.particles.size() == 9);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(checkpoint.particles.at(i).getPosition() == solarSystem.getSystemView()[i].getPosition());
+        REQUIRE(checkpoint.particles.at(i).getVelocity() == solarSystem.getSystemView()[i].getVelocity());
+        REQUIRE(checkpoint.identifiers.at(i) == i);
+    }
+
+    /* A restarted system continues exactly like the original one */
+
+    solarSystemGenerator restarted;
+    restarted.restoreCheckpoint(checkpointer->getFileName(10));
+    REQUIRE(restarted.getIterations() == 10);
+    restarted.evolutionOfSystem("steps", 10, 0.001, 0.0);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(restarted.getSystemView()[i].getPosition() == solarSystem.getSystemView()[i].getPosition());
+    }
+    std::remove(checkpointer->getFileName(10).c_str());
+    std::remove(checkpointer->getFileName(20).c_str());
+}
+
+/* Testing that large particle storage is mapped and first touched, and that
+ * it behaves like a normal vector */
+
+TEST_CASE("Testing the first-touch allocation of the particles", "[numaAllocator]")
+{
+    setHugePageMode(HugePageMode::transparent);
+    long long mappedBefore = getMemoryPlacementReport().mappedBytes;
+    ParticleVector particles;
+    for (int i = 0; i < 10000; i++) {
+        Particle p(1. + i);
+        p.setPosition(Eigen::Vector3d(i, 2. * i, 3. * i));
+        particles.push_back(p);
+    }
+    setHugePageMode(HugePageMode::none);
+    REQUIRE(getMemoryPlacementReport().mappedBytes > mappedBefore);
+    REQUIRE(getMemoryPlacementReport().firstTouchedBytes >= getMemoryPlacementReport().mappedBytes);
+    for (int i = 0; i < 10000; i++) {
+        REQUIRE(particles.at(i).getMass() == 1. + i);
+        REQUIRE(particles.at(i).getPosition() == Eigen::Vector3d(i, 2. * i, 3. * i));
+    }
+    ConstParticleSpan view = particles;
+    REQUIRE(view.positions().col(9999) == Eigen::Vector3d(9999., 19998., 29997.));
+    std::vector<ThreadPlacement> placement = getThreadPlacement();
+    REQUIRE(placement.size() == omp_get_max_threads());
+    REQUIRE(describeThreadBinding().find("NUMA nodes") != std::string::npos);
+}
+
+/* Testing that consecutive cells along the Hilbert curve share a face, and
+ * that the particles keep their names when they are reordered */
+
+TEST_CASE("Testing the reordering along a space filling curve", "[spaceFillingCurve]")
+{
+    std::vector<std::uint64_t> keys;
+    std::vector<int> cells;
+    for (int cell = 0; cell < 64; cell++) {
+        keys.push_back(hilbertKey(cell % 4, cell / 4 % 4, cell / 16));
+        cells.push_back(cell);
+    }
+    parallelRadixSort(keys, cells);
+    for (int k = 0; k < 64; k++) {
+        REQUIRE(keys.at(k) == k);
+    }
+    for (int k = 1; k < 64; k++) {
+        int a = cells.at(k - 1);
+        int b = cells.at(k);
+        int steps = std::abs(a % 4 - b % 4) + std::abs(a / 4 % 4 - b / 4 % 4) + std::abs(a / 16 - b / 16);
+        REQUIRE(steps == 1);
+    }
+    REQUIRE(mortonKey(1, 0, 0) == 4);
+    REQUIRE(mortonKey(0, 1, 0) == 2);
+    REQUIRE(mortonKey(0, 0, 3) == 9);
+
+    solarSystemGenerator reference;
+    reference.generateInitialConditions(9);
+    reference.evolutionOfSystem("steps", 20, 0.001, 0.0);
+    solarSystemGenerator reordered;
+    reordered.generateInitialConditions(9);
+    reordered.enableReordering(SpaceFillingCurve::hilbert, 5);
+    reordered.evolutionOfSystem("steps", 20, 0.001, 0.0);
+    REQUIRE(reordered.getNumberOfReorderings() == 4);
+    REQUIRE(reordered.getReorderingSeconds() > 0.);
+
+    std::vector<std::string> referenceNames = reference.getIdentifierParticles();
+    std::vector<std::string> names = reordered.getIdentifierParticles();
+    std::vector<int> identifiers = reordered.getParticleIdentifiers();
+    for (int i = 0; i < 9; i++) {
+        int original = identifiers.at(i);
+        REQUIRE(names.at(i) == referenceNames.at(original));
+        REQUIRE((reordered.getSystemView()[i].getPosition() - reference.getSystemView()[original].getPosition()).norm() < 1e-12);
+    }
+}
+
+/* Testing the Ewald sums: a small cluster in a large box feels the plain
+ * Newtonian forces, a perfect lattice feels none, and the accelerations
+ * converge with the number of wave vectors and do not depend on the split */
+
+TEST_CASE("Testing the periodic Ewald backend", "[periodicEwald]")
+{
+    std::vector<Particle> cluster;
+    for (int i = 0; i < 20; i++) {
+        Particle p(0.5 + (i % 3) * 0.25);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 1.), std::fmod(i * 0.414, 1.),
+            std::fmod(i * 0.732, 1.)));
+        cluster.push_back(p);
+    }
+    std::vector<Particle> direct = cluster;
+    std::vector<Particle> inLargeBox = cluster;
+    DirectSummationBackend().computeAccelerations(direct, 0.01);
+    PeriodicEwaldBackend(200.).computeAccelerations(inLargeBox, 0.01);
+    for (int i = 0; i < 20; i++) {
+        REQUIRE(inLargeBox.at(i).getAcceleration().isApprox(direct.at(i).getAcceleration(), 1e-5));
+    }
+
+    std::vector<Particle> lattice;
+    for (int i = 0; i < 8; i++) {
+        Particle p(1.);
+        p.setPosition(Eigen::Vector3d(i % 2, i / 2 % 2, i / 4) + Eigen::Vector3d(0.3, 0.3, 0.3));
+        lattice.push_back(p);
+    }
+    PeriodicEwaldBackend(2.).computeAccelerations(lattice, 0.);
+    for (const Particle& p : lattice) {
+        REQUIRE(p.getAcceleration().norm() < 1e-5);
+    }
+
+    /* The same particles in a box of side 1 */
+
+    std::vector<Particle> reference = cluster;
+    PeriodicEwaldBackend(1., 7., 14).computeAccelerations(reference, 0.);
+    double scale = 0.;
+    Eigen::Vector3d totalForce(0., 0., 0.);
+    for (const Particle& p : reference) {
+        scale = std::max(scale, p.getAcceleration().norm());
+        totalForce = totalForce + p.getMass() * p.getAcceleration();
+    }
+    REQUIRE(totalForce.norm() < 1e-10 * scale);
+    std::vector<Particle> shifted = cluster;
+    for (Particle& p : shifted) {
+        p.setPosition(p.getPosition() + Eigen::Vector3d(3., -2., 5.));
+    }
+    PeriodicEwaldBackend(1., 7., 14).computeAccelerations(shifted, 0.);
+    for (int i = 0; i < 20; i++) {
+        REQUIRE((shifted.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm() < 1e-9 * scale);
+    }
+    double previousError = 0.;
+    for (int waves = 2; waves <= 8; waves = waves + 3) {
+        std::vector<Particle> truncated = cluster;
+        PeriodicEwaldBackend(1., 7., waves).computeAccelerations(truncated, 0.);
+        double error = 0.;
+        for (int i = 0; i < 20; i++) {
+            error = std::max(error, (truncated.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm());
+        }
+        if (waves > 2) {
+            REQUIRE(error < previousError);
+        }
+        previousError = error;
+    }
+    REQUIRE(previousError < 1e-4 * scale);
+    std::vector<Particle> otherSplit = cluster;
+    PeriodicEwaldBackend(1., 9., 16).computeAccelerations(otherSplit, 0.);
+    for (int i = 0; i < 20; i++) {
+        REQUIRE((otherSplit.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm() < 1e-4 * scale);
+    }
+}
+
+/* Testing the split-loop kernels, which exclude the particle by its index,
+ * against the pairwise calcAcceleration for both softening variants */
+
+TEST_CASE("Testing the direct summation kernels", "[accelerationKernels]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 50; i++) {
+        Particle p(0.5 + (i % 5) * 0.1);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 3.), std::fmod(i * 0.414, 3.),
+            std::fmod(i * 0.732, 3.)));
+        particles.push_back(p);
+    }
+    REQUIRE(selectAccelerationKernel(0.) != selectAccelerationKernel(0.05));
+    for (double epsilon : { 0., 0.05 }) {
+        AccelerationKernel kernel = selectAccelerationKernel(epsilon);
+        for (int i = 0; i < particles.size(); i++) {
+            Eigen::Vector3d expected(0., 0., 0.);
+            double expectedPotential = 0.;
+            for (int j = 0; j < particles.size(); j++) {
+                if (j != i) {
+                    expected = expected + calcAcceleration(&particles.at(i), &particles.at(j), epsilon);
+                    expectedPotential = expectedPotential - 0.5 * particles.at(i).getMass() * particles.at(j).getMass() / getDistance(&particles.at(i), &particles.at(j));
+                }
+            }
+            REQUIRE(kernel(particles, i, epsilon).isApprox(expected, 1e-12));
+            REQUIRE_THAT(calculatePotentialEnergyOfParticle(particles, i), WithinRel(expectedPotential, 1e-12));
+            particles.at(i).calcTotalAcceleration(particles, epsilon);
+            REQUIRE(particles.at(i).getAcceleration() == kernel(particles, i, epsilon));
+        }
+    }
+
+    /* Coincident bodies of the same mass are no longer taken for the same
+     * body: a third body feels both of them */
+
+    std::vector<Particle> pair { Particle(1.), Particle(1.), Particle(1.) };
+    pair.at(2).setPosition(Eigen::Vector3d(1., 0., 0.));
+    AccelerationKernel softened = selectAccelerationKernel(0.1);
+    REQUIRE(softened(pair, 0, 0.1).isApprox(softened(pair, 1, 0.1)));
+    REQUIRE_THAT(softened(pair, 2, 0.1).x(), WithinRel(-2. / std::pow(1.01, 1.5), 1e-12));
+}
+
+/* Testing the simulation service: named systems stay resident between the
+ * requests and evolve exactly like local ones */
+
+TEST_CASE("Testing the simulation server on a Unix domain socket", "[simulationServer]")
+{
+    std::string socketPath = "/tmp/nbody_test_" + std::to_string(getpid()) + ".sock";
+    SimulationServer server(socketPath);
+    std::thread serving([&server] { server.run(); });
+    {
+        SimulationClient client(socketPath);
+        client.generateSolarSystem("solar");
+        ServerResponseHeader response = client.advance("solar", 20, 0.001, 0.);
+        response = client.advance("solar", 10, 0.001, 0.);
+        REQUIRE(response.iterations == 30);
+        REQUIRE(response.numberOfParticles == 9);
+        REQUIRE_THAT(response.time, WithinRel(0.03, 1e-12));
+
+        solarSystemGenerator local;
+        local.generateInitialConditions(9);
+        local.evolutionOfSystem("steps", 30, 0.001, 0.);
+        std::vector<Particle> snapshot = client.snapshot("solar");
+        REQUIRE(snapshot.size() == 9);
+        for (int i = 0; i < 9; i++) {
+            REQUIRE(snapshot.at(i).getPosition() == local.getSystemView()[i].getPosition());
+            REQUIRE(snapshot.at(i).getVelocity() == local.getSystemView()[i].getVelocity());
+        }
+        REQUIRE(client.energy("solar").energy == calculateTotalEnergy(local.getSystemView()));
+
+        /* A second connection loads its own system next to the first one */
+
+        SimulationClient other(socketPath);
+        std::vector<Particle> pair { Particle(1.), Particle(0.001) };
+        pair.at(1).setPosition(Eigen::Vector3d(1., 0., 0.));
+        pair.at(1).setVelocity(Eigen::Vector3d(0., 1., 0.));
+        REQUIRE(other.load("pair", pair).numberOfParticles == 2);
+        other.advance("pair", 5, 0.01, 0.);
+        REQUIRE(client.energy("solar").iterations == 30);
+        REQUIRE(other.snapshot("pair").at(1).getPosition().y() > 0.);
+        REQUIRE_THROWS_AS(client.advance("missing", 1, 0.01, 0.), std::runtime_error);
+        other.remove("pair");
+        REQUIRE_THROWS_AS(other.energy("pair"), std::runtime_error);
+        client.shutdown();
+    }
+    serving.join();
+    REQUIRE(server.getNumberOfSimulations() == 1);
+}
+
+/* Testing that the server keeps serving while a client is stalled in the
+ * middle of a request, and that it drops a client whose header asks for a
+ * payload its command does not take, before allocating anything for it */
+
+TEST_CASE("Testing the simulation server with stalled and invalid clients", "[simulationServer]")
+{
+    std::string socketPath = "/tmp/nbody_test_stalled_" + std::to_string(getpid()) + ".sock";
+    SimulationServer server(socketPath);
+    std::thread serving([&server] { server.run(); });
+    auto connectRaw = [&socketPath]() {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+        int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        REQUIRE(connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+        return connection;
+    };
+    {
+        /* Half of a header, then nothing */
+
+        int stalled = connectRaw();
+        ServerRequestHeader partial;
+        partial.command = static_cast<std::uint32_t>(ServerCommand::energy);
+        REQUIRE(send(stalled, &partial, sizeof(partial) / 2, 0) == sizeof(partial) / 2);
+
+        /* A whole header announcing a huge load, then nothing */
+
+        int announcing = connectRaw();
+        ServerRequestHeader huge;
+        huge.command = static_cast<std::uint32_t>(ServerCommand::load);
+        huge.count = (std::int64_t)1 << 28;
+        huge.payloadBytes = huge.count * sizeof(Particle);
+        REQUIRE(send(announcing, &huge, sizeof(huge), 0) == sizeof(huge));
+
+        /* A payload on a command that takes none closes the connection */
+
+        int invalid = connectRaw();
+        ServerRequestHeader withPayload;
+        withPayload.command = static_cast<std::uint32_t>(ServerCommand::energy);
+        withPayload.payloadBytes = (std::uint64_t)1 << 34;
+        REQUIRE(send(invalid, &withPayload, sizeof(withPayload), 0) == sizeof(withPayload));
+        ServerResponseHeader response;
+        REQUIRE(recv(invalid, &response, sizeof(response), 0) == 0);
+        close(invalid);
+
+        SimulationClient client(socketPath);
+        client.generateSolarSystem("solar");
+        REQUIRE(client.advance("solar", 10, 0.001, 0.).iterations == 10);
+
+        /* A load larger than one growth step of the payload buffer */
+
+        std::vector<Particle> many;
+        for (int i = 0; i < 20000; i++) {
+            Particle p(1e-6 * (i + 1));
+            p.setPosition(Eigen::Vector3d(i, -i, 0.5 * i));
+            many.push_back(p);
+        }
+        REQUIRE(client.load("many", many).numberOfParticles == 20000);
+        std::vector<Particle> loaded = client.snapshot("many");
+        REQUIRE(loaded.size() == 20000);
+        REQUIRE(loaded.back().getPosition() == many.back().getPosition());
+        REQUIRE(loaded.back().getMass() == many.back().getMass());
+        client.remove("many");
+        client.shutdown();
+        close(stalled);
+        close(announcing);
+    }
+    serving.join();
+    REQUIRE(server.getNumberOfSimulations() == 1);
+}
+
+/* Testing the autotuner: the tiled direct summation gives the same
+ * accelerations as the untiled one, a tuned configuration is cached under the
+ * key of the system and reused without trials */
+
+TEST_CASE("Testing the autotuner and the tiled direct summation", "[autotuner]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 150; i++) {
+        Particle p(0.5 + (i % 5) * 0.1);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 3.), std::fmod(i * 0.414, 3.),
+            std::fmod(i * 0.732, 3.)));
+        particles.push_back(p);
+    }
+    std::vector<Particle> tiled = particles;
+    DirectSummationBackend().computeAccelerations(particles, 0.05);
+    DirectSummationBackend(64).computeAccelerations(tiled, 0.05);
+    for (int i = 0; i < particles.size(); i++) {
+        REQUIRE(tiled.at(i).getAcceleration().isApprox(particles.at(i).getAcceleration(), 1e-12));
+    }
+    REQUIRE_THROWS_AS(DirectSummationBackend(-1), std::invalid_argument);
+
+    REQUIRE(Autotuner::sizeBucket(1) == 1);
+    REQUIRE(Autotuner::sizeBucket(150) == 128);
+    REQUIRE(Autotuner::sizeBucket(256) == 256);
+    REQUIRE(scheduleKindFromName(scheduleKindName(omp_sched_guided)) == omp_sched_guided);
+    REQUIRE_THROWS_AS(scheduleKindFromName("fastest"), std::invalid_argument);
+
+    int maximumThreads = omp_get_max_threads();
+    std::string cacheFile = "/tmp/nbody_tuning_test_" + std::to_string(getpid()) + ".cache";
+    std::remove(cacheFile.c_str());
+    nBodySystemGenerator system;
+    system.copySystem(&particles);
+    Autotuner autotuner(cacheFile, 1);
+    REQUIRE(autotuner.cacheKey(system).find("|128|direct") != std::string::npos);
+    TuningConfiguration tuned = autotuner.tune(system, 0.001, 0.05);
+    REQUIRE_FALSE(autotuner.lastWasCached());
+    REQUIRE(autotuner.getNumberOfTrials() > 1);
+    REQUIRE(tuned.secondsPerStep > 0);
+    REQUIRE(tuned.threads <= omp_get_max_threads());
+    REQUIRE(system.getIterations() == 0);
+
+    Autotuner again(cacheFile, 1);
+    TuningConfiguration reused = again.tune(system, 0.001, 0.05);
+    REQUIRE(again.lastWasCached());
+    REQUIRE(again.getNumberOfTrials() == 0);
+    REQUIRE(reused.scheduleKind == tuned.scheduleKind);
+    REQUIRE(reused.chunkSize == tuned.chunkSize);
+    REQUIRE(reused.tileSize == tuned.tileSize);
+    REQUIRE(reused.threads == tuned.threads);
+
+    /* The tuned system evolves like an untuned one */
+
+    nBodySystemGenerator reference;
+    reference.copySystem(&particles);
+    reference.evolutionOfSystem("steps", 5, 0.001, 0.05);
+    again.apply(reused, system);
+    system.evolutionOfSystem("steps", 5, 0.001, 0.05);
+    omp_set_num_threads(maximumThreads);
+    std::vector<Particle> evolved = system.getSystemInformations();
+    std::vector<Particle> expected = reference.getSystemInformations();
+    for (int i = 0; i < evolved.size(); i++) {
+        REQUIRE(evolved.at(i).getPosition().isApprox(expected.at(i).getPosition(), 1e-10));
+    }
+    std::remove(cacheFile.c_str());
+}
+
+/* Testing the out-of-core system: streamed in blocks that do not divide the
+ * number of particles, it makes the same steps as the system in memory, and
+ * the file keeps the state between two openings */
+
+TEST_CASE("Testing the out-of-core direct summation", "[outOfCore]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 300; i++) {
+        Particle p(0.5 + (i % 5) * 0.1);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 3.), std::fmod(i * 0.414, 3.),
+            std::fmod(i * 0.732, 3.)));
+        p.setVelocity(Eigen::Vector3d(0.01 * (i % 3), 0., -0.02));
+        particles.push_back(p);
+    }
+    std::string fileName = "/tmp/nbody_test_" + std::to_string(getpid()) + ".ooc";
+    OutOfCoreSystem::create(fileName, particles.size());
+    REQUIRE(OutOfCoreSystem::numberOfParticlesInFile(fileName) == 300);
+    REQUIRE(OutOfCoreSystem::numberOfParticlesInFile("/tmp/nbody_no_such_file.ooc") == 0);
+    {
+        OutOfCoreSystem system(fileName, 64);
+        system.writeParticles(0, particles);
+        system.advance(3, 0.001, 0.05);
+        REQUIRE(system.getIterations() == 3);
+        const OutOfCoreStatistics& statistics = system.getStatistics();
+        REQUIRE(statistics.blocksRead == 3 * 5 * 5);
+        REQUIRE(statistics.bytesRead == 3 * 5 * 300 * 4 * (long long)sizeof(double));
+        REQUIRE(statistics.overlapFraction >= 0.);
+        REQUIRE(statistics.overlapFraction <= 1.);
+        REQUIRE_THROWS_AS(system.readParticles(250, 100), std::out_of_range);
+    }
+    nBodySystemGenerator reference;
+    reference.copySystem(&particles);
+    reference.evolutionOfSystem("steps", 5, 0.001, 0.05);
+    OutOfCoreSystem reopened(fileName, 128);
+    REQUIRE(reopened.getIterations() == 3);
+    reopened.advance(2, 0.001, 0.05);
+    std::vector<Particle> evolved = reopened.readParticles(0, 300);
+    std::vector<Particle> expected = reference.getSystemInformations();
+    for (int i = 0; i < 300; i++) {
+        REQUIRE(evolved.at(i).getPosition().isApprox(expected.at(i).getPosition(), 1e-12));
+        REQUIRE(evolved.at(i).getVelocity().isApprox(expected.at(i).getVelocity(), 1e-10));
+    }
+    std::remove(fileName.c_str());
+    REQUIRE_THROWS_AS(OutOfCoreSystem(fileName), std::runtime_error);
+}
+
+/* Testing the removal of the escapers: only the unbound particles moving away
+ * beyond the radius leave, with their identifier and state, and the others
+ * stay in order */
+
+TEST_CASE("Testing the pruning of the escapers", "[escapers]")
+{
+    std::vector<Particle> particles { Particle(1.) };
+    for (int i = 0; i < 6; i++) {
+        Particle planet(1e-6);
+        double theta = i * M_PI / 3.;
+        planet.setPosition(Eigen::Vector3d(std::cos(theta), std::sin(theta), 0.));
+        planet.setVelocity(Eigen::Vector3d(-std::sin(theta), std::cos(theta), 0.));
+        particles.push_back(planet);
+    }
+    Particle escaping(1e-6), falling(1e-6), bound(1e-6);
+    escaping.setPosition(Eigen::Vector3d(50., 0., 0.));
+    escaping.setVelocity(Eigen::Vector3d(1., 0., 0.));
+    falling.setPosition(Eigen::Vector3d(0., 50., 0.));
+    falling.setVelocity(Eigen::Vector3d(0., -1., 0.));
+    bound.setPosition(Eigen::Vector3d(0., 0., 50.));
+    bound.setVelocity(Eigen::Vector3d(0., 0., 0.1));
+    particles.push_back(falling);
+    particles.push_back(escaping);
+    particles.push_back(bound);
+
+    std::vector<EscapedParticle> escapers;
+    std::vector<char> keep = findEscapers(particles, 20., escapers);
+    REQUIRE(escapers.size() == 1);
+    REQUIRE(escapers.at(0).index == 8);
+    REQUIRE(keep.at(8) == 0);
+    REQUIRE(std::count(keep.begin(), keep.end(), 1) == 9);
+    REQUIRE(escapers.at(0).specificEnergy > 0);
+    REQUIRE_THROWS_AS(findEscapers(particles, 0., escapers), std::invalid_argument);
+
+    nBodySystemGenerator system;
+    system.copySystem(&particles);
+    system.enableEscaperPruning(20., 5);
+    REQUIRE_THROWS_AS(system.enableEscaperPruning(20., 0), std::invalid_argument);
+    system.evolutionOfSystem("steps", 12, 0.001, 0.);
+    REQUIRE(system.getNumberOfEscapers() == 1);
+    REQUIRE(system.getNumberOfParticles() == 9);
+    EscapedParticle escaped = system.getEscapers().at(0);
+    REQUIRE(escaped.identifier == 8);
+    REQUIRE(escaped.step == 5);
+    REQUIRE_THAT(escaped.time, WithinRel(0.005, 1e-12));
+    REQUIRE(escaped.particle.getPosition().x() > 50.);
+    std::vector<int> identifiers = system.getParticleIdentifiers();
+    REQUIRE(identifiers == std::vector<int> { 0, 1, 2, 3, 4, 5, 6, 7, 9 });
+}
+
+/* Testing the field at probe points: the direct summation matches the force
+ * between particles, the backends keep their own interaction, and the
+ * acceleration is minus the gradient of the potential */
+
+TEST_CASE("Testing the evaluation of the field at probe points", "[fieldEvaluation]")
+{
+    std::vector<Particle> particles;
+    for (int i = 0; i < 200; i++) {
+        Particle p(0.5 + (i % 5) * 0.1);
+        p.setPosition(Eigen::Vector3d(std::fmod(i * 0.618, 3.), std::fmod(i * 0.414, 3.),
+            std::fmod(i * 0.732, 3.)));
+        particles.push_back(p);
+    }
+    std::vector<Eigen::Vector3d> probes { particles.at(7).getPosition() };
+    for (int p = 0; p < 99; p++) {
+        probes.push_back(Eigen::Vector3d(std::fmod(p * 0.377, 3.), std::fmod(p * 0.291, 3.), 1.5));
+    }
+    nBodySystemGenerator system;
+    system.copySystem(&particles);
+    for (double epsilon : { 0., 0.05 }) {
+        FieldValues field = system.evaluateField(probes, epsilon);
+        REQUIRE(field.potential.size() == 100);
+        for (int p = 0; p < 100; p++) {
+            Particle probe(0.);
+            probe.setPosition(probes.at(p));
+            Eigen::Vector3d expected(0., 0., 0.);
+            double expectedPotential = 0.;
+            for (const Particle& source : particles) {
+                double distanceSquared = (source.getPosition() - probes.at(p)).squaredNorm();
+                if (distanceSquared + epsilon * epsilon > 0) {
+                    expected = expected + calcAcceleration(&probe, &source, epsilon);
+                    expectedPotential = expectedPotential - source.getMass() / std::sqrt(distanceSquared + epsilon * epsilon);
+                }
+            }
+            REQUIRE(field.acceleration.at(p).isApprox(expected, 1e-10));
+            REQUIRE_THAT(field.potential.at(p), WithinRel(expectedPotential, 1e-10));
+        }
+    }
+    REQUIRE(system.getNumberOfParticles() == 200);
+
+    /* Probes at the particles feel what the particles feel */
+
+    std::vector<Eigen::Vector3d> atParticles;
+    for (const Particle& p : particles) {
+        atParticles.push_back(p.getPosition());
+    }
+    std::vector<std::shared_ptr<ForceBackend>> backends { std::make_shared<CellListBackend>(0.7),
+        std::make_shared<PeriodicEwaldBackend>(3.) };
+    for (const std::shared_ptr<ForceBackend>& backend : backends) {
+        std::vector<Particle> evolved = particles;
+        backend->computeAccelerations(evolved, 0.);
+        system.setForceBackend(backend);
+        FieldValues field = system.evaluateField(atParticles, 0.);
+        for (int i = 0; i < 200; i++) {
+            REQUIRE(field.acceleration.at(i).isApprox(evolved.at(i).getAcceleration(), 1e-8));
+        }
+    }
+
+    /* Minus the gradient of the periodic potential */
+
+    Eigen::Vector3d point(1.1, 0.4, 2.3);
+    double h = 1e-4;
+    std::vector<Eigen::Vector3d> stencil { point };
+    for (int axis = 0; axis < 3; axis++) {
+        stencil.push_back(point + h * Eigen::Vector3d::Unit(axis));
+        stencil.push_back(point - h * Eigen::Vector3d::Unit(axis));
+    }
+    FieldValues periodic = system.evaluateField(stencil, 0.);
+    Eigen::Vector3d gradient;
+    for (int axis = 0; axis < 3; axis++) {
+        gradient(axis) = (periodic.potential.at(1 + 2 * axis) - periodic.potential.at(2 + 2 * axis)) / (2 * h);
+    }
+    REQUIRE((periodic.acceleration.at(0) + gradient).norm() < 1e-3 * periodic.acceleration.at(0).norm());
+}
+
+/* Testing the benchmark harness: the standard initial conditions are in the
+ * frame of their centre of mass, the direct summation has no force error and
+ * the Pareto front keeps only the configurations nobody beats */
+
+TEST_CASE("Testing the accuracy versus cost benchmark", "[benchmark]")
+{
+    for (std::string name : { "plummer", "disc" }) {
+        std::vector<Particle> particles = makeStandardInitialConditions(name, 200);
+        REQUIRE(particles.size() == 200);
+        Eigen::Vector3d momentum(0., 0., 0.);
+        for (const Particle& p : particles) {
+            momentum = momentum + p.getMass() * p.getVelocity();
+        }
+        REQUIRE(momentum.norm() < 1e-12);
+        REQUIRE(particles.at(1).getPosition() != particles.at(2).getPosition());
+    }
+    REQUIRE_THROWS_AS(makeStandardInitialConditions("cube", 10), std::invalid_argument);
+    REQUIRE_THROWS_AS(makeBenchmarkBackend("tree", 0., std::vector<Particle> {}), std::invalid_argument);
+
+    BenchmarkSettings settings;
+    settings.initialConditions = { "plummer" };
+    settings.sizes = { 100 };
+    settings.cutoffs = { 0.5 };
+    settings.steps = 2;
+    std::vector<BenchmarkResult> results = runBenchmark(settings);
+    REQUIRE(results.size() == 6);
+    int onFront = 0;
+    for (const BenchmarkResult& result : results) {
+        REQUIRE(result.numberOfParticles == 100);
+        REQUIRE(result.secondsPerStep > 0);
+        if (result.backend == "direct") {
+            REQUIRE(result.maximumForceError == 0.);
+        }
+        if (result.backend == "tiled" || result.backend == "split") {
+            REQUIRE(result.maximumForceError < 1e-12);
+        }
+        if (result.backend == "cells") {
+            REQUIRE(result.rmsForceError > 1e-3);
+        }
+        onFront = onFront + result.paretoOptimal;
+    }
+    REQUIRE(onFront >= 1);
+
+    /* The energy drift is measured with the potential of the softened force */
+
+    std::vector<Particle> pair { Particle(1.), Particle(1.) };
+    pair.at(1).setPosition(Eigen::Vector3d(1., 0., 0.));
+    REQUIRE_THAT(calculateTotalEnergy(pair, 0.5), WithinRel(-1. / std::sqrt(1.25), 1e-14));
+    REQUIRE_THAT(calculateTotalEnergy(pair), WithinRel(-1., 1e-14));
+    nBodySystemGenerator direct;
+    std::vector<Particle> plummer = makeStandardInitialConditions("plummer", 100);
+    direct.copySystem(&plummer);
+    double energyBefore = calculateTotalEnergy(direct.getSystemView(), settings.epsilon);
+    direct.evolutionOfSystem("steps", settings.steps, settings.dt, settings.epsilon);
+    double energyAfter = calculateTotalEnergy(direct.getSystemView(), settings.epsilon);
+    for (const BenchmarkResult& result : results) {
+        if (result.backend == "direct") {
+            REQUIRE_THAT(result.energyDrift, WithinRel(std::abs((energyAfter - energyBefore) / energyBefore), 1e-9));
+        }
+    }
+
+    std::vector<BenchmarkResult> dominated(2, results.at(0));
+    dominated.at(1).secondsPerStep = 2. * dominated.at(0).secondsPerStep;
+    markParetoFront(dominated);
+    REQUIRE(dominated.at(0).paretoOptimal);
+    REQUIRE_FALSE(dominated.at(1).paretoOptimal);
+
+    std::string csvFile = "/tmp/nbody_benchmark_" + std::to_string(getpid()) + ".csv";
+    writeBenchmarkCsv(csvFile, results);
+    std::ifstream csv(csvFile);
+    std::string line;
+    int lines = 0;
+    while (std::getline(csv, line)) {
+        lines++;
+    }
+    REQUIRE(lines == 7);
+    std::remove(csvFile.c_str());
+}
+
+/* Testing the trajectory analysis: the elements of known orbits, and the
+ * frames of a few checkpoints written out of order, with their bound bodies,
+ * histograms and elements file */
+
+TEST_CASE("Testing the analysis of the trajectory", "[trajectoryAnalysis]")
+{
+    OrbitalElements circular = keplerianElements(Eigen::Vector3d(2., 0., 0.), Eigen::Vector3d(0., std::sqrt(0.5), 0.), 1.);
+    REQUIRE_THAT(circular.semiMajorAxis, Catch::Matchers::WithinAbs(2., 1e-12));
+    REQUIRE(circular.eccentricity < 1e-12);
+    REQUIRE(circular.inclination == 0.);
+
+    double inclination = M_PI / 6;
+    Eigen::Vector3d velocity(0., std::sqrt(1.5) * std::cos(inclination), std::sqrt(1.5) * std::sin(inclination));
+    OrbitalElements eccentric = keplerianElements(Eigen::Vector3d(1., 0., 0.), velocity, 1.);
+    REQUIRE_THAT(eccentric.semiMajorAxis, Catch::Matchers::WithinAbs(2., 1e-12));
+    REQUIRE_THAT(eccentric.eccentricity, Catch::Matchers::WithinAbs(0.5, 1e-12));
+    REQUIRE_THAT(eccentric.inclination, Catch::Matchers::WithinAbs(inclination, 1e-12));
+    REQUIRE_THAT(eccentric.longitudeOfAscendingNode, Catch::Matchers::WithinAbs(0., 1e-12));
+    REQUIRE_THAT(std::sin(eccentric.argumentOfPericentre), Catch::Matchers::WithinAbs(0., 1e-12));
+    REQUIRE_THAT(std::sin(eccentric.trueAnomaly), Catch::Matchers::WithinAbs(0., 1e-12));
+    OrbitalElements later = keplerianElements(Eigen::Vector3d(0., 1.5, 0.), std::sqrt(2. / 3.) * Eigen::Vector3d(-1., 0.5, 0.), 1.);
+    REQUIRE_THAT(later.trueAnomaly, Catch::Matchers::WithinAbs(M_PI / 2, 1e-12));
+    REQUIRE_THROWS_AS(keplerianElements(Eigen::Vector3d(0., 0., 0.), velocity, 1.), std::invalid_argument);
+
+    std::vector<Particle> particles(5, Particle(1e-6));
+    particles.at(0).setMass(1.);
+    for (int i = 1; i <= 3; i++) {
+        particles.at(i).setPosition(Eigen::Vector3d(2. * i, 0., 0.));
+        particles.at(i).setVelocity(Eigen::Vector3d(0., std::sqrt(1. / (2. * i)), 0.));
+    }
+    particles.at(4).setPosition(Eigen::Vector3d(0., 50., 0.));
+    particles.at(4).setVelocity(Eigen::Vector3d(0., 5., 0.));
+    std::vector<int> identifiers = { 0, 1, 2, 3, 4 };
+    std::string prefix = "/tmp/nbody_analysis_" + std::to_string(getpid());
+    std::vector<std::string> files;
+    for (int step : { 20, 0, 10 }) {
+        files.push_back(prefix + "_" + std::to_string(step) + ".bin");
+        writeCheckpoint(files.back(), step, 0.01 * step, particles, identifiers);
+    }
+
+    AnalysisSettings settings;
+    settings.bins = 10;
+    settings.maximumRadius = 10.;
+    settings.elementsFile = prefix + "_elements.bin";
+    std::vector<FrameSummary> frames = analyzeTrajectory(files, settings);
+    REQUIRE(frames.size() == 3);
+    for (int f = 0; f < 3; f++) {
+        REQUIRE(frames.at(f).step == 10 * f);
+        REQUIRE(frames.at(f).numberOfParticles == 5);
+        REQUIRE(frames.at(f).boundBodies == 3);
+        REQUIRE(frames.at(f).meanEccentricity < 1e-5);
+        REQUIRE_THAT(frames.at(f).meanSemiMajorAxis, Catch::Matchers::WithinRel(4., 1e-5));
+        REQUIRE(frames.at(f).radialHistogram.at(2) == 1);
+        REQUIRE(frames.at(f).radialHistogram.at(9) == 1);
+        REQUIRE(frames.at(f).speedHistogram.at(9) == 1);
+        REQUIRE_THAT(frames.at(f).potentialEnergy, Catch::Matchers::WithinRel(frames.at(f).centralPotentialEnergy, 1e-5));
+    }
+    std::ifstream elements(settings.elementsFile, std::ios::binary | std::ios::ate);
+    REQUIRE((long long)elements.tellg() == 16 + 3 * (3 + 5 * 7) * 8);
+
+    settings.pairwiseEnergyLimit = 0;
+    settings.elementsFile = "";
+    frames = analyzeTrajectory({ files.at(0) }, settings);
+    REQUIRE(std::isnan(frames.at(0).potentialEnergy));
+    for (const std::string& file : files) {
+        std::remove(file.c_str());
+    }
+    std::remove((prefix + "_elements.bin").c_str());
+}
+
+/* Testing the split between massive bodies and test particles: with massless
+ * test particles the accelerations are those of the direct summation, with
+ * light ones the error is of the order of their mass and the momentum is
+ * still conserved */
+
+TEST_CASE("Testing the massive and test particle backend", "[testParticles]")
+{
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<double> position(-5., 5.);
+    std::vector<Particle> particles(1000, Particle(0.));
+    for (Particle& particle : particles) {
+        particle.setPosition(Eigen::Vector3d(position(generator), position(generator), position(generator)));
+    }
+    particles.at(0).setMass(1.);
+    particles.at(500).setMass(1e-3);
+    particles.at(999).setMass(0.5);
+    double epsilon = 0.01;
+    std::vector<Particle> reference = particles;
+    DirectSummationBackend().computeAccelerations(reference, epsilon);
+    MassiveTestParticleBackend backend(1e-4);
+    REQUIRE(backend.getName() == "split");
+    REQUIRE_THROWS_AS(MassiveTestParticleBackend(-1.), std::invalid_argument);
+    backend.computeAccelerations(particles, epsilon);
+    REQUIRE(backend.getNumberOfMassiveParticles() == 3);
+    for (int i = 0; i < particles.size(); i++) {
+        double norm = reference.at(i).getAcceleration().norm();
+        REQUIRE((particles.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm() < 1e-12 * norm);
+    }
+
+    for (int i = 0; i < particles.size(); i++) {
+        if (particles.at(i).getMass() == 0.) {
+            particles.at(i).setMass(1e-7);
+        }
+    }
+    reference = particles;
+    DirectSummationBackend().computeAccelerations(reference, epsilon);
+    backend.computeAccelerations(particles, epsilon);
+    Eigen::Vector3d force(0., 0., 0.);
+    for (int i = 0; i < particles.size(); i++) {
+        double norm = reference.at(i).getAcceleration().norm();
+        REQUIRE((particles.at(i).getAcceleration() - reference.at(i).getAcceleration()).norm() < 1e-3 * norm);
+        force = force + particles.at(i).getMass() * particles.at(i).getAcceleration();
+    }
+    REQUIRE(force.norm() < 1e-12);
+
+    std::vector<Eigen::Vector3d> probes = { Eigen::Vector3d(20., 0., 0.) };
+    FieldValues field = backend.evaluateField(particles, probes, 0.);
+    std::vector<Particle> massive = { particles.at(0), particles.at(500), particles.at(999) };
+    FieldValues massiveField = evaluateFieldDirect(massive, probes, 0.);
+    REQUIRE_THAT(field.potential.at(0), Catch::Matchers::WithinRel(massiveField.potential.at(0), 1e-12));
+    REQUIRE((field.acceleration.at(0) - massiveField.acceleration.at(0)).norm() < 1e-12 * massiveField.acceleration.at(0).norm());
+}
+
+/* Testing the timeline of the phases: the ring buffer of a thread keeps its
+ * last events, and the evolution leaves complete events in the Chrome trace */
+
+TEST_CASE("Testing the trace of the phases", "[phaseTracer]")
+{
+    PhaseTracer& tracer = phaseTracer();
+    REQUIRE_THROWS_AS(tracer.enable(0), std::invalid_argument);
+    tracer.enable(4);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++) {
+        tracer.record(Phase::io, start, start + std::chrono::microseconds(i));
+    }
+    REQUIRE(tracer.getNumberOfEvents() == 4);
+    REQUIRE(tracer.getNumberOfDroppedEvents() == 6);
+    std::ostringstream trace;
+    tracer.writeChromeTrace(trace);
+    int completeEvents = 0;
+    for (std::size_t position = trace.str().find("\"ph\": \"X\""); position != std::string::npos; position = trace.str().find("\"ph\": \"X\"", position + 1)) {
+        completeEvents++;
+    }
+    REQUIRE(completeEvents == 4);
+    REQUIRE(trace.str().find("\"dur\": 9.000") != std::string::npos);
+    REQUIRE(trace.str().find("\"dur\": 5.000") == std::string::npos);
+
+#ifdef NBODY_INSTRUMENTATION
+    tracer.enable(1024);
+    solarSystemGenerator system;
+    system.generateInitialConditions(9);
+    system.evolutionOfSystem("steps", 3, 0.01, 0.0);
+    tracer.disable();
+    REQUIRE(tracer.getNumberOfEvents() >= 6);
+    REQUIRE(tracer.getNumberOfDroppedEvents() == 0);
+    trace.str("");
+    tracer.writeChromeTrace(trace);
+    REQUIRE(trace.str().find("\"name\": \"force\"") != std::string::npos);
+    REQUIRE(trace.str().find("\"name\": \"update\"") != std::string::npos);
+#endif
+    tracer.disable();
+}
+
+/* Testing the dense output: the Hermite interpolant is exact for a cubic
+ * motion, the clock counts whole steps and the states at the output times are
+ * those of the steps they fall on, or between them */
+
+TEST_CASE("Testing the dense output and the clock of the steps", "[denseOutput]")
+{
+    std::vector<Particle> start(1, Particle(1.)), end(1, Particle(1.)), output(1, Particle(0.));
+    end.at(0).setPosition(Eigen::Vector3d(1., 0., 0.));
+    end.at(0).setVelocity(Eigen::Vector3d(3., 0., 0.));
+    interpolateStep(start, end, 1., 0.5, output);
+    REQUIRE_THAT(output.at(0).getPosition().x(), Catch::Matchers::WithinAbs(0.125, 1e-15));
+    REQUIRE_THAT(output.at(0).getVelocity().x(), Catch::Matchers::WithinAbs(0.75, 1e-15));
+    REQUIRE_THAT(output.at(0).getAcceleration().x(), Catch::Matchers::WithinAbs(3., 1e-15));
+    REQUIRE(output.at(0).getMass() == 1.);
+
+    REQUIRE(stepsToReach(1., 0.1) == 10);
+    REQUIRE(stepsToReach(0.3, 0.1) == 3);
+    REQUIRE(stepsToReach(0.35, 0.1) == 4);
+
+    std::vector<Particle> orbit(2, Particle(1.));
+    orbit.at(1).setMass(1e-6);
+    orbit.at(1).setPosition(Eigen::Vector3d(1., 0., 0.));
+    orbit.at(1).setVelocity(Eigen::Vector3d(0., 1., 0.));
+    nBodySystemGenerator system;
+    system.copySystem(&orbit);
+    std::vector<double> times;
+    std::vector<Eigen::Vector3d> positions;
+    auto denseOutput = std::make_shared<DenseOutput>(std::vector<double> { 0.5, 0., 0.123, 0.005 },
+        [&](double time, ConstParticleSpan particles) {
+            times.push_back(time);
+            positions.push_back(particles[1].getPosition());
+        });
+    system.setDenseOutput(denseOutput);
+    system.evolutionOfSystem("time", 1., 0.01, 0.);
+    REQUIRE(system.getIterations() == 100);
+    REQUIRE(system.getElapsedTime() == 1.);
+    REQUIRE(denseOutput->getNumberOfOutputs() == 4);
+    REQUIRE(times == std::vector<double> { 0., 0.005, 0.123, 0.5 });
+    REQUIRE(positions.at(0) == Eigen::Vector3d(1., 0., 0.));
+    REQUIRE_THAT(positions.at(1).y(), Catch::Matchers::WithinAbs(0.005, 1e-6));
+    REQUIRE_THAT(positions.at(2).norm(), Catch::Matchers::WithinAbs(1., 1e-2));
+
+    nBodySystemGenerator reference;
+    reference.copySystem(&orbit);
+    reference.evolutionOfSystem("steps", 50, 0.01, 0.);
+    REQUIRE((positions.at(3) - reference.getSystemInformations().at(1).getPosition()).norm() < 1e-12);
+    nBodySystemGenerator between;
+    between.copySystem(&orbit);
+    between.evolutionOfSystem("steps", 12, 0.01, 0.);
+    double before = between.getSystemInformations().at(1).getPosition().y();
+    between.evolutionOfSystem("steps", 1, 0.01, 0.);
+    double after = between.getSystemInformations().at(1).getPosition().y();
+    REQUIRE(positions.at(2).y() > before);
+    REQUIRE(positions.at(2).y() < after);
+
+    /* An output time at the end of the run, built on the clock of the steps as
+     * by nBodySystemSimulator, is given the final state */
+
+    nBodySystemGenerator toTheEnd;
+    toTheEnd.copySystem(&orbit);
+    std::vector<double> endTimes;
+    for (int k = 0; k <= 6; k++) {
+        endTimes.push_back(k * 0.1);
+    }
+    std::vector<Eigen::Vector3d> endPositions;
+    auto endOutput = std::make_shared<DenseOutput>(endTimes,
+        [&](double, ConstParticleSpan particles) { endPositions.push_back(particles[1].getPosition()); });
+    toTheEnd.setDenseOutput(endOutput);
+    toTheEnd.evolutionOfSystem("time", 0.6, 0.1, 0.);
+    REQUIRE(toTheEnd.getIterations() == 6);
+    REQUIRE(endOutput->getNumberOfOutputs() == 7);
+    REQUIRE(endOutput->getNumberOfPendingOutputs() == 0);
+    REQUIRE((endPositions.back() - toTheEnd.getSystemInformations().at(1).getPosition()).norm() < 1e-15);
+    REQUIRE_THROWS_AS(system.setDenseOutput(std::make_shared<DenseOutput>(std::vector<double> { 0.5 }, [](double, ConstParticleSpan) {})), std::invalid_argument);
+}
+
+/* Testing Parareal: with as many iterations as slices the result is the serial
+ * one, and on the solar system the residual falls below the tolerance in fewer
+ * iterations (Mercury, badly resolved by the coarse Euler steps, limits how
+ * fast) */
+
+TEST_CASE("Testing the Parareal integration", "[parareal]")
+{
+    solarSystemGenerator serial;
+    serial.generateInitialConditions(9);
+    std::vector<Particle> initial = serial.getSystemInformations();
+    serial.evolutionOfSystem("steps", 2000, 0.001, 0.);
+
+    PararealSettings settings;
+    settings.slices = 4;
+    settings.coarseFactor = 20;
+    settings.tolerance = 0.;
+    PararealResult exact = integrateParareal(initial, 2000, 0.001, 0., settings);
+    REQUIRE(exact.slices == 4);
+    REQUIRE(exact.iterations == 4);
+    REQUIRE(exact.converged);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE((exact.finalState.at(i).getPosition() - serial.getSystemInformations().at(i).getPosition()).norm() < 1e-12);
+        REQUIRE((exact.finalState.at(i).getVelocity() - serial.getSystemInformations().at(i).getVelocity()).norm() < 1e-12);
+    }
+
+    solarSystemGenerator parallel;
+    parallel.generateInitialConditions(9);
+    settings.slices = 8;
+    settings.coarseFactor = 5;
+    settings.tolerance = 1e-4;
+    PararealResult result = parallel.evolutionInParallelInTime(2000, 0.001, 0., settings);
+    REQUIRE(result.converged);
+    REQUIRE(result.iterations < 8);
+    REQUIRE(result.residuals.back() <= 1e-4);
+    REQUIRE(result.residuals.front() > result.residuals.back());
+    REQUIRE(parallel.getIterations() == 2000);
+    REQUIRE_THAT(parallel.getElapsedTime(), Catch::Matchers::WithinAbs(2., 1e-12));
+    REQUIRE((parallel.getSystemInformations().at(3).getPosition() - serial.getSystemInformations().at(3).getPosition()).norm() < 1e-3);
+    REQUIRE(parallel.usesPlanarKernels());
+
+    /* Switching the planar kernels off on the generator also holds for
+     * Parareal */
+
+    solarSystemGenerator spatial;
+    spatial.generateInitialConditions(9);
+    spatial.enablePlanarKernels(false);
+    PararealResult spatialResult = spatial.evolutionInParallelInTime(2000, 0.001, 0., settings);
+    REQUIRE_FALSE(spatial.usesPlanarKernels());
+    settings.planarKernels = false;
+    PararealResult spatialReference = integrateParareal(initial, 2000, 0.001, 0., settings);
+    REQUIRE(spatialResult.iterations == spatialReference.iterations);
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(spatialResult.finalState.at(i).getPosition() == spatialReference.finalState.at(i).getPosition());
+    }
+    REQUIRE_THROWS_AS(integrateParareal(initial, 0, 0.001, 0., settings), std::invalid_argument);
+}
+
+/* Testing the work-stealing pool: every iteration is run once, also by loops
+ * opened inside the tasks of another loop, reductions do not depend on the
+ * threads, exceptions reach the caller, and a run on the pool gives the same
+ * particles as the run on OpenMP */
+
+TEST_CASE("Testing the work-stealing thread pool", "[executor]")
+{
+    WorkStealingPool pool(4);
+    REQUIRE(pool.getNumberOfThreads() == 4);
+    std::vector<std::atomic<int>> visits(10000);
+    for (std::atomic<int>& count : visits) {
+        count = 0;
+    }
+    pool.parallelFor(0, 100, 1, [&](long long first, long long last) {
+        for (long long outer = first; outer < last; outer++) {
+            pool.parallelFor(0, 100, 7, [&](long long innerFirst, long long innerLast) {
+                for (long long inner = innerFirst; inner < innerLast; inner++) {
+                    visits[outer * 100 + inner]++;
+                }
+            });
+        }
+    });
+    bool everyOnce = true;
+    for (std::atomic<int>& count : visits) {
+        everyOnce = everyOnce && count.load() == 1;
+    }
+    REQUIRE(everyOnce);
+    REQUIRE(pool.getNumberOfTasks() > 100);
+
+    auto sum = [&](int threads) {
+        WorkStealingPool sized(threads);
+        return sized.parallelReduce(
+            0, 100000, 1000, 0., [](long long first, long long last) {
+                double partial = 0.;
+                for (long long i = first; i < last; i++) {
+                    partial = partial + 1. / (i + 1);
+                }
+                return partial;
+            },
+            [](double a, double b) { return a + b; });
+    };
+    REQUIRE(sum(1) == sum(3));
+    REQUIRE_THAT(sum(2), WithinRel(12.0901461298634, 1e-12));
+
+    REQUIRE_THROWS_AS(pool.parallelFor(0, 64, 1, [](long long first, long long) {
+        if (first == 42) {
+            throw std::runtime_error("\nFailure in a task\n");
+        }
+    }),
+        std::runtime_error);
+    REQUIRE_THROWS_AS(executionBackendFromName("tbb"), std::invalid_argument);
+
+    nBodySystemGenerator onOpenMP;
+    onOpenMP.generateInitialConditions(300);
+    nBodySystemGenerator onPool;
+    std::vector<Particle> initial = onOpenMP.getSystemInformations();
+    onPool.copySystem(&initial);
+    onOpenMP.evolutionOfSystem("steps", 5, 0.001, 0.01);
+    double energyOnOpenMP = calculateTotalEnergy(onOpenMP.getSystemView());
+    setExecutionBackend(ExecutionBackend::workStealing, 3);
+    REQUIRE(usingWorkStealingPool());
+    REQUIRE(threadPool().getNumberOfThreads() == 3);
+    onPool.evolutionOfSystem("steps", 5, 0.001, 0.01);
+    double energyOnPool = calculateTotalEnergy(onPool.getSystemView());
+    setExecutionBackend(ExecutionBackend::openmp);
+    for (int i = 0; i < 300; i++) {
+        REQUIRE(onPool.getSystemInformations().at(i).getPosition() == onOpenMP.getSystemInformations().at(i).getPosition());
+    }
+    REQUIRE_THAT(energyOnPool, WithinRel(energyOnOpenMP, 1e-12));
+}
+
+/* Testing the loops of the force backends and of the tools on the pool: they
+ * give the results of the OpenMP loops, exactly when the sums are done in the
+ * same order and up to rounding when partial sums are combined */
+
+TEST_CASE("Testing the backends and the tools on the work-stealing pool", "[executor]")
+{
+    const std::vector<Particle> system = makeStandardInitialConditions("plummer", 400);
+    std::vector<Particle> massiveAndTest = system;
+    for (int i = 0; i < 400; i = i + 10) {
+        massiveAndTest.at(i).setMass(0.1);
+    }
+    auto onBoth = [](auto compute) {
+        auto onOpenMP = compute();
+        setExecutionBackend(ExecutionBackend::workStealing, 3);
+        auto onPool = compute();
+        setExecutionBackend(ExecutionBackend::openmp);
+        return std::make_pair(onOpenMP, onPool);
+    };
+    auto accelerationsOf = [](const std::vector<Particle>& initial, auto makeBackend) {
+        return [&initial, makeBackend]() {
+            std::vector<Particle> particles = initial;
+            std::shared_ptr<ForceBackend> backend = makeBackend();
+            backend->computeAccelerations(particles, 0.01);
+            std::vector<Eigen::Vector3d> accelerations;
+            for (const Particle& particle : particles) {
+                accelerations.push_back(particle.getAcceleration());
+            }
+            return accelerations;
+        };
+    };
+    auto largestDifference = [](const std::vector<Eigen::Vector3d>& a, const std::vector<Eigen::Vector3d>& b) {
+        REQUIRE(a.size() == b.size());
+        double difference = 0.;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            difference = std::max(difference, (a[i] - b[i]).norm() / std::max(a[i].norm(), 1e-300));
+        }
+        return difference;
+    };
+
+    auto verlet = onBoth(accelerationsOf(system, []() { return std::make_shared<CellListBackend>(0.5, 0.1, true); }));
+    REQUIRE(largestDifference(verlet.first, verlet.second) == 0.);
+    auto ewald = onBoth(accelerationsOf(system, []() { return std::make_shared<PeriodicEwaldBackend>(20.); }));
+    REQUIRE(largestDifference(ewald.first, ewald.second) < 1e-10);
+    auto split = onBoth(accelerationsOf(massiveAndTest, []() { return std::make_shared<MassiveTestParticleBackend>(0.05); }));
+    REQUIRE(largestDifference(split.first, split.second) < 1e-12);
+
+    std::vector<Eigen::Vector3d> probes;
+    for (int p = 0; p < 100; p++) {
+        probes.push_back(Eigen::Vector3d(0.01 * p, -0.02 * p, 0.5));
+    }
+    auto field = onBoth([&]() { return evaluateFieldDirect(system, probes, 0.01).acceleration; });
+    REQUIRE(largestDifference(field.first, field.second) == 0.);
+
+    auto encounters = onBoth([&]() {
+        std::vector<std::pair<int, int>> pairs;
+        for (const EncounterPair& pair : findCloseEncounters(system, 0.1)) {
+            pairs.push_back({ pair.first, pair.second });
+        }
+        return pairs;
+    });
+    REQUIRE(!encounters.first.empty());
+    REQUIRE(encounters.first == encounters.second);
+    auto order = onBoth([&]() { return spaceFillingCurveOrder(system, SpaceFillingCurve::hilbert); });
+    REQUIRE(order.first == order.second);
+    auto generated = onBoth([]() {
+        nBodySystemGenerator generator;
+        generator.generateInitialConditions(300);
+        std::vector<Eigen::Vector3d> positions;
+        for (const Particle& particle : generator.getSystemView()) {
+            positions.push_back(particle.getPosition());
+        }
+        return positions;
+    });
+    REQUIRE(largestDifference(generated.first, generated.second) == 0.);
+    auto escapers = onBoth([&]() {
+        std::vector<EscapedParticle> escaped;
+        return findEscapers(system, 1., escaped);
+    });
+    REQUIRE(escapers.first == escapers.second);
+    auto compacted = onBoth([&]() {
+        std::vector<int> values(1000);
+        std::vector<char> keep(1000);
+        for (int i = 0; i < 1000; i++) {
+            values[i] = i;
+            keep[i] = i % 3 != 0;
+        }
+        compactInParallel(values, keep);
+        return values;
+    });
+    REQUIRE(compacted.first.size() == 666);
+    REQUIRE(compacted.first == compacted.second);
+
+    auto ensemble = onBoth([]() {
+        SystemEnsemble members(9);
+        members.generateSolarSystemEnsemble(20, 3);
+        members.evolve(50, 0.001, 0.);
+        return members.calculateEnergies();
+    });
+    REQUIRE(ensemble.first == ensemble.second);
+    auto parareal = onBoth([]() {
+        solarSystemGenerator solarSystem;
+        solarSystem.generateInitialConditions(9);
+        PararealSettings settings;
+        settings.slices = 4;
+        return integrateParareal(solarSystem.getSystemView(), 400, 0.001, 0., settings).finalState;
+    });
+    for (int i = 0; i < 9; i++) {
+        REQUIRE(parareal.first.at(i).getPosition() == parareal.second.at(i).getPosition());
+    }
+
+    /* The tools that only act on OpenMP threads refuse to run on the pool */
+
+    setExecutionBackend(ExecutionBackend::workStealing, 3);
+    nBodySystemGenerator tuned;
+    tuned.generateInitialConditions(50);
+    REQUIRE_THROWS_AS(Autotuner("pool_tuning_test.cache", 1).tune(tuned, 0.001, 0.01), std::logic_error);
+    REQUIRE_THROWS_AS(pinThreads(), std::logic_error);
+    setExecutionBackend(ExecutionBackend::openmp);
+}
+
+/* Testing the planar kernels: the generated systems are detected as planar,
+ * the two dimensional run gives the particles of the three dimensional one
+ * and keeps them in the plane, and a system out of the plane keeps the three
+ * dimensional kernels */
+
+TEST_CASE("Testing the planar kernels", "[planar]")
+{
+    nBodySystemGenerator flat;
+    flat.generateInitialConditions(200);
+    REQUIRE(isPlanar(flat.getSystemView()));
+    std::vector<Particle> initial = flat.getSystemInformations();
+    solarSystemGenerator solarSystem;
+    solarSystem.generateInitialConditions(9);
+    std::vector<Particle> planets = solarSystem.getSystemInformations();
+    REQUIRE(isPlanar(planets));
+    for (double epsilon : { 0., 0.05 }) {
+        Eigen::Vector3d planarAcceleration = selectAccelerationKernel(epsilon, true)(planets, 3, epsilon);
+        Eigen::Vector3d spatialAcceleration = selectAccelerationKernel(epsilon)(planets, 3, epsilon);
+        REQUIRE(planarAcceleration.z() == 0.);
+        REQUIRE((planarAcceleration - spatialAcceleration).norm() <= 1e-14 * spatialAcceleration.norm());
+        Eigen::Vector3d planarPartial = selectPartialAccelerationKernel(epsilon, true)(planets, 3, 0, 5, epsilon);
+        Eigen::Vector3d spatialPartial = selectPartialAccelerationKernel(epsilon)(planets, 3, 0, 5, epsilon);
+        REQUIRE((planarPartial - spatialPartial).norm() <= 1e-14 * spatialPartial.norm());
+        std::vector<double> x, y, mass;
+        for (const Particle& planet : planets) {
+            x.push_back(planet.getPosition().x());
+            y.push_back(planet.getPosition().y());
+            mass.push_back(planet.getMass());
+        }
+        Eigen::Vector3d columnAcceleration = selectPlanarColumnKernel(epsilon)(x.data(), y.data(), mass.data(), planets.size(), 3, epsilon);
+        REQUIRE(columnAcceleration.z() == 0.);
+        REQUIRE((columnAcceleration - spatialAcceleration).norm() <= 1e-14 * spatialAcceleration.norm());
+    }
+
+    nBodySystemGenerator spatial;
+    spatial.copySystem(&initial);
+    spatial.enablePlanarKernels(false);
+    flat.evolutionOfSystem("steps", 20, 0.001, 0.01);
+    spatial.evolutionOfSystem("steps", 20, 0.001, 0.01);
+    REQUIRE(flat.usesPlanarKernels());
+    REQUIRE_FALSE(spatial.usesPlanarKernels());
+    REQUIRE(isPlanar(flat.getSystemView()));
+
+    /* The direct backend is told once per run that the system is planar */
+
+    nBodySystemGenerator withBackend;
+    withBackend.copySystem(&initial);
+    withBackend.setForceBackend(std::make_shared<DirectSummationBackend>());
+    withBackend.evolutionOfSystem("steps", 20, 0.001, 0.01);
+    REQUIRE(isPlanar(withBackend.getSystemView()));
+    for (int i = 0; i < 200; i++) {
+        REQUIRE((withBackend.getSystemInformations().at(i).getPosition() - spatial.getSystemInformations().at(i).getPosition()).norm() < 1e-12);
+    }
+    for (int i = 0; i < 200; i++) {
+        REQUIRE((flat.getSystemInformations().at(i).getPosition() - spatial.getSystemInformations().at(i).getPosition()).norm() < 1e-12);
+        REQUIRE((flat.getSystemInformations().at(i).getVelocity() - spatial.getSystemInformations().at(i).getVelocity()).norm() < 1e-12);
+    }
+
+    initial.at(3).setVelocity(initial.at(3).getVelocity() + Eigen::Vector3d(0., 0., 1e-3));
+    REQUIRE_FALSE(isPlanar(initial));
+    nBodySystemGenerator tilted;
+    tilted.copySystem(&initial);
+    tilted.evolutionOfSystem("steps", 20, 0.001, 0.01);
+    REQUIRE_FALSE(tilted.usesPlanarKernels());
+    REQUIRE(tilted.getSystemInformations().at(3).getPosition().z() > 0.);
+    REQUIRE(tilted.getSystemInformations().at(0).getVelocity().z() != 0.);
+}